@@ -10,11 +10,21 @@ phutil_register_library_map(array(
   '__library_version__' => 2,
   'class' =>
   array(
+    'FalconAdmissionControllerTest' => 'unit/tests/FalconAdmissionControllerTest.php',
+    'FalconBloomFilterTest' => 'unit/tests/FalconBloomFilterTest.php',
+    'FalconBuildLogTest' => 'unit/tests/FalconBuildLogTest.php',
     'FalconCPPLicenseLinter' => 'lint/linter/FalconCPPLicenseLinter.php',
+    'FalconCacheBundleTest' => 'unit/tests/FalconCacheBundleTest.php',
+    'FalconCacheFSTest' => 'unit/tests/FalconCacheFSTest.php',
+    'FalconCacheMemoryTest' => 'unit/tests/FalconCacheMemoryTest.php',
+    'FalconCachePackTest' => 'unit/tests/FalconCachePackTest.php',
+    'FalconCacheStatsTest' => 'unit/tests/FalconCacheStatsTest.php',
     'FalconExceptionTest' => 'unit/tests/FalconExceptionTests.php',
+    'FalconHttpTest' => 'unit/tests/FalconHttpTest.php',
     'FalconJsonParserTest' => 'unit/tests/FalconJsonParserTest.php',
     'FalconLintEngine' => 'lint/FalconLintEngine.php',
     'FalconPosixSubProcessTest' => 'unit/tests/FalconPosixSubProcessTest.php',
+    'FalconRWLockTest' => 'unit/tests/FalconRWLockTest.php',
     'FalconUnitTestBase' => 'unit/FalconUnitTestBase.php',
     'FalconUnitTestEngine' => 'unit/FalconUnitTestEngine.php',
   ),
@@ -23,11 +33,21 @@ phutil_register_library_map(array(
   ),
   'xmap' =>
   array(
+    'FalconAdmissionControllerTest' => 'FalconUnitTestBase',
+    'FalconBloomFilterTest' => 'FalconUnitTestBase',
+    'FalconBuildLogTest' => 'FalconUnitTestBase',
     'FalconCPPLicenseLinter' => 'ArcanistLinter',
+    'FalconCacheBundleTest' => 'FalconUnitTestBase',
+    'FalconCacheFSTest' => 'FalconUnitTestBase',
+    'FalconCacheMemoryTest' => 'FalconUnitTestBase',
+    'FalconCachePackTest' => 'FalconUnitTestBase',
+    'FalconCacheStatsTest' => 'FalconUnitTestBase',
     'FalconExceptionTest' => 'FalconUnitTestBase',
+    'FalconHttpTest' => 'FalconUnitTestBase',
     'FalconJsonParserTest' => 'FalconUnitTestBase',
     'FalconLintEngine' => 'ArcanistLintEngine',
     'FalconPosixSubProcessTest' => 'FalconUnitTestBase',
+    'FalconRWLockTest' => 'FalconUnitTestBase',
     'FalconUnitTestEngine' => 'ArcanistBaseUnitTestEngine',
   ),
 ));
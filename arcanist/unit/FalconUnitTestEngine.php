@@ -34,6 +34,16 @@ class FalconUnitTestEngine extends ArcanistBaseUnitTestEngine {
     $this->listOfUnitTests[] = new FalconJsonParserTest();
     $this->listOfUnitTests[] = new FalconExceptionTest();
     $this->listOfUnitTests[] = new FalconPosixSubProcessTest();
+    $this->listOfUnitTests[] = new FalconBloomFilterTest();
+    $this->listOfUnitTests[] = new FalconHttpTest();
+    $this->listOfUnitTests[] = new FalconCachePackTest();
+    $this->listOfUnitTests[] = new FalconCacheBundleTest();
+    $this->listOfUnitTests[] = new FalconCacheMemoryTest();
+    $this->listOfUnitTests[] = new FalconCacheFSTest();
+    $this->listOfUnitTests[] = new FalconCacheStatsTest();
+    $this->listOfUnitTests[] = new FalconBuildLogTest();
+    $this->listOfUnitTests[] = new FalconAdmissionControllerTest();
+    $this->listOfUnitTests[] = new FalconRWLockTest();
   }
 
   /* **********************************************************************
@@ -0,0 +1,17 @@
+<?php
+
+class FalconAdmissionControllerTest extends FalconUnitTestBase {
+  public function getBinaryTest() {
+    return "tests/admission_controller";
+  }
+
+  public function getDependencies() {
+    return array(
+      "src/tests/admission_controller.cpp",
+      "src/admission_controller.cpp",
+      "src/admission_controller.h",
+      "src/test.cpp",
+      "src/test.h",
+    );
+  }
+}
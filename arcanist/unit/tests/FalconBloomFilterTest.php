@@ -0,0 +1,17 @@
+<?php
+
+class FalconBloomFilterTest extends FalconUnitTestBase {
+  public function getBinaryTest() {
+    return "tests/bloom_filter";
+  }
+
+  public function getDependencies() {
+    return array(
+      "src/tests/bloom_filter.cpp",
+      "src/util/bloom_filter.cpp",
+      "src/util/bloom_filter.h",
+      "src/test.cpp",
+      "src/test.h",
+    );
+  }
+}
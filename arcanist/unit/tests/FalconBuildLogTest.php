@@ -0,0 +1,17 @@
+<?php
+
+class FalconBuildLogTest extends FalconUnitTestBase {
+  public function getBinaryTest() {
+    return "tests/build_log";
+  }
+
+  public function getDependencies() {
+    return array(
+      "src/tests/build_log.cpp",
+      "src/build_log.cpp",
+      "src/build_log.h",
+      "src/test.cpp",
+      "src/test.h",
+    );
+  }
+}
@@ -0,0 +1,23 @@
+<?php
+
+class FalconCacheBundleTest extends FalconUnitTestBase {
+  public function getBinaryTest() {
+    return "tests/cache_bundle";
+  }
+
+  public function getDependencies() {
+    return array(
+      "src/tests/cache_bundle.cpp",
+      "src/action_cache.cpp",
+      "src/action_cache.h",
+      "src/cache_backend.cpp",
+      "src/cache_backend.h",
+      "src/cache_bundle.cpp",
+      "src/cache_bundle.h",
+      "src/cache_fs.cpp",
+      "src/cache_fs.h",
+      "src/test.cpp",
+      "src/test.h",
+    );
+  }
+}
@@ -0,0 +1,19 @@
+<?php
+
+class FalconCacheFSTest extends FalconUnitTestBase {
+  public function getBinaryTest() {
+    return "tests/cache_fs";
+  }
+
+  public function getDependencies() {
+    return array(
+      "src/tests/cache_fs.cpp",
+      "src/cache_backend.cpp",
+      "src/cache_backend.h",
+      "src/cache_fs.cpp",
+      "src/cache_fs.h",
+      "src/test.cpp",
+      "src/test.h",
+    );
+  }
+}
@@ -0,0 +1,21 @@
+<?php
+
+class FalconCacheMemoryTest extends FalconUnitTestBase {
+  public function getBinaryTest() {
+    return "tests/cache_memory";
+  }
+
+  public function getDependencies() {
+    return array(
+      "src/tests/cache_memory.cpp",
+      "src/cache_backend.cpp",
+      "src/cache_backend.h",
+      "src/cache_fs.cpp",
+      "src/cache_fs.h",
+      "src/cache_memory.cpp",
+      "src/cache_memory.h",
+      "src/test.cpp",
+      "src/test.h",
+    );
+  }
+}
@@ -0,0 +1,21 @@
+<?php
+
+class FalconCachePackTest extends FalconUnitTestBase {
+  public function getBinaryTest() {
+    return "tests/cache_pack";
+  }
+
+  public function getDependencies() {
+    return array(
+      "src/tests/cache_pack.cpp",
+      "src/cache_backend.cpp",
+      "src/cache_backend.h",
+      "src/cache_fs.cpp",
+      "src/cache_fs.h",
+      "src/cache_pack.cpp",
+      "src/cache_pack.h",
+      "src/test.cpp",
+      "src/test.h",
+    );
+  }
+}
@@ -0,0 +1,17 @@
+<?php
+
+class FalconCacheStatsTest extends FalconUnitTestBase {
+  public function getBinaryTest() {
+    return "tests/cache_stats";
+  }
+
+  public function getDependencies() {
+    return array(
+      "src/tests/cache_stats.cpp",
+      "src/cache_stats.cpp",
+      "src/cache_stats.h",
+      "src/test.cpp",
+      "src/test.h",
+    );
+  }
+}
@@ -0,0 +1,17 @@
+<?php
+
+class FalconHttpTest extends FalconUnitTestBase {
+  public function getBinaryTest() {
+    return "tests/http";
+  }
+
+  public function getDependencies() {
+    return array(
+      "src/tests/http.cpp",
+      "src/util/http.cpp",
+      "src/util/http.h",
+      "src/test.cpp",
+      "src/test.h",
+    );
+  }
+}
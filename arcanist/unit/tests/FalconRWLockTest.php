@@ -0,0 +1,17 @@
+<?php
+
+class FalconRWLockTest extends FalconUnitTestBase {
+  public function getBinaryTest() {
+    return "tests/rw_lock";
+  }
+
+  public function getDependencies() {
+    return array(
+      "src/tests/rw_lock.cpp",
+      "src/util/rw_lock.cpp",
+      "src/util/rw_lock.h",
+      "src/test.cpp",
+      "src/test.h",
+    );
+  }
+}
@@ -1,4 +1,5 @@
 import ijson.backends.python as ijson
+from ijson.common import IncompleteJSONError
 import sys
 
 # Unfortunately, ijson only works on files. This hack makes it possible to use
@@ -21,30 +22,35 @@ class BuildOutputParser:
   def parse(self):
     result = ''
     nb_commands = 0
-    for prefix, event, value in self._parser:
-      if event == 'start_map' and prefix == 'cmds.item':
-        nb_commands += 1
-      if event == 'number':
-        if prefix == 'id':
-          # For now we do not use the build id.
-          pass
-        elif prefix == 'cmds.item.id':
-          # For now we do not use the command id.
-          pass
-      elif event == 'string':
-        if prefix == 'cmds.item.cmd':
-          print value
-        elif prefix == 'cmds.item.stdout':
-          print value
-        elif prefix == 'cmds.item.stderr':
-          # This is an error. Print it in red on stderr.
-          sys.stderr.write('\033[91m')
-          sys.stderr.write(value)
-          sys.stderr.write('\033[0m')
-        elif prefix == 'result':
-          result = value
-        elif prefix == 'cmds.item.cache':
-          print 'Retrieving', value, 'from cache'
+    try:
+      for prefix, event, value in self._parser:
+        if event == 'start_map' and prefix == 'cmds.item':
+          nb_commands += 1
+        if event == 'number':
+          if prefix == 'id':
+            # For now we do not use the build id.
+            pass
+          elif prefix == 'cmds.item.id':
+            # For now we do not use the command id.
+            pass
+        elif event == 'string':
+          if prefix == 'cmds.item.cmd':
+            print value
+          elif prefix == 'cmds.item.stdout':
+            print value
+          elif prefix == 'cmds.item.stderr':
+            # This is an error. Print it in red on stderr.
+            sys.stderr.write('\033[91m')
+            sys.stderr.write(value)
+            sys.stderr.write('\033[0m')
+          elif prefix == 'result':
+            result = value
+          elif prefix == 'cmds.item.cache':
+            print 'Retrieving', value, 'from cache'
+    except IncompleteJSONError:
+      # The stream server closes the connection without sending anything if it
+      # no longer has the output of the build.
+      return False
 
     if result != 'SUCCEEDED':
       return False
@@ -0,0 +1,350 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#include <cassert>
+#include <memory>
+#include <sstream>
+
+#include "action_cache.h"
+
+#include "fs.h"
+#include "graph_hash.h"
+#include "logging.h"
+#include "util/file_lock.h"
+
+namespace falcon {
+
+/* Shared local stores are collected at most once per period, by the first
+ * process that finishes a build after it. */
+static const uint64_t kSharedCollectionPeriod = 24ULL * 3600 * 1000000000;
+
+/* Actions of shared local stores that were not used for that long are
+ * removed. */
+static const uint64_t kSharedActionMaxAge = 7 * kSharedCollectionPeriod;
+
+ActionCache::ActionCache(ILocalCacheBackend& localActions,
+                         ILocalCacheBackend& localBlobs,
+                         ICacheBackend& actions, ICacheBackend& blobs,
+                         const std::string& lockPath)
+    : localActions_(localActions)
+    , localBlobs_(localBlobs)
+    , actions_(actions)
+    , blobs_(blobs)
+    , lockPath_(lockPath)
+    , refCountsLoaded_(false) { }
+
+/* A manifest has one line per file: the digest, a space, then the path. */
+std::string ActionCache::formatManifest(const Manifest& manifest) {
+  std::ostringstream oss;
+  for (auto it = manifest.begin(); it != manifest.end(); ++it) {
+    oss << it->second << " " << it->first << "\n";
+  }
+  return oss.str();
+}
+
+bool ActionCache::parseManifest(const std::string& data, Manifest& manifest) {
+  manifest.clear();
+  std::istringstream iss(data);
+  std::string line;
+  while (std::getline(iss, line)) {
+    std::size_t space = line.find(' ');
+    if (space == std::string::npos || space == 0) {
+      return false;
+    }
+    manifest[line.substr(space + 1)] = line.substr(0, space);
+  }
+  return true;
+}
+
+/* Return true if a file was not modified since the given time. */
+static bool isUnmodified(const std::string& path, uint64_t mtime) {
+  uint64_t current;
+  return fs::getModificationTime(path, current) && current == mtime;
+}
+
+bool ActionCache::saveAction(const std::string& key,
+                             const std::vector<std::string>& paths,
+                             const std::vector<std::string>& digests,
+                             const std::vector<uint64_t>& mtimes) {
+  assert(paths.size() == digests.size() && paths.size() == mtimes.size());
+  {
+    /* The action is used again, it must not be removed. */
+    std::lock_guard<std::mutex> lock(mutex_);
+    deleted_.erase(key);
+  }
+  if (localActions_.hasEntry(key)) {
+    /* Already in cache. */
+    if (!lockPath_.empty()) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      used_.insert(key);
+    }
+    return true;
+  }
+
+  /* Another process must not collect the blobs before the manifest that
+   * uses them is stored. */
+  std::unique_ptr<FileLock> sharedLock;
+  if (!lockPath_.empty()) {
+    sharedLock.reset(new FileLock(lockPath_, FileLock::Mode::SHARED));
+  }
+
+  Manifest manifest;
+  for (std::size_t i = 0; i < paths.size(); i++) {
+    const std::string& path = paths[i];
+    if (!isUnmodified(path, mtimes[i])) {
+      LOG(WARNING) << path << " was modified since it was built, not saving "
+                   << "action " << key;
+      return false;
+    }
+    std::string digest = digests[i];
+    if (digest.empty() && !hash::hashFile(path, digest)) {
+      LOG(ERROR) << "Could not read " << path;
+      return false;
+    }
+    if (!blobs_.writeEntry(digest, path)) {
+      return false;
+    }
+    /* The file may have been modified while it was read. The blob is only
+     * used through the manifest, which is not stored. */
+    if (!isUnmodified(path, mtimes[i])) {
+      LOG(WARNING) << path << " was modified while it was saved, not saving "
+                   << "action " << key;
+      return false;
+    }
+    manifest[path] = digest;
+  }
+
+  /* Store the manifest last: once it is visible, all its blobs are. */
+  if (!actions_.storeEntry(key, formatManifest(manifest))) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  addManifest(key, manifest);
+  return true;
+}
+
+void ActionCache::getManifests(const std::vector<std::string>& keys,
+                               std::vector<Manifest>& manifests,
+                               std::vector<bool>& found) {
+  manifests.assign(keys.size(), Manifest());
+  found.assign(keys.size(), false);
+
+  /* Serve what we can from memory. */
+  std::vector<std::size_t> missing;
+  std::vector<std::string> missingKeys;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (std::size_t i = 0; i < keys.size(); i++) {
+      auto it = manifests_.find(keys[i]);
+      if (it != manifests_.end()) {
+        manifests[i] = it->second;
+        found[i] = true;
+        if (!lockPath_.empty()) {
+          used_.insert(keys[i]);
+        }
+      } else {
+        missing.push_back(i);
+        missingKeys.push_back(keys[i]);
+      }
+    }
+  }
+  if (missing.empty()) {
+    return;
+  }
+
+  /* Read the others with one query. */
+  std::vector<std::string> data;
+  std::vector<bool> loaded;
+  actions_.loadEntries(missingKeys, data, loaded);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (std::size_t i = 0; i < missing.size(); i++) {
+    if (!loaded[i]) {
+      continue;
+    }
+    Manifest& manifest = manifests[missing[i]];
+    if (!parseManifest(data[i], manifest)) {
+      LOG(WARNING) << "Invalid manifest for action " << missingKeys[i];
+      continue;
+    }
+    found[missing[i]] = true;
+    if (!lockPath_.empty()) {
+      used_.insert(missingKeys[i]);
+    }
+    if (manifests_.find(missingKeys[i]) == manifests_.end()) {
+      addManifest(missingKeys[i], manifest);
+    }
+  }
+}
+
+void ActionCache::addManifest(const std::string& key,
+                              const Manifest& manifest) {
+  auto res = manifests_.insert(std::make_pair(key, manifest));
+  if (!res.second || !refCountsLoaded_) {
+    /* Either already counted, or it will be when the counts are loaded. */
+    return;
+  }
+  for (auto it = manifest.begin(); it != manifest.end(); ++it) {
+    refCounts_[it->second]++;
+  }
+}
+
+void ActionCache::loadRefCounts() {
+  if (!refCountsLoaded_) {
+    for (auto it = manifests_.begin(); it != manifests_.end(); ++it) {
+      for (auto it2 = it->second.begin(); it2 != it->second.end(); ++it2) {
+        refCounts_[it2->second]++;
+      }
+    }
+    refCountsLoaded_ = true;
+  }
+
+  /* From now on addManifest() counts the blobs. */
+  std::vector<std::string> keys = localActions_.listEntries();
+  for (auto it = keys.begin(); it != keys.end(); ++it) {
+    if (manifests_.find(*it) != manifests_.end()) {
+      continue;
+    }
+    std::string data;
+    Manifest manifest;
+    if (localActions_.loadEntry(*it, data) && parseManifest(data, manifest)) {
+      addManifest(*it, manifest);
+    }
+  }
+  LOG(INFO) << "Loaded " << manifests_.size() << " action manifests";
+}
+
+void ActionCache::delAction(const std::string& key) {
+  if (!lockPath_.empty()) {
+    /* The git refs of the other checkouts that share the cache may still need
+     * the action. */
+    return;
+  }
+
+  /* This is called by the builder: the manifests are only listed, and the
+   * action removed, by collectGarbage(). */
+  std::lock_guard<std::mutex> lock(mutex_);
+  deleted_.insert(key);
+}
+
+void ActionCache::removeDeletedActions() {
+  if (deleted_.empty()) {
+    return;
+  }
+  if (!refCountsLoaded_) {
+    loadRefCounts();
+  }
+
+  for (auto it = deleted_.begin(); it != deleted_.end(); ++it) {
+    localActions_.delEntry(*it);
+
+    auto itManifest = manifests_.find(*it);
+    if (itManifest == manifests_.end()) {
+      continue;
+    }
+    auto& manifest = itManifest->second;
+    for (auto it2 = manifest.begin(); it2 != manifest.end(); ++it2) {
+      auto count = refCounts_.find(it2->second);
+      if (count != refCounts_.end() && --count->second == 0) {
+        unreferenced_.push_back(it2->second);
+      }
+    }
+    manifests_.erase(itManifest);
+  }
+  deleted_.clear();
+}
+
+void ActionCache::collectGarbage() {
+  if (!lockPath_.empty()) {
+    collectSharedGarbage();
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  removeDeletedActions();
+  for (auto it = unreferenced_.begin(); it != unreferenced_.end(); ++it) {
+    /* The blob may have been used again since. */
+    auto count = refCounts_.find(*it);
+    if (count == refCounts_.end() || count->second > 0) {
+      continue;
+    }
+    DLOG(INFO) << "deleting blob " << *it;
+    localBlobs_.delEntry(*it);
+    refCounts_.erase(count);
+  }
+  unreferenced_.clear();
+}
+
+/* Return true if the last collection of shared local stores is less than
+ * kSharedCollectionPeriod old. */
+static bool isCollectedRecently(const std::string& lockPath, uint64_t now) {
+  uint64_t lastCollection;
+  return fs::getModificationTime(lockPath, lastCollection)
+    && now < lastCollection + kSharedCollectionPeriod;
+}
+
+void ActionCache::collectSharedGarbage() {
+  /* Tell the other processes that the actions we used are still needed. */
+  std::vector<std::string> used;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    used.assign(used_.begin(), used_.end());
+    used_.clear();
+  }
+  localActions_.touchEntries(used);
+
+  uint64_t now = fs::currentTime();
+  if (isCollectedRecently(lockPath_, now)) {
+    return;
+  }
+  FileLock exclusiveLock(lockPath_, FileLock::Mode::EXCLUSIVE);
+  if (!exclusiveLock.isLocked() || isCollectedRecently(lockPath_, now)) {
+    /* Another process collected while we waited for the lock. */
+    return;
+  }
+  fs::touch(lockPath_);
+
+  /* Remove the old actions, and find the blobs of the others. No manifest
+   * can be added while we hold the lock. */
+  std::unordered_set<std::string> referenced;
+  std::size_t numActions = 0;
+  std::vector<std::string> keys = localActions_.listEntries();
+  for (auto it = keys.begin(); it != keys.end(); ++it) {
+    uint64_t lastUse;
+    std::string data;
+    Manifest manifest;
+    if (localActions_.getLastUse(*it, lastUse)
+        && lastUse + kSharedActionMaxAge < now) {
+      localActions_.delEntry(*it);
+      std::lock_guard<std::mutex> lock(mutex_);
+      manifests_.erase(*it);
+      numActions++;
+    } else if (!localActions_.loadEntry(*it, data)) {
+      /* Its blobs would be removed. */
+      LOG(ERROR) << "Could not read the manifest of action " << *it
+                 << ", not collecting the shared cache";
+      return;
+    } else if (parseManifest(data, manifest)) {
+      for (auto it2 = manifest.begin(); it2 != manifest.end(); ++it2) {
+        referenced.insert(it2->second);
+      }
+    }
+  }
+
+  /* This includes the blobs written by an action that failed to be saved. */
+  std::size_t numBlobs = 0;
+  std::vector<std::string> digests = localBlobs_.listEntries();
+  for (auto it = digests.begin(); it != digests.end(); ++it) {
+    if (referenced.find(*it) == referenced.end()) {
+      localBlobs_.delEntry(*it);
+      numBlobs++;
+    }
+  }
+  LOG(INFO) << "Removed " << numActions << " actions and " << numBlobs
+            << " blobs from the shared cache";
+}
+
+} // namespace falcon
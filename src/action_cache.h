@@ -0,0 +1,171 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#ifndef FALCON_ACTION_CACHE_H_
+#define FALCON_ACTION_CACHE_H_
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "cache_backend.h"
+
+namespace falcon {
+
+/**
+ * The cache is split in two stores:
+ * - the action cache maps the key of an action (the hash of a rule, or the
+ *   hash used to look up its depfile) to a small manifest that gives the
+ *   digest of the content of each file the action produced;
+ * - the blob store keeps the content of the files, keyed by their digest.
+ *
+ * Restoring a rule costs one manifest read, then one copy per output. Files
+ * with identical contents are stored once, whatever rule, target or git ref
+ * produced them.
+ *
+ * Blobs are reference counted by the manifests of the local action cache.
+ * Removing an action only records it: the action, and the blobs it was the
+ * last one to use, are removed by the next call to collectGarbage(), which
+ * runs once the build is over. The counts are only needed to remove actions,
+ * so they are computed from the local manifests by the first collection that
+ * removes one rather than when the daemon starts.
+ *
+ * Parsed manifests are kept in memory, so that looking up an action twice,
+ * which lazy fetching does, only reads it once.
+ *
+ * When the local stores are shared with other processes, delAction() does
+ * nothing: an action one checkout does not need any more may be used by the
+ * others, which we cannot tell. Instead, the actions that no process used for
+ * a week are removed, with the blobs that no remaining action uses. A lock
+ * file coordinates this with the other processes: saveAction() holds it
+ * shared from the first blob written until the manifest is stored, and
+ * collectGarbage() holds it exclusive while it collects, at most once a day.
+ * The modification time of the lock file records the last collection.
+ *
+ * This class is thread safe.
+ */
+class ActionCache {
+ public:
+  /** Map the path of each file produced by an action to its digest. */
+  typedef std::map<std::string, std::string> Manifest;
+
+  /**
+   * @param localActions Local store of the manifests.
+   * @param localBlobs   Local store of the blobs.
+   * @param actions      Where manifests are looked up and stored. Either
+   *                     localActions or a tier in front of a remote store.
+   * @param blobs        Where blobs are looked up and stored.
+   * @param lockPath     Lock file shared with the other processes that use
+   *                     the local stores, or an empty string if they are
+   *                     private.
+   */
+  ActionCache(ILocalCacheBackend& localActions,
+              ILocalCacheBackend& localBlobs,
+              ICacheBackend& actions, ICacheBackend& blobs,
+              const std::string& lockPath);
+
+  /**
+   * Store the given files in the blob store and their manifest under key.
+   * Nothing is done if the action is already in cache.
+   * @param key     Key of the action.
+   * @param paths   Files produced by the action.
+   * @param digests Digest of each file, if already known, so that it is not
+   *                computed again. Empty strings for the others.
+   * @param mtimes  Modification time of each file when the action completed,
+   *                or when its digest was computed (see
+   *                fs::getModificationTime()). The action is not saved if one
+   *                of them was modified since: its content may not be the one
+   *                the action produced.
+   * @return true on success.
+   */
+  bool saveAction(const std::string& key,
+                  const std::vector<std::string>& paths,
+                  const std::vector<std::string>& digests,
+                  const std::vector<uint64_t>& mtimes);
+
+  /**
+   * Look up the manifests of several actions with one query.
+   * @param keys      Keys of the actions.
+   * @param manifests Filled with one manifest per key.
+   * @param found     Filled with one flag per key.
+   */
+  void getManifests(const std::vector<std::string>& keys,
+                    std::vector<Manifest>& manifests,
+                    std::vector<bool>& found);
+
+  /** Remove an action from the local cache. It is removed, with the blobs
+   * nothing else uses, by the next call to collectGarbage(), unless it is
+   * saved again in the meantime. Nothing is removed if the local stores are
+   * shared. */
+  void delAction(const std::string& key);
+
+  /** Remove the actions passed to delAction() and the blobs that are not used
+   * any more. If the local stores are shared, record the use of the actions
+   * looked up since the last call, and remove the old actions if it is time
+   * to. Must not run concurrently with saveAction(). */
+  void collectGarbage();
+
+  /** Store of the blobs. */
+  ICacheBackend& blobs() { return blobs_; }
+
+  /** Serialize a manifest, as stored in the action cache. */
+  static std::string formatManifest(const Manifest& manifest);
+  static bool parseManifest(const std::string& data, Manifest& manifest);
+
+ private:
+  /** Add a manifest to manifests_ and count its blobs. mutex_ must be
+   * held. */
+  void addManifest(const std::string& key, const Manifest& manifest);
+
+  /** Read the local manifests that are not in memory yet to compute the
+   * reference counts. mutex_ must be held. */
+  void loadRefCounts();
+
+  /** Remove the actions of deleted_ and count the blobs they used. mutex_
+   * must be held. */
+  void removeDeletedActions();
+
+  /** Collect the garbage of shared local stores. */
+  void collectSharedGarbage();
+
+  ILocalCacheBackend& localActions_;
+  ILocalCacheBackend& localBlobs_;
+  ICacheBackend& actions_;
+  ICacheBackend& blobs_;
+  std::string lockPath_;
+
+  std::mutex mutex_;
+
+  /** Manifests read or written so far, by key. All of them are in the local
+   * action cache. */
+  std::unordered_map<std::string, Manifest> manifests_;
+
+  /** True once refCounts_ was computed. */
+  bool refCountsLoaded_;
+
+  /** Number of local manifests that use each blob. */
+  std::unordered_map<std::string, unsigned int> refCounts_;
+
+  /** Actions passed to delAction(), not removed yet. */
+  std::unordered_set<std::string> deleted_;
+
+  /** Blobs whose count reached 0. */
+  std::vector<std::string> unreferenced_;
+
+  /** Actions of shared local stores found by getManifests() or saveAction()
+   * since the last collection. */
+  std::unordered_set<std::string> used_;
+
+  ActionCache(const ActionCache& other) = delete;
+  ActionCache& operator=(const ActionCache&) = delete;
+};
+
+} // namespace falcon
+
+#endif // FALCON_ACTION_CACHE_H_
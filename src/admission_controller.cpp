@@ -0,0 +1,117 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#include <cassert>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#include "admission_controller.h"
+
+#include "logging.h"
+
+namespace falcon {
+
+AdmissionController::AdmissionController(const Limits& limits)
+    : limits_(limits)
+    , budget_(0)
+    , reserved_(0)
+    , numRunning_(0)
+    , holding_(false) { }
+
+void AdmissionController::startBuild() {
+  assert(numRunning_ == 0);
+  SystemStats stats;
+  readSystemStats(stats);
+  budget_ = stats.memAvailable > limits_.memoryReserve
+    ? stats.memAvailable - limits_.memoryReserve : 0;
+  holding_ = false;
+}
+
+bool AdmissionController::admit(const Rule* rule) {
+  if (numRunning_ == 0) {
+    /* Always make progress. */
+    holding_ = false;
+    return true;
+  }
+
+  SystemStats stats;
+  readSystemStats(stats);
+
+  if (limits_.maxLoad > 0 && stats.load >= limits_.maxLoad) {
+    hold("the load average is too high");
+    return false;
+  }
+  if (limits_.maxMemoryPressure > 0
+      && stats.memoryPressure >= limits_.maxMemoryPressure) {
+    hold("the memory pressure is too high");
+    return false;
+  }
+
+  uint64_t rss = rule->getMaxRss();
+  if (budget_ > 0 && reserved_ + rss > budget_) {
+    hold("the running commands may use all the memory");
+    return false;
+  }
+  if (stats.memAvailable > 0
+      && rss + limits_.memoryReserve > stats.memAvailable) {
+    hold("there is not enough memory available");
+    return false;
+  }
+
+  holding_ = false;
+  return true;
+}
+
+void AdmissionController::onStarted(const Rule* rule) {
+  reserved_ += rule->getMaxRss();
+  numRunning_++;
+}
+
+void AdmissionController::onFinished(const Rule* rule) {
+  assert(numRunning_ > 0);
+  assert(reserved_ >= rule->getMaxRss());
+  reserved_ -= rule->getMaxRss();
+  numRunning_--;
+}
+
+void AdmissionController::hold(const std::string& reason) {
+  if (!holding_) {
+    LOG(INFO) << "Holding back commands: " << reason;
+    holding_ = true;
+  }
+}
+
+void AdmissionController::readSystemStats(SystemStats& stats) {
+  stats.load = 0;
+  stats.memoryPressure = 0;
+  stats.memAvailable = 0;
+
+  double load[1];
+  if (getloadavg(load, 1) == 1) {
+    stats.load = load[0];
+  }
+
+  /* The pressure stall information is only available on recent kernels. */
+  std::ifstream pressure("/proc/pressure/memory");
+  std::string line;
+  while (std::getline(pressure, line)) {
+    if (line.compare(0, 11, "some avg10=") == 0) {
+      stats.memoryPressure = atof(line.c_str() + 11);
+      break;
+    }
+  }
+
+  std::ifstream meminfo("/proc/meminfo");
+  while (std::getline(meminfo, line)) {
+    if (line.compare(0, 13, "MemAvailable:") == 0) {
+      std::istringstream iss(line.substr(13));
+      iss >> stats.memAvailable;
+      break;
+    }
+  }
+}
+
+} // namespace falcon
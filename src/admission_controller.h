@@ -0,0 +1,104 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#ifndef FALCON_ADMISSION_CONTROLLER_H_
+#define FALCON_ADMISSION_CONTROLLER_H_
+
+#include <cstdint>
+#include <string>
+
+#include "graph.h"
+
+namespace falcon {
+
+/**
+ * AdmissionController decides if the builder can start one more command
+ * without overloading the machine. Swapping slows a build down much more than
+ * running fewer commands at a time.
+ *
+ * A command is held back when:
+ * - the load average is above the load limit;
+ * - the memory pressure (the "some avg10" line of /proc/pressure/memory) is
+ *   above the pressure limit;
+ * - the peak RSS of its last run (see Rule::getMaxRss()), added to the peak
+ *   RSS of the commands that are running, would not fit in the memory that was
+ *   available when the build started, minus the reserve;
+ * - its peak RSS does not fit in the memory available now, minus the reserve.
+ *
+ * A command is always admitted when none is running, so that the build always
+ * makes progress. The rules that never ran are assumed to use no memory.
+ */
+class AdmissionController {
+ public:
+  struct Limits {
+    /* Maximum load average, 0 for no limit. */
+    double maxLoad;
+    /* Maximum percentage of time stalled on memory, 0 for no limit. */
+    double maxMemoryPressure;
+    /* Memory to keep free, in kilobytes. */
+    uint64_t memoryReserve;
+  };
+
+  /* State of the machine. A value we could not read is set to 0. */
+  struct SystemStats {
+    double load;
+    double memoryPressure;
+    /* MemAvailable of /proc/meminfo, in kilobytes. */
+    uint64_t memAvailable;
+  };
+
+  explicit AdmissionController(const Limits& limits);
+  virtual ~AdmissionController() {}
+
+  /**
+   * Start a new build: read the memory available for the build. Must be
+   * called when no command is running.
+   */
+  void startBuild();
+
+  /**
+   * Determine if the command of a rule can be started now.
+   * @param rule Rule to be started.
+   * @return true if the rule can be started. The caller must then call
+   * onStarted().
+   */
+  bool admit(const Rule* rule);
+
+  /** Notify that the command of a rule was started. */
+  void onStarted(const Rule* rule);
+
+  /** Notify that the command of a rule completed. */
+  void onFinished(const Rule* rule);
+
+  /** Peak RSS of the commands that are running, in kilobytes. */
+  uint64_t getReservedMemory() const { return reserved_; }
+
+ protected:
+  /** Read the state of the machine. Virtual for the tests. */
+  virtual void readSystemStats(SystemStats& stats);
+
+ private:
+  /** Log why we are holding back commands, once until they are admitted
+   * again. */
+  void hold(const std::string& reason);
+
+  Limits limits_;
+
+  /* Memory the commands of the build can use, in kilobytes, 0 if unknown. */
+  uint64_t budget_;
+
+  /* Sum of the peak RSS of the commands that are running, in kilobytes. */
+  uint64_t reserved_;
+
+  std::size_t numRunning_;
+  bool holding_;
+
+  AdmissionController(const AdmissionController& other) = delete;
+  AdmissionController& operator=(const AdmissionController&) = delete;
+};
+
+} // namespace falcon
+
+#endif // FALCON_ADMISSION_CONTROLLER_H_
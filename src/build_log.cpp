@@ -0,0 +1,197 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#include <cstdio>
+#include <sstream>
+
+#include "build_log.h"
+
+#include "logging.h"
+
+namespace falcon {
+
+static const char* kHeader = "# falcon build log v1";
+
+/* Do not bother compacting small logs. */
+static const std::size_t kMinRecordsToCompact = 1000;
+
+/* Compact when less than one record out of kCompactRatio is the latest of its
+ * rule. */
+static const std::size_t kCompactRatio = 3;
+
+static void writeEntry(std::ostream& os, const BuildLog::Entry& e) {
+  os << e.startTime << ' ' << e.endTime << ' ' << e.status << ' '
+     << e.cpuTime << ' ' << e.maxRss << ' ' << e.outputSize << ' '
+     << e.hash << ' ' << e.output << '\n';
+}
+
+static bool parseEntry(const std::string& line, BuildLog::Entry& e) {
+  std::istringstream iss(line);
+  if (!(iss >> e.startTime >> e.endTime >> e.status >> e.cpuTime >> e.maxRss
+            >> e.outputSize >> e.hash)) {
+    return false;
+  }
+  /* The output is the rest of the line, it may contain spaces. */
+  if (iss.get() != ' ' || !std::getline(iss, e.output)) {
+    return false;
+  }
+  return !e.output.empty();
+}
+
+BuildLog::BuildLog(const std::string& path)
+    : path_(path)
+    , numRecords_(0) {
+  bool valid = load();
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  /* A record cut by a crash must be removed before appending new ones. */
+  if (!valid || (numRecords_ > kMinRecordsToCompact
+                 && numRecords_ > kCompactRatio * entries_.size())) {
+    compact();
+    return;
+  }
+  file_.open(path_.c_str(), std::ios::out | std::ios::app);
+  if (!file_.is_open()) {
+    LOG(ERROR) << "Could not open the build log " << path_;
+    return;
+  }
+  if (numRecords_ == 0) {
+    /* New file, or one we could not read. */
+    file_.close();
+    file_.open(path_.c_str(), std::ios::out | std::ios::trunc);
+    file_ << kHeader << '\n';
+    file_.flush();
+  }
+}
+
+bool BuildLog::load() {
+  std::ifstream ifs(path_.c_str());
+  if (!ifs.is_open()) {
+    /* No build log yet. */
+    return true;
+  }
+
+  std::string line;
+  if (!std::getline(ifs, line) || line != kHeader) {
+    LOG(WARNING) << "Ignoring the build log " << path_
+                 << ": unknown format";
+    return true;
+  }
+
+  std::size_t numInvalid = 0;
+  while (std::getline(ifs, line)) {
+    Entry entry;
+    if (!parseEntry(line, entry)) {
+      /* Probably a record that was cut by a crash. */
+      numInvalid++;
+      continue;
+    }
+    entries_[entry.output] = entry;
+    numRecords_++;
+  }
+  LOG(INFO) << "Loaded " << entries_.size() << " records from the build log";
+  if (numInvalid > 0) {
+    LOG(WARNING) << "Skipped " << numInvalid << " invalid records in "
+                 << path_;
+    return false;
+  }
+  return true;
+}
+
+void BuildLog::compact() {
+  if (file_.is_open()) {
+    file_.close();
+  }
+
+  std::string tmp = path_ + ".tmp";
+  {
+    std::ofstream ofs(tmp.c_str(), std::ios::out | std::ios::trunc);
+    ofs << kHeader << '\n';
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+      writeEntry(ofs, it->second);
+    }
+    ofs.flush();
+    if (!ofs.good()) {
+      LOG(ERROR) << "Could not write " << tmp;
+      std::remove(tmp.c_str());
+      file_.open(path_.c_str(), std::ios::out | std::ios::app);
+      return;
+    }
+  }
+  if (std::rename(tmp.c_str(), path_.c_str()) != 0) {
+    LOG(ERROR) << "Could not replace the build log " << path_;
+    std::remove(tmp.c_str());
+  } else {
+    LOG(INFO) << "Compacted the build log from " << numRecords_ << " to "
+              << entries_.size() << " records";
+    numRecords_ = entries_.size();
+  }
+  file_.open(path_.c_str(), std::ios::out | std::ios::app);
+}
+
+void BuildLog::record(const Entry& entry) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  entries_[entry.output] = entry;
+  numRecords_++;
+
+  if (numRecords_ > kMinRecordsToCompact
+      && numRecords_ > kCompactRatio * entries_.size()) {
+    /* The new record is written with the others. */
+    compact();
+    return;
+  }
+  if (file_.is_open()) {
+    writeEntry(file_, entry);
+    file_.flush();
+  }
+}
+
+bool BuildLog::find(const std::string& output, Entry& entry) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(output);
+  if (it == entries_.end()) {
+    return false;
+  }
+  entry = it->second;
+  return true;
+}
+
+void BuildLog::applyHistory(RuleArray& rules) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto it = rules.begin(); it != rules.end(); ++it) {
+    Rule* rule = *it;
+    if (rule->isPhony() || rule->getDuration() > 0
+        || rule->getOutputs().empty()) {
+      continue;
+    }
+    auto itEntry = entries_.find(rule->getOutputs()[0]->getPath());
+    if (itEntry == entries_.end() || itEntry->second.status != "SUCCEEDED") {
+      continue;
+    }
+    const Entry& entry = itEntry->second;
+    if (entry.endTime > entry.startTime) {
+      rule->setDuration(entry.endTime - entry.startTime);
+    }
+    rule->setMaxRss(entry.maxRss);
+  }
+}
+
+std::size_t BuildLog::size() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.size();
+}
+
+void BuildLog::toJson(const Entry& e, std::ostream& os) {
+  os << "{ \"output\": \"" << e.output << "\""
+     << ", \"hash\": \"" << e.hash << "\""
+     << ", \"status\": \"" << e.status << "\""
+     << ", \"start_time\": " << e.startTime
+     << ", \"end_time\": " << e.endTime
+     << ", \"cpu_time\": " << e.cpuTime
+     << ", \"max_rss\": " << e.maxRss
+     << ", \"output_size\": " << e.outputSize << " }";
+}
+
+} // namespace falcon
@@ -0,0 +1,114 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#ifndef FALCON_BUILD_LOG_H_
+#define FALCON_BUILD_LOG_H_
+
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+
+#include "graph.h"
+
+namespace falcon {
+
+/**
+ * BuildLog keeps a record of each command run by the daemon: when it ran, its
+ * exit status, the resources it used and the size of its outputs. It is used
+ * to schedule the longest rules first, to avoid running out of memory and to
+ * track regressions.
+ *
+ * The records are appended to a text file, one line per record:
+ *
+ *   <start> <end> <status> <cpu time> <max rss> <output size> <hash> <output>
+ *
+ * where the times are in milliseconds since the epoch, the max rss in
+ * kilobytes, <hash> is the hash of the rule and <output> its first output,
+ * which identifies the rule across changes of its inputs.
+ *
+ * Only the latest record of each rule is kept in memory. When the file has too
+ * many records that were superseded, it is rewritten with only the latest
+ * ones.
+ *
+ * This class is thread safe.
+ */
+class BuildLog {
+ public:
+  struct Entry {
+    uint64_t startTime;
+    uint64_t endTime;
+    std::string status;
+    uint64_t cpuTime;
+    uint64_t maxRss;
+    uint64_t outputSize;
+    std::string hash;
+    std::string output;
+  };
+
+  /**
+   * Load the log, and open it for appending new records.
+   * @param path Path of the log file. It is created if it does not exist.
+   */
+  explicit BuildLog(const std::string& path);
+
+  /**
+   * Append a record to the log.
+   * @param entry Record to be added. It replaces any record with the same
+   *              output.
+   */
+  void record(const Entry& entry);
+
+  /**
+   * Find the latest record of a rule.
+   * @param output First output of the rule.
+   * @param entry  Filled with the record, if found.
+   * @return true if the rule has a record.
+   */
+  bool find(const std::string& output, Entry& entry);
+
+  /**
+   * Set the duration and the peak RSS of the rules that never ran since the
+   * daemon started from their latest successful record, so that the build
+   * plan and the admission controller can use them.
+   * @param rules Rules of the graph.
+   */
+  void applyHistory(RuleArray& rules);
+
+  /** Number of records in memory. */
+  std::size_t size();
+
+  /** Print a record as a json object. */
+  static void toJson(const Entry& entry, std::ostream& os);
+
+ private:
+  /** Load the records of the file. Return false if some records are invalid
+   * and the file must be rewritten. */
+  bool load();
+
+  /** Rewrite the log with only the latest records. Must be called with mutex_
+   * held. */
+  void compact();
+
+  std::string path_;
+
+  /* Latest record of each rule, by first output. */
+  std::unordered_map<std::string, Entry> entries_;
+
+  /* Number of records in the file, including the superseded ones. */
+  std::size_t numRecords_;
+
+  std::ofstream file_;
+  std::mutex mutex_;
+
+  BuildLog(const BuildLog& other) = delete;
+  BuildLog& operator=(const BuildLog&) = delete;
+};
+
+} // namespace falcon
+
+#endif // FALCON_BUILD_LOG_H_
@@ -3,6 +3,8 @@
  * LICENSE : see accompanying LICENSE file for details.
  */
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 
 #include "build_plan.h"
@@ -10,49 +12,187 @@
 
 namespace falcon {
 
-BuildPlan::BuildPlan(NodeSet& targets) : numStarted_(0) {
-  for (auto it = targets.begin(); it != targets.end(); ++it) {
-    addTarget(*it);
-  }
+/* Id of the last plan. 0 is never used, it is the id of the rules that were
+ * never part of a plan. */
+static std::atomic<unsigned int> lastPlanId(0);
+
+/* Id of the last traversal of a plan, see Rule::planVisitId_. */
+static std::atomic<unsigned int> lastVisitId(0);
+
+BuildPlan::BuildPlan(NodeSet& targets)
+    : id_(++lastPlanId), defaultCost_(1), numStarted_(0) {
+  RuleArray rules;
+  merge(targets, rules);
 
   /* If the build plan contains rules to build, we should have at least a rule
    * that is ready otherwise there is no starting point. */
   assert(rules_.empty() || !readyRules_.empty());
 }
 
-void BuildPlan::addTarget(Node* target) {
-  if (!target->isDirty()) {
-    /* This target is already up to date. */
+void BuildPlan::merge(NodeSet& targets, RuleArray& rules) {
+  std::size_t numRules = rules_.size();
+  addTargets(targets, rules);
+  if (rules_.size() == numRules) {
+    /* Everything was already part of the plan. */
     return;
   }
 
-  Rule* rule = target->getChild();
-  if (!rule) {
-    /* This is a source file. Ignore it. */
-    return;
+  /* The rules that never ran are assumed to take the average time. */
+  uint64_t total = 0;
+  std::size_t numKnown = 0;
+  for (auto it = rules_.begin(); it != rules_.end(); ++it) {
+    if (!(*it)->isPhony() && (*it)->getDuration() > 0) {
+      total += (*it)->getDuration();
+      numKnown++;
+    }
+  }
+  if (numKnown > 0) {
+    defaultCost_ = std::max<uint64_t>(total / numKnown, 1);
   }
 
-  if (rules_.find(rule) != rules_.end()) {
-    /* This rule is already in the plan. */
-    return;
+  /* The new rules may depend on the rules that were already planned, compute
+   * the priorities again. The rules that are already ready keep their place
+   * in readyRules_. */
+  for (auto it = rules_.begin(); it != rules_.end(); ++it) {
+    (*it)->planPriority_ = 0;
+    (*it)->planPendingDependents_ = 0;
+  }
+  uint64_t criticalPath = computePriorities();
+
+  /* The new rules that depend on a rule that failed can never be built. */
+  RuleArray skipped;
+  for (auto it = rules.begin(); it != rules.end(); ++it) {
+    if ((*it)->planFailed_) {
+      notifyRuleFailed(*it, skipped);
+    }
+  }
+
+  for (auto it = rules_.begin() + numRules; it != rules_.end(); ++it) {
+    if ((*it)->ready()) {
+      pushReady(*it);
+    }
+  }
+  LOG(INFO) << "Planned " << rules_.size() - numRules
+            << " rules, critical path: " << criticalPath
+            << (numKnown > 0 ? "ms" : " rules");
+}
+
+void BuildPlan::addTargets(NodeSet& targets, RuleArray& rules) {
+  /* The rules of the plan may be needed by several targets, visit each of them
+   * once. */
+  unsigned int visitId = ++lastVisitId;
+  NodeArray stack(targets.begin(), targets.end());
+  while (!stack.empty()) {
+    Node* target = stack.back();
+    stack.pop_back();
+
+    if (!target->isDirty()) {
+      /* This target is already up to date. */
+      continue;
+    }
+
+    Rule* rule = target->getChild();
+    if (!rule) {
+      /* This is a source file. Ignore it. */
+      continue;
+    }
+
+    if (rule->planVisitId_ == visitId) {
+      /* This rule was already visited. */
+      continue;
+    }
+    rule->planVisitId_ = visitId;
+    rules.push_back(rule);
+
+    if (!contains(rule)) {
+      /* If the target is dirty, the rule should be dirty as well. */
+      assert(rule->isDirty());
+      rule->planId_ = id_;
+      rule->planPriority_ = 0;
+      rule->planPendingDependents_ = 0;
+      rule->planReady_ = false;
+      rule->planFailed_ = false;
+      rules_.push_back(rule);
+    }
+
+    /* If all the inputs are already built, the rule is added to readyRules_
+     * once all the priorities are known. */
+    if (!rule->ready()) {
+      /* Add any other rule that will build the required inputs. */
+      auto& inputs = rule->getInputs();
+      stack.insert(stack.end(), inputs.begin(), inputs.end());
+    }
   }
+}
+
+uint64_t BuildPlan::getCost(const Rule* rule) const {
+  if (rule->isPhony()) {
+    return 0;
+  }
+  return rule->getDuration() > 0 ? rule->getDuration() : defaultCost_;
+}
+
+uint64_t BuildPlan::computePriorities() {
+  /* The priority of a rule depends on the priorities of the rules that take
+   * one of its outputs as input. Count them for each rule, then visit the
+   * rules starting from the ones that no rule of the plan depends on. */
+  for (auto it = rules_.begin(); it != rules_.end(); ++it) {
+    auto& inputs = (*it)->getInputs();
+    for (auto itIn = inputs.begin(); itIn != inputs.end(); ++itIn) {
+      Rule* child = (*itIn)->getChild();
+      if (child && contains(child)) {
+        child->planPendingDependents_++;
+      }
+    }
+  }
+
+  RuleArray stack;
+  for (auto it = rules_.begin(); it != rules_.end(); ++it) {
+    if ((*it)->planPendingDependents_ == 0) {
+      stack.push_back(*it);
+    }
+  }
+
+  uint64_t criticalPath = 0;
+  while (!stack.empty()) {
+    Rule* rule = stack.back();
+    stack.pop_back();
+
+    /* planPriority_ holds the longest chain of the rules that depend on this
+     * one, all of them were visited. */
+    rule->planPriority_ += getCost(rule);
+    criticalPath = std::max(criticalPath, rule->planPriority_);
 
-  /* If the target is dirty, the rule should be dirty as well. */
-  assert(rule->isDirty());
-  rules_.insert(rule);
-
-  if (rule->ready()) {
-    /* All the inputs are already built. */
-    assert(readyRules_.find(rule) == readyRules_.end());
-    readyRules_.insert(rule);
-  } else {
-    /* Traverse the graph to add any other rule that will build the required
-     * inputs. */
     auto& inputs = rule->getInputs();
-    for (auto it = inputs.begin(); it != inputs.end(); ++it) {
-      addTarget(*it);
+    for (auto itIn = inputs.begin(); itIn != inputs.end(); ++itIn) {
+      Rule* child = (*itIn)->getChild();
+      if (!child || !contains(child)) {
+        continue;
+      }
+      child->planPriority_ = std::max(child->planPriority_,
+                                      rule->planPriority_);
+      assert(child->planPendingDependents_ > 0);
+      if (--child->planPendingDependents_ == 0) {
+        stack.push_back(child);
+      }
     }
   }
+
+  return criticalPath;
+}
+
+uint64_t BuildPlan::getPriority(Rule* rule) const {
+  assert(contains(rule));
+  return rule->planPriority_;
+}
+
+void BuildPlan::pushReady(Rule* rule) {
+  if (rule->planReady_) {
+    return;
+  }
+  rule->planReady_ = true;
+  readyRules_.push_back(PriorityRule(rule->planPriority_, rule));
+  std::push_heap(readyRules_.begin(), readyRules_.end());
 }
 
 Rule* BuildPlan::findWork() {
@@ -60,9 +200,9 @@ Rule* BuildPlan::findWork() {
     /* We cannot build any rule. */
     return nullptr;
   }
-  auto itRule = readyRules_.begin();
-  Rule* rule = *itRule;
-  readyRules_.erase(itRule);
+  std::pop_heap(readyRules_.begin(), readyRules_.end());
+  Rule* rule = readyRules_.back().second;
+  readyRules_.pop_back();
   assert(rule);
   numStarted_++;
 
@@ -70,9 +210,8 @@ Rule* BuildPlan::findWork() {
 }
 
 void BuildPlan::notifyRuleBuilt(Rule *rule) {
-  auto itRule = rules_.find(rule);
-  assert(readyRules_.find(rule) == readyRules_.end());
-  assert(itRule != rules_.end());
+  assert(contains(rule));
+  assert(rule->planReady_);
 
   /* Traverse the outputs to find any rule that became ready. */
   auto& outputs = rule->getOutputs();
@@ -81,8 +220,38 @@ void BuildPlan::notifyRuleBuilt(Rule *rule) {
     for (auto it2 = parentRules.begin(); it2 != parentRules.end(); ++it2) {
       Rule *parentRule = *it2;
       /* If the rule is ready and in the plan, add it to readyRules_. */
-      if (parentRule->ready() && rules_.find(parentRule) != rules_.end()) {
-        readyRules_.insert(parentRule);
+      if (contains(parentRule) && parentRule->ready()) {
+        pushReady(parentRule);
+      }
+    }
+  }
+}
+
+void BuildPlan::notifyRuleFailed(Rule *rule, RuleArray& skipped) {
+  assert(contains(rule));
+  assert(rule->planReady_);
+  rule->planFailed_ = true;
+
+  /* The rules that depend on the failed rule never become ready. Mark them as
+   * if they were returned by findWork(), so that the plan can be done. */
+  RuleArray stack(1, rule);
+  while (!stack.empty()) {
+    Rule* current = stack.back();
+    stack.pop_back();
+
+    auto& outputs = current->getOutputs();
+    for (auto it = outputs.begin(); it != outputs.end(); ++it) {
+      auto& parentRules = (*it)->getParents();
+      for (auto it2 = parentRules.begin(); it2 != parentRules.end(); ++it2) {
+        Rule *parentRule = *it2;
+        if (!contains(parentRule) || parentRule->planReady_) {
+          continue;
+        }
+        parentRule->planReady_ = true;
+        parentRule->planFailed_ = true;
+        numStarted_++;
+        skipped.push_back(parentRule);
+        stack.push_back(parentRule);
       }
     }
   }
@@ -6,6 +6,10 @@
 #ifndef FALCON_BUILD_PLAN_H_
 #define FALCON_BUILD_PLAN_H_
 
+#include <cstdint>
+#include <utility>
+#include <vector>
+
 #include "graph.h"
 
 namespace falcon {
@@ -19,6 +23,21 @@ namespace falcon {
  * notifyRuleBuilt(). The build plan can then deduce new rules that are ready.
  * This goes on until there are no more rules to build.
  *
+ * Ready rules are returned longest critical path first: the priority of a rule
+ * is the time it takes to run it and the longest chain of rules of the plan
+ * that depend on it. The time of a rule is the duration of its last run (see
+ * Rule::getDuration()). Rules that never ran count for the average duration
+ * of the plan, or for 1 if no rule of the plan ever ran, in which case the
+ * priority is the depth of the chain.
+ *
+ * The plan keeps its bookkeeping in the rules (see Rule::planId_): a rule is
+ * part of the plan if it is stamped with the id of the plan, so that finding
+ * out if a rule is in the plan does not need any lookup. A rule can only be
+ * part of one plan at a time.
+ *
+ * More targets can be merged in the plan while it is being built (see
+ * merge()). The rules needed by several merges are only built once.
+ *
  * Usage:
  *
  * BuildPlan plan({ target1, target2, target3 });
@@ -40,6 +59,16 @@ class BuildPlan {
    */
   BuildPlan(NodeSet& targets);
 
+  /**
+   * Add more targets to the plan.
+   * @param targets Targets that we wish to build.
+   * @param rules   Filled with the rules needed to build the targets that are
+   *                not built yet, including the ones that were already part of
+   *                the plan. The ones that depend on a rule that failed are
+   *                skipped (see hasFailed()).
+   */
+  void merge(NodeSet& targets, RuleArray& rules);
+
   /**
    * Find a rule that is ready to be built.
    * @return Rule that can be built. It is guaranteed that all its inputs are up
@@ -67,23 +96,73 @@ class BuildPlan {
    */
   void notifyRuleBuilt(Rule *rule);
 
+  /**
+   * Notify that a rule failed. The rules of the plan that depend on it,
+   * directly or not, can never be built: they are removed from the plan, so
+   * that the rules that do not depend on it can still be built.
+   * @param rule    Rule that failed.
+   * @param skipped Filled with the rules that were removed from the plan.
+   */
+  void notifyRuleFailed(Rule *rule, RuleArray& skipped);
+
+  /**
+   * Determine if a rule of the plan failed, or was removed from the plan
+   * because it depends on a rule that failed.
+   */
+  bool hasFailed(const Rule* rule) const {
+    return contains(rule) && rule->planFailed_;
+  }
+
+  /**
+   * Get the priority of a rule of the plan. Rules with a higher priority should
+   * be started first.
+   * @param rule Rule of the plan.
+   * @return Estimated time in milliseconds between the start of the rule and
+   * the end of the longest chain of rules that depend on it.
+   */
+  uint64_t getPriority(Rule* rule) const;
+
  private:
 
+  /** Ready rules, in a binary heap ordered by priority. */
+  typedef std::pair<uint64_t, Rule*> PriorityRule;
+
   /**
-   * Add a new target to be built.
-   * @param target Target to be built.
+   * Add the rules needed to build the targets to rules_.
+   * @param targets Targets to be built.
+   * @param rules   Filled with the rules needed to build the targets, including
+   *                the ones that were already part of the plan.
    */
-  void addTarget(Node* target);
+  void addTargets(NodeSet& targets, RuleArray& rules);
+
+  /** Compute the priority of all the rules of the plan. Return the priority of
+   * the critical path. */
+  uint64_t computePriorities();
+
+  /** Estimated time it takes to run the command of a rule. */
+  uint64_t getCost(const Rule* rule) const;
+
+  /** Return true if the rule is part of this plan. */
+  bool contains(const Rule* rule) const { return rule->planId_ == id_; }
+
+  /** Add a rule of the plan to readyRules_, unless it is already there. */
+  void pushReady(Rule* rule);
+
+  /** Unique id of the plan, stamped on the rules of the plan. */
+  unsigned int id_;
 
   /** All the rules that we need to build in the plan. */
-  RuleSet rules_;
+  RuleArray rules_;
+
+  /** Rules that are ready to be built, ie all their inputs are up to date. */
+  std::vector<PriorityRule> readyRules_;
 
-  /** Set of rules that are ready to be built, ie all their inputs are up to
-   * date. */
-  RuleSet readyRules_;
+  /** Cost of the rules that never ran. */
+  uint64_t defaultCost_;
 
   /**
-   * Number of rules that were returned by findWork().
+   * Number of rules that were returned by findWork() or removed from the plan
+   * because they depend on a rule that failed.
    */
   std::size_t numStarted_;
 };
@@ -0,0 +1,52 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#include <cassert>
+
+#include "cache_backend.h"
+
+namespace falcon {
+
+void ICacheBackend::hasEntries(const std::vector<std::string>& hashes,
+                               std::vector<bool>& found) {
+  found.assign(hashes.size(), false);
+  for (std::size_t i = 0; i < hashes.size(); i++) {
+    found[i] = hasEntry(hashes[i]);
+  }
+}
+
+void ICacheBackend::readEntries(const std::vector<std::string>& hashes,
+                                const std::vector<std::string>& paths,
+                                std::vector<bool>& restored) {
+  assert(hashes.size() == paths.size());
+  restored.assign(hashes.size(), false);
+  for (std::size_t i = 0; i < hashes.size(); i++) {
+    restored[i] = readEntry(hashes[i], paths[i]);
+  }
+}
+
+void ICacheBackend::loadEntries(const std::vector<std::string>& hashes,
+                                std::vector<std::string>& data,
+                                std::vector<bool>& found) {
+  data.assign(hashes.size(), std::string());
+  found.assign(hashes.size(), false);
+  for (std::size_t i = 0; i < hashes.size(); i++) {
+    found[i] = loadEntry(hashes[i], data[i]);
+  }
+}
+
+void ICacheBackend::prefetchEntries(const std::vector<std::string>&) { }
+
+int ILocalCacheBackend::openEntry(const std::string&, uint64_t&, uint64_t&) {
+  return -1;
+}
+
+void ILocalCacheBackend::touchEntries(const std::vector<std::string>&) { }
+
+bool ILocalCacheBackend::getLastUse(const std::string&, uint64_t&) {
+  return false;
+}
+
+} // namespace falcon
@@ -0,0 +1,159 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#ifndef FALCON_CACHE_BACKEND_H_
+#define FALCON_CACHE_BACKEND_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace falcon {
+
+/**
+ * Interface of a storage for cache entries. An entry is a file identified by a
+ * hash. Entries can be copied from and to files (writeEntry, readEntry) or,
+ * for small entries such as action manifests, from and to memory (storeEntry,
+ * loadEntry).
+ *
+ * Implementations must be thread safe: entries are written by the cache
+ * writer threads and restored by the I/O threads concurrently.
+ */
+class ICacheBackend {
+ public:
+  virtual ~ICacheBackend() {}
+
+  /**
+   * Write an entry in the cache.
+   * @param hash of the entry.
+   * @param path of the file to be stored.
+   * @return true on sucess, false otherwise.
+   */
+  virtual bool writeEntry(const std::string& hash, const std::string& path) = 0;
+
+  /**
+   * Check if the cache contains an entry.
+   * @param hash Hash of the entry.
+   * @return True if the entry exists, false otherwise.
+   */
+  virtual bool hasEntry(const std::string& hash) = 0;
+
+  /**
+   * Query the cache for an entry with the given hash and restore it to the
+   * given path.
+   * @param hash Hash of the entry.
+   * @param path Path where to store the entry.
+   * @return true if the entry was found, false otherwise.
+   */
+  virtual bool readEntry(const std::string& hash, const std::string& path) = 0;
+
+  /**
+   * Remove the given entry from cache.
+   * @param hash of the entry.
+   * @return true if entry was removed or did not exist, false on error.
+   */
+  virtual bool delEntry(const std::string& hash) = 0;
+
+  /**
+   * Write an entry from memory.
+   * @param hash of the entry.
+   * @param data Content of the entry.
+   * @return true on sucess, false otherwise.
+   */
+  virtual bool storeEntry(const std::string& hash, const std::string& data) = 0;
+
+  /**
+   * Read an entry in memory.
+   * @param hash of the entry.
+   * @param data Filled with the content of the entry.
+   * @return true if the entry was found, false otherwise.
+   */
+  virtual bool loadEntry(const std::string& hash, std::string& data) = 0;
+
+  /**
+   * Check if the cache contains several entries at once. Backends override
+   * this to answer the whole batch with a single lock or network round trip.
+   * The default implementation calls hasEntry() for each hash.
+   * @param hashes Hashes of the entries.
+   * @param found  Filled with one flag per hash.
+   */
+  virtual void hasEntries(const std::vector<std::string>& hashes,
+                          std::vector<bool>& found);
+
+  /**
+   * Restore several entries at once. The default implementation calls
+   * readEntry() for each hash.
+   * @param hashes   Hashes of the entries.
+   * @param paths    Path where to store each entry.
+   * @param restored Filled with one flag per hash, set to true if the entry
+   *                 was restored.
+   */
+  virtual void readEntries(const std::vector<std::string>& hashes,
+                           const std::vector<std::string>& paths,
+                           std::vector<bool>& restored);
+
+  /**
+   * Read several entries in memory at once. The default implementation calls
+   * loadEntry() for each hash.
+   * @param hashes Hashes of the entries.
+   * @param data   Filled with the content of each entry.
+   * @param found  Filled with one flag per hash.
+   */
+  virtual void loadEntries(const std::vector<std::string>& hashes,
+                           std::vector<std::string>& data,
+                           std::vector<bool>& found);
+
+  /**
+   * Hint that the given entries will be read soon, so that the backend can
+   * bring them closer: in the page cache for a local backend, in the local
+   * cache for a tiered one. The default implementation does nothing.
+   * @param hashes Hashes of the entries.
+   */
+  virtual void prefetchEntries(const std::vector<std::string>& hashes);
+};
+
+/**
+ * A backend whose entries are all stored on the local machine. Unlike a
+ * remote cache, it can enumerate its entries.
+ */
+class ILocalCacheBackend : public ICacheBackend {
+ public:
+  /** Return the hashes of all the entries. */
+  virtual std::vector<std::string> listEntries() = 0;
+
+  /**
+   * Open the file that holds the content of an entry, so that it can be sent
+   * without copying it in memory, eg with sendfile(2). The default
+   * implementation returns -1.
+   * @param hash   Hash of the entry.
+   * @param offset Set to the offset of the content in the file.
+   * @param length Set to the length of the content.
+   * @return a file descriptor the caller must close, or -1 if the entry is
+   * not found or is not stored in a file.
+   */
+  virtual int openEntry(const std::string& hash, uint64_t& offset,
+                        uint64_t& length);
+
+  /**
+   * Record that the given entries were just used. The default implementation
+   * does nothing.
+   * @param hashes Hashes of the entries.
+   */
+  virtual void touchEntries(const std::vector<std::string>& hashes);
+
+  /**
+   * Get when an entry was last used: when it was stored, or last passed to
+   * touchEntries(). The default implementation returns false.
+   * @param hash Hash of the entry.
+   * @param time Set to the time of the last use, see
+   *             fs::getModificationTime().
+   * @return false if the entry is not found or the time is not known.
+   */
+  virtual bool getLastUse(const std::string& hash, uint64_t& time);
+};
+
+} // namespace falcon
+
+#endif // FALCON_CACHE_BACKEND_H_
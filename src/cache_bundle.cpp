@@ -0,0 +1,394 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <unordered_map>
+
+#include "cache_bundle.h"
+
+#include "graph_hash.h"
+#include "logging.h"
+#include "util/thread_pool.h"
+
+namespace falcon { namespace bundle {
+
+static const char kMagic[8] = { 'F', 'C', 'B', 'U', 'N', 'D', 'L', '1' };
+
+static const uint8_t kTypeBlob = 'b';
+static const uint8_t kTypeAction = 'a';
+
+/* Keys are file names in the local cache, anything longer is corrupted. */
+static const uint32_t kMaxKeyLength = 1024;
+
+struct RecordHeader {
+  uint8_t type;
+  uint8_t pad[3];
+  uint32_t keyLength;
+  uint64_t dataLength;
+};
+
+struct IndexEntry {
+  RecordHeader header;
+  /* Offset of the data of the record. */
+  uint64_t offset;
+};
+
+struct Trailer {
+  uint64_t indexOffset;
+  uint64_t numRecords;
+  char magic[8];
+};
+
+/* A record, as read from the index. */
+struct Record {
+  uint8_t type;
+  std::string key;
+  uint64_t offset;
+  uint64_t length;
+};
+
+static bool writeAll(int fd, const char* data, std::size_t len) {
+  while (len > 0) {
+    ssize_t w = write(fd, data, len);
+    if (w < 0 && errno == EINTR) {
+      continue;
+    }
+    if (w < 0) {
+      return false;
+    }
+    data += w;
+    len -= w;
+  }
+  return true;
+}
+
+static bool readAt(int fd, char* data, std::size_t len, uint64_t offset) {
+  while (len > 0) {
+    ssize_t r = pread(fd, data, len, offset);
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    if (r <= 0) {
+      return false;
+    }
+    data += r;
+    len -= r;
+    offset += r;
+  }
+  return true;
+}
+
+/** Write the records sequentially, then the index. */
+class Writer {
+ public:
+  explicit Writer(int fd) : fd_(fd), offset_(0), numRecords_(0) { }
+
+  bool writeHeader() {
+    return append(kMagic, sizeof(kMagic));
+  }
+
+  bool writeRecord(uint8_t type, const std::string& key,
+                   const std::string& data) {
+    IndexEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.header.type = type;
+    entry.header.keyLength = key.size();
+    entry.header.dataLength = data.size();
+    entry.offset = offset_ + sizeof(entry.header) + key.size();
+    if (!append(reinterpret_cast<const char*>(&entry.header),
+                sizeof(entry.header))
+        || !append(key.data(), key.size())
+        || !append(data.data(), data.size())) {
+      return false;
+    }
+    index_.append(reinterpret_cast<const char*>(&entry), sizeof(entry));
+    index_.append(key);
+    numRecords_++;
+    return true;
+  }
+
+  bool writeIndex() {
+    Trailer trailer;
+    trailer.indexOffset = offset_;
+    trailer.numRecords = numRecords_;
+    memcpy(trailer.magic, kMagic, sizeof(kMagic));
+    return append(index_.data(), index_.size())
+      && append(reinterpret_cast<const char*>(&trailer), sizeof(trailer));
+  }
+
+ private:
+  bool append(const char* data, std::size_t len) {
+    if (!writeAll(fd_, data, len)) {
+      return false;
+    }
+    offset_ += len;
+    return true;
+  }
+
+  int fd_;
+  uint64_t offset_;
+  std::string index_;
+  uint64_t numRecords_;
+};
+
+bool exportActions(const std::string& path,
+                   const std::vector<std::string>& keys,
+                   ActionCache& actionCache, Summary& summary) {
+  summary = Summary();
+
+  std::vector<ActionCache::Manifest> manifests;
+  std::vector<bool> found;
+  actionCache.getManifests(keys, manifests, found);
+
+  /* Write to a temporary file so that an interrupted export does not leave a
+   * truncated bundle behind. */
+  std::string tmp = path + ".tmp";
+  int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    LOG(ERROR) << "Could not create " << tmp << ": " << strerror(errno);
+    return false;
+  }
+  Writer writer(fd);
+  bool ok = writer.writeHeader();
+
+  /* Blobs first, each one once. */
+  std::unordered_map<std::string, bool> blobs;
+  for (std::size_t i = 0; ok && i < keys.size(); i++) {
+    if (!found[i]) {
+      continue;
+    }
+    for (auto it = manifests[i].begin(); ok && it != manifests[i].end();
+         ++it) {
+      if (blobs.find(it->second) != blobs.end()) {
+        continue;
+      }
+      std::string data;
+      bool available = actionCache.blobs().loadEntry(it->second, data);
+      blobs[it->second] = available;
+      if (!available) {
+        LOG(WARNING) << "Blob " << it->second << " is missing, not exporting "
+                     << "the actions that use it";
+        continue;
+      }
+      ok = writer.writeRecord(kTypeBlob, it->second, data);
+      summary.numBlobs++;
+      summary.numBytes += data.size();
+    }
+  }
+
+  /* Then the actions whose blobs are all in the bundle. */
+  for (std::size_t i = 0; ok && i < keys.size(); i++) {
+    if (!found[i]) {
+      continue;
+    }
+    bool complete = true;
+    for (auto it = manifests[i].begin(); it != manifests[i].end(); ++it) {
+      complete = complete && blobs[it->second];
+    }
+    if (!complete) {
+      summary.numErrors++;
+      continue;
+    }
+    ok = writer.writeRecord(kTypeAction, keys[i],
+                            ActionCache::formatManifest(manifests[i]));
+    summary.numActions++;
+  }
+
+  ok = ok && writer.writeIndex();
+  ok = close(fd) == 0 && ok;
+  if (!ok || rename(tmp.c_str(), path.c_str()) < 0) {
+    LOG(ERROR) << "Could not write " << path << ": " << strerror(errno);
+    unlink(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+/** Read and check the index of a bundle. */
+static bool readIndex(int fd, std::vector<Record>& records) {
+  struct stat st;
+  if (fstat(fd, &st) < 0
+      || (uint64_t)st.st_size < sizeof(kMagic) + sizeof(Trailer)) {
+    return false;
+  }
+  uint64_t size = st.st_size;
+
+  char magic[sizeof(kMagic)];
+  Trailer trailer;
+  if (!readAt(fd, magic, sizeof(magic), 0)
+      || memcmp(magic, kMagic, sizeof(kMagic)) != 0
+      || !readAt(fd, reinterpret_cast<char*>(&trailer), sizeof(trailer),
+                 size - sizeof(trailer))
+      || memcmp(trailer.magic, kMagic, sizeof(kMagic)) != 0
+      || trailer.indexOffset < sizeof(kMagic)
+      || trailer.indexOffset > size - sizeof(trailer)) {
+    return false;
+  }
+
+  std::string index(size - sizeof(trailer) - trailer.indexOffset, '\0');
+  if (!index.empty()
+      && !readAt(fd, &index[0], index.size(), trailer.indexOffset)) {
+    return false;
+  }
+
+  std::size_t pos = 0;
+  for (uint64_t i = 0; i < trailer.numRecords; i++) {
+    IndexEntry entry;
+    if (pos + sizeof(entry) > index.size()) {
+      return false;
+    }
+    memcpy(&entry, index.data() + pos, sizeof(entry));
+    pos += sizeof(entry);
+
+    Record record;
+    record.type = entry.header.type;
+    record.offset = entry.offset;
+    record.length = entry.header.dataLength;
+    if (entry.header.keyLength == 0 || entry.header.keyLength > kMaxKeyLength
+        || pos + entry.header.keyLength > index.size()
+        || record.offset > trailer.indexOffset
+        || record.length > trailer.indexOffset - record.offset) {
+      return false;
+    }
+    record.key.assign(index, pos, entry.header.keyLength);
+    pos += entry.header.keyLength;
+
+    /* Keys become file names in the cache. */
+    if (record.key.find('/') != std::string::npos || record.key[0] == '.'
+        || (record.type != kTypeBlob && record.type != kTypeAction)) {
+      return false;
+    }
+    records.push_back(record);
+  }
+  return pos == index.size();
+}
+
+/** Import the records of a shard. A blob is only stored if it matches its
+ * digest, an action if all its blobs are available. */
+static void importShard(int fd, const std::vector<const Record*>& shard,
+                        ILocalCacheBackend& actions, ILocalCacheBackend& blobs,
+                        Summary& summary) {
+  for (auto it = shard.begin(); it != shard.end(); ++it) {
+    const Record& record = **it;
+    ILocalCacheBackend& store = record.type == kTypeBlob ? blobs : actions;
+    if (store.hasEntry(record.key)) {
+      continue;
+    }
+
+    std::string data(record.length, '\0');
+    if (!data.empty() && !readAt(fd, &data[0], data.size(), record.offset)) {
+      LOG(ERROR) << "Could not read " << record.key << " from the bundle";
+      summary.numErrors++;
+      continue;
+    }
+
+    if (record.type == kTypeBlob) {
+      if (hash::hashData(data) != record.key) {
+        LOG(ERROR) << "Blob " << record.key << " is corrupted";
+        summary.numErrors++;
+        continue;
+      }
+      if (!blobs.storeEntry(record.key, data)) {
+        summary.numErrors++;
+        continue;
+      }
+      summary.numBlobs++;
+      summary.numBytes += data.size();
+    } else {
+      ActionCache::Manifest manifest;
+      bool complete = ActionCache::parseManifest(data, manifest);
+      for (auto itM = manifest.begin(); complete && itM != manifest.end();
+           ++itM) {
+        complete = blobs.hasEntry(itM->second);
+      }
+      if (!complete) {
+        LOG(ERROR) << "Action " << record.key << " is invalid or incomplete";
+        summary.numErrors++;
+        continue;
+      }
+      if (!actions.storeEntry(record.key, data)) {
+        summary.numErrors++;
+        continue;
+      }
+      summary.numActions++;
+    }
+  }
+}
+
+/** Import records with several threads, each taking a contiguous share. */
+static void importRecords(int fd, const std::vector<const Record*>& records,
+                          ILocalCacheBackend& actions,
+                          ILocalCacheBackend& blobs, ThreadPool& pool,
+                          Summary& summary) {
+  if (records.empty()) {
+    return;
+  }
+  std::size_t numShards = std::min(records.size(), pool.numThreads());
+  std::vector<Summary> results(numShards);
+  for (std::size_t i = 0; i < numShards; i++) {
+    std::vector<const Record*> shard(
+        records.begin() + records.size() * i / numShards,
+        records.begin() + records.size() * (i + 1) / numShards);
+    Summary* result = &results[i];
+    pool.submit([fd, shard, &actions, &blobs, result]() {
+      importShard(fd, shard, actions, blobs, *result);
+    });
+  }
+  pool.wait();
+
+  for (auto it = results.begin(); it != results.end(); ++it) {
+    summary.numActions += it->numActions;
+    summary.numBlobs += it->numBlobs;
+    summary.numBytes += it->numBytes;
+    summary.numErrors += it->numErrors;
+  }
+}
+
+bool importActions(const std::string& path, ILocalCacheBackend& actions,
+                   ILocalCacheBackend& blobs, std::size_t numThreads,
+                   Summary& summary) {
+  summary = Summary();
+
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    LOG(ERROR) << "Could not open " << path << ": " << strerror(errno);
+    return false;
+  }
+
+  std::vector<Record> records;
+  if (!readIndex(fd, records)) {
+    LOG(ERROR) << path << " is not a valid cache bundle";
+    close(fd);
+    return false;
+  }
+
+  std::vector<const Record*> blobRecords;
+  std::vector<const Record*> actionRecords;
+  for (auto it = records.begin(); it != records.end(); ++it) {
+    if (it->type == kTypeBlob) {
+      blobRecords.push_back(&*it);
+    } else {
+      actionRecords.push_back(&*it);
+    }
+  }
+
+  /* All the blobs are imported before the actions, so that an action in
+   * cache never refers to a blob that is not. */
+  ThreadPool pool(numThreads > 0 ? numThreads : 1, 0);
+  importRecords(fd, blobRecords, actions, blobs, pool, summary);
+  importRecords(fd, actionRecords, actions, blobs, pool, summary);
+
+  close(fd);
+  return summary.numErrors == 0;
+}
+
+} } // namespace falcon::bundle
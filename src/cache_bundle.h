@@ -0,0 +1,78 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#ifndef FALCON_CACHE_BUNDLE_H_
+#define FALCON_CACHE_BUNDLE_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "action_cache.h"
+#include "cache_backend.h"
+
+/**
+ * A bundle is a single file that holds a set of actions and all the blobs
+ * they use. It is used to seed the cache of a machine that starts from
+ * scratch, eg from a bundle exported by a nightly build.
+ *
+ * Layout:
+ * - a header;
+ * - the records, one per blob then one per action. A record is a fixed size
+ *   header, the key and the data. Blobs are written before the actions that
+ *   use them so that the bundle can be produced and consumed as a stream;
+ * - an index of the records: for each record, its header, the offset of its
+ *   data and its key;
+ * - a trailer that gives the offset of the index.
+ * Integers are stored in the byte order of the host.
+ *
+ * The index lets the importer split the records between several threads that
+ * read them in parallel. Each blob is verified against its digest before it is
+ * stored, and an action is only imported if all its blobs are available.
+ */
+
+namespace falcon { namespace bundle {
+
+struct Summary {
+  Summary() : numActions(0), numBlobs(0), numBytes(0), numErrors(0) {}
+
+  /* Number of actions and blobs exported or imported. */
+  std::size_t numActions;
+  std::size_t numBlobs;
+  /* Total size of the blobs. */
+  uint64_t numBytes;
+  /* Number of entries that could not be exported or imported. */
+  std::size_t numErrors;
+};
+
+/**
+ * Write a bundle with the given actions and their blobs. Actions that are not
+ * in cache, or whose blobs are not all in cache, are skipped.
+ * @param path        Path of the bundle.
+ * @param keys        Keys of the actions.
+ * @param actionCache Cache to read the actions and blobs from.
+ * @param summary     Filled with what was written.
+ * @return false if the bundle could not be written.
+ */
+bool exportActions(const std::string& path,
+                   const std::vector<std::string>& keys,
+                   ActionCache& actionCache, Summary& summary);
+
+/**
+ * Import a bundle in a local cache. Entries already in cache are skipped.
+ * @param path       Path of the bundle.
+ * @param actions    Local store of the manifests.
+ * @param blobs      Local store of the blobs.
+ * @param numThreads Number of threads extracting the records.
+ * @param summary    Filled with what was imported.
+ * @return false if the bundle is invalid or an entry was corrupted.
+ */
+bool importActions(const std::string& path, ILocalCacheBackend& actions,
+                   ILocalCacheBackend& blobs, std::size_t numThreads,
+                   Summary& summary);
+
+} } // namespace falcon::bundle
+
+#endif // FALCON_CACHE_BUNDLE_H_
@@ -4,10 +4,14 @@
  */
 
 #include <cassert>
+#include <dirent.h>
+#include <fcntl.h>
 #include <fstream>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
 
 #include "cache_fs.h"
 
@@ -16,64 +20,296 @@
 
 namespace falcon {
 
-CacheFS::CacheFS(const std::string& dir)
-    : dir_(dir) {}
+/* A shared cache looks for the entries of the other processes at most once
+ * per period, in nanoseconds. */
+static const uint64_t kIndexRefreshPeriod = 5ULL * 1000000000;
+
+CacheFS::CacheFS(const std::string& dir, bool shared)
+    : dir_(dir)
+    , shared_(shared)
+    , filter_(0)
+    , dirTime_(0)
+    , refreshTime_(0) {
+  loadIndex();
+}
+
+void CacheFS::loadIndex() {
+  /* Read the time first: an entry added during the scan will trigger
+   * another one. */
+  uint64_t dirTime = 0;
+  fs::getModificationTime(dir_, dirTime);
+
+  DIR* dir = opendir(dir_.c_str());
+  if (dir == NULL) {
+    /* The cache directory does not exist yet, the cache is empty. */
+    return;
+  }
+
+  std::unordered_set<std::string> index;
+  struct dirent* ent;
+  while ((ent = readdir(dir)) != NULL) {
+    /* Skip ".", ".." and any hidden file. */
+    if (ent->d_name[0] == '.') {
+      continue;
+    }
+    index.insert(ent->d_name);
+  }
+  closedir(dir);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  index_.swap(index);
+  dirTime_ = dirTime;
+  rebuildFilter(index_.size() * 2);
+  LOG(INFO) << "Loaded " << index_.size() << " cache entries from " << dir_;
+}
+
+void CacheFS::addToIndex(const std::string& hash) {
+  if (!index_.insert(hash).second) {
+    return;
+  }
+  if (index_.size() > filter_.capacity()) {
+    rebuildFilter(index_.size() * 2);
+  } else {
+    filter_.add(hash);
+  }
+}
+
+void CacheFS::rebuildFilter(std::size_t capacity) {
+  filter_ = BloomFilter(capacity);
+  for (auto it = index_.begin(); it != index_.end(); ++it) {
+    filter_.add(*it);
+  }
+}
+
+void CacheFS::refreshIndex() {
+  if (!shared_) {
+    return;
+  }
+  uint64_t now = fs::currentTime();
+  uint64_t dirTime;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (now < refreshTime_ + kIndexRefreshPeriod) {
+      return;
+    }
+    /* The other threads keep using the index meanwhile. */
+    refreshTime_ = now;
+    dirTime = dirTime_;
+  }
+
+  /* Adding or removing an entry renames or removes a file in dir_, which
+   * updates its modification time. */
+  uint64_t current;
+  if (fs::getModificationTime(dir_, current) && current == dirTime) {
+    return;
+  }
+  loadIndex();
+}
+
+bool CacheFS::findEntry(const std::string& hash) {
+  return filter_.mayContain(hash) && index_.find(hash) != index_.end();
+}
+
+std::string CacheFS::getEntryPath(const std::string& hash) const {
+  std::string path = dir_;
+  path.append("/");
+  path.append(hash);
+  return path;
+}
+
+int CacheFS::createTempFile(std::string& tmp) {
+  /* Temporary files are hidden so that loadIndex() ignores the ones left
+   * behind by a crash. */
+  tmp = dir_ + "/.tmp.XXXXXX";
+  fs::createPath(tmp);
+  int fd = mkstemp(&tmp[0]);
+  if (fd < 0) {
+    LOG(ERROR) << "Could not create a temporary file in " << dir_;
+  }
+  return fd;
+}
+
+bool CacheFS::publishEntry(const std::string& hash, const std::string& tmp) {
+  std::string output = getEntryPath(hash);
+  if (rename(tmp.c_str(), output.c_str()) < 0) {
+    LOG(ERROR) << "Could not publish cache entry " << hash;
+    unlink(tmp.c_str());
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  addToIndex(hash);
+  return true;
+}
 
 bool CacheFS::writeEntry(const std::string& hash, const std::string& path) {
   assert(!hash.empty());
 
-  fs::mkdir(dir_);
+  if (hasEntry(hash)) {
+    /* The target is already in cache. */
+    return true;
+  }
 
-  std::string output = dir_;
-  output.append("/");
-  output.append(hash);
+  /* Copy the target in a temporary file, then publish the entry. */
+  std::string tmp;
+  int fd = createTempFile(tmp);
+  if (fd < 0) {
+    return false;
+  }
+  close(fd);
 
-  struct stat sb;
-  if (stat(output.c_str(), &sb) == 0) {
-    /* The target is already in cache. */
+  if (!fs::copyFile(path, tmp)) {
+    LOG(ERROR) << "Could not store " << path << " in cache";
+    unlink(tmp.c_str());
+    return false;
+  }
+
+  return publishEntry(hash, tmp);
+}
+
+bool CacheFS::storeEntry(const std::string& hash, const std::string& data) {
+  assert(!hash.empty());
+
+  if (hasEntry(hash)) {
     return true;
   }
 
-  /* Copy the target in the cache. */
-  try {
-    std::ifstream ifs(path, std::ios::binary);
-    std::ofstream ofs(output, std::ios::binary);
-    ofs << ifs.rdbuf();
-  } catch (std::ios_base::failure& e) {
-    LOG(ERROR) << "Could not store " << path << " in cache: " << e.what();
+  std::string tmp;
+  int fd = createTempFile(tmp);
+  if (fd < 0) {
     return false;
   }
 
+  const char* ptr = data.data();
+  std::size_t len = data.size();
+  while (len > 0) {
+    ssize_t w = write(fd, ptr, len);
+    if (w < 0 && errno == EINTR) {
+      continue;
+    }
+    if (w < 0) {
+      LOG(ERROR) << "Could not store entry " << hash << " in cache";
+      close(fd);
+      unlink(tmp.c_str());
+      return false;
+    }
+    ptr += w;
+    len -= w;
+  }
+  close(fd);
+
+  return publishEntry(hash, tmp);
+}
+
+bool CacheFS::loadEntry(const std::string& hash, std::string& data) {
+  assert(!hash.empty());
+  if (!hasEntry(hash)) {
+    return false;
+  }
+
+  std::ifstream ifs(getEntryPath(hash), std::ios::in | std::ios::binary);
+  if (!ifs.is_open()) {
+    LOG(WARNING) << "Cache entry " << hash << " is missing";
+    std::lock_guard<std::mutex> lock(mutex_);
+    index_.erase(hash);
+    return false;
+  }
+  data.assign((std::istreambuf_iterator<char>(ifs)),
+              std::istreambuf_iterator<char>());
   return true;
 }
 
+std::vector<std::string> CacheFS::listEntries() {
+  if (shared_) {
+    /* Pick up the entries added and removed by the other processes. */
+    loadIndex();
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  return std::vector<std::string>(index_.begin(), index_.end());
+}
+
 bool CacheFS::hasEntry(const std::string& hash) {
   assert(!hash.empty());
-  std::string output = dir_;
-  output.append("/");
-  output.append(hash);
-  struct stat sb;
-  return stat(output.c_str(), &sb) == 0;
+  refreshIndex();
+  std::lock_guard<std::mutex> lock(mutex_);
+  return findEntry(hash);
 }
 
-bool CacheFS::readEntry(const std::string& hash, const std::string& path) {
+void CacheFS::hasEntries(const std::vector<std::string>& hashes,
+                         std::vector<bool>& found) {
+  found.assign(hashes.size(), false);
+  refreshIndex();
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (std::size_t i = 0; i < hashes.size(); i++) {
+    found[i] = findEntry(hashes[i]);
+  }
+}
+
+void CacheFS::prefetchEntries(const std::vector<std::string>& hashes) {
+  std::vector<bool> found;
+  hasEntries(hashes, found);
+  for (std::size_t i = 0; i < hashes.size(); i++) {
+    if (!found[i]) {
+      continue;
+    }
+    int fd = open(getEntryPath(hashes[i]).c_str(), O_RDONLY);
+    if (fd < 0) {
+      continue;
+    }
+    /* Only a hint: the read ahead is started asynchronously. */
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+  }
+}
+
+int CacheFS::openEntry(const std::string& hash, uint64_t& offset,
+                       uint64_t& length) {
   assert(!hash.empty());
-  std::string output = dir_;
-  output.append("/");
-  output.append(hash);
+  if (!hasEntry(hash)) {
+    return -1;
+  }
+
+  int fd = open(getEntryPath(hash).c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    return -1;
+  }
+  offset = 0;
+  length = st.st_size;
+  return fd;
+}
 
-  struct stat sb;
-  if (stat(output.c_str(), &sb) != 0) {
+void CacheFS::touchEntries(const std::vector<std::string>& hashes) {
+  for (auto it = hashes.begin(); it != hashes.end(); ++it) {
+    fs::touch(getEntryPath(*it));
+  }
+}
+
+bool CacheFS::getLastUse(const std::string& hash, uint64_t& time) {
+  return fs::getModificationTime(getEntryPath(hash), time);
+}
+
+bool CacheFS::readEntry(const std::string& hash, const std::string& path) {
+  assert(!hash.empty());
+  if (!hasEntry(hash)) {
     return false;
   }
 
+  std::string output = getEntryPath(hash);
+
   /* Copy the target from the cache. */
-  try {
-    std::ifstream ifs(output, std::ios::binary);
-    std::ofstream ofs(path, std::ios::binary);
-    ofs << ifs.rdbuf();
-  } catch (std::ios_base::failure& e) {
-    LOG(ERROR) << "Could not retrieve " << path << " in cache: " << e.what();
+  if (!fs::copyFile(output, path)) {
+    if (access(output.c_str(), F_OK) != 0) {
+      /* The entry was removed behind our back. */
+      LOG(WARNING) << "Cache entry " << hash << " is missing";
+      std::lock_guard<std::mutex> lock(mutex_);
+      index_.erase(hash);
+    } else {
+      LOG(ERROR) << "Could not retrieve " << path << " from cache";
+    }
     return false;
   }
 
@@ -82,20 +318,19 @@ bool CacheFS::readEntry(const std::string& hash, const std::string& path) {
 
 bool CacheFS::delEntry(const std::string& hash) {
   assert(!hash.empty());
-  std::string entry = dir_;
-  entry.append("/");
-  entry.append(hash);
-
-  struct stat sb;
-  if (stat(entry.c_str(), &sb) != 0) {
+  if (!hasEntry(hash)) {
     return true;
   }
 
-  if (unlink(entry.c_str()) < 0) {
+  std::string entry = getEntryPath(hash);
+
+  if (unlink(entry.c_str()) < 0 && errno != ENOENT) {
     LOG(ERROR) << "Could not remove " << entry;
     return false;
   }
 
+  std::lock_guard<std::mutex> lock(mutex_);
+  index_.erase(hash);
   return true;
 }
 
@@ -5,48 +5,123 @@
 #ifndef FALCON_CACHE_FS_H_
 #define FALCON_CACHE_FS_H_
 
+#include <cstdint>
+#include <mutex>
 #include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "cache_backend.h"
+#include "util/bloom_filter.h"
 
 namespace falcon {
 
-class CacheFS {
+/**
+ * Cache entries stored as files in a directory, one file per entry, named
+ * after the entry's hash.
+ *
+ * The list of entries is loaded in memory when the object is created and kept
+ * up to date by writeEntry() and delEntry(), so that looking up an entry never
+ * hits the file system. A bloom filter sits in front of the index so that the
+ * common case, an entry that is not in cache, is answered without even
+ * probing the hash table.
+ *
+ * This class is thread safe. Entries are first written to a temporary file and
+ * renamed once complete so that a reader never sees a partial entry.
+ *
+ * The directory can be shared by several processes, eg the daemons of several
+ * checkouts of the same repository. The rename makes concurrent writes safe,
+ * and a shared cache scans the directory again when it was modified, at most
+ * once every few seconds, to pick up the entries added and removed by the
+ * other processes. Until then, an entry added by another process is missed,
+ * and an entry it removed fails to be read. listEntries() always scans the
+ * directory again.
+ */
+class CacheFS : public ILocalCacheBackend {
  public:
 
-  CacheFS(const std::string& dir);
-
   /**
-   * Write an entry in the cache.
-   * @param hash of the entry.
-   * @param path of the entry.
-   * @return true on sucess, false otherwise.
+   * @param dir    Directory of the entries.
+   * @param shared Whether other processes may add or remove entries.
    */
-  bool writeEntry(const std::string& hash, const std::string& path);
+  CacheFS(const std::string& dir, bool shared);
 
-  /**
-   * Check if the cache contains an entry.
-   * @param hash Hash of the entry.
-   * @return True if the entry exists, false otherwise.
-   */
+  bool writeEntry(const std::string& hash, const std::string& path);
   bool hasEntry(const std::string& hash);
-
-  /**
-   * Query the cache for an entry with the given hash and restore it to the
-   * given path.
-   * @param hash Hash of the entry.
-   * @param path Path where to store the entry.
-   * @return true if the entry was found, false otherwise.
-   */
   bool readEntry(const std::string& hash, const std::string& path);
-
-  /**
-   * Remove the given entry from cache.
-   * @param hash of the entry.
-   * @return true if entry was removed or did not exist, false on error.
-   */
   bool delEntry(const std::string& hash);
+  bool storeEntry(const std::string& hash, const std::string& data);
+  bool loadEntry(const std::string& hash, std::string& data);
+
+  /** Look up all the entries with a single lock. */
+  void hasEntries(const std::vector<std::string>& hashes,
+                  std::vector<bool>& found);
+
+  /** Ask the kernel to read the entries in the page cache. */
+  void prefetchEntries(const std::vector<std::string>& hashes);
+
+  int openEntry(const std::string& hash, uint64_t& offset, uint64_t& length);
+
+  /** The time of the last use of an entry is the modification time of its
+   * file. */
+  void touchEntries(const std::vector<std::string>& hashes);
+  bool getLastUse(const std::string& hash, uint64_t& time);
+
+  /** Path of the file that stores the given entry. The entry may not
+   * exist. */
+  std::string getEntryPath(const std::string& hash) const;
+
+  std::vector<std::string> listEntries();
 
  private:
+  /** Scan dir_ and fill the index with the entries found. */
+  void loadIndex();
+
+  /** For a shared cache, scan dir_ again if it is time to and it was
+   * modified since the last scan. */
+  void refreshIndex();
+
+  /** Add an entry to the index. Grow the bloom filter if needed.
+   * mutex_ must be held. */
+  void addToIndex(const std::string& hash);
+
+  /** Look up an entry in the index. mutex_ must be held. */
+  bool findEntry(const std::string& hash);
+
+  /** Rebuild the bloom filter from index_ with room for at least capacity
+   * entries. */
+  void rebuildFilter(std::size_t capacity);
+
+  /** Create a hidden temporary file in dir_. Return its file descriptor, or
+   * -1 on error. */
+  int createTempFile(std::string& tmp);
+
+  /** Rename a complete temporary file to the entry and add the entry to the
+   * index. The temporary file is removed on error. */
+  bool publishEntry(const std::string& hash, const std::string& tmp);
+
   std::string dir_;
+  bool shared_;
+
+  /** Set of hashes of the entries present in dir_. */
+  std::unordered_set<std::string> index_;
+
+  /** Negative fast path for index_. Entries removed from index_ are not
+   * removed from the filter, it is rebuilt when it grows. */
+  BloomFilter filter_;
+
+  /** Modification time of dir_ when it was last scanned. */
+  uint64_t dirTime_;
+
+  /** When a shared cache last checked if dir_ was modified. 0 at first, so
+   * that the first lookup checks it. */
+  uint64_t refreshTime_;
+
+  /* Protect index_, filter_, dirTime_ and refreshTime_. */
+  std::mutex mutex_;
+
+  CacheFS(const CacheFS& other) = delete;
+  CacheFS& operator=(const CacheFS&) = delete;
 };
 
 } // namespace falcon
@@ -16,9 +16,9 @@
 namespace falcon {
 
 CacheGitDirectory::CacheGitDirectory(const std::string& gitRepository,
-                                     CacheFS cacheFs)
+                                     ActionCache& actionCache)
     : gitRepository_(gitRepository)
-    , cacheFs_(cacheFs) { }
+    , actionCache_(actionCache) { }
 
 bool CacheGitDirectory::checkIsGitRepository() const {
   git_libgit2_init();
@@ -64,24 +64,45 @@ bool CacheGitDirectory::isInRef() const {
   return !currentGitRef_.empty();
 }
 
-void CacheGitDirectory::registerNode(const std::string& hash, Node* node) {
-  auto itRefMap = gitNodeMap_.find(node);
-  if (itRefMap == gitNodeMap_.end()) {
-    auto itInserted = gitNodeMap_.insert(std::make_pair(node, RefMap()));
+void CacheGitDirectory::registerRule(const std::string& hash, Rule* rule) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto itRefMap = gitRuleMap_.find(rule);
+  if (itRefMap == gitRuleMap_.end()) {
+    auto itInserted = gitRuleMap_.insert(std::make_pair(rule, RefMap()));
     itRefMap = itInserted.first;
   }
   registerEntryInRefMap(hash, itRefMap->second);
 }
 
-void CacheGitDirectory::registerRule(const std::string& hash, Rule* rule) {
-  auto itRefMap = gitRuleMap_.find(rule);
-  if (itRefMap == gitRuleMap_.end()) {
-    auto itInserted = gitRuleMap_.insert(std::make_pair(rule, RefMap()));
+void CacheGitDirectory::registerDepfile(const std::string& hash, Rule* rule) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto itRefMap = gitDepfileMap_.find(rule);
+  if (itRefMap == gitDepfileMap_.end()) {
+    auto itInserted = gitDepfileMap_.insert(std::make_pair(rule, RefMap()));
     itRefMap = itInserted.first;
   }
   registerEntryInRefMap(hash, itRefMap->second);
 }
 
+std::vector<std::string> CacheGitDirectory::getRefEntries(
+    const std::string& ref) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<std::string> keys;
+  for (auto it = gitRuleMap_.begin(); it != gitRuleMap_.end(); ++it) {
+    auto itEntry = it->second.find(ref);
+    if (itEntry != it->second.end()) {
+      keys.push_back(itEntry->second->hash);
+    }
+  }
+  for (auto it = gitDepfileMap_.begin(); it != gitDepfileMap_.end(); ++it) {
+    auto itEntry = it->second.find(ref);
+    if (itEntry != it->second.end()) {
+      keys.push_back(itEntry->second->hash);
+    }
+  }
+  return keys;
+}
+
 void CacheGitDirectory::registerEntryInRefMap(const std::string& hash,
                                               RefMap& refMap) {
   assert(isInRef());
@@ -107,7 +128,7 @@ void CacheGitDirectory::registerEntryInRefMap(const std::string& hash,
     prevEntry->numGitRefs--;
     if (prevEntry->numGitRefs == 0 && prevEntry != entry) {
       DLOG(INFO) << "deleting " << prevEntry->hash;
-      cacheFs_.delEntry(prevEntry->hash);
+      actionCache_.delAction(prevEntry->hash);
       gitHashMap_.erase(prevEntry->hash);
       delete prevEntry;
     }
@@ -6,30 +6,32 @@
 #ifndef FALCON_CACHE_GIT_DIRECTORY_H_
 # define FALCON_CACHE_GIT_DIRECTORY_H_
 
+#include <mutex>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
-#include "cache_fs.h"
+#include "action_cache.h"
 
 namespace falcon {
 
-class Node;
 class Rule;
 
 /**
  * Directory of cache entries for a git repository.
  *
  * This class is used when the cache manager uses the CACHE_GIT_REFS policy.
- * It keeps track of cache entries associated to nodes and make sure that for a
- * given node there is only one cache entry per git reference.
+ * It keeps track of the actions cached for each rule and make sure that for a
+ * given rule there is only one action (and one depfile) per git reference.
  *
- * When a cache entry is added for a node, this class checks if there was a
- * previous entry for the same node and the same ref. If it is the case, the
- * previous entry is removed from the cache.
+ * When an action is added for a rule, this class checks if there was a
+ * previous action for the same rule and the same ref. If it is the case, the
+ * previous action is removed from the cache.
  */
 class CacheGitDirectory {
  public:
-  CacheGitDirectory(const std::string& gitRepository, CacheFS cacheFs);
+  CacheGitDirectory(const std::string& gitRepository,
+                    ActionCache& actionCache);
 
   /** Return true if there is a git repository. */
   bool checkIsGitRepository() const;
@@ -41,12 +43,19 @@ class CacheGitDirectory {
    * reference instead of being in a detached state. */
   bool isInRef() const;
 
-  /** Notify that an entry has been saved in cache for the given node. */
-  void registerNode(const std::string& hash, Node* node);
-
-  /** Notify that an entry has been saved in cache for the given rule. */
+  /** Notify that the outputs of the given rule have been saved in cache
+   * under the given action key. */
   void registerRule(const std::string& hash, Rule* rule);
 
+  /** Notify that the depfile of the given rule has been saved in cache under
+   * the given action key. */
+  void registerDepfile(const std::string& hash, Rule* rule);
+
+  /** Return the keys of all the actions, outputs and depfiles, currently
+   * associated with the given git reference. This may be called from another
+   * thread while rules are being registered. */
+  std::vector<std::string> getRefEntries(const std::string& ref);
+
  private:
   std::string gitRepository_;
 
@@ -61,19 +70,23 @@ class CacheGitDirectory {
     unsigned int numGitRefs;
   };
 
-  /* For a given node, map a git ref to a cache entry.
-   * Each node/rule has such a map so that we can track, for each node/rule, the
-   * current cache entry associated with a git reference. */
+  /* For a given rule, map a git ref to a cache entry.
+   * Each rule has such a map for its outputs and one for its depfile so that
+   * we can track the current cache entry associated with a git reference. */
   typedef std::unordered_map<std::string, GitCacheEntry*> RefMap;
-  std::unordered_map<Node*, RefMap> gitNodeMap_;
   std::unordered_map<Rule*, RefMap> gitRuleMap_;
+  std::unordered_map<Rule*, RefMap> gitDepfileMap_;
 
   /* Global map of cache entries, key'ed by hash. */
   std::unordered_map<std::string, GitCacheEntry*> gitHashMap_;
 
+  /* Protect the maps above. */
+  std::mutex mutex_;
+
+  /** mutex_ must be held. */
   void registerEntryInRefMap(const std::string& hash, RefMap& refMap);
 
-  CacheFS cacheFs_;
+  ActionCache& actionCache_;
 };
 
 } // namespace falcon
@@ -0,0 +1,365 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "cache_http.h"
+
+#include "logging.h"
+
+namespace falcon {
+
+/* Maximum number of requests sent before reading the responses. This bounds
+ * the amount of data the server may have to buffer. */
+static const std::size_t kPipelineDepth = 32;
+
+/* Idle connections kept in the pool. */
+static const std::size_t kMaxIdleConnections = 16;
+
+/* Time during which the remote cache is not used after a connection
+ * failure. */
+static const std::chrono::seconds kRetryDelay(10);
+
+/* Timeout of a single read or write on a socket, so that a stuck server does
+ * not stall the build forever. */
+static const int kSocketTimeoutSeconds = 30;
+
+CacheHttp::CacheHttp(const std::string& host, int port,
+                     const std::string& prefix)
+    : host_(host)
+    , port_(port)
+    , prefix_(prefix) {
+  std::ostringstream oss;
+  oss << host << ":" << port;
+  hostHeader_ = oss.str();
+}
+
+CacheHttp::ConnectionPtr CacheHttp::acquire(bool fresh, bool& reused) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (std::chrono::steady_clock::now() < disabledUntil_) {
+      return nullptr;
+    }
+    if (!fresh && !idle_.empty()) {
+      ConnectionPtr conn = std::move(idle_.back());
+      idle_.pop_back();
+      reused = true;
+      return conn;
+    }
+  }
+
+  reused = false;
+  int fd = http::connectTo(host_, port_);
+  if (fd < 0) {
+    LOG(WARNING) << "Could not connect to the remote cache " << hostHeader_
+                 << ", disabling it for " << kRetryDelay.count() << "s";
+    std::lock_guard<std::mutex> lock(mutex_);
+    disabledUntil_ = std::chrono::steady_clock::now() + kRetryDelay;
+    return nullptr;
+  }
+
+  struct timeval tv;
+  tv.tv_sec = kSocketTimeoutSeconds;
+  tv.tv_usec = 0;
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+  return ConnectionPtr(new http::Connection(fd));
+}
+
+void CacheHttp::release(ConnectionPtr conn) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (idle_.size() < kMaxIdleConnections) {
+    idle_.push_back(std::move(conn));
+  }
+}
+
+bool CacheHttp::request(const RequestFn& fn) {
+  bool fresh = false;
+  for (;;) {
+    bool reused;
+    ConnectionPtr conn = acquire(fresh, reused);
+    if (!conn) {
+      return false;
+    }
+
+    bool keepAlive = true;
+    if (fn(*conn, keepAlive)) {
+      if (keepAlive) {
+        release(std::move(conn));
+      }
+      return true;
+    }
+
+    if (!reused) {
+      return false;
+    }
+    /* The connection was probably closed by the server while idle. */
+    fresh = true;
+  }
+}
+
+bool CacheHttp::hasEntry(const std::string& hash) {
+  assert(!hash.empty());
+  std::string req = http::formatRequest("HEAD", prefix_ + hash, hostHeader_, 0);
+
+  bool found = false;
+  bool ok = request([&](http::Connection& conn, bool& keepAlive) {
+    http::Response res;
+    if (!conn.write(req) || !http::readResponse(conn, res)) {
+      return false;
+    }
+    /* The response to a HEAD request has no body, whatever Content-Length
+     * says. */
+    found = res.status == 200;
+    keepAlive = res.keepAlive;
+    return true;
+  });
+
+  return ok && found;
+}
+
+bool CacheHttp::receiveEntry(http::Connection& conn,
+                             const http::Response& res,
+                             const std::string& path, bool& found) {
+  found = false;
+  if (res.status != 200) {
+    return conn.skipBody(res.contentLength);
+  }
+
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0) {
+    LOG(ERROR) << "Could not open " << path << ": " << strerror(errno);
+    return conn.skipBody(res.contentLength);
+  }
+  bool done = conn.readBody(res.contentLength, fd);
+  close(fd);
+  if (!done) {
+    unlink(path.c_str());
+    return false;
+  }
+  found = true;
+  return true;
+}
+
+bool CacheHttp::readEntry(const std::string& hash, const std::string& path) {
+  assert(!hash.empty());
+  std::string req = http::formatRequest("GET", prefix_ + hash, hostHeader_, 0);
+
+  bool found = false;
+  bool ok = request([&](http::Connection& conn, bool& keepAlive) {
+    http::Response res;
+    if (!conn.write(req) || !http::readResponse(conn, res)) {
+      return false;
+    }
+    keepAlive = res.keepAlive;
+    return receiveEntry(conn, res, path, found);
+  });
+
+  return ok && found;
+}
+
+void CacheHttp::hasEntries(const std::vector<std::string>& hashes,
+                           std::vector<bool>& found) {
+  found.assign(hashes.size(), false);
+
+  for (std::size_t start = 0; start < hashes.size(); start += kPipelineDepth) {
+    std::size_t end = std::min(hashes.size(), start + kPipelineDepth);
+
+    std::string req;
+    for (std::size_t i = start; i < end; i++) {
+      req += http::formatRequest("HEAD", prefix_ + hashes[i], hostHeader_, 0);
+    }
+
+    bool ok = request([&](http::Connection& conn, bool& keepAlive) {
+      if (!conn.write(req)) {
+        return false;
+      }
+      for (std::size_t i = start; i < end; i++) {
+        http::Response res;
+        if (!http::readResponse(conn, res)) {
+          return false;
+        }
+        found[i] = res.status == 200;
+        keepAlive = res.keepAlive;
+      }
+      return true;
+    });
+
+    if (!ok) {
+      /* Treat the entries we could not check as missing. The remote cache is
+       * probably unreachable, don't bother with the rest of the batch. */
+      std::fill(found.begin() + start, found.end(), false);
+      return;
+    }
+  }
+}
+
+void CacheHttp::readEntries(const std::vector<std::string>& hashes,
+                            const std::vector<std::string>& paths,
+                            std::vector<bool>& restored) {
+  assert(hashes.size() == paths.size());
+  restored.assign(hashes.size(), false);
+
+  for (std::size_t start = 0; start < hashes.size(); start += kPipelineDepth) {
+    std::size_t end = std::min(hashes.size(), start + kPipelineDepth);
+
+    std::string req;
+    for (std::size_t i = start; i < end; i++) {
+      req += http::formatRequest("GET", prefix_ + hashes[i], hostHeader_, 0);
+    }
+
+    bool ok = request([&](http::Connection& conn, bool& keepAlive) {
+      if (!conn.write(req)) {
+        return false;
+      }
+      for (std::size_t i = start; i < end; i++) {
+        http::Response res;
+        bool found;
+        if (!http::readResponse(conn, res)
+            || !receiveEntry(conn, res, paths[i], found)) {
+          return false;
+        }
+        restored[i] = found;
+        keepAlive = res.keepAlive;
+      }
+      return true;
+    });
+
+    if (!ok) {
+      std::fill(restored.begin() + start, restored.end(), false);
+      return;
+    }
+  }
+}
+
+bool CacheHttp::writeEntry(const std::string& hash, const std::string& path) {
+  assert(!hash.empty());
+
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    LOG(ERROR) << "Could not open " << path << ": " << strerror(errno);
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    LOG(ERROR) << "Could not stat " << path << ": " << strerror(errno);
+    close(fd);
+    return false;
+  }
+  std::string req = http::formatRequest("PUT", prefix_ + hash, hostHeader_,
+                                        st.st_size);
+
+  bool stored = false;
+  bool ok = request([&](http::Connection& conn, bool& keepAlive) {
+    http::Response res;
+    if (!conn.write(req) || !conn.writeFile(fd, 0, st.st_size)
+        || !http::readResponse(conn, res)) {
+      return false;
+    }
+    keepAlive = res.keepAlive;
+    stored = res.status == 200 || res.status == 201;
+    return conn.skipBody(res.contentLength);
+  });
+  close(fd);
+
+  if (ok && !stored) {
+    LOG(WARNING) << "The remote cache refused " << path;
+  }
+  return ok && stored;
+}
+
+bool CacheHttp::storeEntry(const std::string& hash, const std::string& data) {
+  assert(!hash.empty());
+  std::string req = http::formatRequest("PUT", prefix_ + hash, hostHeader_,
+                                        data.size()) + data;
+
+  bool stored = false;
+  bool ok = request([&](http::Connection& conn, bool& keepAlive) {
+    http::Response res;
+    if (!conn.write(req) || !http::readResponse(conn, res)) {
+      return false;
+    }
+    keepAlive = res.keepAlive;
+    stored = res.status == 200 || res.status == 201;
+    return conn.skipBody(res.contentLength);
+  });
+
+  return ok && stored;
+}
+
+bool CacheHttp::loadEntry(const std::string& hash, std::string& data) {
+  std::vector<std::string> hashes(1, hash);
+  std::vector<std::string> results;
+  std::vector<bool> found;
+  loadEntries(hashes, results, found);
+  if (!found[0]) {
+    return false;
+  }
+  data.swap(results[0]);
+  return true;
+}
+
+void CacheHttp::loadEntries(const std::vector<std::string>& hashes,
+                            std::vector<std::string>& data,
+                            std::vector<bool>& found) {
+  data.assign(hashes.size(), std::string());
+  found.assign(hashes.size(), false);
+
+  for (std::size_t start = 0; start < hashes.size(); start += kPipelineDepth) {
+    std::size_t end = std::min(hashes.size(), start + kPipelineDepth);
+
+    std::string req;
+    for (std::size_t i = start; i < end; i++) {
+      req += http::formatRequest("GET", prefix_ + hashes[i], hostHeader_, 0);
+    }
+
+    bool ok = request([&](http::Connection& conn, bool& keepAlive) {
+      if (!conn.write(req)) {
+        return false;
+      }
+      for (std::size_t i = start; i < end; i++) {
+        http::Response res;
+        if (!http::readResponse(conn, res)) {
+          return false;
+        }
+        keepAlive = res.keepAlive;
+        if (res.status != 200) {
+          found[i] = false;
+          if (!conn.skipBody(res.contentLength)) {
+            return false;
+          }
+          continue;
+        }
+        if (!conn.readBody(res.contentLength, data[i])) {
+          return false;
+        }
+        found[i] = true;
+      }
+      return true;
+    });
+
+    if (!ok) {
+      std::fill(found.begin() + start, found.end(), false);
+      return;
+    }
+  }
+}
+
+bool CacheHttp::delEntry(const std::string& hash) {
+  return true;
+}
+
+} // namespace falcon
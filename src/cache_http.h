@@ -0,0 +1,113 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#ifndef FALCON_CACHE_HTTP_H_
+#define FALCON_CACHE_HTTP_H_
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "cache_backend.h"
+#include "util/http.h"
+
+namespace falcon {
+
+/**
+ * Cache entries stored on a remote HTTP server. See util/http.h for the
+ * protocol, falcon-cache-server is a reference implementation of the server.
+ * The server may hold several stores, each one under its own path prefix.
+ *
+ * Connections are kept alive and reused between requests. Several threads can
+ * use the cache concurrently, each request takes a connection from the pool
+ * or opens a new one.
+ *
+ * If the server cannot be reached, the remote cache is disabled for a few
+ * seconds so that a build does not pay for a connection attempt per entry.
+ */
+class CacheHttp : public ICacheBackend {
+ public:
+  /**
+   * @param host   Host of the server.
+   * @param port   Port of the server.
+   * @param prefix Path of the store on the server, eg "/cas/".
+   */
+  CacheHttp(const std::string& host, int port, const std::string& prefix);
+
+  bool writeEntry(const std::string& hash, const std::string& path);
+  bool hasEntry(const std::string& hash);
+  bool readEntry(const std::string& hash, const std::string& path);
+
+  /** Entries are shared with other users of the server, they are never
+   * removed from here. Always return true. */
+  bool delEntry(const std::string& hash);
+  bool storeEntry(const std::string& hash, const std::string& data);
+  bool loadEntry(const std::string& hash, std::string& data);
+
+  /** Pipeline the HEAD requests: the whole batch costs about one round trip
+   * per kPipelineDepth entries instead of one per entry. */
+  void hasEntries(const std::vector<std::string>& hashes,
+                  std::vector<bool>& found);
+
+  /** Pipeline the GET requests. */
+  void readEntries(const std::vector<std::string>& hashes,
+                   const std::vector<std::string>& paths,
+                   std::vector<bool>& restored);
+  void loadEntries(const std::vector<std::string>& hashes,
+                   std::vector<std::string>& data,
+                   std::vector<bool>& found);
+
+ private:
+  typedef std::unique_ptr<http::Connection> ConnectionPtr;
+
+  /**
+   * Function that performs a request on a connection.
+   * Return false if the connection failed. keepAlive must be set to false if
+   * the connection cannot be reused.
+   */
+  typedef std::function<bool(http::Connection& conn, bool& keepAlive)>
+    RequestFn;
+
+  /**
+   * Run a request. A request that fails on a connection taken from the pool
+   * is retried once on a fresh connection: the server may have closed an idle
+   * connection.
+   * @return false if the request could not be performed.
+   */
+  bool request(const RequestFn& fn);
+
+  /** Take an idle connection from the pool, or open a new one if fresh is
+   * true or the pool is empty. Return nullptr on error. */
+  ConnectionPtr acquire(bool fresh, bool& reused);
+
+  /** Put a connection back in the pool. */
+  void release(ConnectionPtr conn);
+
+  /** Read the body of a GET response into a file. Consume the body even if
+   * the file cannot be written so that the connection can be reused.
+   * @return false if the connection failed. */
+  bool receiveEntry(http::Connection& conn, const http::Response& res,
+                    const std::string& path, bool& found);
+
+  std::string host_;
+  int port_;
+  std::string prefix_;
+  /* Value of the Host header. */
+  std::string hostHeader_;
+
+  std::mutex mutex_;
+  std::vector<ConnectionPtr> idle_;
+  std::chrono::steady_clock::time_point disabledUntil_;
+
+  CacheHttp(const CacheHttp& other) = delete;
+  CacheHttp& operator=(const CacheHttp&) = delete;
+};
+
+} // namespace falcon
+
+#endif // FALCON_CACHE_HTTP_H_
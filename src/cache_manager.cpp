@@ -3,14 +3,21 @@
  * LICENSE : see accompanying LICENSE file for details.
  */
 
+#include <algorithm>
 #include <cassert>
-#include <fstream>
+#include <cerrno>
+#include <functional>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <stdio.h>
+#include <unordered_set>
+#include <unistd.h>
 
 #include "cache_manager.h"
 
+#include "cache_http.h"
+#include "cache_memory.h"
+#include "cache_tiered.h"
 #include "exceptions.h"
 #include "fs.h"
 #include "graph.h"
@@ -18,32 +25,244 @@
 
 namespace falcon {
 
+/* Number of threads saving actions in cache, and number of actions that can be
+ * pending before saveRule() blocks. */
+static const std::size_t kNumWriterThreads = 2;
+static const std::size_t kMaxPendingWrites = 256;
+
+/* Number of threads restoring entries from the cache. Restoring is bound by
+ * I/O, so use more threads than we have cpus. */
+static const std::size_t kNumIOThreads = 8;
+
+/* Entries smaller than that are stored in packfiles rather than in their own
+ * file. */
+static const std::size_t kPackThreshold = 16 << 10;
+
+/* Put a remote store behind a local one: the remote cache server if there is
+ * one, else the cache of the peer daemon, read-only. Return nullptr if there
+ * is neither. */
+static std::unique_ptr<ICacheBackend> makeRemoteTier(ILocalCacheBackend& local,
+                                                     const std::string& remote,
+                                                     const std::string& peer,
+                                                     const std::string& prefix) {
+  std::string host;
+  int port;
+  bool readOnly = remote.empty();
+  const std::string& address = readOnly ? peer : remote;
+  if (address.empty() || !http::parseHostPort(address, host, port)) {
+    return nullptr;
+  }
+  std::unique_ptr<ICacheBackend> remoteCache(new CacheHttp(host, port, prefix));
+  /* The blobs are stored under the digest of their content. */
+  bool verify = prefix == "/cas/";
+  return std::unique_ptr<ICacheBackend>(
+      new CacheTiered(local, std::move(remoteCache), readOnly, verify));
+}
+
+/* Put a memory tier in front of a local store. Return nullptr if it is
+ * disabled. */
+static std::unique_ptr<CacheMemory> makeMemoryTier(ILocalCacheBackend& local,
+                                                   std::size_t maxBytes) {
+  if (maxBytes == 0) {
+    return nullptr;
+  }
+  return std::unique_ptr<CacheMemory>(
+      new CacheMemory(local, maxBytes, kPackThreshold));
+}
+
+/* Directory of the entries stored one per file. */
+static std::string cacheDirectory(const std::string& falconDir,
+                                  const std::string& sharedDir) {
+  return sharedDir.empty() ? falconDir + "/cache" : sharedDir;
+}
+
 CacheManager::CacheManager(const std::string& workingDirectory,
-                           const std::string& falconDir)
+                           const std::string& falconDir,
+                           const std::string& sharedDir,
+                           const std::string& remote,
+                           const std::string& peer,
+                           std::size_t memoryCacheSize)
     : workingDirectory_(workingDirectory)
-    , cacheFs_(falconDir + "/cache")
-    , gitDirectory_(workingDirectory, cacheFs_) {
+    , actionFs_(cacheDirectory(falconDir, sharedDir) + "/ac",
+                !sharedDir.empty())
+    , blobFs_(cacheDirectory(falconDir, sharedDir) + "/cas",
+              !sharedDir.empty())
+    , actionPack_(falconDir + "/cache/ac-pack", actionFs_,
+                  sharedDir.empty() ? kPackThreshold : 0)
+    , blobPack_(falconDir + "/cache/cas-pack", blobFs_,
+                sharedDir.empty() ? kPackThreshold : 0)
+    , blobMemory_(makeMemoryTier(blobPack_, memoryCacheSize))
+    , localBlobs_(blobMemory_ ? static_cast<ILocalCacheBackend&>(*blobMemory_)
+                              : blobPack_)
+    , remoteActions_(makeRemoteTier(actionPack_, remote, peer, "/ac/"))
+    , remoteBlobs_(makeRemoteTier(localBlobs_, remote, peer, "/cas/"))
+    , actionCache_(actionPack_, localBlobs_,
+                   remoteActions_ ? *remoteActions_ : actionPack_,
+                   remoteBlobs_ ? *remoteBlobs_ : localBlobs_,
+                   sharedDir.empty() ? "" : sharedDir + "/lock")
+    , gitDirectory_(workingDirectory, actionCache_)
+    , writer_(kNumWriterThreads, kMaxPendingWrites)
+    , io_(kNumIOThreads, 0) {
 
   /* If we find a git repository, automatically use the CACHE_GIT_REFS
    * policy. */
   if (gitDirectory_.checkIsGitRepository()) {
     policy_ = Policy::CACHE_GIT_REFS;
+    headWatcher_.reset(new GitHeadWatcher(workingDirectory + "/.git",
+        std::bind(&CacheManager::prefetchRef, this, std::placeholders::_1)));
+    headWatcher_->start();
   } else {
     policy_ = Policy::CACHE_EVERYTHING;
   }
+
+  if (!sharedDir.empty()) {
+    LOG(INFO) << "Using shared cache " << sharedDir;
+  }
+  if (remoteActions_ && !remote.empty()) {
+    LOG(INFO) << "Using remote cache " << remote;
+  } else if (remoteActions_) {
+    LOG(INFO) << "Using the cache of the peer daemon " << peer;
+  } else if (!remote.empty() || !peer.empty()) {
+    LOG(ERROR) << "Invalid remote cache address '" << remote << peer
+               << "', expected host:port";
+  }
+  if (!remote.empty() && !peer.empty()) {
+    LOG(WARNING) << "Both a remote cache and a peer daemon are configured, "
+                 << "ignoring the peer daemon";
+  }
+}
+
+CacheManager::~CacheManager() {
+  stopServer();
 }
 
-bool CacheManager::saveNode(Node* node) {
-  if (!cacheFs_.writeEntry(node->getHash(), node->getPath())) {
-    LOG(ERROR) << "could not save " << node->getPath() << " in cache";
+bool CacheManager::startServer(int port) {
+  assert(!server_);
+  try {
+    server_.reset(new CacheServer(port, actionPack_, localBlobs_));
+  } catch (Exception& e) {
+    LOG(ERROR) << "Could not serve the cache on port " << port << ": "
+               << e.getErrorMessage();
     return false;
   }
+  serverThread_ = std::thread(&CacheServer::run, server_.get());
+  return true;
+}
 
-  if (policy_ == Policy::CACHE_GIT_REFS) {
-    gitDirectory_.registerNode(node->getHash(), node);
+void CacheManager::stopServer() {
+  if (!server_) {
+    return;
   }
+  server_->stop();
+  serverThread_.join();
+  server_.reset();
+}
 
-  return true;
+const char* CacheManager::toString(Policy policy) {
+  switch (policy) {
+    case Policy::CACHE_NOTHING: return "nothing";
+    case Policy::CACHE_EVERYTHING: return "everything";
+    case Policy::CACHE_GIT_REFS: return "git_refs";
+  }
+  return "unknown";
+}
+
+uint64_t CacheManager::restoredBytes(const std::vector<std::string>& paths,
+                                     const std::vector<bool>& restored) {
+  uint64_t bytes = 0;
+  for (std::size_t i = 0; i < paths.size(); i++) {
+    struct stat st;
+    if (restored[i] && stat(paths[i].c_str(), &st) == 0) {
+      bytes += st.st_size;
+    }
+  }
+  return bytes;
+}
+
+void CacheManager::record(CacheStats::Op op, uint64_t hits, uint64_t misses,
+                          uint64_t bytes,
+                          CacheStats::Clock::time_point start) {
+  stats_.record(toString(policy_), op, hits, misses, bytes, start);
+}
+
+std::string CacheManager::depfileKey(Rule* rule) {
+  /* The depfile hash of a rule with no implicit dependencies may be equal to
+   * its hash, make sure the keys differ. */
+  return rule->getHashDepfile() + ".d";
+}
+
+void CacheManager::queueSave(const std::string& key,
+                             const std::vector<std::string>& paths,
+                             const std::vector<std::string>& digests,
+                             std::vector<uint64_t> mtimes) {
+  /* The files may be modified before the task runs, by the next rule or by
+   * the user: remember their modification time, so that the writer does not
+   * store their new content under the key of the rule. */
+  for (std::size_t i = 0; i < paths.size(); i++) {
+    if (digests[i].empty()) {
+      fs::getModificationTime(paths[i], mtimes[i]);
+    }
+  }
+
+  /* Capture copies of the strings: the rule may be modified or deleted by the
+   * time the task runs. The policy is the one of the build that queued the
+   * save. */
+  ActionCache& actionCache = actionCache_;
+  CacheStats& stats = stats_;
+  std::string policy = toString(policy_);
+  writer_.submit([&actionCache, &stats, policy, key, paths, digests,
+                  mtimes]() {
+    auto start = CacheStats::Clock::now();
+    bool saved = actionCache.saveAction(key, paths, digests, mtimes);
+    if (!saved) {
+      LOG(ERROR) << "could not save action " << key;
+    }
+    uint64_t bytes = saved
+      ? restoredBytes(paths, std::vector<bool>(paths.size(), true)) : 0;
+    stats.record(policy, CacheStats::Op::SAVE_RULE, saved, !saved, bytes,
+                 start);
+  });
+}
+
+void CacheManager::prefetchRef(const std::string& ref) {
+  if (policy_ != Policy::CACHE_GIT_REFS) {
+    return;
+  }
+  std::vector<std::string> keys = gitDirectory_.getRefEntries(ref);
+  if (keys.empty()) {
+    return;
+  }
+
+  std::vector<ActionCache::Manifest> manifests;
+  std::vector<bool> found;
+  actionCache_.getManifests(keys, manifests, found);
+
+  /* Many actions share blobs, prefetch each one once. */
+  std::unordered_set<std::string> seen;
+  std::vector<std::string> digests;
+  for (std::size_t i = 0; i < keys.size(); i++) {
+    if (!found[i]) {
+      continue;
+    }
+    for (auto it = manifests[i].begin(); it != manifests[i].end(); ++it) {
+      if (seen.insert(it->second).second) {
+        digests.push_back(it->second);
+      }
+    }
+  }
+  actionCache_.blobs().prefetchEntries(digests);
+
+  LOG(INFO) << "Prefetched " << digests.size() << " cache entries for "
+            << ref;
+}
+
+void CacheManager::flush() {
+  writer_.wait();
+  auto start = CacheStats::Clock::now();
+  actionCache_.collectGarbage();
+  actionPack_.compact();
+  blobPack_.compact();
+  record(CacheStats::Op::COLLECT_GARBAGE, 0, 0, 0, start);
 }
 
 void CacheManager::saveRule(Rule *rule) {
@@ -57,69 +276,374 @@ void CacheManager::saveRule(Rule *rule) {
     return;
   }
 
-  /* Save all the outputs. */
+  /* Save all the outputs, with the digests the builder computed. */
+  std::vector<std::string> paths;
+  std::vector<std::string> digests;
+  std::vector<uint64_t> mtimes;
   auto& outputs = rule->getOutputs();
   for (auto it = outputs.begin(); it != outputs.end(); it++) {
-    if (!saveNode(*it)) {
-      LOG(ERROR) << "could not save " << (*it)->getPath() << " in cache";
-    }
+    paths.push_back((*it)->getPath());
+    digests.push_back((*it)->getContentDigest());
+    mtimes.push_back((*it)->getContentMtime());
+  }
+  queueSave(rule->getHash(), paths, digests, mtimes);
+
+  if (policy_ == Policy::CACHE_GIT_REFS) {
+    gitDirectory_.registerRule(rule->getHash(), rule);
   }
 
   /* Save the depfile. */
   if (rule->hasDepfile()) {
-    if (!cacheFs_.writeEntry(rule->getHashDepfile(), rule->getDepfile())) {
-      LOG(ERROR) << "could not save " << rule->getDepfile() << " to "
-        << rule->getHashDepfile() << std::endl;
+    std::string key = depfileKey(rule);
+    queueSave(key, std::vector<std::string>(1, rule->getDepfile()),
+              std::vector<std::string>(1, ""), std::vector<uint64_t>(1, 0));
+    if (policy_ == Policy::CACHE_GIT_REFS) {
+      gitDirectory_.registerDepfile(key, rule);
     }
   }
+}
 
-  if (policy_ == Policy::CACHE_GIT_REFS) {
-    gitDirectory_.registerRule(rule->getHashDepfile(), rule);
+void CacheManager::hasEntries(const std::vector<std::string>& hashes,
+                              std::vector<bool>& found) {
+  actionCache_.blobs().hasEntries(hashes, found);
+}
+
+void CacheManager::restoreEntries(const std::vector<std::string>& hashes,
+                                  const std::vector<std::string>& paths,
+                                  std::vector<bool>& restored) {
+  assert(hashes.size() == paths.size());
+  restored.assign(hashes.size(), false);
+  if (hashes.empty()) {
+    return;
+  }
+
+  /* Give each I/O thread a contiguous share of the batch. Each share is
+   * handed to the backend in one call so that it can batch the requests
+   * (pipelining for the remote cache) while the threads overlap the copies.
+   * Each task writes its own result vector. */
+  std::size_t numShards = std::min(hashes.size(), io_.numThreads());
+  std::vector<std::vector<bool>> results(numShards);
+  ICacheBackend& backend = actionCache_.blobs();
+  for (std::size_t i = 0; i < numShards; i++) {
+    std::size_t begin = hashes.size() * i / numShards;
+    std::size_t end = hashes.size() * (i + 1) / numShards;
+    std::vector<std::string> shardHashes(hashes.begin() + begin,
+                                         hashes.begin() + end);
+    std::vector<std::string> shardPaths(paths.begin() + begin,
+                                        paths.begin() + end);
+    std::vector<bool>* result = &results[i];
+    io_.submit([&backend, shardHashes, shardPaths, result]() {
+      for (auto it = shardPaths.begin(); it != shardPaths.end(); ++it) {
+        if (!fs::createPath(*it)) {
+          LOG(ERROR) << "could not create path " << *it;
+        }
+      }
+      backend.readEntries(shardHashes, shardPaths, *result);
+    });
+  }
+  io_.wait();
+
+  std::size_t k = 0;
+  for (std::size_t i = 0; i < numShards; i++) {
+    for (std::size_t j = 0; j < results[i].size(); j++) {
+      restored[k++] = results[i][j];
+    }
   }
 }
 
-bool CacheManager::restoreNode(Node* node) {
-  if (!cacheFs_.hasEntry(node->getHash())) {
-    return false;
+void CacheManager::lookupNodes(const NodeArray& nodes,
+                               std::vector<std::string>& digests,
+                               std::vector<bool>& found) {
+  digests.assign(nodes.size(), std::string());
+  found.assign(nodes.size(), false);
+
+  /* Several nodes may be produced by the same rule, only look up its manifest
+   * once. */
+  std::vector<std::string> keys;
+  std::unordered_map<std::string, std::size_t> keyIndex;
+  for (auto it = nodes.begin(); it != nodes.end(); ++it) {
+    Rule* rule = (*it)->getChild();
+    if (rule && !rule->isPhony()
+        && keyIndex.find(rule->getHash()) == keyIndex.end()) {
+      keyIndex[rule->getHash()] = keys.size();
+      keys.push_back(rule->getHash());
+    }
   }
-  if (policy_ == Policy::CACHE_GIT_REFS) {
-    gitDirectory_.registerNode(node->getHash(), node);
+
+  std::vector<ActionCache::Manifest> manifests;
+  std::vector<bool> manifestFound;
+  actionCache_.getManifests(keys, manifests, manifestFound);
+
+  for (std::size_t i = 0; i < nodes.size(); i++) {
+    Rule* rule = nodes[i]->getChild();
+    if (!rule || rule->isPhony()) {
+      continue;
+    }
+    std::size_t k = keyIndex[rule->getHash()];
+    if (!manifestFound[k]) {
+      continue;
+    }
+    auto it = manifests[k].find(nodes[i]->getPath());
+    if (it != manifests[k].end()) {
+      digests[i] = it->second;
+      found[i] = true;
+    }
   }
-  return cacheFs_.readEntry(node->getHash(), node->getPath());
 }
 
-bool CacheManager::restoreRule(Rule *rule) {
-  if (rule->isPhony()) {
-    return false;
+void CacheManager::hasNodes(const NodeArray& nodes, std::vector<bool>& found) {
+  std::vector<std::string> digests;
+  lookupNodes(nodes, digests, found);
+}
+
+void CacheManager::deferNodes(const NodeArray& nodes,
+                              std::vector<bool>& deferred) {
+  auto start = CacheStats::Clock::now();
+  std::vector<std::string> digests;
+  std::vector<bool> found;
+  lookupNodes(nodes, digests, found);
+
+  deferred.assign(nodes.size(), false);
+  std::size_t numDeferred = 0;
+  bool registerInRef = policy_ == Policy::CACHE_GIT_REFS
+    && gitDirectory_.isInRef();
+  for (std::size_t i = 0; i < nodes.size(); i++) {
+    if (!found[i]) {
+      continue;
+    }
+    Node* node = nodes[i];
+    /* Don't leave a stale version of the file around until it is
+     * materialized. */
+    if (unlink(node->getPath().c_str()) < 0 && errno != ENOENT) {
+      LOG(ERROR) << "could not remove " << node->getPath();
+      continue;
+    }
+    node->setDeferredDigest(digests[i]);
+    deferred[i] = true;
+    numDeferred++;
+    if (registerInRef) {
+      /* Keep the action of the rule, and thus the blob, for the current
+       * ref. */
+      gitDirectory_.registerRule(node->getChild()->getHash(),
+                                 node->getChild());
+    }
   }
+  record(CacheStats::Op::RESTORE_NODE, numDeferred,
+         nodes.size() - numDeferred, 0, start);
+}
 
-  /* Check we have all the outputs in cache. */
-  auto& outputs = rule->getOutputs();
-  for (auto it = outputs.begin(); it != outputs.end(); it++) {
-    if (!cacheFs_.hasEntry((*it)->getHash())) {
-      return false;
+void CacheManager::materializeNodes(const NodeArray& nodes,
+                                    std::vector<bool>& restored) {
+  auto start = CacheStats::Clock::now();
+  std::vector<std::string> hashes;
+  std::vector<std::string> paths;
+  for (auto it = nodes.begin(); it != nodes.end(); ++it) {
+    assert((*it)->isDeferred());
+    hashes.push_back((*it)->getDeferredDigest());
+    paths.push_back((*it)->getPath());
+  }
+
+  restoreEntries(hashes, paths, restored);
+
+  std::size_t numFailed = 0;
+  for (std::size_t i = 0; i < nodes.size(); i++) {
+    if (restored[i]) {
+      nodes[i]->setDeferredDigest("");
+      /* See LazyCache::onNodeRestored. */
+      nodes[i]->setTimestamp(time(NULL));
+    } else {
+      numFailed++;
     }
-    if (policy_ == Policy::CACHE_GIT_REFS) {
-      gitDirectory_.registerNode((*it)->getHash(), *it);
+  }
+  /* The hits were counted by deferNodes(). */
+  record(CacheStats::Op::RESTORE_NODE, 0, numFailed,
+         restoredBytes(paths, restored), start);
+}
+
+void CacheManager::restoreNodes(const NodeArray& nodes,
+                                std::vector<bool>& restored) {
+  auto start = CacheStats::Clock::now();
+  std::vector<std::string> digests;
+  std::vector<bool> found;
+  lookupNodes(nodes, digests, found);
+
+  std::vector<std::string> hashes;
+  std::vector<std::string> paths;
+  std::vector<std::size_t> index;
+  for (std::size_t i = 0; i < nodes.size(); i++) {
+    if (found[i]) {
+      hashes.push_back(digests[i]);
+      paths.push_back(nodes[i]->getPath());
+      index.push_back(i);
     }
   }
 
-  if (policy_ == Policy::CACHE_GIT_REFS) {
-    gitDirectory_.registerRule(rule->getHashDepfile(), rule);
+  std::vector<bool> blobRestored;
+  restoreEntries(hashes, paths, blobRestored);
+
+  restored.assign(nodes.size(), false);
+  bool registerInRef = policy_ == Policy::CACHE_GIT_REFS
+    && gitDirectory_.isInRef();
+  std::size_t numRestored = 0;
+  for (std::size_t i = 0; i < index.size(); i++) {
+    if (!blobRestored[i]) {
+      continue;
+    }
+    Node* node = nodes[index[i]];
+    restored[index[i]] = true;
+    numRestored++;
+    if (registerInRef) {
+      /* Keep the action of the rule for the current ref. */
+      gitDirectory_.registerRule(node->getChild()->getHash(),
+                                 node->getChild());
+    }
+  }
+  record(CacheStats::Op::RESTORE_NODE, numRestored,
+         nodes.size() - numRestored, restoredBytes(paths, blobRestored),
+         start);
+}
+
+bool CacheManager::restoreNode(Node* node) {
+  std::vector<Node*> nodes(1, node);
+  std::vector<bool> restored;
+  restoreNodes(nodes, restored);
+  return restored[0];
+}
+
+bool CacheManager::restoreRule(Rule *rule) {
+  std::vector<Rule*> rules(1, rule);
+  std::vector<bool> restored;
+  restoreRules(rules, restored);
+  return restored[0];
+}
+
+void CacheManager::restoreRules(const std::vector<Rule*>& rules,
+                                std::vector<bool>& restored) {
+  auto start = CacheStats::Clock::now();
+  restored.assign(rules.size(), false);
+
+  /* Look up the manifests of all the rules in one batch. */
+  std::vector<std::string> keys;
+  for (auto it = rules.begin(); it != rules.end(); ++it) {
+    keys.push_back((*it)->getHash());
   }
+  std::vector<ActionCache::Manifest> manifests;
+  std::vector<bool> found;
+  actionCache_.getManifests(keys, manifests, found);
 
-  /* Retrieve all the outputs. */
-  for (auto it = outputs.begin(); it != outputs.end(); it++) {
-    if (!cacheFs_.readEntry((*it)->getHash(), (*it)->getPath())) {
-      return false;
+  bool registerInRef = policy_ == Policy::CACHE_GIT_REFS
+    && gitDirectory_.isInRef();
+
+  /* Only restore the rules whose manifest has all the outputs. first[i] is
+   * the index of the first output of rules[i] in the batch to be restored, or
+   * -1 if the rule is not restored. */
+  std::vector<std::string> hashes;
+  std::vector<std::string> paths;
+  std::vector<long> first(rules.size(), -1);
+  for (std::size_t i = 0; i < rules.size(); i++) {
+    Rule* rule = rules[i];
+    if (rule->isPhony() || !found[i]) {
+      continue;
+    }
+    auto& outputs = rule->getOutputs();
+    std::vector<std::string> digests;
+    for (auto it = outputs.begin(); it != outputs.end(); ++it) {
+      auto itDigest = manifests[i].find((*it)->getPath());
+      if (itDigest == manifests[i].end()) {
+        break;
+      }
+      digests.push_back(itDigest->second);
+    }
+    if (digests.size() != outputs.size()) {
+      continue;
+    }
+
+    first[i] = hashes.size();
+    for (std::size_t j = 0; j < outputs.size(); j++) {
+      hashes.push_back(digests[j]);
+      paths.push_back(outputs[j]->getPath());
     }
   }
 
-  return true;
+  /* Retrieve all the outputs. */
+  std::vector<bool> outputRestored;
+  restoreEntries(hashes, paths, outputRestored);
+
+  std::size_t numRestored = 0;
+  for (std::size_t i = 0; i < rules.size(); i++) {
+    if (first[i] < 0) {
+      continue;
+    }
+    std::size_t numOutputs = rules[i]->getOutputs().size();
+    bool complete = true;
+    for (std::size_t j = 0; j < numOutputs; j++) {
+      complete = complete && outputRestored[first[i] + j];
+    }
+    restored[i] = complete;
+    numRestored += complete;
+    if (complete && registerInRef) {
+      /* Keep the action of the rule for the current ref, as saveRule()
+       * does. */
+      gitDirectory_.registerRule(rules[i]->getHash(), rules[i]);
+    }
+  }
+  record(CacheStats::Op::RESTORE_RULE, numRestored,
+         rules.size() - numRestored, restoredBytes(paths, outputRestored),
+         start);
 }
 
 bool CacheManager::restoreDepfile(Rule* rule) {
-  return cacheFs_.readEntry(rule->getHashDepfile(), rule->getDepfile());
+  auto start = CacheStats::Clock::now();
+  std::vector<std::string> keys(1, depfileKey(rule));
+  std::vector<ActionCache::Manifest> manifests;
+  std::vector<bool> found;
+  actionCache_.getManifests(keys, manifests, found);
+
+  bool restored = false;
+  if (found[0]) {
+    auto it = manifests[0].find(rule->getDepfile());
+    restored = it != manifests[0].end()
+      && actionCache_.blobs().readEntry(it->second, rule->getDepfile());
+  }
+
+  std::vector<std::string> paths(1, rule->getDepfile());
+  record(CacheStats::Op::RESTORE_DEPFILE, restored, !restored,
+         restoredBytes(paths, std::vector<bool>(1, restored)), start);
+  return restored;
+}
+
+bool CacheManager::exportBundle(const NodeSet& targets, const std::string& path,
+                                bundle::Summary& summary) {
+  /* Collect the actions of all the rules below the targets. */
+  std::vector<std::string> keys;
+  std::set<Rule*> seen;
+  NodeArray stack(targets.begin(), targets.end());
+  while (!stack.empty()) {
+    Node* node = stack.back();
+    stack.pop_back();
+    Rule* rule = node->getChild();
+    if (!rule || !seen.insert(rule).second) {
+      continue;
+    }
+    if (!rule->isPhony()) {
+      keys.push_back(rule->getHash());
+      if (rule->hasDepfile()) {
+        keys.push_back(depfileKey(rule));
+      }
+    }
+    auto& inputs = rule->getInputs();
+    stack.insert(stack.end(), inputs.begin(), inputs.end());
+  }
+
+  return bundle::exportActions(path, keys, actionCache_, summary);
+}
+
+bool CacheManager::importBundle(const std::string& path,
+                                bundle::Summary& summary) {
+  /* Import in the local stores directly, the entries don't need to go to the
+   * memory tier or to the remote cache. */
+  return bundle::importActions(path, actionPack_, blobPack_, io_.numThreads(),
+                               summary);
 }
 
 } // namespace falcon
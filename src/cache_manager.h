@@ -6,17 +6,39 @@
 #ifndef FALCON_CACHE_MANAGER_H_
 #define FALCON_CACHE_MANAGER_H_
 
+#include <memory>
+#include <set>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
+#include "action_cache.h"
+#include "cache_bundle.h"
+#include "cache_backend.h"
 #include "cache_fs.h"
 #include "cache_git_directory.h"
+#include "cache_memory.h"
+#include "cache_pack.h"
+#include "cache_server.h"
+#include "cache_stats.h"
+#include "git_head_watcher.h"
+#include "util/thread_pool.h"
 
 namespace falcon {
 
 class Rule;
 class Node;
 
+/**
+ * The cache manager saves the outputs of the rules that were built and
+ * restores them when the same rule needs to be built again.
+ *
+ * The outputs of a rule are stored as an action of the ActionCache, keyed by
+ * the hash of the rule. The depfile of a rule is stored as a separate action
+ * keyed by the depfile hash of the rule, since it must be found before the
+ * implicit dependencies, and thus the hash of the rule, are known.
+ */
 class CacheManager {
  public:
 
@@ -35,24 +57,122 @@ class CacheManager {
     CACHE_GIT_REFS
   };
 
+  /**
+   * @param workingDirectory Root of the project.
+   * @param falconDir        Directory where the local cache is stored.
+   * @param sharedDir        Directory of a local cache shared with the
+   *                         daemons of other checkouts, or an empty string
+   *                         to use a cache private to this checkout.
+   * @param remote           "host:port" of a remote cache server shared with
+   *                         other users, or an empty string to only use the
+   *                         local cache.
+   * @param peer             "host:port" of another falcon daemon that serves
+   *                         its cache, see startServer(), used read-only if
+   *                         there is no remote cache server. Empty if none.
+   * @param memoryCacheSize  Maximum number of bytes of small blobs kept in
+   *                         memory, 0 to disable the memory tier.
+   */
   CacheManager(const std::string& workingDirectory,
-               const std::string& falconDir);
+               const std::string& falconDir,
+               const std::string& sharedDir,
+               const std::string& remote,
+               const std::string& peer,
+               std::size_t memoryCacheSize);
+  ~CacheManager();
 
   void setPolicy(Policy policy) { policy_ = policy; }
   Policy getPolicy() const { return policy_; }
 
+  static const char* toString(Policy policy);
+
+  /**
+   * Counters of the cache operations, by policy. A node whose restore is
+   * deferred counts as a hit when it is found, and its bytes count when it
+   * is materialized.
+   */
+  CacheStats& getStats() { return stats_; }
+
   /**
    * Check the git repository for the current ref.
    * Must be called before each build.
    */
   void gitUpdateRef() { gitDirectory_.updateRef(); }
 
+  /**
+   * Prepare the cache entries that were last saved under the given git
+   * reference so that restoring them is fast: their manifests are read,
+   * blobs only in the remote cache are downloaded in the local cache and
+   * local blobs are read ahead in the page cache.
+   * Called in the background when HEAD moves, so that the restores are
+   * mostly done by the time the user starts a build after a checkout.
+   */
+  void prefetchRef(const std::string& ref);
+
+  /**
+   * Serve the local cache over HTTP in a background thread, so that other
+   * daemons can use this one as a read-only remote cache, eg the daemons of
+   * developers fetching what the continuous build server built.
+   * @param port Port to listen on.
+   * @return false if the server could not be started.
+   */
+  bool startServer(int port);
+
+  /** Stop the server started by startServer(), if any. */
+  void stopServer();
+
   /**
    * Called after a rule was built. Save all the outputs and the depfile
    * in cache.
+   * The digests of the outputs recorded by the builder (see
+   * Node::getContentDigest()) are reused, the other files are hashed by the
+   * writer threads, which copy them in the background. This only takes a
+   * snapshot of the paths, keys, digests and modification times to be saved:
+   * an output modified before it is copied is not saved.
+   * Blocks if too many actions are already pending.
    */
   void saveRule(Rule* rule);
 
+  /**
+   * Wait until all the entries queued by saveRule() are written.
+   * Must be called at the end of each build, before any output can be
+   * modified again. The actions a git ref does not need any more and the
+   * blobs that are not used any more are removed here, without holding the
+   * lock of the graph, and the packfiles are compacted.
+   */
+  void flush();
+
+  /**
+   * Check if the blob store has the given entries. The whole batch is
+   * answered with one query to the backend, which matters a lot for a remote
+   * cache.
+   * @param hashes Digests of the entries.
+   * @param found  Filled with one flag per hash.
+   */
+  void hasEntries(const std::vector<std::string>& hashes,
+                  std::vector<bool>& found);
+
+  /**
+   * Restore several entries from the blob store. The batch is split between
+   * the I/O threads, each of which hands its share to the backend in a single
+   * call. This blocks until they all complete.
+   * @param hashes   Digests of the entries.
+   * @param paths    Path where to store each entry.
+   * @param restored Filled with one flag per hash, set to true if the
+   *                 corresponding entry was restored.
+   */
+  void restoreEntries(const std::vector<std::string>& hashes,
+                      const std::vector<std::string>& paths,
+                      std::vector<bool>& restored);
+
+  /**
+   * Check if the cache has an entry for each of the given nodes, ie if the
+   * action of the rule that produces the node is in cache. The manifests of
+   * all the rules are looked up with one query.
+   * @param nodes Nodes to look up.
+   * @param found Filled with one flag per node.
+   */
+  void hasNodes(const std::vector<Node*>& nodes, std::vector<bool>& found);
+
   /**
    * Try to restore a node from the cache.
    * @param node Node to be restored.
@@ -60,6 +180,35 @@ class CacheManager {
    */
   bool restoreNode(Node* node);
 
+  /**
+   * Restore several nodes from the cache, see restoreEntries().
+   * @param nodes    Nodes to be restored.
+   * @param restored Filled with one entry per node, set to true if the
+   *                 corresponding node was restored.
+   */
+  void restoreNodes(const std::vector<Node*>& nodes,
+                    std::vector<bool>& restored);
+
+  /**
+   * Find the given nodes in the cache without writing them in the workspace.
+   * Each node found records the digest of its content (see
+   * Node::setDeferredDigest) and any stale file at its path is removed.
+   * @param nodes    Nodes to look up.
+   * @param deferred Filled with one flag per node, set to true if the node
+   *                 was found.
+   */
+  void deferNodes(const std::vector<Node*>& nodes,
+                  std::vector<bool>& deferred);
+
+  /**
+   * Write the content of nodes returned by deferNodes() in the workspace.
+   * @param nodes    Deferred nodes.
+   * @param restored Filled with one flag per node, set to true if the node
+   *                 was written.
+   */
+  void materializeNodes(const std::vector<Node*>& nodes,
+                        std::vector<bool>& restored);
+
   /**
    * Try to restore all the outputs of the given rule from the cache.
    * @param rule Rule to be restored.
@@ -68,6 +217,16 @@ class CacheManager {
    */
   bool restoreRule(Rule* rule);
 
+  /**
+   * Try to restore several rules from the cache. The outputs of all the rules
+   * are looked up and restored in batches.
+   * @param rules    Rules to be restored.
+   * @param restored Filled with one flag per rule, set to true if all the
+   *                 outputs of the corresponding rule were restored.
+   */
+  void restoreRules(const std::vector<Rule*>& rules,
+                    std::vector<bool>& restored);
+
   /**
    * Query the cache for information on the depfiles of the given rule.
    * Reload the depfile if found in cache.
@@ -76,16 +235,98 @@ class CacheManager {
    */
   bool restoreDepfile(Rule* rule);
 
+  /**
+   * Export the cache entries of the given targets and of everything they
+   * depend on in a bundle (see cache_bundle.h). The hashes of the rules must
+   * be up to date.
+   * @param targets Targets to export.
+   * @param path    Path of the bundle.
+   * @param summary Filled with what was exported.
+   * @return false if the bundle could not be written.
+   */
+  bool exportBundle(const std::set<Node*>& targets, const std::string& path,
+                    bundle::Summary& summary);
+
+  /**
+   * Import a bundle in the local cache, with one thread per I/O thread.
+   * @param path    Path of the bundle.
+   * @param summary Filled with what was imported.
+   * @return false if the bundle is invalid or an entry was corrupted.
+   */
+  bool importBundle(const std::string& path, bundle::Summary& summary);
+
  private:
+  /** Key of the action that stores the depfile of a rule. */
+  static std::string depfileKey(Rule* rule);
+
+  /** Queue the save of an action, see ActionCache::saveAction(). The
+   * modification time of the files whose digest is not known is taken
+   * now. */
+  void queueSave(const std::string& key,
+                 const std::vector<std::string>& paths,
+                 const std::vector<std::string>& digests,
+                 std::vector<uint64_t> mtimes);
+
+  /** Total size of the files that were restored. */
+  static uint64_t restoredBytes(const std::vector<std::string>& paths,
+                                const std::vector<bool>& restored);
+
+  /** Count a call in stats_ under the current policy. */
+  void record(CacheStats::Op op, uint64_t hits, uint64_t misses,
+              uint64_t bytes, CacheStats::Clock::time_point start);
+
   /**
-   * Save a node in cache.
+   * Find the digest of each node in the manifest of the rule that produces
+   * it.
+   * @param nodes   Nodes to look up.
+   * @param digests Filled with the digest of each node found.
+   * @param found   Filled with one flag per node.
    */
-  bool saveNode(Node* node);
+  void lookupNodes(const std::vector<Node*>& nodes,
+                   std::vector<std::string>& digests,
+                   std::vector<bool>& found);
 
   Policy policy_;
   std::string workingDirectory_;
-  CacheFS cacheFs_;
+  CacheStats stats_;
+
+  /** Local stores of the action cache. Small entries are packed, the others
+   * are stored in one file each. Packs are private to a process, so when the
+   * cache directory is shared nothing is packed: every entry is a file,
+   * published atomically, that the other daemons can find. */
+  CacheFS actionFs_;
+  CacheFS blobFs_;
+  CachePack actionPack_;
+  CachePack blobPack_;
+
+  /** Recently used small blobs, if enabled. The manifests don't need one,
+   * ActionCache keeps them in memory. */
+  std::unique_ptr<CacheMemory> blobMemory_;
+
+  /** Local blob store: blobMemory_ if enabled, blobPack_ otherwise. */
+  ILocalCacheBackend& localBlobs_;
+
+  /** Local stores backed by the remote stores, if there is a remote cache. */
+  std::unique_ptr<ICacheBackend> remoteActions_;
+  std::unique_ptr<ICacheBackend> remoteBlobs_;
+
+  ActionCache actionCache_;
   CacheGitDirectory gitDirectory_;
+
+  /** Threads saving the actions in cache. Declared after the stores so that
+   * it is destroyed, and thus flushed, before them. */
+  ThreadPool writer_;
+
+  /** Threads restoring entries from the cache. */
+  ThreadPool io_;
+
+  /** Serves the local stores to other daemons, if enabled. */
+  std::unique_ptr<CacheServer> server_;
+  std::thread serverThread_;
+
+  /** Calls prefetchRef() when HEAD moves. Declared last so that it is stopped
+   * before anything it uses is destroyed. */
+  std::unique_ptr<GitHeadWatcher> headWatcher_;
 };
 
 } // namespace falcon
@@ -0,0 +1,188 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#include <cassert>
+#include <cerrno>
+#include <fcntl.h>
+#include <fstream>
+#include <iterator>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "cache_memory.h"
+
+#include "logging.h"
+
+namespace falcon {
+
+CacheMemory::CacheMemory(ILocalCacheBackend& backing, std::size_t maxBytes,
+                         std::size_t maxEntrySize)
+    : backing_(backing)
+    , maxBytes_(maxBytes)
+    , maxEntrySize_(maxEntrySize)
+    , bytes_(0) { }
+
+bool CacheMemory::get(const std::string& hash, std::string& data) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = index_.find(hash);
+  if (it == index_.end()) {
+    return false;
+  }
+  entries_.splice(entries_.begin(), entries_, it->second);
+  data = it->second->data;
+  return true;
+}
+
+void CacheMemory::put(const std::string& hash, const std::string& data) {
+  if (data.size() >= maxEntrySize_ || data.size() > maxBytes_) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = index_.find(hash);
+  if (it != index_.end()) {
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return;
+  }
+
+  Entry entry;
+  entry.hash = hash;
+  entry.data = data;
+  entries_.push_front(std::move(entry));
+  index_[hash] = entries_.begin();
+  bytes_ += data.size();
+
+  while (bytes_ > maxBytes_) {
+    Entry& last = entries_.back();
+    bytes_ -= last.data.size();
+    index_.erase(last.hash);
+    entries_.pop_back();
+  }
+}
+
+void CacheMemory::putFile(const std::string& hash, const std::string& path) {
+  struct stat st;
+  if (stat(path.c_str(), &st) < 0
+      || (std::size_t)st.st_size >= maxEntrySize_) {
+    return;
+  }
+  /* The file was just written, this reads it from the page cache. */
+  std::ifstream ifs(path, std::ios::in | std::ios::binary);
+  if (!ifs.is_open()) {
+    return;
+  }
+  std::string data((std::istreambuf_iterator<char>(ifs)),
+                   std::istreambuf_iterator<char>());
+  put(hash, data);
+}
+
+bool CacheMemory::writeEntry(const std::string& hash,
+                             const std::string& path) {
+  if (!backing_.writeEntry(hash, path)) {
+    return false;
+  }
+  putFile(hash, path);
+  return true;
+}
+
+bool CacheMemory::storeEntry(const std::string& hash,
+                             const std::string& data) {
+  if (!backing_.storeEntry(hash, data)) {
+    return false;
+  }
+  put(hash, data);
+  return true;
+}
+
+bool CacheMemory::hasEntry(const std::string& hash) {
+  return backing_.hasEntry(hash);
+}
+
+void CacheMemory::hasEntries(const std::vector<std::string>& hashes,
+                             std::vector<bool>& found) {
+  backing_.hasEntries(hashes, found);
+}
+
+bool CacheMemory::readEntry(const std::string& hash, const std::string& path) {
+  assert(!hash.empty());
+  std::string data;
+  if (!get(hash, data)) {
+    if (!backing_.readEntry(hash, path)) {
+      return false;
+    }
+    putFile(hash, path);
+    return true;
+  }
+
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    LOG(ERROR) << "Could not retrieve " << path << " from cache";
+    return false;
+  }
+  const char* ptr = data.data();
+  std::size_t len = data.size();
+  while (len > 0) {
+    ssize_t w = write(fd, ptr, len);
+    if (w < 0 && errno == EINTR) {
+      continue;
+    }
+    if (w < 0) {
+      LOG(ERROR) << "Could not retrieve " << path << " from cache";
+      close(fd);
+      return false;
+    }
+    ptr += w;
+    len -= w;
+  }
+  close(fd);
+  return true;
+}
+
+bool CacheMemory::loadEntry(const std::string& hash, std::string& data) {
+  assert(!hash.empty());
+  if (get(hash, data)) {
+    return true;
+  }
+  if (!backing_.loadEntry(hash, data)) {
+    return false;
+  }
+  put(hash, data);
+  return true;
+}
+
+bool CacheMemory::delEntry(const std::string& hash) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(hash);
+    if (it != index_.end()) {
+      bytes_ -= it->second->data.size();
+      entries_.erase(it->second);
+      index_.erase(it);
+    }
+  }
+  return backing_.delEntry(hash);
+}
+
+std::vector<std::string> CacheMemory::listEntries() {
+  return backing_.listEntries();
+}
+
+void CacheMemory::prefetchEntries(const std::vector<std::string>& hashes) {
+  backing_.prefetchEntries(hashes);
+}
+
+int CacheMemory::openEntry(const std::string& hash, uint64_t& offset,
+                           uint64_t& length) {
+  /* Entries are written through, the backing store has them all. */
+  return backing_.openEntry(hash, offset, length);
+}
+
+std::size_t CacheMemory::size() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return bytes_;
+}
+
+} // namespace falcon
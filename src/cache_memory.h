@@ -0,0 +1,93 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#ifndef FALCON_CACHE_MEMORY_H_
+#define FALCON_CACHE_MEMORY_H_
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "cache_backend.h"
+
+namespace falcon {
+
+/**
+ * In-process memory tier in front of a local cache.
+ *
+ * Keeps a copy of the small entries that were recently saved or restored,
+ * such as depfiles and generated headers, so that restoring them again does
+ * not read the local cache. Depfiles in particular are restored several times
+ * per build: once by the dependency scan, then again each time the hash of
+ * their rule is computed.
+ *
+ * The memory tier is write-through: every entry it holds is also in the
+ * backing cache, which answers the lookups. Entries are evicted in least
+ * recently used order once the total size exceeds a bound.
+ *
+ * This class is thread safe.
+ */
+class CacheMemory : public ILocalCacheBackend {
+ public:
+  /**
+   * @param backing      Local cache that stores all the entries.
+   * @param maxBytes     Maximum total size of the entries kept in memory.
+   * @param maxEntrySize Only entries smaller than that are kept in memory.
+   */
+  CacheMemory(ILocalCacheBackend& backing, std::size_t maxBytes,
+              std::size_t maxEntrySize);
+
+  bool writeEntry(const std::string& hash, const std::string& path);
+  bool hasEntry(const std::string& hash);
+  bool readEntry(const std::string& hash, const std::string& path);
+  bool delEntry(const std::string& hash);
+  bool storeEntry(const std::string& hash, const std::string& data);
+  bool loadEntry(const std::string& hash, std::string& data);
+  std::vector<std::string> listEntries();
+
+  void hasEntries(const std::vector<std::string>& hashes,
+                  std::vector<bool>& found);
+  void prefetchEntries(const std::vector<std::string>& hashes);
+  int openEntry(const std::string& hash, uint64_t& offset, uint64_t& length);
+
+  /** Total size of the entries kept in memory. */
+  std::size_t size();
+
+ private:
+  struct Entry {
+    std::string hash;
+    std::string data;
+  };
+  typedef std::list<Entry> EntryList;
+
+  /** Copy the entry from memory. Mark it as the most recently used. */
+  bool get(const std::string& hash, std::string& data);
+
+  /** Keep a copy of the entry if it is small enough. */
+  void put(const std::string& hash, const std::string& data);
+
+  /** Keep a copy of the file if it is small enough. */
+  void putFile(const std::string& hash, const std::string& path);
+
+  ILocalCacheBackend& backing_;
+  std::size_t maxBytes_;
+  std::size_t maxEntrySize_;
+
+  std::mutex mutex_;
+
+  /* Most recently used first. */
+  EntryList entries_;
+  std::unordered_map<std::string, EntryList::iterator> index_;
+  std::size_t bytes_;
+
+  CacheMemory(const CacheMemory& other) = delete;
+  CacheMemory& operator=(const CacheMemory&) = delete;
+};
+
+} // namespace falcon
+
+#endif // FALCON_CACHE_MEMORY_H_
@@ -0,0 +1,808 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "cache_pack.h"
+
+#include "fs.h"
+#include "logging.h"
+
+namespace falcon {
+
+/* A pack is sealed once it reaches this size. */
+static const uint64_t kMaxPackSize = 64 << 20;
+
+/* Checkpoint the index when that many records are not covered by it. */
+static const std::size_t kMaxRecentEntries = 4096;
+
+/* Don't bother rewriting the packs for less than that many dead bytes. */
+static const uint64_t kMinDeadBytes = 4 << 20;
+
+/* Length of a tombstone in recent_. */
+static const uint32_t kTombstone = UINT32_MAX;
+
+static const uint32_t kRecordMagic = 0x4b504346;
+static const uint32_t kRecordTombstone = 1;
+
+struct RecordHeader {
+  uint32_t magic;
+  uint32_t flags;
+  uint32_t keyLength;
+  uint32_t dataLength;
+};
+
+static const uint64_t kIndexMagic = 0x3158444950434346ULL;
+
+/* Keys are stored in a fixed size, nul padded, field of the index. Longer
+ * keys are never packed. */
+static const std::size_t kKeyField = 72;
+static const std::size_t kMaxKeyLength = kKeyField - 1;
+
+struct IndexHeader {
+  uint64_t magic;
+  uint64_t numEntries;
+  uint64_t numPacks;
+};
+
+struct IndexPack {
+  uint64_t id;
+  /* Size of the pack covered by the index. */
+  uint64_t size;
+};
+
+struct IndexEntry {
+  char key[kKeyField];
+  uint32_t pack;
+  uint32_t length;
+  uint64_t offset;
+};
+
+static uint64_t recordSize(const std::string& key, uint32_t length) {
+  return sizeof(RecordHeader) + key.size()
+    + (length == kTombstone ? 0 : length);
+}
+
+static bool writeAll(int fd, const char* data, std::size_t len,
+                     uint64_t offset) {
+  while (len > 0) {
+    ssize_t w = pwrite(fd, data, len, offset);
+    if (w < 0 && errno == EINTR) {
+      continue;
+    }
+    if (w < 0) {
+      return false;
+    }
+    data += w;
+    len -= w;
+    offset += w;
+  }
+  return true;
+}
+
+static bool readAll(int fd, char* data, std::size_t len, uint64_t offset) {
+  while (len > 0) {
+    ssize_t r = pread(fd, data, len, offset);
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    if (r <= 0) {
+      return false;
+    }
+    data += r;
+    len -= r;
+    offset += r;
+  }
+  return true;
+}
+
+CachePack::Mapping::~Mapping() {
+  munmap(addr, length);
+}
+
+CachePack::CachePack(const std::string& dir, ILocalCacheBackend& large,
+                     std::size_t threshold)
+    : dir_(dir)
+    , large_(large)
+    , threshold_(threshold)
+    , current_(0)
+    , indexCount_(0)
+    , totalBytes_(0)
+    , deadBytes_(0) {
+  fs::createPath(indexPath());
+  open();
+}
+
+CachePack::~CachePack() {
+  for (auto it = packs_.begin(); it != packs_.end(); ++it) {
+    close(it->second.fd);
+  }
+}
+
+std::string CachePack::packPath(uint32_t id) const {
+  char name[32];
+  snprintf(name, sizeof(name), "/pack-%u", id);
+  return dir_ + name;
+}
+
+std::string CachePack::indexPath() const {
+  return dir_ + "/index";
+}
+
+void CachePack::open() {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  DIR* dir = opendir(dir_.c_str());
+  if (dir != NULL) {
+    struct dirent* ent;
+    while ((ent = readdir(dir)) != NULL) {
+      unsigned int id;
+      char extra;
+      if (sscanf(ent->d_name, "pack-%u%c", &id, &extra) != 1) {
+        continue;
+      }
+      int fd = ::open(packPath(id).c_str(), O_RDWR);
+      struct stat st;
+      if (fd < 0 || fstat(fd, &st) < 0) {
+        LOG(ERROR) << "Could not open " << packPath(id);
+        if (fd >= 0) {
+          close(fd);
+        }
+        continue;
+      }
+      Pack pack;
+      pack.fd = fd;
+      pack.size = st.st_size;
+      packs_[id] = pack;
+      totalBytes_ += st.st_size;
+    }
+    closedir(dir);
+  }
+
+  /* The index is only usable if it describes packs we have. */
+  mapIndex();
+  for (auto it = covered_.begin(); it != covered_.end(); ++it) {
+    auto pack = packs_.find(it->first);
+    if (pack == packs_.end() || pack->second.size < it->second) {
+      LOG(WARNING) << "The pack index of " << dir_ << " is stale, rebuilding it";
+      index_.reset();
+      indexCount_ = 0;
+      covered_.clear();
+      break;
+    }
+  }
+
+  for (auto it = packs_.begin(); it != packs_.end(); ++it) {
+    auto cover = covered_.find(it->first);
+    scanPack(it->first, cover == covered_.end() ? 0 : cover->second);
+  }
+
+  if (packs_.empty() || packs_.rbegin()->second.size >= kMaxPackSize) {
+    startPack();
+  } else {
+    current_ = packs_.rbegin()->first;
+  }
+
+  std::vector<std::pair<std::string, Location>> entries;
+  liveEntries(entries);
+  uint64_t liveBytes = 0;
+  for (auto it = entries.begin(); it != entries.end(); ++it) {
+    liveBytes += recordSize(it->first, it->second.length);
+  }
+  deadBytes_ = totalBytes_ > liveBytes ? totalBytes_ - liveBytes : 0;
+
+  LOG(INFO) << "Loaded " << entries.size() << " packed cache entries from "
+            << dir_;
+}
+
+void CachePack::mapIndex() {
+  index_.reset();
+  indexCount_ = 0;
+  covered_.clear();
+
+  int fd = ::open(indexPath().c_str(), O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0
+      || (std::size_t)st.st_size < sizeof(IndexHeader)) {
+    close(fd);
+    return;
+  }
+  void* addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    return;
+  }
+  MappingPtr mapping(new Mapping(addr, st.st_size));
+
+  const IndexHeader* header = static_cast<const IndexHeader*>(addr);
+  std::size_t expected = sizeof(IndexHeader)
+    + header->numPacks * sizeof(IndexPack)
+    + header->numEntries * sizeof(IndexEntry);
+  if (header->magic != kIndexMagic || expected != (std::size_t)st.st_size) {
+    LOG(WARNING) << "Ignoring invalid pack index " << indexPath();
+    return;
+  }
+
+  const IndexPack* packs = reinterpret_cast<const IndexPack*>(header + 1);
+  for (uint64_t i = 0; i < header->numPacks; i++) {
+    covered_[packs[i].id] = packs[i].size;
+  }
+  index_ = mapping;
+  indexCount_ = header->numEntries;
+}
+
+void CachePack::scanPack(uint32_t id, uint64_t from) {
+  Pack& pack = packs_[id];
+  uint64_t offset = from;
+  while (offset < pack.size) {
+    RecordHeader header;
+    if (offset + sizeof(header) > pack.size
+        || !readAll(pack.fd, reinterpret_cast<char*>(&header), sizeof(header),
+                    offset)
+        || header.magic != kRecordMagic
+        || header.keyLength == 0 || header.keyLength > kMaxKeyLength
+        || offset + sizeof(header) + header.keyLength + header.dataLength
+           > pack.size) {
+      break;
+    }
+    std::string key(header.keyLength, '\0');
+    if (!readAll(pack.fd, &key[0], key.size(), offset + sizeof(header))) {
+      break;
+    }
+
+    Location loc;
+    loc.pack = id;
+    loc.offset = offset + sizeof(header) + header.keyLength;
+    loc.length = (header.flags & kRecordTombstone) ? kTombstone
+                                                   : header.dataLength;
+    recent_[key] = loc;
+    offset = loc.offset + header.dataLength;
+  }
+
+  if (offset < pack.size) {
+    /* The end of the pack was not completely written, probably because of a
+     * crash. Drop it. */
+    LOG(WARNING) << "Truncating " << packPath(id) << " at offset " << offset;
+    if (ftruncate(pack.fd, offset) == 0) {
+      totalBytes_ -= pack.size - offset;
+      pack.size = offset;
+    }
+  }
+}
+
+bool CachePack::startPack() {
+  uint32_t id = packs_.empty() ? 0 : packs_.rbegin()->first + 1;
+  int fd = ::open(packPath(id).c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    LOG(ERROR) << "Could not create " << packPath(id) << ": "
+               << strerror(errno);
+    return false;
+  }
+  Pack pack;
+  pack.fd = fd;
+  pack.size = 0;
+  packs_[id] = pack;
+  current_ = id;
+  return true;
+}
+
+bool CachePack::lookup(const std::string& hash, Location& loc) {
+  auto it = recent_.find(hash);
+  if (it != recent_.end()) {
+    loc = it->second;
+    return loc.length != kTombstone;
+  }
+
+  if (!index_ || hash.size() > kMaxKeyLength) {
+    return false;
+  }
+
+  const IndexHeader* header = static_cast<const IndexHeader*>(index_->addr);
+  const IndexEntry* entries = reinterpret_cast<const IndexEntry*>(
+      reinterpret_cast<const IndexPack*>(header + 1) + header->numPacks);
+  const IndexEntry* end = entries + indexCount_;
+  const IndexEntry* entry = std::lower_bound(entries, end, hash,
+      [](const IndexEntry& e, const std::string& key) {
+        return strncmp(e.key, key.c_str(), kKeyField) < 0;
+      });
+  if (entry == end || strncmp(entry->key, hash.c_str(), kKeyField) != 0) {
+    return false;
+  }
+  loc.pack = entry->pack;
+  loc.offset = entry->offset;
+  loc.length = entry->length;
+  return true;
+}
+
+bool CachePack::append(const std::string& hash, const char* data,
+                       uint32_t length, bool tombstone, Location& loc) {
+  auto it = packs_.find(current_);
+  if (it == packs_.end()) {
+    return false;
+  }
+  Pack& pack = it->second;
+
+  RecordHeader header;
+  header.magic = kRecordMagic;
+  header.flags = tombstone ? kRecordTombstone : 0;
+  header.keyLength = hash.size();
+  header.dataLength = tombstone ? 0 : length;
+
+  std::string record(reinterpret_cast<const char*>(&header), sizeof(header));
+  record.append(hash);
+  if (!tombstone) {
+    record.append(data, length);
+  }
+  if (!writeAll(pack.fd, record.data(), record.size(), pack.size)) {
+    LOG(ERROR) << "Could not write in " << packPath(current_) << ": "
+               << strerror(errno);
+    return false;
+  }
+
+  loc.pack = current_;
+  loc.offset = pack.size + sizeof(header) + hash.size();
+  loc.length = tombstone ? kTombstone : length;
+  pack.size += record.size();
+  totalBytes_ += record.size();
+
+  if (pack.size >= kMaxPackSize) {
+    startPack();
+  }
+  return true;
+}
+
+CachePack::MappingPtr CachePack::getMapping(const Location& loc) {
+  auto it = packs_.find(loc.pack);
+  if (it == packs_.end()) {
+    return nullptr;
+  }
+  Pack& pack = it->second;
+  if (!pack.mapping || pack.mapping->length < loc.offset + loc.length) {
+    /* The pack grew since it was mapped. Readers of the previous mapping keep
+     * it alive until they are done. */
+    void* addr = mmap(NULL, pack.size, PROT_READ, MAP_SHARED, pack.fd, 0);
+    if (addr == MAP_FAILED) {
+      LOG(ERROR) << "Could not map " << packPath(loc.pack) << ": "
+                 << strerror(errno);
+      return nullptr;
+    }
+    pack.mapping.reset(new Mapping(addr, pack.size));
+  }
+  return pack.mapping;
+}
+
+bool CachePack::readPacked(const std::string& hash, std::string& data,
+                           bool& packed) {
+  MappingPtr mapping;
+  Location loc;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    packed = lookup(hash, loc);
+    if (!packed) {
+      return false;
+    }
+    if (loc.length > 0) {
+      mapping = getMapping(loc);
+      if (!mapping) {
+        return false;
+      }
+    }
+  }
+
+  if (loc.length == 0) {
+    data.clear();
+  } else {
+    data.assign(static_cast<const char*>(mapping->addr) + loc.offset,
+                loc.length);
+  }
+  return true;
+}
+
+bool CachePack::writeEntry(const std::string& hash, const std::string& path) {
+  assert(!hash.empty());
+  if (hasEntry(hash)) {
+    return true;
+  }
+
+  struct stat st;
+  if (hash.size() > kMaxKeyLength || stat(path.c_str(), &st) < 0
+      || (std::size_t)st.st_size >= threshold_) {
+    return large_.writeEntry(hash, path);
+  }
+
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    LOG(ERROR) << "Could not open " << path << ": " << strerror(errno);
+    return false;
+  }
+  std::string data(st.st_size, '\0');
+  bool ok = data.empty() || readAll(fd, &data[0], data.size(), 0);
+  close(fd);
+  if (!ok) {
+    LOG(ERROR) << "Could not read " << path;
+    return false;
+  }
+  return storeEntry(hash, data);
+}
+
+bool CachePack::storeEntry(const std::string& hash, const std::string& data) {
+  assert(!hash.empty());
+  if (hash.size() > kMaxKeyLength || data.size() >= threshold_) {
+    return large_.storeEntry(hash, data);
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  Location loc;
+  if (lookup(hash, loc)) {
+    return true;
+  }
+  if (!append(hash, data.data(), data.size(), false, loc)) {
+    return false;
+  }
+  recent_[hash] = loc;
+  return true;
+}
+
+bool CachePack::hasEntry(const std::string& hash) {
+  assert(!hash.empty());
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Location loc;
+    if (lookup(hash, loc)) {
+      return true;
+    }
+  }
+  return large_.hasEntry(hash);
+}
+
+void CachePack::hasEntries(const std::vector<std::string>& hashes,
+                           std::vector<bool>& found) {
+  found.assign(hashes.size(), false);
+
+  std::vector<std::size_t> missing;
+  std::vector<std::string> largeHashes;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (std::size_t i = 0; i < hashes.size(); i++) {
+      Location loc;
+      found[i] = lookup(hashes[i], loc);
+      if (!found[i]) {
+        missing.push_back(i);
+        largeHashes.push_back(hashes[i]);
+      }
+    }
+  }
+  if (missing.empty()) {
+    return;
+  }
+
+  std::vector<bool> largeFound;
+  large_.hasEntries(largeHashes, largeFound);
+  for (std::size_t i = 0; i < missing.size(); i++) {
+    found[missing[i]] = largeFound[i];
+  }
+}
+
+void CachePack::prefetchEntries(const std::vector<std::string>& hashes) {
+  std::vector<std::string> largeHashes;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = hashes.begin(); it != hashes.end(); ++it) {
+      Location loc;
+      if (!lookup(*it, loc)) {
+        largeHashes.push_back(*it);
+        continue;
+      }
+      auto pack = packs_.find(loc.pack);
+      if (pack != packs_.end() && loc.length > 0) {
+        posix_fadvise(pack->second.fd, loc.offset, loc.length,
+                      POSIX_FADV_WILLNEED);
+      }
+    }
+  }
+  if (!largeHashes.empty()) {
+    large_.prefetchEntries(largeHashes);
+  }
+}
+
+void CachePack::touchEntries(const std::vector<std::string>& hashes) {
+  std::vector<std::string> largeHashes;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = hashes.begin(); it != hashes.end(); ++it) {
+      Location loc;
+      if (!lookup(*it, loc)) {
+        largeHashes.push_back(*it);
+      }
+    }
+  }
+  if (!largeHashes.empty()) {
+    large_.touchEntries(largeHashes);
+  }
+}
+
+bool CachePack::getLastUse(const std::string& hash, uint64_t& time) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Location loc;
+    if (lookup(hash, loc)) {
+      return false;
+    }
+  }
+  return large_.getLastUse(hash, time);
+}
+
+int CachePack::openEntry(const std::string& hash, uint64_t& offset,
+                         uint64_t& length) {
+  assert(!hash.empty());
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Location loc;
+    if (lookup(hash, loc)) {
+      auto pack = packs_.find(loc.pack);
+      if (pack == packs_.end()) {
+        return -1;
+      }
+      /* Records are never modified and a pack removed by compact() stays
+       * readable through the duplicate. */
+      offset = loc.offset;
+      length = loc.length;
+      return fcntl(pack->second.fd, F_DUPFD_CLOEXEC, 0);
+    }
+  }
+  return large_.openEntry(hash, offset, length);
+}
+
+bool CachePack::readEntry(const std::string& hash, const std::string& path) {
+  assert(!hash.empty());
+
+  MappingPtr mapping;
+  Location loc;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!lookup(hash, loc)) {
+      mapping = nullptr;
+      loc.length = kTombstone;
+    } else if (loc.length > 0) {
+      mapping = getMapping(loc);
+      if (!mapping) {
+        return false;
+      }
+    }
+  }
+  if (loc.length == kTombstone) {
+    return large_.readEntry(hash, path);
+  }
+
+  /* Write the entry straight from the mapping of the pack. */
+  int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    LOG(ERROR) << "Could not retrieve " << path << " from cache";
+    return false;
+  }
+  bool ok = loc.length == 0
+    || writeAll(fd, static_cast<const char*>(mapping->addr) + loc.offset,
+                loc.length, 0);
+  close(fd);
+  if (!ok) {
+    LOG(ERROR) << "Could not retrieve " << path << " from cache";
+  }
+  return ok;
+}
+
+bool CachePack::loadEntry(const std::string& hash, std::string& data) {
+  assert(!hash.empty());
+  bool packed;
+  if (readPacked(hash, data, packed)) {
+    return true;
+  }
+  return !packed && large_.loadEntry(hash, data);
+}
+
+bool CachePack::delEntry(const std::string& hash) {
+  assert(!hash.empty());
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Location loc;
+    if (lookup(hash, loc)) {
+      Location tombstone;
+      if (!append(hash, NULL, 0, true, tombstone)) {
+        return false;
+      }
+      recent_[hash] = tombstone;
+      deadBytes_ += recordSize(hash, loc.length)
+        + recordSize(hash, kTombstone);
+      return true;
+    }
+  }
+  return large_.delEntry(hash);
+}
+
+std::vector<std::string> CachePack::listEntries() {
+  std::vector<std::string> hashes = large_.listEntries();
+  std::vector<std::pair<std::string, Location>> entries;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    liveEntries(entries);
+  }
+  for (auto it = entries.begin(); it != entries.end(); ++it) {
+    hashes.push_back(it->first);
+  }
+  return hashes;
+}
+
+void CachePack::liveEntries(
+    std::vector<std::pair<std::string, Location>>& entries) {
+  entries.clear();
+
+  if (index_) {
+    const IndexHeader* header = static_cast<const IndexHeader*>(index_->addr);
+    const IndexEntry* indexEntries = reinterpret_cast<const IndexEntry*>(
+        reinterpret_cast<const IndexPack*>(header + 1) + header->numPacks);
+    for (std::size_t i = 0; i < indexCount_; i++) {
+      std::string key(indexEntries[i].key,
+                      strnlen(indexEntries[i].key, kKeyField));
+      if (recent_.find(key) != recent_.end()) {
+        /* Overridden by a more recent record. */
+        continue;
+      }
+      Location loc;
+      loc.pack = indexEntries[i].pack;
+      loc.offset = indexEntries[i].offset;
+      loc.length = indexEntries[i].length;
+      entries.push_back(std::make_pair(key, loc));
+    }
+  }
+
+  for (auto it = recent_.begin(); it != recent_.end(); ++it) {
+    if (it->second.length != kTombstone) {
+      entries.push_back(*it);
+    }
+  }
+
+  std::sort(entries.begin(), entries.end(),
+      [](const std::pair<std::string, Location>& a,
+         const std::pair<std::string, Location>& b) {
+        return a.first < b.first;
+      });
+}
+
+bool CachePack::writeIndex(
+    const std::vector<std::pair<std::string, Location>>& entries) {
+  IndexHeader header;
+  header.magic = kIndexMagic;
+  header.numEntries = entries.size();
+  header.numPacks = packs_.size();
+
+  std::string data(reinterpret_cast<const char*>(&header), sizeof(header));
+  for (auto it = packs_.begin(); it != packs_.end(); ++it) {
+    IndexPack pack;
+    pack.id = it->first;
+    pack.size = it->second.size;
+    data.append(reinterpret_cast<const char*>(&pack), sizeof(pack));
+  }
+  for (auto it = entries.begin(); it != entries.end(); ++it) {
+    IndexEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    memcpy(entry.key, it->first.data(), it->first.size());
+    entry.pack = it->second.pack;
+    entry.offset = it->second.offset;
+    entry.length = it->second.length;
+    data.append(reinterpret_cast<const char*>(&entry), sizeof(entry));
+  }
+
+  /* Publish the new index atomically. */
+  std::string tmp = indexPath() + ".tmp";
+  int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    LOG(ERROR) << "Could not create " << tmp << ": " << strerror(errno);
+    return false;
+  }
+  bool ok = writeAll(fd, data.data(), data.size(), 0);
+  close(fd);
+  if (!ok || rename(tmp.c_str(), indexPath().c_str()) < 0) {
+    LOG(ERROR) << "Could not write " << indexPath();
+    unlink(tmp.c_str());
+    return false;
+  }
+
+  recent_.clear();
+  mapIndex();
+  return true;
+}
+
+void CachePack::rewritePacks() {
+  std::vector<std::pair<std::string, Location>> entries;
+  liveEntries(entries);
+
+  std::vector<uint32_t> oldPacks;
+  for (auto it = packs_.begin(); it != packs_.end(); ++it) {
+    oldPacks.push_back(it->first);
+  }
+  uint32_t oldCurrent = current_;
+  uint64_t oldTotal = totalBytes_;
+
+  /* Copy the live records in new packs. */
+  if (!startPack()) {
+    return;
+  }
+  totalBytes_ = 0;
+  bool ok = true;
+  for (auto it = entries.begin(); it != entries.end(); ++it) {
+    MappingPtr mapping;
+    if (it->second.length > 0) {
+      mapping = getMapping(it->second);
+      if (!mapping) {
+        ok = false;
+        break;
+      }
+    }
+    const char* data = mapping ? static_cast<const char*>(mapping->addr)
+                                 + it->second.offset : NULL;
+    Location loc;
+    if (!append(it->first, data, it->second.length, false, loc)) {
+      ok = false;
+      break;
+    }
+    it->second = loc;
+  }
+
+  /* Set the old packs aside while writing the index so that it only
+   * describes the new ones. */
+  std::map<uint32_t, Pack> old;
+  for (auto it = oldPacks.begin(); it != oldPacks.end(); ++it) {
+    old[*it] = packs_[*it];
+    packs_.erase(*it);
+  }
+  if (!ok || !writeIndex(entries)) {
+    /* The index in place, and recent_, still refer to the old packs. Drop
+     * the new ones. */
+    for (auto it = packs_.begin(); it != packs_.end(); ++it) {
+      close(it->second.fd);
+      unlink(packPath(it->first).c_str());
+    }
+    packs_.swap(old);
+    current_ = oldCurrent;
+    totalBytes_ = oldTotal;
+    return;
+  }
+
+  /* The new index is in place, the old packs can be removed. */
+  for (auto it = old.begin(); it != old.end(); ++it) {
+    close(it->second.fd);
+    unlink(packPath(it->first).c_str());
+  }
+
+  deadBytes_ = 0;
+  LOG(INFO) << "Compacted " << dir_ << ": " << oldTotal << " -> "
+            << totalBytes_ << " bytes";
+}
+
+void CachePack::compact() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (deadBytes_ > kMinDeadBytes && deadBytes_ * 2 > totalBytes_) {
+    rewritePacks();
+  } else if (recent_.size() > kMaxRecentEntries) {
+    std::vector<std::pair<std::string, Location>> entries;
+    liveEntries(entries);
+    writeIndex(entries);
+  }
+}
+
+} // namespace falcon
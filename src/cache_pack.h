@@ -0,0 +1,182 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#ifndef FALCON_CACHE_PACK_H_
+#define FALCON_CACHE_PACK_H_
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "cache_backend.h"
+
+namespace falcon {
+
+/**
+ * Local cache that stores small entries in packfiles.
+ *
+ * Most cache entries are tiny (depfiles, stamp files, manifests, generated
+ * headers). Storing each one in its own file costs an inode and an open/copy
+ * per entry. Entries smaller than a threshold are instead appended to a pack,
+ * and read straight from a read-only mapping of the pack. Larger entries are
+ * delegated to another local backend.
+ *
+ * Directory layout:
+ * - pack-<id>: append-only list of records. Each record is a header, the key
+ *   and the data. Removing an entry appends a tombstone record. A pack is
+ *   sealed once it reaches kMaxPackSize and a new one is started.
+ * - index: sorted table of key -> (pack, offset, length), mapped in memory and
+ *   searched with a binary search. The index records how much of each pack it
+ *   covers. The records appended after that are scanned when the cache is
+ *   opened and kept in a hash table until the next checkpoint.
+ *
+ * compact() writes a new index when too many records are not covered by it,
+ * and rewrites the packs without the dead records when they take more than
+ * half of the space. Since the index is derived from the packs, it can be
+ * rebuilt by scanning them if it is lost.
+ *
+ * This class is thread safe.
+ */
+class CachePack : public ILocalCacheBackend {
+ public:
+  /**
+   * @param dir       Directory of the packs.
+   * @param large     Backend used for the entries that are too large.
+   * @param threshold Entries smaller than this many bytes are packed.
+   */
+  CachePack(const std::string& dir, ILocalCacheBackend& large,
+            std::size_t threshold);
+  ~CachePack();
+
+  bool writeEntry(const std::string& hash, const std::string& path);
+  bool hasEntry(const std::string& hash);
+  bool readEntry(const std::string& hash, const std::string& path);
+  bool delEntry(const std::string& hash);
+  bool storeEntry(const std::string& hash, const std::string& data);
+  bool loadEntry(const std::string& hash, std::string& data);
+  std::vector<std::string> listEntries();
+
+  /** Look up all the entries with a single lock. */
+  void hasEntries(const std::vector<std::string>& hashes,
+                  std::vector<bool>& found);
+
+  /** Ask the kernel to read the packed entries in the page cache, and pass
+   * the others to the large entries backend. */
+  void prefetchEntries(const std::vector<std::string>& hashes);
+
+  /** A packed entry is a range of its pack. */
+  int openEntry(const std::string& hash, uint64_t& offset, uint64_t& length);
+
+  /** Only the entries of the large entries backend have a time of last
+   * use. */
+  void touchEntries(const std::vector<std::string>& hashes);
+  bool getLastUse(const std::string& hash, uint64_t& time);
+
+  /** Checkpoint the index and remove the dead records if needed. */
+  void compact();
+
+ private:
+  /** Location of the data of an entry. */
+  struct Location {
+    uint32_t pack;
+    uint32_t length;
+    uint64_t offset;
+  };
+
+  /** A read-only mapping of a pack. Readers hold a reference, so a mapping
+   * stays valid while in use even if the pack is remapped or removed. */
+  struct Mapping {
+    Mapping(void* a, std::size_t l) : addr(a), length(l) { }
+    ~Mapping();
+    void* addr;
+    std::size_t length;
+  };
+  typedef std::shared_ptr<Mapping> MappingPtr;
+
+  struct Pack {
+    int fd;
+    /* Size of the pack, ie offset of the next record. */
+    uint64_t size;
+    MappingPtr mapping;
+  };
+
+  std::string packPath(uint32_t id) const;
+  std::string indexPath() const;
+
+  /** Map the index and scan the tail of each pack. */
+  void open();
+
+  /** Scan the records of a pack from the given offset and add them to
+   * recent_. Truncate the pack after the last complete record. */
+  void scanPack(uint32_t id, uint64_t from);
+
+  /** Open a new empty pack and make it the one we append to. */
+  bool startPack();
+
+  /** Find an entry. mutex_ must be held. */
+  bool lookup(const std::string& hash, Location& loc);
+
+  /** Append a record to the current pack. mutex_ must be held. */
+  bool append(const std::string& hash, const char* data, uint32_t length,
+              bool tombstone, Location& loc);
+
+  /** Return a mapping of the pack that covers the given location, mapping it
+   * again if it grew. mutex_ must be held. */
+  MappingPtr getMapping(const Location& loc);
+
+  /** Get the data of an entry in memory. */
+  bool readPacked(const std::string& hash, std::string& data, bool& packed);
+
+  /** Collect all the live entries, sorted by key. mutex_ must be held. */
+  void liveEntries(std::vector<std::pair<std::string, Location>>& entries);
+
+  /** Write an index of the given entries, which must be sorted, and map it.
+   * mutex_ must be held. */
+  bool writeIndex(
+      const std::vector<std::pair<std::string, Location>>& entries);
+
+  /** Map the index file if it exists. mutex_ must be held. */
+  void mapIndex();
+
+  /** Copy the live records into new packs and remove the old packs.
+   * mutex_ must be held. */
+  void rewritePacks();
+
+  std::string dir_;
+  ILocalCacheBackend& large_;
+  std::size_t threshold_;
+
+  std::mutex mutex_;
+
+  std::map<uint32_t, Pack> packs_;
+  /* Pack we append to. */
+  uint32_t current_;
+
+  /* The mapped index. */
+  MappingPtr index_;
+  std::size_t indexCount_;
+  /* Size of each pack covered by the index. */
+  std::map<uint32_t, uint64_t> covered_;
+
+  /* Records not covered by the index. A tombstone has a length of
+   * kTombstone. */
+  std::unordered_map<std::string, Location> recent_;
+
+  /* Bytes of data in the packs, and bytes of data that are not reachable
+   * any more. */
+  uint64_t totalBytes_;
+  uint64_t deadBytes_;
+
+  CachePack(const CachePack& other) = delete;
+  CachePack& operator=(const CachePack&) = delete;
+};
+
+} // namespace falcon
+
+#endif // FALCON_CACHE_PACK_H_
@@ -0,0 +1,268 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <thread>
+#include <unistd.h>
+
+#include "cache_server.h"
+
+#include "exceptions.h"
+#include "fs.h"
+#include "logging.h"
+#include "util/hasher.h"
+#include "util/http.h"
+
+namespace falcon {
+
+/* Only accept plain hashes as keys, anything else could escape the cache
+ * directory or clash with the temporary files. */
+static bool isValidKey(const std::string& key) {
+  return !key.empty() && key[0] != '.'
+    && key.find('/') == std::string::npos;
+}
+
+CacheServer::CacheServer(int port, const std::string& dir)
+    : port_(port)
+    , dir_(dir)
+    , ownedActions_(new CacheFS(dir + "/ac", false))
+    , ownedBlobs_(new CacheFS(dir + "/cas", false))
+    , actions_(*ownedActions_)
+    , blobs_(*ownedBlobs_)
+    , readOnly_(false)
+    , stopped_(false) {
+  fs::mkdir(dir_);
+  openSocket();
+}
+
+CacheServer::CacheServer(int port, ILocalCacheBackend& actions,
+                         ILocalCacheBackend& blobs)
+    : port_(port)
+    , actions_(actions)
+    , blobs_(blobs)
+    , readOnly_(true)
+    , stopped_(false) {
+  openSocket();
+}
+
+void CacheServer::openSocket() {
+  serverSocket_ = socket(AF_INET, SOCK_STREAM, 0);
+  if (serverSocket_ < 0) {
+    THROW_ERROR(errno, "socket");
+  }
+
+  int on = 1;
+  if (setsockopt(serverSocket_, SOL_SOCKET, SO_REUSEADDR, &on,
+                 sizeof(on)) < 0) {
+    close(serverSocket_);
+    THROW_ERROR(errno, "setsockopt");
+  }
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port_);
+  if (bind(serverSocket_, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+    close(serverSocket_);
+    THROW_ERROR(errno, "bind");
+  }
+
+  if (listen(serverSocket_, 128) < 0) {
+    close(serverSocket_);
+    THROW_ERROR(errno, "listen");
+  }
+}
+
+CacheServer::~CacheServer() {
+  close(serverSocket_);
+}
+
+void CacheServer::run() {
+  /* Clients may go away at any time. sendfile() has no MSG_NOSIGNAL, so block
+   * SIGPIPE in this thread, and thus in the client threads it starts, rather
+   * than in the whole process, whose children must get the default
+   * handling. */
+  sigset_t sigpipe;
+  sigemptyset(&sigpipe);
+  sigaddset(&sigpipe, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &sigpipe, NULL);
+
+  if (readOnly_) {
+    LOG(INFO) << "Serving the local cache on port " << port_;
+  } else {
+    LOG(INFO) << "Serving " << dir_ << " on port " << port_;
+  }
+  while (!stopped_) {
+    int fd = accept(serverSocket_, NULL, NULL);
+    if (fd < 0) {
+      if (errno != EINTR && !stopped_) {
+        LOG(ERROR) << "accept: " << strerror(errno);
+      }
+      continue;
+    }
+
+    std::lock_guard<std::mutex> lock(clientsMutex_);
+    if (stopped_) {
+      close(fd);
+      break;
+    }
+    clients_.insert(fd);
+    std::thread(&CacheServer::serveClient, this, fd).detach();
+  }
+}
+
+void CacheServer::stop() {
+  stopped_ = true;
+  /* Wake up accept(). */
+  shutdown(serverSocket_, SHUT_RDWR);
+
+  std::unique_lock<std::mutex> lock(clientsMutex_);
+  for (auto it = clients_.begin(); it != clients_.end(); ++it) {
+    shutdown(*it, SHUT_RDWR);
+  }
+  clientsDone_.wait(lock, [this]() { return clients_.empty(); });
+}
+
+ILocalCacheBackend* CacheServer::findStore(const std::string& path,
+                                           std::string& hash) {
+  static const std::string kActions = "/ac/";
+  static const std::string kBlobs = "/cas/";
+
+  ILocalCacheBackend* store;
+  if (path.compare(0, kActions.size(), kActions) == 0) {
+    hash = path.substr(kActions.size());
+    store = &actions_;
+  } else if (path.compare(0, kBlobs.size(), kBlobs) == 0) {
+    hash = path.substr(kBlobs.size());
+    store = &blobs_;
+  } else {
+    return nullptr;
+  }
+  return isValidKey(hash) ? store : nullptr;
+}
+
+void CacheServer::serveClient(int fd) {
+  {
+    http::Connection conn(fd);
+    serveRequests(conn);
+  }
+
+  /* The connection is closed, stop() may now return. */
+  std::lock_guard<std::mutex> lock(clientsMutex_);
+  clients_.erase(fd);
+  clientsDone_.notify_all();
+}
+
+void CacheServer::serveRequests(http::Connection& conn) {
+  http::Request req;
+  while (http::readRequest(conn, req)) {
+    std::string hash;
+    ILocalCacheBackend* store = findStore(req.path, hash);
+    bool ok;
+
+    if (!store) {
+      ok = conn.skipBody(req.contentLength)
+        && conn.write(http::formatResponse(400, 0, req.keepAlive));
+    } else if (req.method == "HEAD") {
+      int status = store->hasEntry(hash) ? 200 : 404;
+      ok = conn.write(http::formatResponse(status, 0, req.keepAlive));
+    } else if (req.method == "GET") {
+      ok = handleGet(conn, req, *store, hash);
+    } else if (req.method == "PUT") {
+      ok = handlePut(conn, req, *store, hash);
+    } else {
+      ok = conn.skipBody(req.contentLength)
+        && conn.write(http::formatResponse(405, 0, req.keepAlive));
+    }
+
+    if (!ok || !req.keepAlive) {
+      break;
+    }
+  }
+}
+
+bool CacheServer::handleGet(http::Connection& conn, const http::Request& req,
+                            ILocalCacheBackend& store,
+                            const std::string& hash) {
+  uint64_t offset;
+  uint64_t length;
+  int fd = store.openEntry(hash, offset, length);
+  if (fd >= 0) {
+    /* The entry may be truncated while it is sent. The client would then
+     * read the next response as the end of this one. */
+    bool ok = conn.write(http::formatResponse(200, length, req.keepAlive))
+      && conn.writeFile(fd, offset, length);
+    close(fd);
+    if (!ok) {
+      LOG(WARNING) << "Could not send the cache entry " << hash;
+    }
+    return ok;
+  }
+
+  /* Not stored in a file, send it from memory. */
+  std::string data;
+  if (!store.loadEntry(hash, data)) {
+    return conn.write(http::formatResponse(404, 0, req.keepAlive));
+  }
+  return conn.write(http::formatResponse(200, data.size(), req.keepAlive))
+    && conn.write(data);
+}
+
+bool CacheServer::handlePut(http::Connection& conn, const http::Request& req,
+                            ILocalCacheBackend& store,
+                            const std::string& hash) {
+  if (readOnly_) {
+    return conn.skipBody(req.contentLength)
+      && conn.write(http::formatResponse(403, 0, req.keepAlive));
+  }
+
+  /* Receive the body in a temporary file, CacheFS then publishes it
+   * atomically. */
+  std::string tmp = dir_ + "/.upload.XXXXXX";
+  int fd = mkstemp(&tmp[0]);
+  if (fd < 0) {
+    LOG(ERROR) << "Could not create a temporary file in " << dir_;
+    return conn.skipBody(req.contentLength)
+      && conn.write(http::formatResponse(500, 0, req.keepAlive));
+  }
+
+  bool received = conn.readBody(req.contentLength, fd);
+  close(fd);
+  bool ok;
+  if (received) {
+    /* The blobs are stored under the digest of their content: a truncated or
+     * corrupted upload would be served to every client. */
+    std::string digest;
+    int status;
+    if (&store == &blobs_ && (!hash::hashFile(tmp, digest) || digest != hash)) {
+      LOG(ERROR) << "Rejected the cache entry " << hash
+                 << ", its content does not match";
+      status = 400;
+    } else {
+      status = store.writeEntry(hash, tmp) ? 201 : 500;
+    }
+    ok = conn.write(http::formatResponse(status, 0, req.keepAlive));
+  } else {
+    /* Either the client went away or the disk is full. The rest of the body
+     * was not read: answer if we can, and close the connection. */
+    LOG(ERROR) << "Could not receive the cache entry " << hash;
+    conn.write(http::formatResponse(500, 0, false));
+    ok = false;
+  }
+  unlink(tmp.c_str());
+  return ok;
+}
+
+} // namespace falcon
@@ -0,0 +1,106 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#ifndef FALCON_CACHE_SERVER_H_
+#define FALCON_CACHE_SERVER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+
+#include "cache_fs.h"
+
+namespace falcon {
+
+namespace http { class Connection; struct Request; }
+
+/**
+ * Serve the entries of the two stores of an ActionCache over HTTP, using the
+ * protocol described in util/http.h: the manifests under /ac/ and the blobs
+ * under /cas/. This is what CacheHttp talks to.
+ *
+ * The server either owns a cache directory, for falcon-cache-server, or
+ * exposes the local stores of a falcon daemon read-only, so that the daemon
+ * of another machine, eg a developer's, can use it as its remote cache.
+ * Entries stored in a file, packed or not, are sent with sendfile(2).
+ *
+ * Each connection is handled by its own thread.
+ */
+class CacheServer {
+ public:
+  /**
+   * Serve a cache directory. Clients can add entries.
+   * @param port Port to listen on.
+   * @param dir  Directory where the entries are stored.
+   */
+  CacheServer(int port, const std::string& dir);
+
+  /**
+   * Serve the given stores, read-only.
+   * @param port    Port to listen on.
+   * @param actions Store of the manifests.
+   * @param blobs   Store of the blobs.
+   */
+  CacheServer(int port, ILocalCacheBackend& actions,
+              ILocalCacheBackend& blobs);
+  ~CacheServer();
+
+  /** Accept and serve connections until stop() is called. */
+  void run();
+
+  /** Make run() return, and close the connections of the clients. Returns
+   * once no client is being served. */
+  void stop();
+
+ private:
+  /** Listen on port_. */
+  void openSocket();
+
+  /** Serve the requests of a client until it closes the connection, then
+   * forget about the client. */
+  void serveClient(int fd);
+
+  /** Serve the requests read from a connection until it is closed. */
+  void serveRequests(http::Connection& conn);
+
+  /** Find the store and the key of an entry from the path of a request.
+   * Return nullptr if the path is not valid. */
+  ILocalCacheBackend* findStore(const std::string& path, std::string& hash);
+
+  /** Serve a request. Return false if the connection must be closed: a
+   * response or a request body was cut, and what follows on the connection
+   * cannot be parsed. */
+  bool handleGet(http::Connection& conn, const http::Request& req,
+                 ILocalCacheBackend& store, const std::string& hash);
+  bool handlePut(http::Connection& conn, const http::Request& req,
+                 ILocalCacheBackend& store, const std::string& hash);
+
+  int port_;
+  /* Empty when serving the stores of a daemon. */
+  std::string dir_;
+  std::unique_ptr<CacheFS> ownedActions_;
+  std::unique_ptr<CacheFS> ownedBlobs_;
+  ILocalCacheBackend& actions_;
+  ILocalCacheBackend& blobs_;
+  bool readOnly_;
+  int serverSocket_;
+
+  std::atomic_bool stopped_;
+
+  /* Sockets of the clients being served, so that stop() can close them. */
+  std::mutex clientsMutex_;
+  std::condition_variable clientsDone_;
+  std::set<int> clients_;
+
+  CacheServer(const CacheServer& other) = delete;
+  CacheServer& operator=(const CacheServer&) = delete;
+};
+
+} // namespace falcon
+
+#endif // FALCON_CACHE_SERVER_H_
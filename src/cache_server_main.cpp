@@ -0,0 +1,37 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#include <cstdlib>
+#include <iostream>
+#include <signal.h>
+
+#include "cache_server.h"
+#include "exceptions.h"
+#include "logging.h"
+
+/**
+ * falcon-cache-server: a remote cache that falcon daemons can share, see the
+ * cache-remote option of falcond.
+ */
+int main(int const argc, char const* const* argv) {
+  if (argc != 3) {
+    std::cerr << "usage: " << argv[0] << " <port> <directory>" << std::endl;
+    return 1;
+  }
+
+  falcon::defaultlogging(argv[0], google::GLOG_INFO, "");
+
+  /* Clients may go away at any time. */
+  signal(SIGPIPE, SIG_IGN);
+
+  try {
+    falcon::CacheServer server(atoi(argv[1]), argv[2]);
+    server.run();
+  } catch (falcon::Exception& e) {
+    LOG(ERROR) << e.getErrorMessage();
+    return e.getCode();
+  }
+  return 0;
+}
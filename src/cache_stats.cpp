@@ -0,0 +1,116 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#include <cstring>
+
+#include "cache_stats.h"
+
+namespace falcon {
+
+static const char* toString(CacheStats::Op op) {
+  switch (op) {
+    case CacheStats::Op::RESTORE_NODE: return "restore_node";
+    case CacheStats::Op::RESTORE_RULE: return "restore_rule";
+    case CacheStats::Op::RESTORE_DEPFILE: return "restore_depfile";
+    case CacheStats::Op::SAVE_RULE: return "save_rule";
+    case CacheStats::Op::COLLECT_GARBAGE: return "collect_garbage";
+  }
+  return "unknown";
+}
+
+CacheStats::OpStats::OpStats()
+    : calls(0)
+    , hits(0)
+    , misses(0)
+    , bytes(0)
+    , micros(0) {
+  memset(latency, 0, sizeof(latency));
+}
+
+void CacheStats::record(const std::string& policy, Op op, uint64_t hits,
+                        uint64_t misses, uint64_t bytes,
+                        Clock::time_point start) {
+  uint64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(
+      Clock::now() - start).count();
+  std::size_t bucket = 0;
+  while (bucket < kNumBuckets - 1 && (micros >> bucket) > 0) {
+    bucket++;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  OpStats& stats = stats_[policy].ops[static_cast<std::size_t>(op)];
+  stats.calls++;
+  stats.hits += hits;
+  stats.misses += misses;
+  stats.bytes += bytes;
+  stats.micros += micros;
+  stats.latency[bucket]++;
+}
+
+CacheStats::Snapshot CacheStats::snapshot() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+CacheStats::Snapshot CacheStats::diff(const Snapshot& now,
+                                      const Snapshot& before) {
+  Snapshot res = now;
+  for (auto it = before.begin(); it != before.end(); ++it) {
+    PolicyStats& policy = res[it->first];
+    for (std::size_t i = 0; i < kNumOps; i++) {
+      OpStats& op = policy.ops[i];
+      const OpStats& prev = it->second.ops[i];
+      op.calls -= prev.calls;
+      op.hits -= prev.hits;
+      op.misses -= prev.misses;
+      op.bytes -= prev.bytes;
+      op.micros -= prev.micros;
+      for (std::size_t j = 0; j < kNumBuckets; j++) {
+        op.latency[j] -= prev.latency[j];
+      }
+    }
+  }
+  return res;
+}
+
+void CacheStats::toJson(const Snapshot& stats, std::ostream& os) {
+  os << "{";
+  bool firstPolicy = true;
+  for (auto it = stats.begin(); it != stats.end(); ++it) {
+    os << (firstPolicy ? "" : ",") << " \"" << it->first << "\": {";
+    firstPolicy = false;
+
+    bool firstOp = true;
+    for (std::size_t i = 0; i < kNumOps; i++) {
+      const OpStats& op = it->second.ops[i];
+      if (op.calls == 0) {
+        continue;
+      }
+      os << (firstOp ? "" : ",")
+         << " \"" << toString(static_cast<Op>(i)) << "\": {"
+         << " \"calls\": " << op.calls
+         << ", \"hits\": " << op.hits
+         << ", \"misses\": " << op.misses
+         << ", \"bytes\": " << op.bytes
+         << ", \"micros\": " << op.micros
+         << ", \"latency\": [";
+      firstOp = false;
+
+      /* Drop the empty buckets at the end. */
+      std::size_t numBuckets = kNumBuckets;
+      while (numBuckets > 0 && op.latency[numBuckets - 1] == 0) {
+        numBuckets--;
+      }
+      for (std::size_t j = 0; j < numBuckets; j++) {
+        os << (j == 0 ? " " : ", ") << op.latency[j];
+      }
+      os << " ] }";
+    }
+    os << " }";
+  }
+  os << " }";
+}
+
+} // namespace falcon
@@ -0,0 +1,103 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#ifndef FALCON_CACHE_STATS_H_
+#define FALCON_CACHE_STATS_H_
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+namespace falcon {
+
+/**
+ * Counters of the operations of the CacheManager, to see how much the cache
+ * saves and tune the cache policies.
+ *
+ * For each cache policy and each operation, we count the calls, the entries
+ * found (hits) and not found (misses), the bytes copied in or out of the
+ * cache, and the time spent, with a histogram of the latency of the calls.
+ * A call may handle a batch of entries, so there can be more hits and misses
+ * than calls.
+ *
+ * The counters are never reset. The stats of a build are the difference
+ * between two snapshots.
+ *
+ * This class is thread safe.
+ */
+class CacheStats {
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  enum class Op {
+    RESTORE_NODE,
+    RESTORE_RULE,
+    RESTORE_DEPFILE,
+    SAVE_RULE,
+    COLLECT_GARBAGE
+  };
+  static const std::size_t kNumOps = 5;
+
+  /* Bucket i of the latency histogram counts the calls that took less than
+   * 2^i microseconds, and at least 2^(i-1). The last bucket has the calls
+   * that took longer. */
+  static const std::size_t kNumBuckets = 24;
+
+  struct OpStats {
+    OpStats();
+
+    uint64_t calls;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t bytes;
+    uint64_t micros;
+    uint64_t latency[kNumBuckets];
+  };
+
+  /** Stats of all the operations run under one policy. */
+  struct PolicyStats {
+    OpStats ops[kNumOps];
+  };
+
+  /** Stats by policy name. */
+  typedef std::map<std::string, PolicyStats> Snapshot;
+
+  CacheStats() { }
+
+  /**
+   * Count a call.
+   * @param policy Name of the cache policy in use.
+   * @param op     Operation.
+   * @param hits   Number of entries found, or saved.
+   * @param misses Number of entries not found, or not saved.
+   * @param bytes  Number of bytes copied.
+   * @param start  Time when the call started.
+   */
+  void record(const std::string& policy, Op op, uint64_t hits,
+              uint64_t misses, uint64_t bytes, Clock::time_point start);
+
+  Snapshot snapshot();
+
+  /** Counters of now minus counters of before. */
+  static Snapshot diff(const Snapshot& now, const Snapshot& before);
+
+  /** Write the stats as a json object. Operations that were never called are
+   * omitted. */
+  static void toJson(const Snapshot& stats, std::ostream& os);
+
+ private:
+  std::mutex mutex_;
+  Snapshot stats_;
+
+  CacheStats(const CacheStats& other) = delete;
+  CacheStats& operator=(const CacheStats&) = delete;
+};
+
+} // namespace falcon
+
+#endif // FALCON_CACHE_STATS_H_
@@ -0,0 +1,228 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#include <algorithm>
+#include <unistd.h>
+
+#include "cache_tiered.h"
+
+#include "logging.h"
+#include "util/hasher.h"
+
+namespace falcon {
+
+/* Number of entries downloaded at once by prefetchEntries(). */
+static const std::size_t kPrefetchBatchSize = 32;
+
+CacheTiered::CacheTiered(ICacheBackend& local,
+                         std::unique_ptr<ICacheBackend> remote,
+                         bool readOnly, bool verify)
+    : local_(local)
+    , remote_(std::move(remote))
+    , readOnly_(readOnly)
+    , verify_(verify) { }
+
+bool CacheTiered::isValid(const std::string& hash,
+                          const std::string& data) const {
+  if (!verify_ || hash::hashData(data) == hash) {
+    return true;
+  }
+  LOG(ERROR) << "Entry " << hash << " of the remote cache is corrupted";
+  return false;
+}
+
+bool CacheTiered::isValidFile(const std::string& hash,
+                              const std::string& path) const {
+  if (!verify_) {
+    return true;
+  }
+  std::string digest;
+  if (hash::hashFile(path, digest) && digest == hash) {
+    return true;
+  }
+  LOG(ERROR) << "Entry " << hash << " of the remote cache is corrupted";
+  unlink(path.c_str());
+  return false;
+}
+
+bool CacheTiered::writeEntry(const std::string& hash,
+                             const std::string& path) {
+  if (local_.hasEntry(hash)) {
+    return true;
+  }
+  if (!local_.writeEntry(hash, path)) {
+    return false;
+  }
+  /* Failing to share the entry is not an error for this build. */
+  if (!readOnly_ && !remote_->writeEntry(hash, path)) {
+    LOG(WARNING) << "Could not store " << path << " in the remote cache";
+  }
+  return true;
+}
+
+bool CacheTiered::hasEntry(const std::string& hash) {
+  return local_.hasEntry(hash) || remote_->hasEntry(hash);
+}
+
+bool CacheTiered::readEntry(const std::string& hash, const std::string& path) {
+  if (local_.readEntry(hash, path)) {
+    return true;
+  }
+  if (!remote_->readEntry(hash, path) || !isValidFile(hash, path)) {
+    return false;
+  }
+  /* Keep a local copy for the next time. */
+  local_.writeEntry(hash, path);
+  return true;
+}
+
+void CacheTiered::hasEntries(const std::vector<std::string>& hashes,
+                             std::vector<bool>& found) {
+  local_.hasEntries(hashes, found);
+
+  std::vector<std::size_t> missing;
+  std::vector<std::string> remoteHashes;
+  for (std::size_t i = 0; i < hashes.size(); i++) {
+    if (!found[i]) {
+      missing.push_back(i);
+      remoteHashes.push_back(hashes[i]);
+    }
+  }
+  if (missing.empty()) {
+    return;
+  }
+
+  std::vector<bool> remoteFound;
+  remote_->hasEntries(remoteHashes, remoteFound);
+  for (std::size_t i = 0; i < missing.size(); i++) {
+    found[missing[i]] = remoteFound[i];
+  }
+}
+
+void CacheTiered::readEntries(const std::vector<std::string>& hashes,
+                              const std::vector<std::string>& paths,
+                              std::vector<bool>& restored) {
+  local_.readEntries(hashes, paths, restored);
+
+  std::vector<std::size_t> missing;
+  std::vector<std::string> remoteHashes;
+  std::vector<std::string> remotePaths;
+  for (std::size_t i = 0; i < hashes.size(); i++) {
+    if (!restored[i]) {
+      missing.push_back(i);
+      remoteHashes.push_back(hashes[i]);
+      remotePaths.push_back(paths[i]);
+    }
+  }
+  if (missing.empty()) {
+    return;
+  }
+
+  std::vector<bool> remoteRestored;
+  remote_->readEntries(remoteHashes, remotePaths, remoteRestored);
+  for (std::size_t i = 0; i < missing.size(); i++) {
+    if (remoteRestored[i] && isValidFile(remoteHashes[i], remotePaths[i])) {
+      restored[missing[i]] = true;
+      /* Keep a local copy for the next time. */
+      local_.writeEntry(remoteHashes[i], remotePaths[i]);
+    }
+  }
+}
+
+bool CacheTiered::storeEntry(const std::string& hash,
+                             const std::string& data) {
+  if (local_.hasEntry(hash)) {
+    return true;
+  }
+  if (!local_.storeEntry(hash, data)) {
+    return false;
+  }
+  if (!readOnly_ && !remote_->storeEntry(hash, data)) {
+    LOG(WARNING) << "Could not store entry " << hash << " in the remote cache";
+  }
+  return true;
+}
+
+bool CacheTiered::loadEntry(const std::string& hash, std::string& data) {
+  if (local_.loadEntry(hash, data)) {
+    return true;
+  }
+  if (!remote_->loadEntry(hash, data) || !isValid(hash, data)) {
+    data.clear();
+    return false;
+  }
+  local_.storeEntry(hash, data);
+  return true;
+}
+
+void CacheTiered::loadEntries(const std::vector<std::string>& hashes,
+                              std::vector<std::string>& data,
+                              std::vector<bool>& found) {
+  local_.loadEntries(hashes, data, found);
+
+  std::vector<std::size_t> missing;
+  std::vector<std::string> remoteHashes;
+  for (std::size_t i = 0; i < hashes.size(); i++) {
+    if (!found[i]) {
+      missing.push_back(i);
+      remoteHashes.push_back(hashes[i]);
+    }
+  }
+  if (missing.empty()) {
+    return;
+  }
+
+  std::vector<std::string> remoteData;
+  std::vector<bool> remoteFound;
+  remote_->loadEntries(remoteHashes, remoteData, remoteFound);
+  for (std::size_t i = 0; i < missing.size(); i++) {
+    if (remoteFound[i] && isValid(remoteHashes[i], remoteData[i])) {
+      found[missing[i]] = true;
+      data[missing[i]].swap(remoteData[i]);
+      /* Keep a local copy for the next time. */
+      local_.storeEntry(remoteHashes[i], data[missing[i]]);
+    }
+  }
+}
+
+void CacheTiered::prefetchEntries(const std::vector<std::string>& hashes) {
+  std::vector<bool> found;
+  local_.hasEntries(hashes, found);
+
+  std::vector<std::string> localHashes;
+  std::vector<std::string> remoteHashes;
+  for (std::size_t i = 0; i < hashes.size(); i++) {
+    if (found[i]) {
+      localHashes.push_back(hashes[i]);
+    } else {
+      remoteHashes.push_back(hashes[i]);
+    }
+  }
+  local_.prefetchEntries(localHashes);
+
+  /* Download the missing entries by small batches to bound the memory used
+   * to hold them. */
+  for (std::size_t begin = 0; begin < remoteHashes.size();
+       begin += kPrefetchBatchSize) {
+    std::size_t end = std::min(begin + kPrefetchBatchSize,
+                               remoteHashes.size());
+    std::vector<std::string> batch(remoteHashes.begin() + begin,
+                                   remoteHashes.begin() + end);
+    std::vector<std::string> data;
+    std::vector<bool> remoteFound;
+    remote_->loadEntries(batch, data, remoteFound);
+    for (std::size_t i = 0; i < batch.size(); i++) {
+      if (remoteFound[i] && isValid(batch[i], data[i])) {
+        local_.storeEntry(batch[i], data[i]);
+      }
+    }
+  }
+}
+
+bool CacheTiered::delEntry(const std::string& hash) {
+  return local_.delEntry(hash);
+}
+
+} // namespace falcon
@@ -0,0 +1,86 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#ifndef FALCON_CACHE_TIERED_H_
+#define FALCON_CACHE_TIERED_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "cache_backend.h"
+
+namespace falcon {
+
+/**
+ * A local cache in front of a remote one.
+ *
+ * Entries are looked up in the local cache first. Entries retrieved from the
+ * remote cache are kept in the local cache, so that they are fetched only
+ * once. New entries are written to both caches, unless the local cache
+ * already has them: they then came from, or were already sent to, the remote
+ * cache. A read-only remote cache, eg the cache of another falcon daemon, is
+ * only read from.
+ *
+ * Entries are only ever removed from the local cache: the remote cache is
+ * shared with other users.
+ *
+ * If the keys are the digests of the content, the entries retrieved from the
+ * remote cache are checked against them: a corrupted entry is treated as
+ * missing, and is not kept in the local cache.
+ */
+class CacheTiered : public ICacheBackend {
+ public:
+  /**
+   * @param local    Local cache.
+   * @param remote   Remote cache.
+   * @param readOnly True if new entries must not be sent to the remote cache.
+   * @param verify   True if the keys are the digests of the content of the
+   *                 entries (see hash::hashData()).
+   */
+  CacheTiered(ICacheBackend& local, std::unique_ptr<ICacheBackend> remote,
+              bool readOnly, bool verify);
+
+  bool writeEntry(const std::string& hash, const std::string& path);
+  bool hasEntry(const std::string& hash);
+  bool readEntry(const std::string& hash, const std::string& path);
+  bool delEntry(const std::string& hash);
+  bool storeEntry(const std::string& hash, const std::string& data);
+  bool loadEntry(const std::string& hash, std::string& data);
+
+  /** Only the entries missing from the local cache are looked up in the
+   * remote cache, in one batch. */
+  void hasEntries(const std::vector<std::string>& hashes,
+                  std::vector<bool>& found);
+  void readEntries(const std::vector<std::string>& hashes,
+                   const std::vector<std::string>& paths,
+                   std::vector<bool>& restored);
+  void loadEntries(const std::vector<std::string>& hashes,
+                   std::vector<std::string>& data,
+                   std::vector<bool>& found);
+
+  /** Entries missing from the local cache are downloaded in it. */
+  void prefetchEntries(const std::vector<std::string>& hashes);
+
+ private:
+  /** Return true if data retrieved from the remote cache matches its key. */
+  bool isValid(const std::string& hash, const std::string& data) const;
+
+  /** Same as isValid() for an entry written in a file. The file is removed
+   * if it does not match. */
+  bool isValidFile(const std::string& hash, const std::string& path) const;
+
+  ICacheBackend& local_;
+  std::unique_ptr<ICacheBackend> remote_;
+  bool readOnly_;
+  bool verify_;
+
+  CacheTiered(const CacheTiered& other) = delete;
+  CacheTiered& operator=(const CacheTiered&) = delete;
+};
+
+} // namespace falcon
+
+#endif // FALCON_CACHE_TIERED_H_
@@ -25,8 +25,19 @@ int64_t FalconServiceHandler::getPid() {
 }
 
 StartBuildResult::type FalconServiceHandler::startBuild(
-    const std::set<std::string>& targets, int32_t numThreads, bool lazyFetch) {
-  return daemon_->startBuild(targets, numThreads, lazyFetch);
+    const std::set<std::string>& targets, int32_t numThreads, bool lazyFetch,
+    int32_t maxFailures) {
+  return daemon_->startBuild(targets, numThreads, lazyFetch, maxFailures);
+}
+
+int32_t FalconServiceHandler::requestBuild(
+    const std::set<std::string>& targets, int32_t numThreads, bool lazyFetch,
+    int32_t maxFailures) {
+  return daemon_->requestBuild(targets, numThreads, lazyFetch, maxFailures);
+}
+
+BuildStatus::type FalconServiceHandler::waitForBuild(int32_t buildId) {
+  return daemon_->waitForBuild(buildId);
 }
 
 FalconStatus::type FalconServiceHandler::getStatus() {
@@ -72,6 +83,15 @@ void FalconServiceHandler::getGraphviz(std::string& str) {
   daemon_->getGraphviz(str);
 }
 
+void FalconServiceHandler::getCacheStats(std::string& str) {
+  daemon_->getCacheStats(str);
+}
+
+void FalconServiceHandler::getBuildLogOf(std::string& str,
+                                         const std::string& target) {
+  daemon_->getBuildLogOf(str, target);
+}
+
 CommandServer::CommandServer(DaemonInstance* daemon, int port) {
   handler_.reset(new FalconServiceHandler(daemon));
   processor_.reset(new FalconServiceProcessor(handler_));
@@ -29,7 +29,11 @@ class FalconServiceHandler : virtual public FalconServiceIf {
   /* See thrift/FalconService.thrift for a description of these commands. */
   int64_t getPid();
   StartBuildResult::type startBuild(const std::set<std::string>& targets,
-                                    int32_t numThreads, bool lazyFetch);
+                                    int32_t numThreads, bool lazyFetch,
+                                    int32_t maxFailures);
+  int32_t requestBuild(const std::set<std::string>& targets,
+                       int32_t numThreads, bool lazyFetch, int32_t maxFailures);
+  BuildStatus::type waitForBuild(int32_t buildId);
   FalconStatus::type getStatus();
   void getDirtySources(std::set<std::basic_string<char>>& sources);
   void getDirtyTargets(std::set<std::basic_string<char>>& targets);
@@ -40,6 +44,8 @@ class FalconServiceHandler : virtual public FalconServiceIf {
   void interruptBuild();
   void shutdown();
   void getGraphviz(std::string& str);
+  void getCacheStats(std::string& str);
+  void getBuildLogOf(std::string& str, const std::string& target);
 
  private:
   DaemonInstance* daemon_;
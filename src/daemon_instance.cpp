@@ -15,7 +15,6 @@
 #include "graph_parallel_builder.h"
 #include "graph_reloader.h"
 #include "graphparser.h"
-#include "lazy_cache.h"
 #include "logging.h"
 #include "watchman.h"
 
@@ -23,17 +22,30 @@ using namespace std::placeholders;
 
 namespace falcon {
 
+/* Value added to the nice value of the commands of the automatic builds. */
+static const int kAutoBuildNiceness = 10;
+
+/* Number of completed builds whose result can be waited for. */
+static const std::size_t kMaxBuildResults = 1000;
+
 DaemonInstance::DaemonInstance(std::unique_ptr<GlobalConfig> gc,
                                std::unique_ptr<CacheManager> cache)
     : buildId_(0)
     , config_(std::move(gc))
+    , buildLog_(config_->getFalconDir() + "/build_log")
+    , admission_({ config_->getLoadLimit(), config_->getMemoryPressureLimit(),
+                   config_->getMemoryReserve() })
     , watchmanClient_(config_->getWorkingDirectoryPath())
     , isBuilding_(false)
+    , autoBuildPending_(false)
+    , stopAutoBuild_(false)
+    , deferChanges_(false)
     , streamServer_()
     , cache_(std::move(cache)) { }
 
 void DaemonInstance::loadConf(std::unique_ptr<Graph> gp) {
   graph_ = std::move(gp);
+  buildLog_.applyHistory(graph_->getRules());
 }
 
 void DaemonInstance::start() {
@@ -47,27 +59,42 @@ void DaemonInstance::start() {
     LOG(ERROR) << e.getErrorMessage();
   }
 
-  FALCON_CHECK_GRAPH_CONSISTENCY(graph_.get(), mutex_);
+  FALCON_CHECK_GRAPH_CONSISTENCY(graph_.get(), graphLock_);
 
   /* Open the stream server's socket and accept clients in another thread. */
   streamServer_.openPort(config_->getNetworkStreamPort());
   std::thread streamServerThread = std::thread(&StreamServer::run,
                                                &streamServer_);
 
+  /* Let the other daemons use our cache. */
+  if (config_->getCacheServerPort() > 0) {
+    cache_->startServer(config_->getCacheServerPort());
+  }
+
+  if (config_->getAutoBuildDelay() > 0) {
+    autoBuildThread_ = std::thread(&DaemonInstance::autoBuildThread, this);
+  }
+
   /* Start the server. This will block until the server shuts down. */
   LOG(INFO) << "Starting server...";
   commandServer_.reset(new CommandServer(this, config_->getNetworkAPIPort()));
   commandServer_->start();
 
   /* If we reach here, the server was shut down. */
-  if (builder_) {
-    builder_->wait();
+  if (autoBuildThread_.joinable()) {
+    autoBuildThread_.join();
+  }
+  {
+    std::lock_guard<std::mutex> lock(buildMutex_);
+    waitForBuilder();
   }
   streamServer_.stop();
   streamServerThread.join();
+  cache_->stopServer();
 }
 
 void DaemonInstance::checkSourcesMissing() {
+  ReadLock g(graphLock_);
   if (!sourcesMissing_.empty()) {
     std::ostringstream oss;
     oss << "Error, cannot build without: ";
@@ -89,75 +116,183 @@ void DaemonInstance::checkSourcesMissing() {
 /* Commands */
 
 StartBuildResult::type DaemonInstance::startBuild(
-    const std::set<std::string>& targets, int32_t numThreads, bool lazyFetch) {
-  assert(graph_);
+    const std::set<std::string>& targets, int32_t numThreads, bool lazyFetch,
+    int32_t maxFailures) {
+  /* Kept for the clients written before requestBuild. */
+  try {
+    requestBuild(targets, numThreads, lazyFetch, maxFailures);
+  } catch (InvalidBuildError& e) {
+    LOG(WARNING) << "Cannot start the build: " << e.desc;
+    return StartBuildResult::ERROR;
+  }
+  return StartBuildResult::OK;
+}
 
-  if (isBuilding_.load(std::memory_order_acquire)) {
-     return StartBuildResult::BUSY;
+int32_t DaemonInstance::requestBuild(const std::set<std::string>& targets,
+                                     int32_t numThreads, bool lazyFetch,
+                                     int32_t maxFailures) {
+  return startSession(targets, numThreads, lazyFetch, maxFailures, false);
+}
+
+BuildStatus::type DaemonInstance::waitForBuild(int32_t buildId) {
+  std::unique_lock<std::mutex> lock(resultsMutex_);
+  auto it = results_.find(buildId);
+  if (buildId < 0 || it == results_.end()) {
+    InvalidBuildError e;
+    e.desc = "Unknown build " + std::to_string(buildId);
+    throw e;
   }
+  while (it->second == BuildResult::UNKNOWN) {
+    resultsCond_.wait(lock);
+  }
+  switch (it->second) {
+    case BuildResult::SUCCEEDED:
+      return BuildStatus::SUCCEEDED;
+    case BuildResult::INTERRUPTED:
+      return BuildStatus::INTERRUPTED;
+    default:
+      return BuildStatus::FAILED;
+  }
+}
 
-  if (cache_->getPolicy() == CacheManager::Policy::CACHE_GIT_REFS) {
-    cache_->gitUpdateRef();
+unsigned int DaemonInstance::startSession(
+    const std::set<std::string>& targets, int32_t numThreads, bool lazyFetch,
+    int32_t maxFailures, bool automatic) {
+  assert(graph_);
+
+  if (maxFailures < 0) {
+    InvalidBuildError e;
+    e.desc = "The maximum number of failures cannot be negative";
+    throw e;
   }
 
   checkSourcesMissing();
 
-  FALCON_CHECK_GRAPH_CONSISTENCY(graph_.get(), mutex_);
+  GraphParallelBuilder::SessionParams params;
+  params.targets = targets;
+  params.numThreads = numThreads;
+  params.maxFailures = maxFailures;
+  params.lazyFetch = lazyFetch;
+  params.niceness = automatic ? kAutoBuildNiceness : 0;
+  params.automatic = automatic;
+
+  std::future<std::string> future;
+  {
+    std::lock_guard<std::mutex> lock(buildMutex_);
+    params.id = buildId_++;
+    params.callback = std::bind(&DaemonInstance::onSessionCompleted, this,
+                                params.id, cache_->getStats().snapshot(), _1);
+    {
+      std::lock_guard<std::mutex> lockResults(resultsMutex_);
+      results_[params.id] = BuildResult::UNKNOWN;
+    }
+    streamServer_.newBuild(params.id);
 
-  NodeSet targetsToBuild;
-  if (targets.empty()) {
-    targetsToBuild = graph_->getRoots();
-  } else {
-    for (auto it = targets.begin(); it != targets.end(); ++it) {
-      auto itFind = graph_->getNodes().find(*it);
-      if (itFind == graph_->getNodes().end()) {
-        InvalidBuildError e;
-        e.desc = "Unknown target " + *it;
-        throw e;
-      } else {
-        targetsToBuild.insert(itFind->second);
-      }
+    if (builder_) {
+      future = builder_->addSession(params);
+    }
+    if (!future.valid()) {
+      /* No builder is running, or it is stopping, or files changed since it
+       * started. */
+      waitForBuilder();
+      startBuilder(params, future);
     }
   }
 
-  isBuilding_.store(true, std::memory_order_release);
-  streamServer_.newBuild(buildId_);
+  /* Wait for the targets to be merged in the plan. The lock is released so
+   * that the builds requested in the meantime are merged with this one. */
+  std::string error = future.get();
+  if (!error.empty()) {
+    onSessionCompleted(params.id, cache_->getStats().snapshot(),
+                       BuildResult::FAILED);
+    InvalidBuildError e;
+    e.desc = error;
+    throw e;
+  }
+  return params.id;
+}
 
-  if (lazyFetch) {
-    {
-      lock_guard g(mutex_);
-      LazyCache lazyCache(targetsToBuild, *cache_, &streamServer_);
-      lazyCache.fetch();
-    }
-    FALCON_CHECK_GRAPH_CONSISTENCY(graph_.get(), mutex_);
+void DaemonInstance::startBuilder(
+    const GraphParallelBuilder::SessionParams& params,
+    std::future<std::string>& future) {
+  if (cache_->getPolicy() == CacheManager::Policy::CACHE_GIT_REFS) {
+    cache_->gitUpdateRef();
   }
 
-  /* Create a build plan that builds everything. */
+  FALCON_CHECK_GRAPH_CONSISTENCY(graph_.get(), graphLock_);
+
+  /* The targets of the builds are merged in the plan by the builder. */
   /* TODO: if lazy fetch is disabled, BuildPlan should make sure that any target
    * that was lazy fetched in the past is marked dirty. */
-  plan_.reset(new BuildPlan(targetsToBuild));
+  NodeSet targets;
+  plan_.reset(new BuildPlan(targets));
 
+  isBuilding_.store(true, std::memory_order_release);
   auto callback = std::bind(&DaemonInstance::onBuildCompleted, this, _1);
-  builder_.reset(
-      new GraphParallelBuilder(*graph_, *plan_, cache_.get(), &streamServer_,
-                               &watchmanClient_,
-                               config_->getWorkingDirectoryPath(),
-                               numThreads, mutex_, callback));
+  {
+    /* The builder releases the lock of the graph while the commands run.
+     * setDirty() marks it stale when it defers a change. */
+    std::lock_guard<std::mutex> lock(changesMutex_);
+    deferChanges_ = true;
+    builder_.reset(
+        new GraphParallelBuilder(*graph_, *plan_, cache_.get(), &buildLog_,
+                                 &admission_, &streamServer_,
+                                 &watchmanClient_,
+                                 config_->getWorkingDirectoryPath(),
+                                 config_->deferCacheMaterialization(),
+                                 graphLock_, callback));
+  }
+  /* The builder stops once it has no session, add the first one before it
+   * starts. */
+  future = builder_->addSession(params);
   builder_->startBuild();
+}
 
-  return StartBuildResult::OK;
+void DaemonInstance::onSessionCompleted(unsigned int buildId,
+                                        const CacheStats::Snapshot& cacheStats,
+                                        BuildResult res) {
+  std::ostringstream oss;
+  CacheStats::toJson(CacheStats::diff(cache_->getStats().snapshot(),
+                                      cacheStats), oss);
+  streamServer_.endBuild(buildId, res, oss.str());
+
+  {
+    std::lock_guard<std::mutex> lock(resultsMutex_);
+    results_[buildId] = res;
+    /* Forget the oldest builds that completed. */
+    for (auto it = results_.begin();
+         results_.size() > kMaxBuildResults && it != results_.end(); ) {
+      if (it->second == BuildResult::UNKNOWN) {
+        ++it;
+      } else {
+        it = results_.erase(it);
+      }
+    }
+  }
+  resultsCond_.notify_all();
+
+  LOG(INFO) << "Build " << buildId << " completed. Status: " << toString(res);
 }
 
 void DaemonInstance::onBuildCompleted(BuildResult res) {
   assert(isBuilding_);
-  streamServer_.endBuild(res);
 
-  FALCON_CHECK_GRAPH_CONSISTENCY(graph_.get(), mutex_);
+  bool dirty;
+  {
+    std::lock_guard<std::mutex> lock(changesMutex_);
+    dirty = applyPendingChanges();
+    deferChanges_ = false;
+  }
+
+  FALCON_CHECK_GRAPH_CONSISTENCY(graph_.get(), graphLock_);
 
-  ++buildId_;
   isBuilding_.store(false, std::memory_order_release);
 
-  LOG(INFO) << "Build completed. Status: " << toString(res);
+  LOG(INFO) << "Builder stopped. Status: " << toString(res);
+
+  if (dirty) {
+    scheduleAutoBuild();
+  }
 }
 
 FalconStatus::type DaemonInstance::getStatus() {
@@ -166,13 +301,22 @@ FalconStatus::type DaemonInstance::getStatus() {
 
 void DaemonInstance::interruptBuild() {
   LOG(INFO) << "Interrupting build.";
+  /* builder_ is replaced with changesMutex_ held. buildMutex_ may be held for
+   * the whole build by a session waiting for the builder to stop. */
+  std::lock_guard<std::mutex> lock(changesMutex_);
   if (builder_) {
     builder_->interrupt();
   }
 }
 
+void DaemonInstance::waitForBuilder() {
+  if (builder_) {
+    builder_->wait();
+  }
+}
+
 void DaemonInstance::getDirtySources(std::set<std::string>& sources) {
-  lock_guard g(mutex_);
+  ReadLock g(graphLock_);
 
   NodeSet& src = graph_->getSources();
   for (auto it = src.begin(); it != src.end(); ++it) {
@@ -183,7 +327,7 @@ void DaemonInstance::getDirtySources(std::set<std::string>& sources) {
 }
 
 void DaemonInstance::getDirtyTargets(std::set<std::string>& targets) {
-  lock_guard g(mutex_);
+  ReadLock g(graphLock_);
 
   NodeMap& nodes = graph_->getNodes();
   for (auto it = nodes.begin(); it != nodes.end(); ++it) {
@@ -195,7 +339,7 @@ void DaemonInstance::getDirtyTargets(std::set<std::string>& targets) {
 
 void DaemonInstance::getInputsOf(std::set<std::string>& inputs,
                                  const std::string& target) {
-  lock_guard g(mutex_);
+  ReadLock g(graphLock_);
 
   auto it = graph_->getNodes().find(target);
   if (it == graph_->getNodes().end()) {
@@ -213,7 +357,7 @@ void DaemonInstance::getInputsOf(std::set<std::string>& inputs,
 
 void DaemonInstance::getOutputsOf(std::set<std::string>& outputs,
                                   const std::string& target) {
-  lock_guard g(mutex_);
+  ReadLock g(graphLock_);
 
   auto it = graph_->getNodes().find(target);
   if (it == graph_->getNodes().end()) {
@@ -230,7 +374,7 @@ void DaemonInstance::getOutputsOf(std::set<std::string>& outputs,
 }
 
 void DaemonInstance::getHashOf(std::string& hash, const std::string& target) {
-  lock_guard g(mutex_);
+  ReadLock g(graphLock_);
 
   auto it = graph_->getNodes().find(target);
   if (it == graph_->getNodes().end()) {
@@ -241,13 +385,62 @@ void DaemonInstance::getHashOf(std::string& hash, const std::string& target) {
 }
 
 void DaemonInstance::setDirty(const std::string& target) {
-  lock_guard g(mutex_);
+  bool dirty;
+  {
+    std::lock_guard<std::mutex> lock(changesMutex_);
+    if (deferChanges_) {
+      /* Do not wait for the build to complete, only check the target. */
+      if (target != config_->getJsonGraphFile()) {
+        ReadLock g(graphLock_);
+        if (graph_->getNodes().find(target) == graph_->getNodes().end()) {
+          throw TargetNotFound();
+        }
+      }
+      pendingChanges_.push_back(target);
+      /* The next sessions must see the change: they are not merged in the
+       * running builder, but start a new one once it stopped. The automatic
+       * session is interrupted, start another one. */
+      builder_->markStale();
+      dirty = true;
+    } else {
+      dirty = onFileChanged(target);
+    }
+  }
+
+  /* The lock of the graph must be released before scheduling an automatic
+   * build. */
+  if (dirty) {
+    scheduleAutoBuild();
+  }
+}
+
+bool DaemonInstance::applyPendingChanges() {
+  if (pendingChanges_.empty()) {
+    return false;
+  }
+  LOG(INFO) << "Applying " << pendingChanges_.size()
+            << " changes of files notified during the build";
+
+  bool dirty = false;
+  for (auto it = pendingChanges_.begin(); it != pendingChanges_.end(); ++it) {
+    try {
+      dirty |= onFileChanged(*it);
+    } catch (TargetNotFound& e) {
+      /* The graph was reloaded without this target. */
+    }
+  }
+  pendingChanges_.clear();
+  return dirty;
+}
+
+bool DaemonInstance::onFileChanged(const std::string& target) {
+  std::lock_guard<RWLock> g(graphLock_);
 
   if (target == config_->getJsonGraphFile()) {
     reloadGraph();
     falcon::GraphConsistencyChecker checker(graph_.get());
     checker.check();
-    return;
+    return true;
   }
 
   /* Find the target. */
@@ -261,12 +454,17 @@ void DaemonInstance::setDirty(const std::string& target) {
   if (!node->isSource() && node->getChild()->isPhony()) {
     /* This is a phony target. */
     node->markDirty();
-    return;
+    return true;
   }
 
   /* Stat the node. */
   struct stat st;
   if (stat(node->getPath().c_str(), &st) < 0) {
+    if (node->isDeferred()) {
+      /* The output was lazy fetched without being written, it is expected
+       * to be missing. */
+      return false;
+    }
     if (errno != ENOENT && errno != ENOTDIR) {
       LOG(WARNING) << "Failed to stat Node '" << node->getPath() << "'";
       DLOG(WARNING) << "stat(" << node->getPath()
@@ -295,7 +493,7 @@ void DaemonInstance::setDirty(const std::string& target) {
        * In either case, don't mark the output dirty. */
       if (node->getChild()->getTimestamp() >= st.st_mtime
           || (node->isLazyFetched() && node->getTimestamp() >= st.st_mtime)) {
-        return;
+        return false;
       }
     }
   }
@@ -315,12 +513,62 @@ void DaemonInstance::setDirty(const std::string& target) {
     if (!node->isSource()) {
       node->getChild()->setState(State::OUT_OF_DATE);
     }
+    return true;
+  }
+  return false;
+}
+
+void DaemonInstance::scheduleAutoBuild() {
+  if (config_->getAutoBuildDelay() == 0) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(autoBuildMutex_);
+  autoBuildPending_ = true;
+  lastChange_ = std::chrono::steady_clock::now();
+  autoBuildCond_.notify_one();
+}
+
+void DaemonInstance::autoBuildThread() {
+  const std::chrono::milliseconds delay(config_->getAutoBuildDelay());
+  std::unique_lock<std::mutex> lock(autoBuildMutex_);
+
+  while (!stopAutoBuild_) {
+    if (!autoBuildPending_) {
+      autoBuildCond_.wait(lock);
+      continue;
+    }
+
+    /* Wait for the user to stop editing files. */
+    auto deadline = lastChange_ + delay;
+    if (std::chrono::steady_clock::now() < deadline) {
+      autoBuildCond_.wait_until(lock, deadline);
+      continue;
+    }
+
+    autoBuildPending_ = false;
+
+    /* The files that change in the meantime schedule another build. */
+    lock.unlock();
+    try {
+      startSession(config_->getAutoBuildTargets(),
+                   config_->getAutoBuildJobs(), true, 0, true);
+      LOG(INFO) << "Started an automatic build.";
+    } catch (InvalidBuildError& e) {
+      LOG(WARNING) << "Cannot start an automatic build: " << e.desc;
+    }
+    lock.lock();
   }
 }
 
 void DaemonInstance::shutdown() {
   LOG(INFO) << "Shutting down.";
 
+  {
+    std::lock_guard<std::mutex> lock(autoBuildMutex_);
+    stopAutoBuild_ = true;
+    autoBuildCond_.notify_one();
+  }
+
   watchmanClient_.unwatchGraph(*graph_);
 
   /* Interrupt the current build. */
@@ -332,7 +580,7 @@ void DaemonInstance::shutdown() {
 }
 
 void DaemonInstance::getGraphviz(std::string& str) {
-  lock_guard g(mutex_);
+  ReadLock g(graphLock_);
 
   assert(graph_);
   std::ostringstream oss;
@@ -340,6 +588,38 @@ void DaemonInstance::getGraphviz(std::string& str) {
   str = oss.str();
 }
 
+void DaemonInstance::getCacheStats(std::string& str) {
+  std::ostringstream oss;
+  CacheStats::toJson(cache_->getStats().snapshot(), oss);
+  str = oss.str();
+}
+
+void DaemonInstance::getBuildLogOf(std::string& str,
+                                   const std::string& target) {
+  std::string output;
+  {
+    ReadLock g(graphLock_);
+    auto it = graph_->getNodes().find(target);
+    if (it == graph_->getNodes().end()) {
+      throw TargetNotFound();
+    }
+    /* The records are stored by the first output of the rule. */
+    Rule* rule = it->second->getChild();
+    if (rule != nullptr) {
+      output = rule->getOutputs()[0]->getPath();
+    }
+  }
+
+  BuildLog::Entry entry;
+  if (output.empty() || !buildLog_.find(output, entry)) {
+    str = "{ }";
+    return;
+  }
+  std::ostringstream oss;
+  BuildLog::toJson(entry, oss);
+  str = oss.str();
+}
+
 void DaemonInstance::reloadGraph() {
   GraphParser graphParser(config_->getJsonGraphFile());
 
@@ -361,6 +641,7 @@ void DaemonInstance::reloadGraph() {
   sourcesMissing_.clear();
   GraphReloader reloader(*graph_, *graphPtr, watchmanClient_);
   reloader.updateGraph();
+  buildLog_.applyHistory(graph_->getRules());
 }
 
 } // namespace falcon
@@ -7,25 +7,49 @@
 #define FALCON_DAEMON_INSTANCE_H_
 
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <thread>
+#include <vector>
 
 #include "FalconService.h"
+#include "admission_controller.h"
+#include "build_log.h"
 #include "build_plan.h"
 #include "cache_manager.h"
 #include "command_server.h"
 #include "graph.h"
 #include "graph_builder.h"
+#include "graph_parallel_builder.h"
 #include "graphparser.h"
 #include "options.h"
 #include "stream_server.h"
+#include "util/rw_lock.h"
 #include "watchman.h"
 
 namespace falcon {
 
 /**
  * Instance of the Falcon Daemon.
+ *
+ * Several builds can run at the same time: they are sessions of the same
+ * builder (see GraphParallelBuilder), which builds the rules they share once.
+ * A new builder is started when a build is requested while none is running.
+ *
+ * If auto-build-delay is set, the daemon starts building the auto-build
+ * targets by itself once no file changed for that delay. These automatic
+ * builds run few commands, with a low priority. A build requested by a client
+ * during an automatic build shares the rules it needs with it, and its
+ * commands run with the normal priority.
+ *
+ * The queries only take the lock of the graph for reading, and the builder
+ * releases it while the commands run, so they are answered during the builds.
+ * The changes of files notified during a build are applied once the builder
+ * stops, since the graph must not change under it.
  */
 class DaemonInstance {
  public:
@@ -48,7 +72,11 @@ class DaemonInstance {
    * See thrift/FalconService.thrift for a description of these commands. */
 
   StartBuildResult::type startBuild(const std::set<std::string>& targets,
-                                    int32_t numThreads, bool lazyFetch);
+                                    int32_t numThreads, bool lazyFetch,
+                                    int32_t maxFailures);
+  int32_t requestBuild(const std::set<std::string>& targets,
+                       int32_t numThreads, bool lazyFetch, int32_t maxFailures);
+  BuildStatus::type waitForBuild(int32_t buildId);
   FalconStatus::type getStatus();
   void getDirtySources(std::set<std::basic_string<char>>& sources);
   void getDirtyTargets(std::set<std::basic_string<char>>& targets);
@@ -59,13 +87,53 @@ class DaemonInstance {
   void interruptBuild();
   void shutdown();
   void getGraphviz(std::string& str);
+  void getCacheStats(std::string& str);
+  void getBuildLogOf(std::string& str, const std::string& target);
 
  private:
 
+  /** Start a build, as a new session of the running builder if there is one.
+   * @param automatic True for the automatic builds, which run with a lower
+   *                  priority and are interrupted when files change.
+   * @return Id of the build. */
+  unsigned int startSession(const std::set<std::string>& targets, int32_t numThreads,
+                    bool lazyFetch, int32_t maxFailures, bool automatic);
+
+  /** Start a new builder with a first session. Must be called with
+   * buildMutex_ held, when no builder is running.
+   * @param future Set to the future returned by
+   *               GraphParallelBuilder::addSession(). */
+  void startBuilder(const GraphParallelBuilder::SessionParams& params,
+                    std::future<std::string>& future);
+
+  /** Called when a build completes.
+   * @param buildId    Id of the build.
+   * @param cacheStats Cache stats when the build started. */
+  void onSessionCompleted(unsigned int buildId,
+                          const CacheStats::Snapshot& cacheStats,
+                          BuildResult res);
+
+  /** Called when the builder stops. */
   void onBuildCompleted(BuildResult res);
 
-  /** Wait for the current build to complete. */
-  void waitForBuild();
+  /** Process a change of a file notified by watchman. Return true if some
+   * targets became dirty. */
+  bool onFileChanged(const std::string& target);
+
+  /** Apply the changes of files that were notified during a build. Return
+   * true if some targets became dirty. Must be called with changesMutex_
+   * held, once the builder stopped. */
+  bool applyPendingChanges();
+
+  /** Start an automatic build once no file changed for auto-build-delay. */
+  void scheduleAutoBuild();
+
+  /** Thread that starts the automatic builds. */
+  void autoBuildThread();
+
+  /** Wait for the current builder to stop. Must be called with buildMutex_
+   * held, so that builder_ is not replaced in the meantime. */
+  void waitForBuilder();
 
   /** Check if any source file is missing. Throw an exception of type
    * InvalidGraphError if it is the case. */
@@ -79,16 +147,48 @@ class DaemonInstance {
   std::unique_ptr<GlobalConfig> config_;
   std::thread serverThread_;
 
+  /* Record of the commands run by the daemon. */
+  BuildLog buildLog_;
+
+  /* Decides when the builder can start more commands. */
+  AdmissionController admission_;
+
   std::unique_ptr<BuildPlan> plan_;
-  std::unique_ptr<IGraphBuilder> builder_;
+  std::unique_ptr<GraphParallelBuilder> builder_;
 
   WatchmanClient watchmanClient_;
 
   std::atomic_bool isBuilding_;
 
-  /* Mutex to protect concurrent access to graph_. */
-  std::mutex mutex_;
-  typedef std::lock_guard<std::mutex> lock_guard;
+  /* Serialize the builds started by the clients and the automatic ones. */
+  std::mutex buildMutex_;
+
+  /* Result of the latest builds, UNKNOWN while they are running. The oldest
+   * completed builds are forgotten. */
+  std::map<unsigned int, BuildResult> results_;
+  std::mutex resultsMutex_;
+  std::condition_variable resultsCond_;
+
+  /* Protect the state of the automatic builds below. */
+  std::mutex autoBuildMutex_;
+  std::condition_variable autoBuildCond_;
+  /* Set to true if some files changed since the last automatic build. */
+  bool autoBuildPending_;
+  /* Time of the last change of a file. */
+  std::chrono::steady_clock::time_point lastChange_;
+  bool stopAutoBuild_;
+  std::thread autoBuildThread_;
+
+  /* Lock to protect concurrent access to graph_. The queries take it for
+   * reading. */
+  RWLock graphLock_;
+
+  /* Files that changed while a builder was running, and whether a builder is
+   * running. builder_ is replaced with this lock and buildMutex_ held: either
+   * of them is enough to use it. */
+  std::mutex changesMutex_;
+  std::vector<std::string> pendingChanges_;
+  bool deferChanges_;
 
   StreamServer streamServer_;
 
@@ -3,8 +3,11 @@
  * LICENSE : see accompanying LICENSE file for details.
  */
 
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "fs.h"
 #include "exceptions.h"
@@ -15,7 +18,8 @@ namespace falcon { namespace fs {
 bool mkdir(const std::string& path) {
   struct stat sb;
   if (stat(path.c_str(), &sb) != 0) {
-    if (::mkdir(path.c_str(), 0777) != 0) {
+    /* Another thread may have created it in the meantime. */
+    if (::mkdir(path.c_str(), 0777) != 0 && errno != EEXIST) {
       LOG(ERROR) << "Cannot create directory " << path;
       return false;
     }
@@ -62,4 +66,71 @@ bool createPath(const std::string& path) {
   return mkdir(dir);
 }
 
+bool copyFile(const std::string& from, const std::string& to) {
+  int in = open(from.c_str(), O_RDONLY);
+  if (in < 0) {
+    return false;
+  }
+  int out = open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (out < 0) {
+    close(in);
+    return false;
+  }
+
+  bool success = true;
+  char buf[64 << 10];
+  for (;;) {
+    ssize_t len = read(in, buf, sizeof(buf));
+    if (len < 0 && errno == EINTR) {
+      continue;
+    }
+    if (len <= 0) {
+      success = len == 0;
+      break;
+    }
+    char* ptr = buf;
+    while (len > 0) {
+      ssize_t w = write(out, ptr, len);
+      if (w < 0 && errno == EINTR) {
+        continue;
+      }
+      if (w < 0) {
+        success = false;
+        break;
+      }
+      ptr += w;
+      len -= w;
+    }
+    if (!success) {
+      break;
+    }
+  }
+
+  close(in);
+  if (close(out) < 0) {
+    success = false;
+  }
+  return success;
+}
+
+bool getModificationTime(const std::string& path, uint64_t& mtime) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    return false;
+  }
+  mtime = static_cast<uint64_t>(st.st_mtim.tv_sec) * 1000000000
+        + st.st_mtim.tv_nsec;
+  return true;
+}
+
+bool touch(const std::string& path) {
+  return utimensat(AT_FDCWD, path.c_str(), NULL, 0) == 0;
+}
+
+uint64_t currentTime() {
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return static_cast<uint64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
 } } //namespace falcon::fs
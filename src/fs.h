@@ -6,6 +6,7 @@
 #ifndef FALCON_FS_H_
 #define FALCON_FS_H_
 
+#include <cstdint>
 #include <string>
 
 namespace falcon { namespace fs {
@@ -29,6 +30,36 @@ bool createPath(const std::string& path);
  */
 std::string dirname(const std::string& path);
 
+/**
+ * Copy the content of a file to another file. The destination is created or
+ * truncated.
+ * @param from Path of the file to be copied.
+ * @param to   Path of the destination.
+ * @return true on success, false on error.
+ */
+bool copyFile(const std::string& from, const std::string& to);
+
+/**
+ * Get the modification time of a file.
+ * @param path  Path of the file.
+ * @param mtime Filled with the modification time in nanoseconds since the
+ *              epoch.
+ * @return true on success, false if the file cannot be stat'ed.
+ */
+bool getModificationTime(const std::string& path, uint64_t& mtime);
+
+/**
+ * Set the modification time of an existing file to the current time.
+ * @param path Path of the file.
+ * @return true on success, false on error.
+ */
+bool touch(const std::string& path);
+
+/**
+ * Get the current time, in the unit of getModificationTime().
+ */
+uint64_t currentTime();
+
 } } //namespace falcon::fs
 
 #endif // FALCON_FS_H_
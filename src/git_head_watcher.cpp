@@ -0,0 +1,106 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "git_head_watcher.h"
+
+#include "logging.h"
+
+namespace falcon {
+
+/* Interval between two checks of HEAD. */
+static const std::chrono::milliseconds kPollInterval(500);
+
+GitHeadWatcher::GitHeadWatcher(const std::string& gitDir, Callback callback)
+    : gitDir_(gitDir)
+    , callback_(callback)
+    , stopped_(false) { }
+
+GitHeadWatcher::~GitHeadWatcher() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopped_ = true;
+  }
+  cond_.notify_all();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void GitHeadWatcher::start() {
+  thread_ = std::thread(&GitHeadWatcher::run, this);
+}
+
+bool GitHeadWatcher::readHeadRef(const std::string& gitDir, std::string& ref) {
+  std::ifstream ifs(gitDir + "/HEAD");
+  std::string line;
+  if (!std::getline(ifs, line)) {
+    return false;
+  }
+  /* A symbolic reference is stored as "ref: refs/heads/<branch>", a detached
+   * HEAD as a commit id. */
+  static const std::string kPrefix = "ref: ";
+  if (line.compare(0, kPrefix.size(), kPrefix) != 0) {
+    return false;
+  }
+  ref = line.substr(kPrefix.size());
+  return !ref.empty();
+}
+
+static void appendStat(const std::string& path, std::ostringstream& oss) {
+  struct stat st;
+  if (stat(path.c_str(), &st) < 0) {
+    oss << "-;";
+    return;
+  }
+  oss << st.st_ino << ":" << st.st_size << ":" << st.st_mtim.tv_sec << "."
+      << st.st_mtim.tv_nsec << ";";
+}
+
+std::string GitHeadWatcher::signature(std::string& ref) const {
+  std::ostringstream oss;
+  appendStat(gitDir_ + "/HEAD", oss);
+  if (readHeadRef(gitDir_, ref)) {
+    oss << ref << ";";
+    /* The reference is either a loose file or in packed-refs. */
+    appendStat(gitDir_ + "/" + ref, oss);
+    appendStat(gitDir_ + "/packed-refs", oss);
+  } else {
+    ref.clear();
+  }
+  return oss.str();
+}
+
+void GitHeadWatcher::run() {
+  std::string ref;
+  std::string last = signature(ref);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stopped_) {
+    cond_.wait_for(lock, kPollInterval);
+    if (stopped_) {
+      break;
+    }
+    lock.unlock();
+
+    std::string current = signature(ref);
+    if (current != last) {
+      last = current;
+      if (!ref.empty()) {
+        LOG(INFO) << "git HEAD moved to " << ref;
+        callback_(ref);
+      }
+    }
+
+    lock.lock();
+  }
+}
+
+} // namespace falcon
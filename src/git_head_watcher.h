@@ -0,0 +1,71 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#ifndef FALCON_GIT_HEAD_WATCHER_H_
+#define FALCON_GIT_HEAD_WATCHER_H_
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace falcon {
+
+/**
+ * Watch the HEAD of a git repository from a background thread and call a
+ * function each time it moves to a reference, ie after a checkout or a commit.
+ *
+ * The files are polled with stat(), which is cheap and works on any file
+ * system. HEAD is rewritten with a rename when switching branches, and the
+ * file of the current reference when committing on it, so comparing the
+ * inode, size and modification time of both is enough.
+ */
+class GitHeadWatcher {
+ public:
+  /** Called from the watcher thread with the name of the new reference, eg
+   * "refs/heads/master". Not called when HEAD is detached. */
+  typedef std::function<void(const std::string& ref)> Callback;
+
+  /**
+   * @param gitDir   The .git directory of the repository.
+   * @param callback Function to call when HEAD changes.
+   */
+  GitHeadWatcher(const std::string& gitDir, Callback callback);
+
+  /** Stop the thread. */
+  ~GitHeadWatcher();
+
+  /** Start the watcher thread. */
+  void start();
+
+  /**
+   * Read the reference HEAD points to.
+   * @return false if HEAD could not be read or is detached.
+   */
+  static bool readHeadRef(const std::string& gitDir, std::string& ref);
+
+ private:
+  void run();
+
+  /** Describe the current state of HEAD and of the reference it points to.
+   * The result changes whenever either file is rewritten. */
+  std::string signature(std::string& ref) const;
+
+  std::string gitDir_;
+  Callback callback_;
+
+  std::thread thread_;
+  bool stopped_;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+
+  GitHeadWatcher(const GitHeadWatcher& other) = delete;
+  GitHeadWatcher& operator=(const GitHeadWatcher&) = delete;
+};
+
+} // namespace falcon
+
+#endif // FALCON_GIT_HEAD_WATCHER_H_
@@ -25,6 +25,7 @@ Node::Node(const std::string& path, bool isExplicitDependency)
   , hash_()
   , childRule_(nullptr)
   , isExplicitDependency_(isExplicitDependency)
+  , contentMtime_(0)
   , state_(State::UP_TO_DATE)
   , timestamp_(0) { }
 
@@ -62,7 +63,11 @@ bool Node::isExplicitDependency() const { return isExplicitDependency_; }
 
 State const& Node::getState() const { return state_; }
 State&       Node::getState()       { return state_; }
-void Node::setState(State state) { state_ = state; isLazyFetched_ = false; }
+void Node::setState(State state) {
+  state_ = state;
+  isLazyFetched_ = false;
+  deferredDigest_.clear();
+}
 bool Node::isDirty() const { return state_ == State::OUT_OF_DATE; }
 
 void Node::markDirty() {
@@ -94,6 +99,19 @@ std::string& Node::getHashDepfile() { return hashDepfile_; }
 bool Node::isLazyFetched() const { return isLazyFetched_; }
 void Node::setLazyFetched(bool val) { isLazyFetched_ = val; }
 
+bool Node::isDeferred() const { return !deferredDigest_.empty(); }
+const std::string& Node::getDeferredDigest() const { return deferredDigest_; }
+void Node::setDeferredDigest(const std::string& digest) {
+  deferredDigest_ = digest;
+}
+
+const std::string& Node::getContentDigest() const { return contentDigest_; }
+uint64_t Node::getContentMtime() const { return contentMtime_; }
+void Node::setContentDigest(const std::string& digest, uint64_t mtime) {
+  contentDigest_ = digest;
+  contentMtime_ = mtime;
+}
+
 bool Node::operator==(Node const& n) const { return getPath() == n.getPath(); }
 bool Node::operator!=(Node const& n) const { return getPath() != n.getPath(); }
 
@@ -107,7 +125,15 @@ Rule::Rule(const NodeArray& inputs, const NodeArray& outputs)
   , numImplicitDeps_(0)
   , state_(State::UP_TO_DATE)
   , timestamp_(0)
+  , duration_(0)
+  , maxRss_(0)
   , numInputsReady_(0)
+  , planId_(0)
+  , planVisitId_(0)
+  , planPriority_(0)
+  , planPendingDependents_(0)
+  , planReady_(false)
+  , planFailed_(false)
 { }
 
 const NodeArray& Rule::getInputs() const { return inputs_; }
@@ -138,6 +164,9 @@ const bool Rule::hasDepfile() const { return !depfile_.empty(); }
 const std::string& Rule::getDepfile() const { return depfile_; }
 void Rule::setDepfile(const std::string& depfile) { depfile_ = depfile; }
 
+const std::string& Rule::getPool() const { return pool_; }
+void Rule::setPool(const std::string& pool) { pool_ = pool; }
+
 State const& Rule::getState() const { return state_; }
 State&       Rule::getState()       { return state_; }
 bool Rule::isDirty() const { return state_ == State::OUT_OF_DATE; }
@@ -162,6 +191,17 @@ std::string& Rule::getHashDepfile() { return hashDepfile_; }
 Timestamp Rule::getTimestamp() const { return timestamp_; }
 void Rule::setTimestamp(Timestamp t) { timestamp_ = t; }
 
+uint64_t Rule::getDuration() const { return duration_; }
+void Rule::setDuration(uint64_t ms) { duration_ = ms; }
+
+uint64_t Rule::getMaxRss() const { return maxRss_; }
+void Rule::setMaxRss(uint64_t kb) { maxRss_ = kb; }
+
+const std::string& Rule::getInputsDigest() const { return inputsDigest_; }
+void Rule::setInputsDigest(const std::string& digest) {
+  inputsDigest_ = digest;
+}
+
 bool Rule::ready() const { return numInputsReady_ == inputs_.size(); }
 size_t Rule::numReady() const { return numInputsReady_; }
 void Rule::markInputReady() {
@@ -215,4 +255,7 @@ NodeMap& Graph::getNodes() { return nodes_; }
 const RuleArray& Graph::getRules() const { return rules_; }
 RuleArray& Graph::getRules() { return rules_; }
 
+const PoolMap& Graph::getPools() const { return pools_; }
+PoolMap& Graph::getPools() { return pools_; }
+
 } // namespace falcon
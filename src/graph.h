@@ -6,6 +6,7 @@
 #ifndef FALCON_GRAPH_H_
 # define FALCON_GRAPH_H_
 
+# include <cstdint>
 # include <set>
 # include <string>
 # include <vector>
@@ -42,6 +43,7 @@ typedef std::set<Node*>                        NodeSet;
 typedef std::unordered_map<std::string, Node*> NodeMap;
 typedef std::vector<Rule*>                     RuleArray;
 typedef std::set<Rule*>                        RuleSet;
+typedef std::unordered_map<std::string, unsigned int> PoolMap;
 
 typedef std::time_t                            Timestamp;
 
@@ -107,6 +109,22 @@ class Node {
    * false. */
   void setLazyFetched(bool val);
 
+  /** Return true if the content of this node is in cache but was not written
+   * in the workspace yet (see deferredDigest_). */
+  bool isDeferred() const;
+  const std::string& getDeferredDigest() const;
+  /** Record that the node can be restored from the cache blob with the given
+   * digest, or clear it with an empty string.
+   * Note: any call to setState() that follows will clear it. */
+  void setDeferredDigest(const std::string& digest);
+
+  /** Digest of the content of the node when it was last generated by its
+   * rule, and the modification time of the file at that time (see
+   * contentDigest_). Empty if unknown. */
+  const std::string& getContentDigest() const;
+  uint64_t getContentMtime() const;
+  void setContentDigest(const std::string& digest, uint64_t mtime);
+
   /* Operators */
   bool operator==(Node const& n) const;
   bool operator!=(Node const& n) const;
@@ -141,6 +159,18 @@ class Node {
    * in building this node are potentially dirty. */
   bool isLazyFetched_;
 
+  /* If not empty, this node was lazy fetched without being written in the
+   * workspace: its content is the cache blob with this digest. It is written
+   * when a rule that needs it is about to run. */
+  std::string deferredDigest_;
+
+  /* Digest of the content of this node the last time its rule ran, used to
+   * skip the rules that depend on it if the content did not change. It is
+   * only valid while the modification time of the file is contentMtime_: the
+   * file may have been modified since, or written from the cache. */
+  std::string contentDigest_;
+  uint64_t contentMtime_;
+
   State state_;
   Timestamp timestamp_;
 
@@ -180,6 +210,11 @@ class Rule {
   const std::string& getDepfile() const;
   void setDepfile(const std::string& depfile);
 
+  /** Name of the pool the rule belongs to, see Graph::getPools(). Empty if the
+   * rule is not part of a pool. */
+  const std::string& getPool() const;
+  void setPool(const std::string& pool);
+
   /* State management */
   State const& getState() const;
   State& getState();
@@ -200,6 +235,21 @@ class Rule {
   Timestamp getTimestamp() const;
   void setTimestamp(Timestamp);
 
+  /** Duration in milliseconds of the last successful run of the command, or 0
+   * if it never ran. */
+  uint64_t getDuration() const;
+  void setDuration(uint64_t ms);
+
+  /** Peak RSS in kilobytes of the last successful run of the command, or 0 if
+   * it never ran. */
+  uint64_t getMaxRss() const;
+  void setMaxRss(uint64_t kb);
+
+  /** Digest of the command and of the content of the inputs the last time the
+   * command succeeded, or empty if unknown. */
+  const std::string& getInputsDigest() const;
+  void setInputsDigest(const std::string& digest);
+
   /** Return True if this rule is ready (ie all its inputs are up to date).
    * This means the rule can safely be built. */
   bool ready() const;
@@ -234,6 +284,10 @@ class Rule {
   /** Path to the file that contains the implicit dependenciess. */
   std::string depfile_;
 
+  /** Name of the pool that limits how many rules like this one can run at the
+   * same time. Empty if there is no limit. */
+  std::string pool_;
+
   /* Set to UP_TO_DATE if all outputs are UP_TO_DATE, OUT_OF_DATE otherwise. */
   State state_;
 
@@ -248,6 +302,19 @@ class Rule {
   /* The timestamp of a rule is the last time it was built. */
   Timestamp timestamp_;
 
+  /* How long the command took to run the last time it was built, in
+   * milliseconds. Used to schedule the longest chains of rules first. */
+  uint64_t duration_;
+
+  /* Peak RSS of the command the last time it was built, in kilobytes. Used to
+   * avoid running commands that would not fit in memory together. */
+  uint64_t maxRss_;
+
+  /* Digest of the command and of the content of the inputs the last time the
+   * command succeeded. If it is the same when the rule is about to run again,
+   * the outputs would be the same and the rule can be skipped. */
+  std::string inputsDigest_;
+
   /* Number of inputs that are ready. A ready input is a input that has been
    * built, or a soure file. (Indeed, a source file is always ready, even if it
    * is dirty).
@@ -255,9 +322,24 @@ class Rule {
    * equals inputs_.size(). */
   std::size_t numInputsReady_;
 
+  /* Bookkeeping of the BuildPlan this rule is part of: the id of the plan, the
+   * priority of the rule in it, the number of rules of the plan that depend on
+   * this rule and whose priority is not computed yet, whether the rule was
+   * added to the ready rules (or removed from the plan because it depends on a
+   * rule that failed), and whether it failed or depends on a rule that failed.
+   * Only valid if planId_ is the id of the plan. planVisitId_ is the id of the
+   * last traversal of the plan that visited the rule. */
+  unsigned int planId_;
+  unsigned int planVisitId_;
+  uint64_t planPriority_;
+  std::size_t planPendingDependents_;
+  bool planReady_;
+  bool planFailed_;
+
   Rule(const Rule& other) = delete;
   Rule& operator=(const Rule&) = delete;
 
+  friend class BuildPlan;
   friend class GraphReloader;
 };
 
@@ -285,6 +367,11 @@ class Graph {
   const RuleArray& getRules() const;
   RuleArray& getRules();
 
+  /** Pools of rules, mapped to their depth, ie the maximum number of rules of
+   * the pool that can run at the same time. */
+  const PoolMap& getPools() const;
+  PoolMap& getPools();
+
  private:
 
   /* Contains all the root nodes, ie the nodes that are not an input to any
@@ -300,6 +387,9 @@ class Graph {
   /* Contains all the rules */
   RuleArray rules_;
 
+  /* Contains the pools, with their depth. */
+  PoolMap pools_;
+
   Graph(const Graph& other) = delete;
   Graph& operator=(const Graph&) = delete;
 
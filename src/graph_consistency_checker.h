@@ -6,11 +6,10 @@
 #ifndef FALCON_GRAPH_CONSISTENCY_CHECKER_H_
 #define FALCON_GRAPH_CONSISTENCY_CHECKER_H_
 
-#include <mutex>
-
 #include "graph.h"
 
 #include "logging.h"
+#include "util/rw_lock.h"
 
 namespace falcon {
 
@@ -67,7 +66,7 @@ private:
 #if defined (DEBUG)
 # define FALCON_CHECK_GRAPH_CONSISTENCY(__graph__, __mutex__) \
 {                                                             \
-  std::lock_guard<std::mutex> lock(__mutex__);                \
+  falcon::ReadLock lock(__mutex__);                           \
   falcon::GraphConsistencyChecker checker(__graph__);         \
   checker.check();                                            \
 }
@@ -6,12 +6,12 @@
 #include <iostream>
 
 #include <fstream>
-#include <openssl/sha.h>
 #include <cassert>
 #include <cstring>
 
 #include "graph.h"
 #include "graph_hash.h"
+#include "util/hasher.h"
 
 #include "cache_manager.h"
 #include "depfile.h"
@@ -20,32 +20,6 @@
 
 namespace falcon { namespace hash {
 
-class Hasher {
- public:
-  Hasher() {
-    SHA256_Init(&ctx_);
-  }
-
-  Hasher& operator<<(const std::string& data) {
-    SHA256_Update(&ctx_, data.c_str(), data.size());
-    return *this;
-  }
-
-  std::string get() {
-    SHA256_Final(digest_, &ctx_);
-    char mdString[SHA256_DIGEST_LENGTH*2 + 1];
-    memset(mdString, 0, sizeof(mdString));
-    for (int i = 0; i < SHA256_DIGEST_LENGTH; i++) {
-      sprintf(&mdString[i*2], "%02x", (unsigned int)digest_[i]);
-    }
-    return mdString;
-  }
-
- private:
-  SHA256_CTX ctx_;
-  unsigned char digest_[SHA256_DIGEST_LENGTH];
-};
-
 bool updateNodeHash(Node& n,
                     bool recomputeHash,
                     bool recomputeHashDeps) {
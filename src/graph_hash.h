@@ -6,7 +6,19 @@
 #ifndef FALCON_GRAPH_HASH_H_
 #define FALCON_GRAPH_HASH_H_
 
-namespace falcon { namespace hash {
+#include <string>
+
+#include "util/hasher.h"
+
+namespace falcon {
+
+class CacheManager;
+class Graph;
+class Node;
+class Rule;
+class WatchmanClient;
+
+namespace hash {
 
 /* Update the Node hash:
  * if it is a leaf, then compute the new hash. Else get the Child's hash.
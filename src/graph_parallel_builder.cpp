@@ -3,37 +3,54 @@
  * LICENSE : see accompanying LICENSE file for details.
  */
 
+#include <algorithm>
 #include <iostream>
+#include <sys/stat.h>
 
 #include "graph_parallel_builder.h"
 #include "depfile.h"
 #include "fs.h"
 #include "graph_hash.h"
+#include "lazy_cache.h"
 #include "logging.h"
 
 namespace falcon {
 
+/* Number of threads hashing the outputs of the rules that were built. */
+static const std::size_t kNumHashThreads = 2;
+
 GraphParallelBuilder::GraphParallelBuilder(Graph& graph,
                                            BuildPlan& plan,
                                            CacheManager* cache,
+                                           BuildLog* buildLog,
+                                           AdmissionController* admission,
                                            IBuildOutputConsumer* consumer,
                                            WatchmanClient* watchmanClient,
                                            std::string const& workingDirectory,
-                                           std::size_t numThreads,
-                                           std::mutex& mutex,
+                                           bool deferMaterialization,
+                                           RWLock& lock,
                                            onBuildCompletedFn callback)
     : graph_(graph)
     , plan_(plan)
     , cache_(cache)
+    , buildLog_(buildLog)
+    , admission_(admission)
     , consumer_(consumer)
     , manager_(consumer)
     , watchmanClient_(watchmanClient)
     , workingDirectory_(workingDirectory)
-    , numThreads_(numThreads)
+    , deferMaterialization_(deferMaterialization)
     , result_(BuildResult::SUCCEEDED)
-    , lock_(mutex, std::defer_lock)
+    , numFailures_(0)
+    , accepting_(true)
+    , numUnchanged_(0)
+    , numWaiting_(0)
+    , numHashing_(0)
+    , lock_(lock, std::defer_lock)
     , interrupted_(false)
-    , callback_(callback) {}
+    , stale_(false)
+    , callback_(callback)
+    , hasher_(kNumHashThreads, 0) {}
 
 GraphParallelBuilder::~GraphParallelBuilder() {
   /* Make sure the thread finishes before going out of scope. */
@@ -49,6 +66,7 @@ void GraphParallelBuilder::startBuild() {
 void GraphParallelBuilder::interrupt() {
   interrupted_ = true;
   manager_.interrupt();
+  manager_.wakeUp();
 }
 
 void GraphParallelBuilder::wait() {
@@ -57,94 +75,492 @@ void GraphParallelBuilder::wait() {
   }
 }
 
+void GraphParallelBuilder::markStale() {
+  if (!stale_.exchange(true)) {
+    LOG(INFO) << "Files changed during the build, no longer saving in cache";
+  }
+  {
+    std::lock_guard<std::mutex> lock(requestsMutex_);
+    accepting_ = false;
+  }
+
+  /* The build thread interrupts the automatic sessions. */
+  manager_.wakeUp();
+}
+
+std::future<std::string>
+GraphParallelBuilder::addSession(const SessionParams& params) {
+  std::lock_guard<std::mutex> lock(requestsMutex_);
+  if (!accepting_) {
+    return std::future<std::string>();
+  }
+  requests_.push_back(Request());
+  requests_.back().params = params;
+  std::future<std::string> future = requests_.back().promise.get_future();
+
+  /* The build thread may be waiting for a command to complete. */
+  manager_.wakeUp();
+  return future;
+}
+
 void GraphParallelBuilder::buildThread() {
-  /* TODO: improve locking mechanism so that the whole graph is not locked while
-   * building. */
   lock_.lock();
 
+  if (admission_) {
+    admission_->startBuild();
+  }
+
   /* Main build loop. */
-  while (result_ == BuildResult::SUCCEEDED
-      && !plan_.done() && !interrupted_) {
+  while (true) {
+    processRequests();
+    if (stale_) {
+      /* The automatic sessions would build outdated targets. Another one is
+       * started once the changes are applied. */
+      endAutomaticSessions();
+    }
+    endCompletedSessions();
+
+    if (sessions_.empty()) {
+      std::lock_guard<std::mutex> lock(requestsMutex_);
+      if (requests_.empty()) {
+        /* The sessions added from now on need a new builder. */
+        accepting_ = false;
+        break;
+      }
+      continue;
+    }
+    if (interrupted_) {
+      break;
+    }
+
+    /* Look up all the ready rules in the cache at once. */
+    if (plan_.hasWork()) {
+      startReadyRules();
+      endCompletedSessions();
+    }
 
-    /* Try to spawn as many ready commands as possible. */
-    while (plan_.hasWork() && manager_.nbRunning() < numThreads_) {
-      Rule *rule = plan_.findWork();
-      assert(rule);
+    /* Try to spawn as many commands as possible. The admission controller may
+     * hold back the next rule until a command completes. */
+    std::size_t numThreads = getNumThreads();
+    while (!toBuild_.empty() && manager_.nbRunning() < numThreads) {
+      Rule *rule = toBuild_.top().second;
+      if (isPoolFull(rule)) {
+        /* Let the other rules run. This one goes back to toBuild_ when a rule
+         * of its pool completes. */
+        pools_[rule->getPool()].waiting.push(toBuild_.top());
+        toBuild_.pop();
+        numWaiting_++;
+        continue;
+      }
+      if (admission_ && !admission_->admit(rule)) {
+        break;
+      }
+      toBuild_.pop();
       buildRule(rule);
     }
 
-    /* We cannot run any more work. Wait for a command to complete. */
-    if (manager_.nbRunning() > 0) {
-      result_ = waitForNext();
+    if (manager_.nbRunning() > 0 || numHashing_ > 0) {
+      /* We cannot run any more work. Wait for a command to complete, for
+       * outputs to be hashed, or for a new session. */
+      waitForCommand();
+    } else if (!plan_.hasWork() && !sessions_.empty()) {
+      /* Nothing can make progress, this should not happen. */
+      LOG(ERROR) << "The build cannot make progress";
+      result_ = BuildResult::FAILED;
+      break;
     }
   }
 
-  /* Flush the process manager. */
-  while (manager_.nbRunning() > 0) {
-    BuildResult tmp = waitForNext();
-    if (result_ == BuildResult::SUCCEEDED) {
-      result_ = tmp;
-    }
+  if (stale_ && sessions_.empty() && manager_.nbRunning() > 0) {
+    /* No session needs the commands that still run, and their outputs would
+     * be outdated. */
+    LOG(INFO) << "Killing the commands of the interrupted sessions";
+    manager_.interrupt();
+  }
+
+  /* Flush the process manager and the hasher. */
+  while (manager_.nbRunning() > 0 || numHashing_ > 0) {
+    waitForCommand();
+  }
+
+  endAllSessions(interrupted_ ? BuildResult::INTERRUPTED : BuildResult::FAILED);
+
+  if (numFailures_ > 0) {
+    LOG(INFO) << numFailures_ << " rules failed";
+  }
+  if (numUnchanged_ > 0) {
+    LOG(INFO) << "Skipped " << numUnchanged_
+              << " rules whose inputs did not change";
   }
 
   lock_.unlock();
+
+  /* Wait for the outputs to be copied in cache. This is done without holding
+   * the lock, and must complete before the next build can modify them. */
+  if (cache_) {
+    cache_->flush();
+  }
+
   if (callback_) {
     callback_(result_);
   }
 }
 
-void GraphParallelBuilder::buildRule(Rule* rule) {
-  if (rule->isPhony()) {
-    /* A phony target, nothing to do. */
-    onRuleFinished(rule);
+void GraphParallelBuilder::processRequests() {
+  std::list<Request> requests;
+  {
+    std::lock_guard<std::mutex> lock(requestsMutex_);
+    requests.swap(requests_);
+  }
+
+  /* The sessions that were added while the builder was busy are coalesced:
+   * the union of their targets is fetched from the cache and merged in the
+   * plan at once. */
+  NodeSet allTargets;
+  NodeSet fetchTargets;
+  BuildIds allIds;
+  BuildIds fetchIds;
+  for (auto it = requests.begin(); it != requests.end(); ) {
+    const SessionParams& params = it->params;
+    std::string error;
+    if (interrupted_) {
+      error = "The build was interrupted";
+    } else {
+      findTargets(params, it->targets, error);
+    }
+    if (!error.empty()) {
+      it->promise.set_value(error);
+      it = requests.erase(it);
+      continue;
+    }
+
+    allTargets.insert(it->targets.begin(), it->targets.end());
+    allIds.push_back(params.id);
+    if (params.lazyFetch) {
+      fetchTargets.insert(it->targets.begin(), it->targets.end());
+      fetchIds.push_back(params.id);
+    }
+    ++it;
+  }
+  if (requests.empty()) {
     return;
   }
+  if (requests.size() > 1) {
+    LOG(INFO) << "Coalesced " << requests.size() << " build requests";
+  }
 
-  /* Create all the directories for the outputs. */
-  auto& outputs = rule->getOutputs();
-  for (auto it = outputs.begin(); it != outputs.end(); ++it) {
-    /* TODO: we could end the build immediately if this fails. */
-    if (!fs::createPath((*it)->getPath())) {
-      LOG(ERROR) << "could not create path " << (*it)->getPath();
+  if (cache_) {
+    /* The lazy fetch marks the nodes it retrieves up to date, it cannot run
+     * while some of them are being built. */
+    if (!fetchTargets.empty() && isIdle()) {
+      LazyCache lazyCache(fetchTargets, *cache_, consumer_, fetchIds,
+                          deferMaterialization_);
+      lazyCache.fetch();
     }
+    /* The targets the user asks for must be in the workspace, even if they
+     * were deferred by a previous build. */
+    LazyCache lazyCache(allTargets, *cache_, consumer_, allIds,
+                        deferMaterialization_);
+    lazyCache.materializeTargets();
   }
 
-  /* Create the directory for the depfile. */
-  if (rule->hasDepfile() && !fs::createPath(rule->getDepfile())) {
-    LOG(ERROR) << "could not create path " << rule->getDepfile();
+  /* Plan all the new rules at once, so that the priorities are computed once.
+   * Merging the targets of each session then only collects its rules. */
+  RuleArray allRules;
+  plan_.merge(allTargets, allRules);
+
+  for (auto it = requests.begin(); it != requests.end(); ++it) {
+    const SessionParams& params = it->params;
+    RuleArray rules;
+    plan_.merge(it->targets, rules);
+
+    sessions_.push_back(Session());
+    Session& session = sessions_.back();
+    session.params = params;
+    session.numFailures = 0;
+    for (auto itRule = rules.begin(); itRule != rules.end(); ++itRule) {
+      if (plan_.hasFailed(*itRule)) {
+        /* A previous session already failed to build this rule. */
+        session.numFailures++;
+      } else {
+        session.pending.insert(*itRule);
+      }
+    }
+    LOG(INFO) << "Started build " << params.id << " with " << rules.size()
+              << " rules to build";
+    it->promise.set_value("");
   }
+}
 
-  if (tryBuildRuleFromCache(rule)) {
-    /* We managed to retrieve all the outputs from the cache. */
-    onRuleFinished(rule);
+bool GraphParallelBuilder::findTargets(const SessionParams& params,
+                                       NodeSet& targets, std::string& error) {
+  if (params.targets.empty()) {
+    targets = graph_.getRoots();
+    return true;
+  }
+  for (auto it = params.targets.begin(); it != params.targets.end(); ++it) {
+    auto itFind = graph_.getNodes().find(*it);
+    if (itFind == graph_.getNodes().end()) {
+      error = "Unknown target " + *it;
+      return false;
+    }
+    targets.insert(itFind->second);
+  }
+  return true;
+}
+
+bool GraphParallelBuilder::isIdle() const {
+  return plan_.done() && toBuild_.empty() && numWaiting_ == 0
+      && manager_.nbRunning() == 0 && numHashing_ == 0;
+}
+
+void GraphParallelBuilder::endCompletedSessions() {
+  for (auto it = sessions_.begin(); it != sessions_.end(); ) {
+    const SessionParams& params = it->params;
+    bool failed = it->numFailures > 0;
+    bool stop = params.maxFailures > 0
+      && it->numFailures >= params.maxFailures;
+    if (!it->pending.empty() && !stop) {
+      ++it;
+      continue;
+    }
+    BuildResult res = failed ? BuildResult::FAILED : BuildResult::SUCCEEDED;
+    if (failed) {
+      result_ = res;
+    }
+    if (params.callback) {
+      params.callback(res);
+    }
+    it = sessions_.erase(it);
+  }
+}
+
+void GraphParallelBuilder::endAllSessions(BuildResult result) {
+  for (auto it = sessions_.begin(); it != sessions_.end(); ++it) {
+    result_ = result;
+    if (it->params.callback) {
+      it->params.callback(result);
+    }
+  }
+  sessions_.clear();
+
+  std::lock_guard<std::mutex> lock(requestsMutex_);
+  accepting_ = false;
+  for (auto it = requests_.begin(); it != requests_.end(); ++it) {
+    it->promise.set_value("The build was interrupted");
+  }
+  requests_.clear();
+}
+
+void GraphParallelBuilder::endAutomaticSessions() {
+  for (auto it = sessions_.begin(); it != sessions_.end(); ) {
+    if (!it->params.automatic) {
+      ++it;
+      continue;
+    }
+    LOG(INFO) << "Interrupting automatic build " << it->params.id;
+    if (it->params.callback) {
+      it->params.callback(BuildResult::INTERRUPTED);
+    }
+    it = sessions_.erase(it);
+  }
+}
+
+BuildIds GraphParallelBuilder::sessionsOf(const Rule* rule) const {
+  BuildIds ids;
+  for (auto it = sessions_.begin(); it != sessions_.end(); ++it) {
+    if (it->pending.count(const_cast<Rule*>(rule))) {
+      ids.push_back(it->params.id);
+    }
+  }
+  return ids;
+}
+
+std::size_t GraphParallelBuilder::getNumThreads() const {
+  std::size_t numThreads = 1;
+  for (auto it = sessions_.begin(); it != sessions_.end(); ++it) {
+    numThreads = std::max(numThreads, it->params.numThreads);
+  }
+  return numThreads;
+}
+
+void GraphParallelBuilder::startReadyRules() {
+  RuleArray rules;
+
+  /* Completing a phony rule may make other rules ready, keep going until
+   * there is nothing left. */
+  while (plan_.hasWork()) {
+    Rule *rule = plan_.findWork();
+    assert(rule);
+
+    if (rule->isPhony()) {
+      /* A phony target, nothing to do. */
+      onRuleFinished(rule);
+      continue;
+    }
+
+    if (isUnchanged(rule)) {
+      /* The inputs that were rebuilt have the same content as before: the
+       * outputs would be the same. */
+      numUnchanged_++;
+      if (cache_ && !stale_) {
+        /* The hash of the rule changed, save the outputs under the new one. */
+        cache_->saveRule(rule);
+      }
+      onRuleFinished(rule);
+      continue;
+    }
+
+    /* Create all the directories for the outputs. */
+    auto& outputs = rule->getOutputs();
+    for (auto it = outputs.begin(); it != outputs.end(); ++it) {
+      /* TODO: we could end the build immediately if this fails. */
+      if (!fs::createPath((*it)->getPath())) {
+        LOG(ERROR) << "could not create path " << (*it)->getPath();
+      }
+    }
+
+    /* Create the directory for the depfile. */
+    if (rule->hasDepfile() && !fs::createPath(rule->getDepfile())) {
+      LOG(ERROR) << "could not create path " << rule->getDepfile();
+    }
+
+    rules.push_back(rule);
+  }
+
+  std::vector<bool> restored;
+  tryBuildRulesFromCache(rules, restored);
+
+  RuleArray toBuild;
+  for (std::size_t i = 0; i < rules.size(); i++) {
+    if (restored[i]) {
+      /* We managed to retrieve all the outputs from the cache. */
+      onRuleFinished(rules[i]);
+    } else {
+      /* We could not find all the outputs in cache. Build the rule. */
+      toBuild.push_back(rules[i]);
+    }
+  }
+
+  if (!materializeInputs(toBuild)) {
+    /* We cannot tell which rule misses its inputs. */
+    for (auto it = toBuild.begin(); it != toBuild.end(); ++it) {
+      onRuleFailed(*it);
+    }
     return;
   }
+  for (auto it = toBuild.begin(); it != toBuild.end(); ++it) {
+    toBuild_.push(std::make_pair(plan_.getPriority(*it), *it));
+  }
+}
+
+bool GraphParallelBuilder::materializeInputs(const RuleArray& rules) {
+  /* Inputs that were lazy fetched without being written are written now, all
+   * at once. */
+  NodeSet seen;
+  NodeArray nodes;
+  for (auto it = rules.begin(); it != rules.end(); ++it) {
+    auto& inputs = (*it)->getInputs();
+    for (auto itIn = inputs.begin(); itIn != inputs.end(); ++itIn) {
+      if ((*itIn)->isDeferred() && seen.insert(*itIn).second) {
+        nodes.push_back(*itIn);
+      }
+    }
+  }
+  if (nodes.empty()) {
+    return true;
+  }
+
+  assert(cache_);
+  std::vector<bool> restored;
+  cache_->materializeNodes(nodes, restored);
+
+  bool success = true;
+  for (std::size_t i = 0; i < nodes.size(); i++) {
+    if (!restored[i]) {
+      LOG(ERROR) << "could not write " << nodes[i]->getPath()
+                 << " from cache";
+      success = false;
+    }
+  }
+  return success;
+}
+
+void GraphParallelBuilder::buildRule(Rule* rule) {
+  /* The command runs with the highest priority of the sessions that need
+   * it. */
+  int niceness = 0;
+  bool first = true;
+  for (auto it = sessions_.begin(); it != sessions_.end(); ++it) {
+    if (it->pending.count(rule)
+        && (first || it->params.niceness < niceness)) {
+      niceness = it->params.niceness;
+      first = false;
+    }
+  }
+  manager_.setNiceness(niceness);
 
-  /* This is not a phony target, and we could not find all the outputs in cache.
-   * Build the rule. */
   unsigned int id = manager_.addProcess(rule, workingDirectory_);
-  consumer_->newCommand(id, rule->getCommand());
+  if (admission_) {
+    admission_->onStarted(rule);
+  }
+  if (!rule->getPool().empty()) {
+    pools_[rule->getPool()].numRunning++;
+  }
+  consumer_->newCommand(id, rule->getCommand(), sessionsOf(rule));
 }
 
-bool GraphParallelBuilder::tryBuildRuleFromCache(Rule *rule) {
-  if (!cache_) {
+bool GraphParallelBuilder::isPoolFull(const Rule* rule) {
+  if (rule->getPool().empty()) {
     return false;
   }
-
-  if (!cache_->restoreRule(rule)) {
+  auto it = graph_.getPools().find(rule->getPool());
+  if (it == graph_.getPools().end()) {
+    /* The graph was reloaded without this pool. */
     return false;
   }
+  return pools_[rule->getPool()].numRunning >= it->second;
+}
 
-  /* Notify the consumer that all the outputs were retrieved from the cache. */
-  auto& outputs = rule->getOutputs();
-  for (auto it = outputs.begin(); it != outputs.end(); it++) {
-    consumer_->cacheRetrieveAction((*it)->getPath());
+void GraphParallelBuilder::releasePool(const Rule* rule) {
+  if (rule->getPool().empty()) {
+    return;
+  }
+  PoolState& pool = pools_[rule->getPool()];
+  assert(pool.numRunning > 0);
+  pool.numRunning--;
+  if (!pool.waiting.empty()) {
+    toBuild_.push(pool.waiting.top());
+    pool.waiting.pop();
+    numWaiting_--;
   }
+}
 
-  /* Update the timestamp of the rule. */
-  rule->setTimestamp(time(NULL));
+void GraphParallelBuilder::tryBuildRulesFromCache(const RuleArray& rules,
+                                                  std::vector<bool>& restored) {
+  if (!cache_ || rules.empty()) {
+    restored.assign(rules.size(), false);
+    return;
+  }
 
-  return true;
+  cache_->restoreRules(rules, restored);
+
+  for (std::size_t i = 0; i < rules.size(); i++) {
+    if (!restored[i]) {
+      continue;
+    }
+
+    /* Notify the consumer that all the outputs were retrieved from the
+     * cache. */
+    BuildIds sessions = sessionsOf(rules[i]);
+    auto& outputs = rules[i]->getOutputs();
+    for (auto it = outputs.begin(); it != outputs.end(); it++) {
+      consumer_->cacheRetrieveAction((*it)->getPath(), sessions);
+    }
+
+    /* Update the timestamp of the rule. */
+    rules[i]->setTimestamp(time(NULL));
+  }
 }
 
 void GraphParallelBuilder::markOutputsUpToDate(Rule *rule) {
@@ -159,26 +575,54 @@ void GraphParallelBuilder::markOutputsUpToDate(Rule *rule) {
   }
 }
 
+void GraphParallelBuilder::waitForCommand() {
+  /* The commands may run for a long time, let the others read the graph. */
+  lock_.unlock();
+  bool completed = manager_.waitForEvent();
+  lock_.lock();
+
+  if (completed) {
+    waitForNext();
+  }
+  processHashedRules();
+}
+
 BuildResult GraphParallelBuilder::waitForNext() {
   auto res = manager_.waitForNext();
   Rule* rule = res.rule;
   SubProcessExitStatus status = res.status;
 
   consumer_->endCommand(res.cmdId, status);
+  if (admission_) {
+    admission_->onFinished(rule);
+  }
+  releasePool(rule);
 
   /* Update the timestamp of the rule. */
   rule->setTimestamp(std::time(NULL));
 
   if (status != SubProcessExitStatus::SUCCEEDED) {
-    return status == SubProcessExitStatus::INTERRUPTED ?
-        BuildResult::INTERRUPTED : BuildResult::FAILED;
+    logCommand(rule, status, res.usage);
+    if (status == SubProcessExitStatus::INTERRUPTED) {
+      interrupted_ = true;
+      return BuildResult::INTERRUPTED;
+    }
+    onRuleFailed(rule);
+    return BuildResult::FAILED;
   }
 
+  /* Remember how long it took and how much memory it used, the build plan uses
+   * it to schedule the longest chains of rules first and the admission
+   * controller to avoid running out of memory. */
+  rule->setDuration(res.usage.duration);
+  rule->setMaxRss(res.usage.maxRss);
+
   /* Now that the rule was built, parse its depfile (if any). */
   if (rule->hasDepfile()) {
     auto res = Depfile::loadFromfile(rule->getDepfile(), rule,
         watchmanClient_, graph_, true);
     if (res != Depfile::Res::SUCCESS) {
+      onRuleFailed(rule);
       return BuildResult::FAILED;
     }
     /* Since the dependencies might have changed, the hash might have
@@ -188,15 +632,163 @@ BuildResult GraphParallelBuilder::waitForNext() {
     hash::recomputeRuleHash(rule, watchmanClient_, graph_, cache_, true, false);
   }
 
-  if (cache_) {
-    /* Save the outputs and the implicit dependencies in cache. */
-    cache_->saveRule(rule);
-  }
+  logCommand(rule, status, res.usage);
 
-  onRuleFinished(rule);
+  /* The rule completes once its outputs are hashed. */
+  hashOutputs(rule);
   return BuildResult::SUCCEEDED;
 }
 
+void GraphParallelBuilder::hashOutputs(Rule* rule) {
+  /* The task only gets copies of the paths, it does not touch the graph. */
+  std::vector<std::string> paths;
+  auto& outputs = rule->getOutputs();
+  for (auto it = outputs.begin(); it != outputs.end(); ++it) {
+    paths.push_back((*it)->getPath());
+  }
+
+  numHashing_++;
+  hasher_.submit([this, rule, paths]() {
+    HashedRule hashed;
+    hashed.rule = rule;
+    for (auto it = paths.begin(); it != paths.end(); ++it) {
+      std::string digest;
+      uint64_t mtime = 0;
+      uint64_t after = 0;
+      if (!fs::getModificationTime(*it, mtime)
+          || !hash::hashFile(*it, digest)
+          || !fs::getModificationTime(*it, after) || after != mtime) {
+        /* Unreadable, or modified while it was read. */
+        digest.clear();
+      }
+      hashed.digests.push_back(digest);
+      hashed.mtimes.push_back(mtime);
+    }
+    {
+      std::lock_guard<std::mutex> lock(hashedMutex_);
+      hashed_.push_back(std::move(hashed));
+    }
+    manager_.wakeUp();
+  });
+}
+
+void GraphParallelBuilder::processHashedRules() {
+  std::vector<HashedRule> hashed;
+  {
+    std::lock_guard<std::mutex> lock(hashedMutex_);
+    hashed.swap(hashed_);
+  }
+
+  for (auto it = hashed.begin(); it != hashed.end(); ++it) {
+    assert(numHashing_ > 0);
+    numHashing_--;
+    Rule* rule = it->rule;
+    recordDigests(rule, it->digests, it->mtimes);
+
+    if (cache_ && !stale_) {
+      /* Save the outputs and the implicit dependencies in cache. The digests
+       * of the outputs were just recorded, the cache does not compute them
+       * again. */
+      cache_->saveRule(rule);
+    }
+
+    onRuleFinished(rule);
+  }
+}
+
+bool GraphParallelBuilder::computeInputsDigest(const Rule* rule,
+                                              std::string& digest) {
+  std::string data = rule->getCommand();
+  auto& inputs = rule->getInputs();
+  for (auto it = inputs.begin(); it != inputs.end(); ++it) {
+    const Node* input = *it;
+    data += '\n';
+    if (input->isSource()) {
+      /* The hash of a source file is computed from its content, and updated
+       * when it changes. */
+      data += input->getHash();
+      continue;
+    }
+    uint64_t mtime;
+    if (input->getContentDigest().empty()
+        || !fs::getModificationTime(input->getPath(), mtime)
+        || mtime != input->getContentMtime()) {
+      /* Never generated by the daemon, or modified since. */
+      return false;
+    }
+    data += input->getContentDigest();
+  }
+  digest = hash::hashData(data);
+  return true;
+}
+
+bool GraphParallelBuilder::isUnchanged(const Rule* rule) {
+  if (rule->getInputsDigest().empty()) {
+    return false;
+  }
+
+  auto& outputs = rule->getOutputs();
+  for (auto it = outputs.begin(); it != outputs.end(); ++it) {
+    uint64_t mtime;
+    if ((*it)->getContentDigest().empty()
+        || !fs::getModificationTime((*it)->getPath(), mtime)
+        || mtime != (*it)->getContentMtime()) {
+      return false;
+    }
+  }
+
+  std::string digest;
+  return computeInputsDigest(rule, digest)
+      && digest == rule->getInputsDigest();
+}
+
+void GraphParallelBuilder::recordDigests(
+    Rule* rule, const std::vector<std::string>& digests,
+    const std::vector<uint64_t>& mtimes) {
+  auto& outputs = rule->getOutputs();
+  assert(digests.size() == outputs.size());
+  for (std::size_t i = 0; i < outputs.size(); i++) {
+    Node* output = outputs[i];
+    if (!digests[i].empty() && digests[i] == output->getContentDigest()) {
+      LOG(INFO) << output->getPath() << " did not change";
+    }
+    output->setContentDigest(digests[i], mtimes[i]);
+  }
+
+  std::string digest;
+  if (!computeInputsDigest(rule, digest)) {
+    digest.clear();
+  }
+  rule->setInputsDigest(digest);
+}
+
+void GraphParallelBuilder::logCommand(Rule* rule, SubProcessExitStatus status,
+                                      const SubProcessUsage& usage) {
+  if (!buildLog_) {
+    return;
+  }
+
+  BuildLog::Entry entry;
+  entry.startTime = usage.startTime;
+  entry.endTime = usage.startTime + usage.duration;
+  entry.status = toString(status);
+  entry.cpuTime = usage.cpuTime;
+  entry.maxRss = usage.maxRss;
+  entry.outputSize = 0;
+  entry.hash = rule->getHash();
+  entry.output = rule->getOutputs()[0]->getPath();
+
+  auto& outputs = rule->getOutputs();
+  for (auto it = outputs.begin(); it != outputs.end(); ++it) {
+    struct stat st;
+    if (stat((*it)->getPath().c_str(), &st) == 0) {
+      entry.outputSize += st.st_size;
+    }
+  }
+
+  buildLog_->record(entry);
+}
+
 void GraphParallelBuilder::onRuleFinished(Rule* rule) {
   /* Mark all the outputs up to date. */
   markOutputsUpToDate(rule);
@@ -214,6 +806,35 @@ void GraphParallelBuilder::onRuleFinished(Rule* rule) {
 
   /* Inform the plan that the rule is built. */
   plan_.notifyRuleBuilt(rule);
+
+  for (auto it = sessions_.begin(); it != sessions_.end(); ++it) {
+    it->pending.erase(rule);
+  }
+}
+
+void GraphParallelBuilder::onRuleFailed(Rule* rule) {
+  numFailures_++;
+
+  /* The rule and its outputs remain dirty. */
+  RuleArray skipped;
+  plan_.notifyRuleFailed(rule, skipped);
+  if (!skipped.empty()) {
+    LOG(INFO) << "Skipping " << skipped.size() << " rules that depend on "
+              << rule->getOutputs()[0]->getPath();
+  }
+
+  /* The sessions that need the rule count it as a failure, and no longer wait
+   * for the rules that were skipped. */
+  for (auto it = sessions_.begin(); it != sessions_.end(); ++it) {
+    if (it->pending.erase(rule) == 0) {
+      continue;
+    }
+    it->numFailures++;
+    for (auto itSkipped = skipped.begin(); itSkipped != skipped.end();
+         ++itSkipped) {
+      it->pending.erase(*itSkipped);
+    }
+  }
 }
 
 } // namespace falcon
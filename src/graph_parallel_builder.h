@@ -7,32 +7,90 @@
 #define FALCON_GRAPH_PARALLEL_BUILDER_H_
 
 #include <atomic>
+#include <future>
+#include <list>
 #include <memory>
+#include <mutex>
+#include <queue>
+#include <set>
+#include <string>
 #include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
+#include "admission_controller.h"
+#include "build_log.h"
 #include "build_plan.h"
 #include "cache_manager.h"
 #include "graph.h"
 #include "graph_builder.h"
 #include "posix_subprocess_manager.h"
 #include "stream_server.h"
+#include "util/rw_lock.h"
+#include "util/thread_pool.h"
 #include "watchman.h"
 
 namespace falcon {
 
 /** GraphParallelBuilder is a class that takes care of building a BuildPlan in
  * parallel. It uses PosixSubProcessManager to manager multiple commands running
- * at the same time. */
+ * at the same time.
+ *
+ * The builder builds sessions (see addSession()), which can be added while it
+ * is running. The targets of all the sessions are merged in the same plan: a
+ * rule needed by several sessions is built once, and the commands of all the
+ * sessions share the same slots. Each session completes on its own, once all
+ * the rules it needs are built, or once maxFailures of them failed. A session
+ * with maxFailures set to 0 keeps going until everything that does not depend
+ * on a failed rule is built.
+ * The builder stops once it has no more sessions.
+ *
+ * The builder only holds the lock of the graph to change its state: it is
+ * released while waiting for the commands and while the outputs of the rules
+ * that were built are hashed, so that the graph can be read in the
+ * meantime. The graph must not be modified by anyone else while the
+ * builder runs. */
 class GraphParallelBuilder : public IGraphBuilder {
  public:
+  struct SessionParams {
+    /* Id of the session, which identifies its output (see StreamServer). */
+    unsigned int id;
+    /* Targets to be built. Empty to build all the roots of the graph. */
+    std::set<std::string> targets;
+    /* Number of commands that can run at the same time. */
+    std::size_t numThreads;
+    /* Number of failed rules after which the session stops, 0 for no limit. */
+    std::size_t maxFailures;
+    /* Try to retrieve the targets from the cache before building them. */
+    bool lazyFetch;
+    /* Value added to the nice value of the commands of the session. */
+    int niceness;
+    /* Started by the daemon on its own. The session is interrupted once the
+     * builder is stale, see markStale(). */
+    bool automatic;
+    /* Called when the session completes. */
+    onBuildCompletedFn callback;
+  };
+
+  /**
+   * @param deferMaterialization If true, the nodes lazy fetched from the cache
+   *                             are not written in the workspace, except the
+   *                             targets.
+   * @param lock                 Lock of the graph, taken for writing.
+   * @param callback             Called when the builder stops, after all its
+   *                             sessions completed.
+   */
   GraphParallelBuilder(Graph& Graph,
                        BuildPlan& plan,
                        CacheManager* cache,
+                       BuildLog* buildLog,
+                       AdmissionController* admission,
                        IBuildOutputConsumer* consumer,
                        WatchmanClient* watchmanClient,
                        std::string const& workingDirectory,
-                       std::size_t numThreads,
-                       std::mutex& mutex,
+                       bool deferMaterialization,
+                       RWLock& lock,
                        onBuildCompletedFn callback);
 
   ~GraphParallelBuilder();
@@ -45,27 +103,206 @@ class GraphParallelBuilder : public IGraphBuilder {
 
   BuildResult getResult() const { return result_; }
 
+  /**
+   * Notify the builder that some files changed while it runs. The changes
+   * are only applied to the graph once it stops. The sessions already added
+   * keep going, but the builder does not accept new sessions: they must be
+   * planned on a new builder once the changes are applied. The outputs of the
+   * rules that complete from now on are not saved in cache, they may have been
+   * built from the new content of the files while the graph still has the old
+   * one. The automatic sessions are interrupted. If no other session is left,
+   * the commands that still run are killed.
+   * Can be called from any thread.
+   */
+  void markStale();
+
+  /**
+   * Add a session to be built. Can be called from any thread, and before
+   * startBuild(): the builder stops as soon as it has no session.
+   * @param params Parameters of the session.
+   * @return Future that is set once the targets of the session are merged in
+   * the plan: an empty string, or the reason why the session cannot be built.
+   * The future is not valid if the builder stopped: a new builder must be
+   * started.
+   */
+  std::future<std::string> addSession(const SessionParams& params);
+
  private:
   void buildThread();
+
+  /** Merge the targets of the sessions that were added in the plan. The
+   * sessions added since the last call are merged at once. */
+  void processRequests();
+
+  /** Find the nodes of the targets of a session. Return false with an error
+   * message if one of them is unknown. */
+  bool findTargets(const SessionParams& params, NodeSet& targets,
+                   std::string& error);
+
+  /** Return true if the builder has nothing left to do. */
+  bool isIdle() const;
+
+  /** Call the callback of the sessions that completed, and remove them. */
+  void endCompletedSessions();
+
+  /** Complete all the sessions with the given result, and reject the sessions
+   * that were not merged yet. */
+  void endAllSessions(BuildResult result);
+
+  /** Interrupt the automatic sessions. */
+  void endAutomaticSessions();
+
+  /** Ids of the sessions that need a rule. */
+  BuildIds sessionsOf(const Rule* rule) const;
+
+  /** Maximum number of commands that can run at the same time. */
+  std::size_t getNumThreads() const;
+
+  /** Take all the rules that are ready to be built. Phony rules and rules
+   * that can be restored from the cache are completed right away, the others
+   * are queued in toBuild_ with their priority. */
+  void startReadyRules();
+
+  /** Write the inputs of the given rules that were lazy fetched without being
+   * materialized. Return false if one of them could not be written. */
+  bool materializeInputs(const RuleArray& rules);
+
+  /** Spawn the command of a rule. */
   void buildRule(Rule *rule);
-  bool tryBuildRuleFromCache(Rule *rule);
+
+  /** Return true if the pool of a rule already runs as many rules as its
+   * depth. */
+  bool isPoolFull(const Rule* rule);
+
+  /** Notify the pool of a rule that the rule completed. If some rules of the
+   * pool were waiting, the first one is queued in toBuild_ again. */
+  void releasePool(const Rule* rule);
+
+  /** Try to restore several rules from the cache with one batch of lookups.
+   * @param rules    Rules to be restored.
+   * @param restored Filled with one flag per rule. */
+  void tryBuildRulesFromCache(const RuleArray& rules,
+                              std::vector<bool>& restored);
+  /** Compute the digest of the command and of the content of the inputs of a
+   * rule. Return false if the content of an input is unknown. */
+  bool computeInputsDigest(const Rule* rule, std::string& digest);
+
+  /** Return true if the rule does not need to run: its command and the content
+   * of its inputs are the same as the last time it succeeded, and its outputs
+   * were not modified since. */
+  bool isUnchanged(const Rule* rule);
+
+  /** Compute the digest of the outputs of a rule whose command succeeded in
+   * hasher_, without holding the lock of the graph. The rule completes once
+   * they are known, see processHashedRules(). */
+  void hashOutputs(Rule* rule);
+
+  /** Complete the rules whose outputs were hashed. */
+  void processHashedRules();
+
+  /** Record the digest of the outputs and the inputs of a rule whose command
+   * succeeded.
+   * @param digests Digest of each output, empty if it could not be read.
+   * @param mtimes  Modification time of each output when it was hashed. */
+  void recordDigests(Rule* rule, const std::vector<std::string>& digests,
+                     const std::vector<uint64_t>& mtimes);
+
+  /** Append the record of a command that completed to the build log. */
+  void logCommand(Rule* rule, SubProcessExitStatus status,
+                  const SubProcessUsage& usage);
   void markOutputsUpToDate(Rule *rule);
+
+  /** Wait for a command to complete, for outputs to be hashed or for a new
+   * session, without holding the lock of the graph. Process the command that
+   * completed and the rules that were hashed, if any. */
+  void waitForCommand();
+
   BuildResult waitForNext();
   void onRuleFinished(Rule* rule);
 
+  /** Count a rule that failed, and remove the rules that depend on it from the
+   * plan. */
+  void onRuleFailed(Rule* rule);
+
   Graph& graph_;
   BuildPlan& plan_;
   CacheManager* cache_;
+  BuildLog* buildLog_;
+  AdmissionController* admission_;
   IBuildOutputConsumer* consumer_;
   PosixSubProcessManager manager_;
   WatchmanClient * watchmanClient_;
   std::string workingDirectory_;
-  std::size_t numThreads_;
+  bool deferMaterialization_;
   BuildResult result_;
 
-  std::unique_lock<std::mutex> lock_;
+  std::size_t numFailures_;
+
+  struct Session {
+    SessionParams params;
+    /* Rules the session needs that are not built yet. */
+    std::unordered_set<Rule*> pending;
+    std::size_t numFailures;
+  };
+  std::list<Session> sessions_;
+
+  /** Sessions that were added but not merged in the plan yet. */
+  struct Request {
+    SessionParams params;
+    std::promise<std::string> promise;
+    NodeSet targets;
+  };
+  std::list<Request> requests_;
+
+  /** Set to false once the builder stops or is stale. Protected by
+   * requestsMutex_. */
+  bool accepting_;
+  std::mutex requestsMutex_;
+
+  /** Number of rules that were skipped because their inputs did not change. */
+  std::size_t numUnchanged_;
+
+  /** Rules ordered by their priority in the plan. */
+  typedef std::priority_queue<std::pair<uint64_t, Rule*>> RuleQueue;
+
+  /** Rules that were not found in cache, waiting for a free slot to run their
+   * command. The rule with the highest priority in the plan is started first. */
+  RuleQueue toBuild_;
+
+  /** Rules of a pool that are running, and rules of the pool that are waiting
+   * for one of them to complete. */
+  struct PoolState {
+    PoolState() : numRunning(0) {}
+    unsigned int numRunning;
+    RuleQueue waiting;
+  };
+  std::unordered_map<std::string, PoolState> pools_;
+
+  /** Number of rules waiting in the pools. */
+  std::size_t numWaiting_;
+
+  /** Rules whose outputs were hashed by hasher_, waiting to be completed by
+   * the build thread. */
+  struct HashedRule {
+    Rule* rule;
+    std::vector<std::string> digests;
+    std::vector<uint64_t> mtimes;
+  };
+  std::vector<HashedRule> hashed_;
+  std::mutex hashedMutex_;
+
+  /** Number of rules whose outputs are being hashed. */
+  std::size_t numHashing_;
+
+  std::unique_lock<RWLock> lock_;
   std::atomic_bool interrupted_;
+  /** Set by markStale(). */
+  std::atomic_bool stale_;
   onBuildCompletedFn callback_;
+
+  /** Threads hashing the outputs. Declared after what its tasks use. */
+  ThreadPool hasher_;
+
   std::thread thread_;
 };
 
@@ -26,6 +26,7 @@ GraphReloader::GraphReloader(Graph& original, Graph& newGraph,
 }
 
 void GraphReloader::updateGraph() {
+  original_.pools_ = new_.pools_;
   updateRoots();
   cleanStaleSubgraph();
 }
@@ -281,6 +282,9 @@ bool GraphReloader::updateSubGraph(Rule* rule, Rule const* newRule) {
     r = true;
   }
 
+  /* The pool only changes how the rule is scheduled, not its outputs. */
+  rule->setPool(newRule->getPool());
+
   /* Rebuild depfile */
   r |= updateRuleDepfiles(rule, implicitDepsBefore, newRule);
 
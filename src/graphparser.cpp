@@ -5,6 +5,7 @@
 
 #include <fstream>
 #include <cassert>
+#include <cstdlib>
 #include <cstring>
 
 #include "exceptions.h"
@@ -51,6 +52,11 @@ void GraphParser::processFile()
   if (!dom) {
     THROW_ERROR(EINVAL, "No dom for this json file");
   }
+  JsonVal const* pools = dom->getObject("pools");
+  if (pools) {
+    processPools(pools);
+  }
+
   JsonVal const* rules = dom->getObject("rules");
 
   if (rules && rules->_type == JSON_ARRAY_BEGIN) {
@@ -60,6 +66,22 @@ void GraphParser::processFile()
   }
 }
 
+void GraphParser::processPools(JsonVal const* pools) {
+  assert(graph_);
+
+  if (pools->_type != JSON_OBJECT_BEGIN) {
+    THROW_ERROR(EINVAL, "Expecting OBJECT value for pools field");
+  }
+
+  for (auto it = pools->_object.cbegin(); it != pools->_object.cend(); ++it) {
+    if (it->second->_type != JSON_INT || atoi(it->second->_data.c_str()) < 1) {
+      std::string msg = "Expecting a positive INT depth for pool " + it->first;
+      THROW_ERROR(EINVAL, msg.c_str());
+    }
+    graph_->pools_[it->first] = atoi(it->second->_data.c_str());
+  }
+}
+
 void GraphParser::checkNode(JsonVal const* json, NodeArray& nodeArray) {
   NodeSet nodeSet;
   for (std::deque<JsonVal*>::const_iterator it = json->_array.cbegin();
@@ -105,6 +127,7 @@ void GraphParser::processJson(JsonVal const* rules)
     JsonVal const* ruleOutputs = jsonRule->getObject("outputs");
     JsonVal const* ruleCmd     = jsonRule->getObject("cmd");
     JsonVal const* ruleDepfile = jsonRule->getObject("depfile");
+    JsonVal const* rulePool    = jsonRule->getObject("pool");
 
     /* TODO: MANAGE ERROR ?
      * should I have to expect to have at least one input and one outputs ? */
@@ -135,6 +158,17 @@ void GraphParser::processJson(JsonVal const* rules)
       rule->setDepfile(ruleDepfile->_data);
     }
 
+    if (rulePool) {
+      if (rulePool->_type != JSON_STRING) {
+        THROW_ERROR(EINVAL, "Expecting STRING value for pool field");
+      }
+      if (graph_->pools_.find(rulePool->_data) == graph_->pools_.end()) {
+        std::string msg = "Unknown pool " + rulePool->_data;
+        THROW_ERROR(EINVAL, msg.c_str());
+      }
+      rule->setPool(rulePool->_data);
+    }
+
     /* keep the rule in memory */
     graph_->rules_.push_back(rule);
 
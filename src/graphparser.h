@@ -37,6 +37,9 @@ class GraphParser {
     void processFile();
     /* In the case we already have a Json object */
     void processJson(JsonVal const* rules);
+    /* Parse the pools: an object that maps the name of each pool to its
+     * depth. Must be called before processJson(). */
+    void processPools(JsonVal const* pools);
 
   private:
     void checkNode(JsonVal const* json, NodeArray& nodeArray);
@@ -11,15 +11,27 @@
 namespace falcon {
 
 LazyCache::LazyCache(NodeSet& targets, CacheManager& cache,
-                     IBuildOutputConsumer* consumer)
+                     IBuildOutputConsumer* consumer,
+                     const BuildIds& builds,
+                     bool deferMaterialization)
     : targets_(targets)
     , cache_(cache)
-    , consumer_(consumer) { }
+    , consumer_(consumer)
+    , builds_(builds)
+    , deferMaterialization_(deferMaterialization) { }
 
 void LazyCache::fetch() {
   for (auto it = targets_.begin(); it != targets_.end(); ++it) {
     traverseNode(*it);
   }
+
+  while (!pending_.empty() || !frontier_.empty()) {
+    if (!pending_.empty()) {
+      lookupPending();
+    } else {
+      restoreFrontier();
+    }
+  }
 }
 
 void LazyCache::traverseNode(Node* node) {
@@ -28,6 +40,11 @@ void LazyCache::traverseNode(Node* node) {
     return;
   }
 
+  if (!seen_.insert(node).second) {
+    /* This node was already reached from another path. */
+    return;
+  }
+
   Rule* rule = node->getChild();
   if (!rule) {
     /* This is a source file. Ignore it. */
@@ -40,23 +57,8 @@ void LazyCache::traverseNode(Node* node) {
     return;
   }
 
-  if (cache_.restoreNode(node)) {
-    consumer_->cacheRetrieveAction(node->getPath());
-    node->setState(State::UP_TO_DATE);
-    node->setLazyFetched(true);
-    /* Update the timestamp of the node. This will make sure that we don't mark
-     * it dirty when watchman notifies us it changed. */
-    node->setTimestamp(time(NULL));
-    /* Notify the parents of this output that one of their inputs is ready. */
-    auto parentRules = node->getParents();
-    for (auto it = parentRules.begin(); it != parentRules.end(); ++it) {
-      (*it)->markInputReady();
-    }
-  } else {
-    /* We could not restore the node, go deeper. */
-    traverseRule(rule);
-  }
-
+  /* The node will be looked up with the rest of its level. */
+  pending_.push_back(node);
 }
 
 void LazyCache::traverseRule(Rule* rule) {
@@ -66,4 +68,82 @@ void LazyCache::traverseRule(Rule* rule) {
   }
 }
 
+void LazyCache::lookupPending() {
+  NodeArray nodes;
+  nodes.swap(pending_);
+
+  std::vector<bool> found;
+  cache_.hasNodes(nodes, found);
+
+  for (std::size_t i = 0; i < nodes.size(); i++) {
+    if (found[i]) {
+      /* Stop here, the node will be restored with the rest of the frontier. */
+      frontier_.push_back(nodes[i]);
+    } else {
+      /* We cannot restore the node, go deeper. */
+      traverseRule(nodes[i]->getChild());
+    }
+  }
+}
+
+void LazyCache::restoreFrontier() {
+  NodeArray nodes;
+  nodes.swap(frontier_);
+
+  std::vector<bool> restored;
+  if (deferMaterialization_) {
+    cache_.deferNodes(nodes, restored);
+  } else {
+    cache_.restoreNodes(nodes, restored);
+  }
+
+  for (std::size_t i = 0; i < nodes.size(); i++) {
+    if (restored[i]) {
+      onNodeRestored(nodes[i]);
+    } else {
+      /* We could not restore the node, go deeper. */
+      traverseRule(nodes[i]->getChild());
+    }
+  }
+}
+
+void LazyCache::onNodeRestored(Node* node) {
+  consumer_->cacheRetrieveAction(node->getPath(), builds_);
+  /* setState() clears the digest of a deferred node, keep it. */
+  std::string digest = node->getDeferredDigest();
+  node->setState(State::UP_TO_DATE);
+  node->setLazyFetched(true);
+  node->setDeferredDigest(digest);
+  /* Update the timestamp of the node. This will make sure that we don't mark
+   * it dirty when watchman notifies us it changed. */
+  node->setTimestamp(time(NULL));
+  /* Notify the parents of this output that one of their inputs is ready. */
+  auto parentRules = node->getParents();
+  for (auto it = parentRules.begin(); it != parentRules.end(); ++it) {
+    (*it)->markInputReady();
+  }
+}
+
+void LazyCache::materializeTargets() {
+  NodeArray nodes;
+  for (auto it = targets_.begin(); it != targets_.end(); ++it) {
+    if ((*it)->isDeferred()) {
+      nodes.push_back(*it);
+    }
+  }
+  if (nodes.empty()) {
+    return;
+  }
+
+  std::vector<bool> restored;
+  cache_.materializeNodes(nodes, restored);
+  for (std::size_t i = 0; i < nodes.size(); i++) {
+    if (!restored[i]) {
+      LOG(ERROR) << "could not write " << nodes[i]->getPath()
+                 << " from cache, it will be rebuilt";
+      nodes[i]->markDirty();
+    }
+  }
+}
+
 } // namespace falcon
@@ -8,40 +8,94 @@
 
 #include "cache_manager.h"
 #include "graph.h"
+#include "stream_server.h"
 
 namespace falcon {
 
-class IBuildOutputConsumer;
-
 /**
  * LazyCache is a helper class for performing what we call "lazy cache
  * fetching". The concept is that if you can fetch a target from the cache, you
  * don't need to fetch any sub-target as well, they will be fetched only when
  * needed.
  *
- * TODO: when distributed caching is implemented, we can think of ways to
- * improve efficiency by retrieving multiple targets in one single query.
+ * Fetching happens in three steps:
+ * - traverse the graph from the targets, one level at a time, and collect the
+ *   frontier, ie the nodes that are found in cache. All the nodes of a level
+ *   are looked up in the cache with one single query. The traversal stops at
+ *   the nodes found in cache and each node is visited only once, even when
+ *   shared by several targets;
+ * - restore all the nodes of the frontier with one single query;
+ * - mark the restored nodes up-to-date and notify their parents in one pass.
+ * If a node of the frontier cannot be restored, the traversal resumes below it.
+ *
+ * Batching the queries is what makes a remote cache usable here: the number of
+ * round trips is bounded by the depth of the graph instead of its size.
+ *
+ * When materialization is deferred, the nodes of the frontier are not written
+ * in the workspace: they only record the digest of their content in cache.
+ * Most of them are intermediate outputs that nothing reads. The builder
+ * writes the ones a rule needs before running it, and materializeTargets()
+ * writes the requested targets.
  */
 class LazyCache {
  public:
+  /**
+   * @param targets Targets we are building.
+   * @param cache   The cache.
+   * @param consumer Notified of the nodes retrieved from the cache.
+   * @param builds   Builds the nodes are retrieved for.
+   * @param deferMaterialization If true, the nodes found in cache are not
+   *                 written in the workspace, except the targets.
+   */
   LazyCache(NodeSet& targets, CacheManager& cache,
-            IBuildOutputConsumer* consumer);
+            IBuildOutputConsumer* consumer, const BuildIds& builds,
+            bool deferMaterialization);
 
-  /** Start a DFS on each node in "targets". When a node is found in cache,
-   * retrieve it, mark it up-to-date and stop the DFS. */
+  /** Start a traversal from each node in "targets". When a node is found in
+   * cache, retrieve it, mark it up-to-date and stop the traversal. */
   void fetch();
 
+  /** Write the targets that were deferred, by this fetch or a previous one. A
+   * target that cannot be written is marked dirty so that it is rebuilt. */
+  void materializeTargets();
+
  private:
 
+  /** Queue a node to be looked up in the cache, or traverse its rule
+   * directly if it cannot be cached. */
   void traverseNode(Node* node);
   void traverseRule(Rule* rule);
 
+  /** Look up all the nodes of pending_ in the cache. Nodes found are added
+   * to frontier_, the others are traversed, which may fill pending_ again. */
+  void lookupPending();
+
+  /** Restore the nodes of frontier_ and update the graph. Nodes that could
+   * not be restored are traversed, which may fill frontier_ again. */
+  void restoreFrontier();
+
+  /** Mark a node that was restored up-to-date. */
+  void onNodeRestored(Node* node);
+
+
   /** List of targets we are building. */
   NodeSet& targets_;
 
   CacheManager& cache_;
 
   IBuildOutputConsumer* consumer_;
+  BuildIds builds_;
+
+  bool deferMaterialization_;
+
+  /** Nodes already traversed. */
+  NodeSet seen_;
+
+  /** Nodes waiting to be looked up in the cache. */
+  NodeArray pending_;
+
+  /** Nodes found in cache, waiting to be restored. */
+  NodeArray frontier_;
 };
 
 } // namespace falcon
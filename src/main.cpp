@@ -5,6 +5,8 @@
 
 #include <iostream>
 #include <cstdlib>
+#include <cstring>
+#include <unistd.h>
 
 #include "cache_manager.h"
 #include "build_plan.h"
@@ -35,6 +37,14 @@ static void setOptions(falcon::Options& opt) {
   opt.addCLIOption("module,M",
                    po::value<std::string>(),
                    "use -M help for more info");
+  opt.addCLIOption("bundle",
+                   po::value<std::string>(),
+                   "cache bundle for the export-cache and import-cache "
+                   "modules");
+  opt.addCLIOption("target",
+                   po::value<std::vector<std::string>>(),
+                   "target to export with the export-cache module, can be "
+                   "repeated (default: all the roots)");
   opt.addCLIOption("config,f", /* TODO */
                    po::value<std::string>(),
                    "falcon configuration file");
@@ -57,12 +67,114 @@ static void setOptions(falcon::Options& opt) {
   opt.addCFileOption("log-level",
                      po::value<google::LogSeverity>()->default_value(google::GLOG_WARNING),
                      "define the log level");
+  opt.addCFileOption("cache-dir",
+                     po::value<std::string>()->default_value(""),
+                     "local cache directory shared with the daemons of other "
+                     "checkouts (default: private to the checkout)");
+  opt.addCFileOption("cache-remote",
+                     po::value<std::string>()->default_value(""),
+                     "host:port of a remote cache server");
+  opt.addCFileOption("cache-peer",
+                     po::value<std::string>()->default_value(""),
+                     "host:port of another falcon daemon whose cache is used "
+                     "read-only, see cache-serve-port");
+  opt.addCFileOption("cache-serve-port",
+                     po::value<int>()->default_value(0),
+                     "serve the local cache to other falcon daemons on this "
+                     "port, 0 to disable");
+  opt.addCFileOption("cache-memory-size",
+                     po::value<int>()->default_value(64),
+                     "MiB of small cache entries kept in memory, 0 to disable");
+  opt.addCFileOption("cache-defer-outputs",
+                     po::value<bool>()->default_value(false),
+                     "when lazy fetching, only write the outputs found in "
+                     "cache when they are needed");
+  opt.addCFileOption("load-limit",
+                     po::value<double>()->default_value(0),
+                     "do not start new commands while the load average is "
+                     "above this limit, 0 for no limit");
+  opt.addCFileOption("memory-pressure-limit",
+                     po::value<double>()->default_value(0),
+                     "do not start new commands while the memory pressure "
+                     "(percentage of time stalled, see /proc/pressure/memory) "
+                     "is above this limit, 0 for no limit");
+  opt.addCFileOption("memory-reserve",
+                     po::value<int>()->default_value(512),
+                     "MiB of memory the commands should leave free");
+  opt.addCFileOption("auto-build-delay",
+                     po::value<int>()->default_value(0),
+                     "start building the auto-build targets when no file "
+                     "changed for this many milliseconds, 0 to disable");
+  opt.addCFileOption("auto-build-targets",
+                     po::value<std::string>()->default_value(""),
+                     "space separated list of the targets built "
+                     "automatically (default: all the targets)");
+  opt.addCFileOption("auto-build-jobs",
+                     po::value<int>()->default_value(1),
+                     "number of commands run simultaneously by the automatic "
+                     "builds");
   opt.addCFileOption("log-dir",
                      po::value<std::string>(),
                      "write log files in the given directory");
 }
 
-static int loadModule(falcon::Graph& g, std::string const& s) {
+static void printBundleSummary(std::string const& action,
+                               falcon::bundle::Summary const& summary) {
+  std::cout << action << " " << summary.numActions << " actions and "
+            << summary.numBlobs << " blobs (" << summary.numBytes
+            << " bytes)";
+  if (summary.numErrors > 0) {
+    std::cout << ", " << summary.numErrors << " errors";
+  }
+  std::cout << std::endl;
+}
+
+static int exportCache(falcon::Graph& g, falcon::CacheManager& cache,
+                       falcon::Options const& opt) {
+  if (!opt.isOptionSetted("bundle")) {
+    std::cerr << "export-cache: missing --bundle" << std::endl;
+    return 1;
+  }
+
+  falcon::NodeSet targets;
+  if (opt.isOptionSetted("target")) {
+    auto names = opt.vm_["target"].as<std::vector<std::string>>();
+    for (auto it = names.begin(); it != names.end(); ++it) {
+      auto itFind = g.getNodes().find(*it);
+      if (itFind == g.getNodes().end()) {
+        std::cerr << "export-cache: unknown target " << *it << std::endl;
+        return 1;
+      }
+      targets.insert(itFind->second);
+    }
+  } else {
+    targets = g.getRoots();
+  }
+
+  falcon::bundle::Summary summary;
+  if (!cache.exportBundle(targets, opt.vm_["bundle"].as<std::string>(),
+                          summary)) {
+    return 1;
+  }
+  printBundleSummary("exported", summary);
+  return 0;
+}
+
+static int importCache(falcon::CacheManager& cache,
+                       falcon::Options const& opt) {
+  if (!opt.isOptionSetted("bundle")) {
+    std::cerr << "import-cache: missing --bundle" << std::endl;
+    return 1;
+  }
+
+  falcon::bundle::Summary summary;
+  bool ok = cache.importBundle(opt.vm_["bundle"].as<std::string>(), summary);
+  printBundleSummary("imported", summary);
+  return ok ? 0 : 1;
+}
+
+static int loadModule(falcon::Graph& g, falcon::CacheManager& cache,
+                      falcon::Options const& opt, std::string const& s) {
 
   LOG(INFO) << "load module '" << s << "'";
 
@@ -70,10 +182,17 @@ static int loadModule(falcon::Graph& g, std::string const& s) {
     printGraphGraphviz(g, std::cout);
   } else if (0 == s.compare("make")) {
     printGraphMakefile(g, std::cout);
+  } else if (0 == s.compare("export-cache")) {
+    return exportCache(g, cache, opt);
+  } else if (0 == s.compare("import-cache")) {
+    return importCache(cache, opt);
   } else if (0 == s.compare("help")) {
     std::cout << "list of available modules: " << std::endl
-      << "  dot    show the graph in DOT format" << std::endl
-      << "  make   show the graph in Makefile format" << std::endl;
+      << "  dot           show the graph in DOT format" << std::endl
+      << "  make          show the graph in Makefile format" << std::endl
+      << "  export-cache  write the cache entries of the targets in "
+      << "--bundle" << std::endl
+      << "  import-cache  load the cache entries of --bundle" << std::endl;
   } else {
     LOG(ERROR) << "module '" << s << "' not supported";
     return 1;
@@ -83,22 +202,55 @@ static int loadModule(falcon::Graph& g, std::string const& s) {
 }
 
 /**
- * Daemonize the current process.
+ * Daemonize the current process. The original process waits for the daemon to
+ * report its status with notifyStarted(), and exits with it.
+ * @param statusFd Set in the daemon to the pipe given to notifyStarted().
+ * @return -1 in the daemon, the exit code of the process otherwise.
  */
-static void daemonize(std::unique_ptr<falcon::GlobalConfig> config,
-                      std::unique_ptr<falcon::Graph> graph,
-                      std::unique_ptr<falcon::CacheManager> cache) {
+static int daemonize(int& statusFd) {
+  int fds[2];
+  if (pipe(fds) != 0) {
+    LOG(ERROR) << "Cannot create a pipe: " << strerror(errno);
+    return 1;
+  }
 
   /** the double-fork-and-setsid trick establishes a child process that runs in
    * its own process group with its own session and that won't get killed off
    * when your shell exits (for example). */
-  if (fork()) { return; }
+  if (fork()) {
+    /* Wait for the status of the daemon. It exits without writing it if it
+     * crashes. */
+    close(fds[1]);
+    unsigned char status = 1;
+    ssize_t r;
+    do {
+      r = read(fds[0], &status, 1);
+    } while (r < 0 && errno == EINTR);
+    close(fds[0]);
+    return r == 1 ? status : 1;
+  }
+  close(fds[0]);
   setsid();
-  if (fork()) { return; }
+  if (fork()) { return 0; }
+  statusFd = fds[1];
+  return -1;
+}
 
-  falcon::DaemonInstance daemon(std::move(config), std::move(cache));
-  daemon.loadConf(std::move(graph));
-  daemon.start();
+/**
+ * Send the status of the daemon to the original process, see daemonize().
+ * Does nothing if the process was not daemonized.
+ * @param code 0 if the daemon started, otherwise the exit code.
+ */
+static void notifyStarted(int& statusFd, int code) {
+  if (statusFd < 0) {
+    return;
+  }
+  unsigned char status = (code > 0 && code < 256) ? code : (code ? 1 : 0);
+  if (write(statusFd, &status, 1) != 1) {
+    LOG(WARNING) << "Cannot notify the original process: " << strerror(errno);
+  }
+  close(statusFd);
+  statusFd = -1;
 }
 
 int main (int const argc, char const* const* argv) {
@@ -139,22 +291,54 @@ int main (int const argc, char const* const* argv) {
     return e.getCode();
   }
 
-  std::unique_ptr<falcon::CacheManager> cache(
-      new falcon::CacheManager(config->getWorkingDirectoryPath(),
-                               config->getFalconDir()));
+  /* Threads do not survive a fork(): daemonize before the cache manager starts
+   * its threads. */
+  bool runModule = opt.isOptionSetted("module");
+  int statusFd = -1;
+  if (!runModule) {
+    int code = daemonize(statusFd);
+    if (code >= 0) {
+      return code;
+    }
+  }
+
+  /* The original process already returned if we are the daemon: report the
+   * errors to it before exiting. */
+  std::unique_ptr<falcon::CacheManager> cache;
+  try {
+    cache.reset(
+        new falcon::CacheManager(config->getWorkingDirectoryPath(),
+                                 config->getFalconDir(),
+                                 config->getSharedCacheDir(),
+                                 config->getRemoteCache(),
+                                 config->getPeerCache(),
+                                 config->getMemoryCacheSize()));
 
-  /* Scan the graph to discover what needs to be rebuilt, and compute the
-   * hashes of all nodes. */
-  falcon::GraphDependencyScan scanner(*graphPtr, cache.get());
-  scanner.scan();
+    /* Scan the graph to discover what needs to be rebuilt, and compute the
+     * hashes of all nodes. */
+    falcon::GraphDependencyScan scanner(*graphPtr, cache.get());
+    scanner.scan();
+  } catch (falcon::Exception& e) {
+    LOG(ERROR) << "Cannot start the cache: " << e.getErrorMessage();
+    int code = e.getCode() ? e.getCode() : 1;
+    notifyStarted(statusFd, code);
+    return code;
+  } catch (std::exception& e) {
+    LOG(ERROR) << "Cannot start the cache: " << e.what();
+    notifyStarted(statusFd, 1);
+    return 1;
+  }
 
   /* if a module has been requested to execute then load it and return */
-  if (opt.isOptionSetted("module")) {
-    return loadModule(*graphPtr,
+  if (runModule) {
+    return loadModule(*graphPtr, *cache, opt,
                       opt.vm_["module"].as<std::string>());
   }
 
   /* Start the daemon. */
-  daemonize(std::move(config), std::move(graphPtr), std::move(cache));
+  falcon::DaemonInstance daemon(std::move(config), std::move(cache));
+  daemon.loadConf(std::move(graphPtr));
+  notifyStarted(statusFd, 0);
+  daemon.start();
   return 0;
 }
@@ -6,6 +6,7 @@
 #include "options.h"
 #include "exceptions.h"
 #include <iostream>
+#include <sstream>
 
 #include "logging.h"
 
@@ -107,6 +108,27 @@ GlobalConfig::GlobalConfig(Options const& opt) {
   runDaemonBuilder_ = opt.isOptionSetted("daemon");
   programName_ = opt.getProgramName();
   logDirectory_ = opt.getLogDirectory();
+  sharedCacheDir_ = opt.vm_["cache-dir"].as<std::string>();
+  remoteCache_ = opt.vm_["cache-remote"].as<std::string>();
+  peerCache_ = opt.vm_["cache-peer"].as<std::string>();
+  cacheServerPort_ = opt.vm_["cache-serve-port"].as<int>();
+  int memoryCacheSize = opt.vm_["cache-memory-size"].as<int>();
+  memoryCacheSize_ = memoryCacheSize > 0
+    ? (std::size_t)memoryCacheSize << 20 : 0;
+  deferCacheMaterialization_ = opt.vm_["cache-defer-outputs"].as<bool>();
+  loadLimit_ = opt.vm_["load-limit"].as<double>();
+  memoryPressureLimit_ = opt.vm_["memory-pressure-limit"].as<double>();
+  int memoryReserve = opt.vm_["memory-reserve"].as<int>();
+  memoryReserve_ = memoryReserve > 0 ? (uint64_t)memoryReserve << 10 : 0;
+  int autoBuildDelay = opt.vm_["auto-build-delay"].as<int>();
+  autoBuildDelay_ = autoBuildDelay > 0 ? autoBuildDelay : 0;
+  std::istringstream targets(opt.vm_["auto-build-targets"].as<std::string>());
+  std::string target;
+  while (targets >> target) {
+    autoBuildTargets_.insert(target);
+  }
+  int autoBuildJobs = opt.vm_["auto-build-jobs"].as<int>();
+  autoBuildJobs_ = autoBuildJobs > 0 ? autoBuildJobs : 1;
 }
 
 std::string const& GlobalConfig::getJsonGraphFile() const {
@@ -145,4 +167,52 @@ std::string const& GlobalConfig::getLogDirectory() const {
   return logDirectory_;
 }
 std::string const& GlobalConfig::getFalconDir() const { return falconDir_; }
+
+std::string const& GlobalConfig::getSharedCacheDir() const {
+  return sharedCacheDir_;
+}
+
+std::string const& GlobalConfig::getRemoteCache() const {
+  return remoteCache_;
+}
+
+std::string const& GlobalConfig::getPeerCache() const {
+  return peerCache_;
+}
+
+int GlobalConfig::getCacheServerPort() const {
+  return cacheServerPort_;
+}
+
+std::size_t GlobalConfig::getMemoryCacheSize() const {
+  return memoryCacheSize_;
+}
+
+bool GlobalConfig::deferCacheMaterialization() const {
+  return deferCacheMaterialization_;
+}
+
+double GlobalConfig::getLoadLimit() const {
+  return loadLimit_;
+}
+
+double GlobalConfig::getMemoryPressureLimit() const {
+  return memoryPressureLimit_;
+}
+
+uint64_t GlobalConfig::getMemoryReserve() const {
+  return memoryReserve_;
+}
+
+unsigned int GlobalConfig::getAutoBuildDelay() const {
+  return autoBuildDelay_;
+}
+
+std::set<std::string> const& GlobalConfig::getAutoBuildTargets() const {
+  return autoBuildTargets_;
+}
+
+unsigned int GlobalConfig::getAutoBuildJobs() const {
+  return autoBuildJobs_;
+}
 }
@@ -6,6 +6,9 @@
 #ifndef FALCON_OPTIONS_H_
 # define FALCON_OPTIONS_H_
 
+# include <cstdint>
+# include <set>
+# include <string>
 # include <boost/program_options.hpp>
 # include "logging.h"
 
@@ -132,6 +135,74 @@ private:
 public:
   std::string const& getFalconDir() const;
 
+private:
+  std::string sharedCacheDir_;
+public:
+  /** Empty if the cache is private to the checkout. */
+  std::string const& getSharedCacheDir() const;
+
+private:
+  std::string remoteCache_;
+public:
+  std::string const& getRemoteCache() const;
+
+private:
+  std::string peerCache_;
+public:
+  std::string const& getPeerCache() const;
+
+private:
+  int cacheServerPort_;
+public:
+  /** 0 if the cache is not served. */
+  int getCacheServerPort() const;
+
+private:
+  std::size_t memoryCacheSize_;
+public:
+  /** In bytes. */
+  std::size_t getMemoryCacheSize() const;
+
+private:
+  bool deferCacheMaterialization_;
+public:
+  bool deferCacheMaterialization() const;
+
+private:
+  double loadLimit_;
+public:
+  /** 0 if there is no limit. */
+  double getLoadLimit() const;
+
+private:
+  double memoryPressureLimit_;
+public:
+  /** 0 if there is no limit. */
+  double getMemoryPressureLimit() const;
+
+private:
+  uint64_t memoryReserve_;
+public:
+  /** In kilobytes. */
+  uint64_t getMemoryReserve() const;
+
+private:
+  unsigned int autoBuildDelay_;
+public:
+  /** In milliseconds, 0 if the automatic builds are disabled. */
+  unsigned int getAutoBuildDelay() const;
+
+private:
+  std::set<std::string> autoBuildTargets_;
+public:
+  /** Empty to build all the targets. */
+  std::set<std::string> const& getAutoBuildTargets() const;
+
+private:
+  unsigned int autoBuildJobs_;
+public:
+  unsigned int getAutoBuildJobs() const;
+
 private:
   bool runDaemonBuilder_;
 public:
@@ -8,6 +8,8 @@
 #include <cassert>
 #include <fcntl.h>
 #include <signal.h>
+#include <sys/resource.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -37,8 +39,10 @@ PosixSubProcess::PosixSubProcess(const std::string& command,
                                  IStreamConsumer* consumer)
   : id_(id), command_(command)
   , workingDirectory_(workingDirectory)
+  , niceness_(0)
   , stdoutFd_(-1), stderrFd_(-1)
-  , consumer_(consumer), pid_(-1), status_(SubProcessExitStatus::UNKNOWN) { }
+  , consumer_(consumer), pid_(-1), status_(SubProcessExitStatus::UNKNOWN)
+  , usage_({ 0, 0, 0, 0 }) { }
 
 void PosixSubProcess::start() {
 
@@ -58,6 +62,9 @@ void PosixSubProcess::start() {
   }
   stderrFd_ = stderr_pipe[0];
 
+  startTime_ = std::chrono::steady_clock::now();
+  usage_.startTime = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
   pid_ = fork();
   if (pid_ < 0) {
     THROW_ERROR(errno, "Failed to fork");
@@ -108,6 +115,12 @@ void PosixSubProcess::childProcess(int stdout, int stderr) {
       THROW_ERROR_CODE(errno);
     }
 
+    /* Lower the priority of the command. This is best effort, the command
+     * runs anyway if it fails. */
+    if (niceness_ > 0) {
+      setpriority(PRIO_PROCESS, 0, getpriority(PRIO_PROCESS, 0) + niceness_);
+    }
+
     /* Run the command. */
     execl("/bin/sh", "/bin/sh", "-c", command_.c_str(), (char *) NULL);
   } while(false);
@@ -145,9 +158,17 @@ bool PosixSubProcess::onFdReady(int& fd, bool isStdout) {
 
 void PosixSubProcess::waitFinished() {
   int status;
-  if (waitpid(pid_, &status, 0) < 0) {
-    THROW_ERROR(errno, "waitpid failed");
+  struct rusage rusage;
+  if (wait4(pid_, &status, 0, &rusage) < 0) {
+    THROW_ERROR(errno, "wait4 failed");
   }
+  usage_.duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - startTime_).count();
+  usage_.cpuTime =
+      (rusage.ru_utime.tv_sec + rusage.ru_stime.tv_sec) * 1000ULL
+      + (rusage.ru_utime.tv_usec + rusage.ru_stime.tv_usec) / 1000;
+  /* ru_maxrss is in kilobytes on Linux. */
+  usage_.maxRss = rusage.ru_maxrss;
 
   status_ = SubProcessExitStatus::FAILED;
   if (WIFEXITED(status)) {
@@ -6,6 +6,8 @@
 #ifndef FALCON_POSIX_SUBPROCESS_H_
 #define FALCON_POSIX_SUBPROCESS_H_
 
+#include <chrono>
+#include <cstdint>
 #include <list>
 #include <memory>
 #include <mutex>
@@ -23,6 +25,18 @@ namespace falcon {
 enum class SubProcessExitStatus { UNKNOWN, SUCCEEDED, INTERRUPTED, FAILED };
 std::string toString(SubProcessExitStatus v);
 
+/** Resources used by a process that completed. */
+struct SubProcessUsage {
+  /* When the process was started, in milliseconds since the epoch. */
+  uint64_t startTime;
+  /* How long the process ran, in milliseconds. */
+  uint64_t duration;
+  /* User and system CPU time, in milliseconds. */
+  uint64_t cpuTime;
+  /* Peak resident set size, in kilobytes. */
+  uint64_t maxRss;
+};
+
 /**
  * Utility class for spawning a posix sub process.
  */
@@ -35,6 +49,10 @@ class PosixSubProcess {
   /** Start the process. */
   void start();
 
+  /** Run the process with a lower priority. Must be called before start().
+   * @param niceness Value added to the nice value of the process. */
+  void setNiceness(int niceness) { niceness_ = niceness; }
+
   /** Interrupt the process by sending the SIGINT signal. */
   void interrupt();
 
@@ -77,6 +95,10 @@ class PosixSubProcess {
 
   SubProcessExitStatus status() { return status_; }
 
+  /** Return the resources used by the process. Only valid once waitFinished()
+   * returned. */
+  const SubProcessUsage& usage() const { return usage_; }
+
   /**
    * Fill the given buffer with stdout.
    * @param buf Buffer to be filled.
@@ -98,6 +120,9 @@ class PosixSubProcess {
   std::string command_;
   std::string workingDirectory_;
 
+  /* Value added to the nice value of the process. */
+  int niceness_;
+
   /* File descriptors from which to read the output and error streams.
    * Set to -1 if the file descriptor was closed. */
   int stdoutFd_;
@@ -109,6 +134,12 @@ class PosixSubProcess {
 
   /* Exit status of the process. */
   SubProcessExitStatus status_;
+
+  /* When the process was started, to measure how long it ran. */
+  std::chrono::steady_clock::time_point startTime_;
+
+  /* Resources used by the process, filled by waitFinished(). */
+  SubProcessUsage usage_;
 };
 
 typedef std::unique_ptr<PosixSubProcess> PosixSubProcessPtr;
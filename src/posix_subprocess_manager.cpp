@@ -14,7 +14,7 @@
 namespace falcon {
 
 PosixSubProcessManager::PosixSubProcessManager(IStreamConsumer *consumer)
-    : id_(0), consumer_(consumer) { }
+    : id_(0), consumer_(consumer), niceness_(0), wokenUp_(false) { }
 
 PosixSubProcessManager::~PosixSubProcessManager() {
   /* The user should wait for all the processes to complete before
@@ -30,6 +30,7 @@ unsigned int PosixSubProcessManager::addProcess(Rule *rule,
   PosixSubProcessPtr proc(new PosixSubProcess(command, workingDirectory,
                                               id, consumer_));
   mapToRule_.insert(std::make_pair(proc.get(), rule));
+  proc->setNiceness(niceness_);
   proc->start();
 
   int stdout = proc->stdoutFd_;
@@ -59,6 +60,7 @@ void PosixSubProcessManager::run() {
   sigemptyset(&set);
 
   std::vector<pollfd> fds(pollfds_.begin(), pollfds_.end());
+  fds.push_back({ wakeUpEvent_.get(), POLLIN, 0 });
 
   sigprocmask(SIG_SETMASK, &set, &origmask);
   if (poll(&fds.front(), fds.size(), -1) < 0) {
@@ -68,7 +70,13 @@ void PosixSubProcessManager::run() {
 
   /* Try to read data from each fd that is ready. */
   for (auto it = fds.begin(); it != fds.end(); ++it) {
-    if (it->revents) {
+    if (it->revents == 0) {
+      continue;
+    }
+    if (it->fd == wakeUpEvent_.get()) {
+      wakeUpEvent_.flush();
+      wokenUp_ = true;
+    } else {
       readFd(it->fd);
     }
   }
@@ -88,7 +96,21 @@ PosixSubProcessManager::BuiltRule PosixSubProcessManager::waitForNext() {
   Rule *rule = it->second;
   mapToRule_.erase(it);
 
-  return BuiltRule{rule, proc->status(), proc->id()};
+  return BuiltRule{rule, proc->status(), proc->id(), proc->usage()};
+}
+
+bool PosixSubProcessManager::waitForEvent() {
+  wokenUp_ = false;
+  while (finished_.empty() && !wokenUp_) {
+    run();
+  }
+  return !finished_.empty();
+}
+
+void PosixSubProcessManager::wakeUp() {
+  if (wakeUpEvent_.raise() != 0) {
+    LOG(ERROR) << "Could not wake up the process manager";
+  }
 }
 
 void PosixSubProcessManager::interrupt() {
@@ -13,6 +13,7 @@
 
 #include "posix_subprocess.h"
 #include "graph.h"
+#include "util/event.h"
 
 namespace falcon {
 
@@ -27,6 +28,7 @@ class PosixSubProcessManager {
     Rule* rule;
     SubProcessExitStatus status;
     unsigned int cmdId;
+    SubProcessUsage usage;
   };
 
   PosixSubProcessManager(IStreamConsumer *consumer);
@@ -57,8 +59,22 @@ class PosixSubProcessManager {
    */
   BuiltRule waitForNext();
 
+  /**
+   * Wait for the next command to complete, or for wakeUp() to be called.
+   * @return true if a command completed. waitForNext() then returns it without
+   * blocking.
+   */
+  bool waitForEvent();
+
+  /** Make waitForEvent() return. Can be called from any thread. */
+  void wakeUp();
+
   std::size_t nbRunning() const { return running_.size() + finished_.size(); }
 
+  /** Run the processes spawned from now on with a lower priority (see
+   * PosixSubProcess::setNiceness()). */
+  void setNiceness(int niceness) { niceness_ = niceness; }
+
   /** Interrupt all the running processes by sending the SIGINT signal. */
   void interrupt();
 
@@ -87,6 +103,12 @@ class PosixSubProcessManager {
 
   unsigned int id_;
   IStreamConsumer* consumer_;
+  int niceness_;
+
+  /* Raised by wakeUp(), monitored with the file descriptors of the
+   * processes. */
+  EventNotifier wakeUpEvent_;
+  bool wokenUp_;
 
   /** List of processes currently running. */
   RunningProcesses running_;
@@ -22,6 +22,13 @@
 
 namespace falcon {
 
+/* Number of builds whose output is kept after they completed, for the clients
+ * that connect late. */
+static const std::size_t kNumKeptBuilds = 16;
+
+/* Maximum size of the build id sent by a client, newline included. */
+static const std::size_t kMaxBuildIdSize = 16;
+
 StreamServer::StreamServer()
   : serverSocket_(-1)
   , eventFd_()
@@ -93,47 +100,79 @@ void StreamServer::removeBuild(std::list<BuildInfo>::iterator it) {
   builds_.erase(it);
 }
 
-void StreamServer::newBuild(unsigned int buildId) {
-  std::lock_guard<std::mutex> lock(mutex_);
+/* Locking is performed by the callers (closeClient, newBuild). */
+void StreamServer::pruneBuilds() {
+  std::size_t i = 0;
+  for (auto it = builds_.begin(); it != builds_.end(); ++i) {
+    auto next = std::next(it);
+    if (i >= kNumKeptBuilds && it->buildCompleted && it->refcount == 0) {
+      removeBuild(it);
+    }
+    it = next;
+  }
+}
 
-  /* The previous build might be ready for removal if there are no more clients
-   * reading its output. */
-  if (!builds_.empty()) {
-    /* endBuild should have been called prior to calling newBuild. */
-    assert(builds_.front().buildCompleted);
-    if (builds_.front().refcount == 0) {
-      removeBuild(builds_.begin());
+std::list<StreamServer::BuildInfo>::iterator
+StreamServer::findBuild(unsigned int buildId) {
+  for (auto it = builds_.begin(); it != builds_.end(); ++it) {
+    if (it->id == buildId && !it->buildCompleted) {
+      return it;
     }
   }
+  return builds_.end();
+}
+
+std::list<StreamServer::BuildInfo>::iterator
+StreamServer::lookupBuild(unsigned int buildId) {
+  for (auto it = builds_.begin(); it != builds_.end(); ++it) {
+    if (it->id == buildId) {
+      return it;
+    }
+  }
+  return builds_.end();
+}
+
+void StreamServer::newBuild(unsigned int buildId) {
+  std::lock_guard<std::mutex> lock(mutex_);
 
   auto info = BuildInfo(buildId);
   builds_.push_front(std::move(info));
+  BuildInfo& build = builds_.front();
+
+  /* The previous builds might be ready for removal if there are no more
+   * clients reading their output. */
+  pruneBuilds();
 
-  writeBuf("{\n"
-           "  \"id\": ");
+  writeBuf(build, "{\n"
+                  "  \"id\": ");
   std::ostringstream ss;
   ss << buildId;
-  writeBuf(ss.str());
-  writeBuf(",\n"
-           "  \"cmds\": [\n");
+  writeBuf(build, ss.str());
+  writeBuf(build, ",\n"
+                  "  \"cmds\": [\n");
   flushWaiting();
 }
 
-void StreamServer::endBuild(BuildResult result) {
+void StreamServer::endBuild(unsigned int buildId, BuildResult result,
+                            const std::string& cacheStats) {
   std::lock_guard<std::mutex> lock(mutex_);
 
-  /* There should be an ongoing build. */
-  assert(!builds_.empty() && !builds_.front().buildCompleted);
-
-  writeBuf("\n"
-           "  ],\n"
-           "  \"result\": \"");
-  writeBuf(toString(result));
-  writeBuf("\"\n"
-           "}\n");
+  /* The build should be ongoing. */
+  auto it = findBuild(buildId);
+  assert(it != builds_.end());
+  BuildInfo& build = *it;
+
+  writeBuf(build, "\n"
+                  "  ],\n"
+                  "  \"result\": \"");
+  writeBuf(build, toString(result));
+  writeBuf(build, "\",\n"
+                  "  \"cache_stats\": ");
+  writeBuf(build, cacheStats);
+  writeBuf(build, "\n"
+                  "}\n");
+  build.buildCompleted = true;
   flushWaiting();
-
-  builds_.front().buildCompleted = true;
 }
 
 void StreamServer::processEvents() {
@@ -145,6 +184,11 @@ void StreamServer::processEvents() {
           fds.push_back({ fd, POLLOUT });
         }
     );
+    std::for_each(readers_.begin(), readers_.end(),
+        [&fds](const int& fd) {
+          fds.push_back({ fd, POLLIN });
+        }
+    );
 
     fds.push_back({ serverSocket_, POLLIN });
     fds.push_back({ eventFd_.get(), POLLIN });
@@ -176,7 +220,10 @@ void StreamServer::processEvents() {
         LOG(ERROR) << "Unexpected poll event " << it->revents;
       }
     } else if (it->fd != eventFd_.get()) {
-      if (it->revents & POLLOUT) {
+      if (it->events == POLLIN) {
+        /* A hang up is seen by recv. */
+        readBuildId(it->fd);
+      } else if (it->revents & POLLOUT) {
         processClient(it->fd);
       } else {
         LOG(ERROR) << "Unexpected poll event " << it->revents;
@@ -213,23 +260,72 @@ void StreamServer::acceptClients() {
 void StreamServer::createClient(int fd) {
   std::lock_guard<std::mutex> lock(mutex_);
 
-  bool isWaiting = builds_.empty()
-    || builds_.front().buf.size() == 0;
+  /* The client is assigned to a build once it sent its id. */
+  readers_.push_front(fd);
+  map_[fd] = ClientInfo{ builds_.end(), 0, readers_.begin(),
+                         ClientState::READING_ID, "" };
+}
 
-  std::list<int>::iterator itFd;
-  if (isWaiting) {
-    waiting_.push_front(fd);
-    itFd = waiting_.begin();
-  } else {
-    fds_.push_front(fd);
-    itFd = fds_.begin();
+std::list<int>& StreamServer::listOf(ClientState state) {
+  switch (state) {
+    case ClientState::READING_ID:
+      return readers_;
+    case ClientState::WAITING:
+      return waiting_;
+    default:
+      return fds_;
+  }
+}
+
+void StreamServer::readBuildId(int fd) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = map_.find(fd);
+  assert(it != map_.end());
+  ClientInfo& info = it->second;
+  assert(info.state == ClientState::READING_ID);
+
+  char buf[kMaxBuildIdSize];
+  int r = recv(fd, buf, sizeof(buf), 0);
+  if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+    return;
+  }
+  if (r <= 0) {
+    /* The client hung up before sending its build id. */
+    closeClient(fd);
+    return;
+  }
+  info.idBuf.append(buf, r);
+
+  std::size_t end = info.idBuf.find('\n');
+  if (end == std::string::npos) {
+    if (info.idBuf.size() >= kMaxBuildIdSize) {
+      LOG(WARNING) << "Stream client sent an invalid build id";
+      closeClient(fd);
+    }
+    return;
   }
 
-  if (!builds_.empty()) {
-    builds_.front().refcount++;
+  std::string id = info.idBuf.substr(0, end);
+  auto itBuild = builds_.end();
+  if (!id.empty() && id.find_first_not_of("0123456789") == std::string::npos) {
+    itBuild = lookupBuild(std::stoul(id));
+  }
+  if (itBuild == builds_.end()) {
+    LOG(WARNING) << "Stream client asked for unknown build '" << id << "'";
+    closeClient(fd);
+    return;
   }
 
-  map_[fd] = ClientInfo{ builds_.begin(), 0, itFd, isWaiting};
+  /* The header of the build is written by newBuild, there is always something
+   * to be sent. */
+  itBuild->refcount++;
+  info.itBuild = itBuild;
+  info.bufPtr = 0;
+  info.idBuf.clear();
+  readers_.erase(info.itFd);
+  fds_.push_front(fd);
+  info.itFd = fds_.begin();
+  info.state = ClientState::SENDING;
 }
 
 void StreamServer::processClient(int fd) {
@@ -273,63 +369,47 @@ void StreamServer::processClient(int fd) {
     /* There might be more data. Put it in the waiting list. */
     fds_.erase(it->second.itFd);
     waiting_.push_front(fd);
-    it->second.isWaiting = true;
+    it->second.state = ClientState::WAITING;
     it->second.itFd = waiting_.begin();
   }
 }
 
-/* Locking already performed by processClient (the caller). */
+/* Locking already performed by the callers (processClient, readBuildId). */
 void StreamServer::closeClient(int fd) {
   auto itMap = map_.find(fd);
   assert(itMap != map_.end());
 
-  /* Decrement the refcount of the build. */
+  /* Decrement the refcount of the build, if the client was assigned to one.
+   * Remove the build info if it is no longer needed. */
   auto itBuild = itMap->second.itBuild;
-  assert(itBuild != builds_.end());
-  itBuild->refcount--;
-
-  /* Remove the build info if the refcount reaches 0, the build completed, and
-   * we have a more recent build. The last check is here in order to make sure
-   * that we always have at least one build in the list, so that when a new
-   * client connects it is always assigned to a build. */
-  if (itBuild->refcount == 0 && itBuild->buildCompleted
-      && itBuild != builds_.begin()) {
-    removeBuild(itBuild);
+  if (itBuild != builds_.end()) {
+    itBuild->refcount--;
+    pruneBuilds();
   }
 
-  fds_.erase(itMap->second.itFd);
+  listOf(itMap->second.state).erase(itMap->second.itFd);
   map_.erase(itMap);
   close(fd);
 }
 
 void StreamServer::flushWaiting() {
-  /* If we are flushing the waiting list, it means there is some new data
-   * and thus we should have an ongoing build. */
-  assert(!builds_.empty()
-      && !builds_.front().buildCompleted
-      && !builds_.front().buf.empty());
-
-  for (auto it = waiting_.begin(); it != waiting_.end(); ++it) {
-    /* Move the client fd from waiting_ to fds_. */
-    fds_.push_front(*it);
+  for (auto it = waiting_.begin(); it != waiting_.end(); ) {
     auto itMap = map_.find(*it);
     assert(itMap != map_.end());
-    itMap->second.itFd = fds_.begin();
-    itMap->second.isWaiting = false;
+    ClientInfo& info = itMap->second;
 
-    /* Assign the client to the current build, if needed. */
-    if (itMap->second.itBuild == builds_.end()) {
-      itMap->second.itBuild = builds_.begin();
-      itMap->second.itBuild->refcount++;
-    } else {
-      /* If the client in the waiting list was already assigned to a build, it
-       * should be the current build, because we can only do a build at a time,
-       * and any client that was reading the data of a previous build should
-       * have been closed. */
-      assert(itMap->second.itBuild == builds_.begin());
+    if (info.bufPtr >= info.itBuild->buf.size()) {
+      /* No new data for the build of this client. */
+      ++it;
+      continue;
     }
+
+    /* Move the client fd from waiting_ to fds_. */
+    fds_.push_front(*it);
+    info.itFd = fds_.begin();
+    info.state = ClientState::SENDING;
+    it = waiting_.erase(it);
   }
-  waiting_.clear();
 
   notifyPoll();
 }
@@ -340,45 +420,62 @@ void StreamServer::notifyPoll() {
   }
 }
 
-void StreamServer::writeBuf(const std::string& str) {
-  assert(!builds_.empty());
-  builds_.front().buf.append(str);
+void StreamServer::writeBuf(BuildInfo& build, const std::string& str) {
+  build.buf.append(str);
 }
 
-void StreamServer::writeBufEscapeJson(const char* buf, std::size_t len) {
-  assert(!builds_.empty());
-
+void StreamServer::writeBufEscapeJson(BuildInfo& build, const char* buf,
+                                      std::size_t len) {
   for (std::size_t i = 0; i < len; i++) {
     char c = buf[i];
     if (c == '"' || c == '\\') {
-      builds_.front().buf.push_back('\\');
-      builds_.front().buf.push_back(c);
+      build.buf.push_back('\\');
+      build.buf.push_back(c);
     } else if (c == '\n') {
-      builds_.front().buf.append("\\n");
+      build.buf.append("\\n");
     } else {
-      builds_.front().buf.push_back(c);
+      build.buf.push_back(c);
     }
   }
 }
 
+void StreamServer::newChunk(BuildInfo& build) {
+  if (build.firstChunk) {
+    build.firstChunk = false;
+  } else {
+    writeBuf(build, ",\n");
+  }
+}
+
 void StreamServer::writeCmdOutput(unsigned int cmdId, char* buf,
                                   std::size_t len, bool isStdout) {
   std::lock_guard<std::mutex> lock(mutex_);
-  assert(!builds_.empty());
-  assert(!builds_.front().firstChunk);
 
-  writeBuf(",\n");
-  writeBuf("    { \"id\": ");
+  auto itCmd = cmdBuilds_.find(cmdId);
+  if (itCmd == cmdBuilds_.end()) {
+    return;
+  }
+
   std::ostringstream ss;
   ss << cmdId;
-  writeBuf(ss.str());
-  if (isStdout) {
-    writeBuf(", \"stdout\": \"");
-  } else {
-    writeBuf(", \"stderr\": \"");
+  for (auto itId = itCmd->second.begin(); itId != itCmd->second.end();
+       ++itId) {
+    auto it = findBuild(*itId);
+    if (it == builds_.end()) {
+      /* This build completed already. */
+      continue;
+    }
+    newChunk(*it);
+    writeBuf(*it, "    { \"id\": ");
+    writeBuf(*it, ss.str());
+    if (isStdout) {
+      writeBuf(*it, ", \"stdout\": \"");
+    } else {
+      writeBuf(*it, ", \"stderr\": \"");
+    }
+    writeBufEscapeJson(*it, buf, len);
+    writeBuf(*it, "\" }");
   }
-  writeBufEscapeJson(buf, len);
-  writeBuf("\" }");
 
   flushWaiting();
 }
@@ -391,24 +488,26 @@ void StreamServer::writeStderr(unsigned int cmdId, char* buf, std::size_t len) {
   writeCmdOutput(cmdId, buf, len, false);
 }
 
-void StreamServer::newCommand(unsigned int cmdId, const std::string& cmd) {
+void StreamServer::newCommand(unsigned int cmdId, const std::string& cmd,
+                              const BuildIds& builds) {
   std::lock_guard<std::mutex> lock(mutex_);
 
-  assert(!builds_.empty());
+  cmdBuilds_[cmdId] = builds;
 
-  if (builds_.front().firstChunk) {
-    builds_.front().firstChunk = false;
-  } else {
-    writeBuf(",\n");
-  }
-
-  writeBuf("    { \"id\": ");
   std::ostringstream ss;
   ss << cmdId;
-  writeBuf(ss.str());
-  writeBuf(", \"cmd\": \"");
-  writeBufEscapeJson(&cmd[0], cmd.size());
-  writeBuf("\" }");
+  for (auto itId = builds.begin(); itId != builds.end(); ++itId) {
+    auto it = findBuild(*itId);
+    if (it == builds_.end()) {
+      continue;
+    }
+    newChunk(*it);
+    writeBuf(*it, "    { \"id\": ");
+    writeBuf(*it, ss.str());
+    writeBuf(*it, ", \"cmd\": \"");
+    writeBufEscapeJson(*it, &cmd[0], cmd.size());
+    writeBuf(*it, "\" }");
+  }
 
   flushWaiting();
 }
@@ -416,37 +515,46 @@ void StreamServer::newCommand(unsigned int cmdId, const std::string& cmd) {
 void StreamServer::endCommand(unsigned int cmdId, SubProcessExitStatus status) {
   std::lock_guard<std::mutex> lock(mutex_);
 
-  assert(!builds_.empty());
+  auto itCmd = cmdBuilds_.find(cmdId);
+  if (itCmd == cmdBuilds_.end()) {
+    return;
+  }
 
-  writeBuf(",\n");
-  writeBuf("    { \"id\": ");
   std::ostringstream ss;
   ss << cmdId;
-  writeBuf(ss.str());
-  writeBuf(", \"status\": \"");
-  writeBuf(toString(status));
-  writeBuf("\" }");
+  for (auto itId = itCmd->second.begin(); itId != itCmd->second.end();
+       ++itId) {
+    auto it = findBuild(*itId);
+    if (it == builds_.end()) {
+      continue;
+    }
+    newChunk(*it);
+    writeBuf(*it, "    { \"id\": ");
+    writeBuf(*it, ss.str());
+    writeBuf(*it, ", \"status\": \"");
+    writeBuf(*it, toString(status));
+    writeBuf(*it, "\" }");
+  }
+  cmdBuilds_.erase(itCmd);
 
   flushWaiting();
 }
 
-void StreamServer::cacheRetrieveAction(const std::string& path) {
+void StreamServer::cacheRetrieveAction(const std::string& path,
+                                       const BuildIds& builds) {
   std::lock_guard<std::mutex> lock(mutex_);
 
-  assert(!builds_.empty());
-
-  if (builds_.front().firstChunk) {
-    builds_.front().firstChunk = false;
-  } else {
-    writeBuf(",\n");
+  for (auto itId = builds.begin(); itId != builds.end(); ++itId) {
+    auto it = findBuild(*itId);
+    if (it == builds_.end()) {
+      continue;
+    }
+    newChunk(*it);
+    writeBuf(*it, "    { \"cache\": \"");
+    writeBuf(*it, path);
+    writeBuf(*it, "\" }");
   }
 
-  writeBuf("    { \"cache\": \"");
-  std::ostringstream ss;
-  ss << path;
-  writeBuf(ss.str());
-  writeBuf("\" }");
-
   flushWaiting();
 }
 
@@ -12,6 +12,7 @@
 #include <mutex>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "stream_consumer.h"
 #include "util/event.h"
@@ -20,27 +21,37 @@ namespace falcon {
 
 enum class BuildResult;
 
+/** Ids of the builds an action is part of. */
+typedef std::vector<unsigned int> BuildIds;
+
 /**
  * Interface required by GraphParallelBuilder.
  */
 class IBuildOutputConsumer : public IStreamConsumer {
  public:
   virtual ~IBuildOutputConsumer() {}
-  virtual void newCommand(unsigned int cmdId, const std::string& cmd) = 0;
+  virtual void newCommand(unsigned int cmdId, const std::string& cmd,
+                          const BuildIds& builds) = 0;
   virtual void endCommand(unsigned int cmdId, SubProcessExitStatus status) = 0;
-  virtual void cacheRetrieveAction(const std::string& path) = 0;
+  virtual void cacheRetrieveAction(const std::string& path,
+                                   const BuildIds& builds) = 0;
 };
 
 /**
  * -- A server for streaming the build output to several clients.
  *
- * When a client connects to the streaming server, it will receive the output of
- * the last build that was started (it may be a build that already completed).
- * If there is no such build (ie we never built before), the client will wait
- * and receive the data of the next build to start.
+ * When a client connects to the streaming server, it first sends the id of the
+ * build it wants to follow, in decimal followed by a newline. The id is the one
+ * returned by requestBuild. It then receives the output of that build (it may
+ * be a build that already completed). If the build is unknown, the client
+ * socket is closed without sending anything.
  * A client will only receive the output of one build. When the output of the
  * build is sent completely, the client socket is closed.
  *
+ * Several builds may run at the same time. Each of them has its own output,
+ * with the commands and the cache actions it needs. A command needed by
+ * several builds appears in the output of each of them.
+ *
  * This class is designed in a way that guarantees that it is possible to start
  * a new build even if there are still slow client reading the output of a
  * previous build. Thus, we can have clients that read the output of an old
@@ -56,19 +67,24 @@ class IBuildOutputConsumer : public IStreamConsumer {
  * - A refcount that counts the number of clients to which the buffer is
  *   currently being sent.
  * When a build completes and the refcount reaches 0, the struct is removed from
- * the list.
+ * the list, unless it is one of the kNumKeptBuilds last builds. These are kept
+ * for the clients that connect after their build completed.
  *
- * This class maintains two lists:
+ * This class maintains three lists:
+ * - readers_: this is the list of clients' file descriptors that did not send
+ *   the id of their build yet. These file descriptors are monitored with poll
+ *   for reading;
  * - waiting_: this is the list of clients' file descriptors that are waiting
  *   for new data to come;
  * - fds_: this is the list of clients' file descriptors for which there is new
  *   data to be sent to. These file descriptors are monitored with poll.
  * The file descriptors are moved from one list to the other depending on its
- * state (waiting for new data vs ready to read new data).
+ * state (reading the build id vs waiting for new data vs ready to read new
+ * data).
  *
  * This class maintains a list of 'ClientInfo' structs corresponding to each
  * connected client. Each struct contains:
- * - an iterator to the corresponding file descriptor either in waiting_ or
+ * - an iterator to the corresponding file descriptor in readers_, waiting_ or
  *   fds_ depending on the state of the client;
  * - An iterator to the BuildInfo struct corresponding to the build on which the
  *   client is reading the output;
@@ -111,22 +127,29 @@ class StreamServer : public IBuildOutputConsumer {
 
   /**
    * Indicate that a new build has started.
-   * Must be called after endBuild was called if it is not the first build.
+   * @param buildId Id of the build, must be unique.
    */
   void newBuild(unsigned int buildId);
 
   /**
-   * Mark the current build as completed. Must be called after newBuild was
-   * called.
+   * Mark a build as completed. Must be called after newBuild was called.
+   * @param buildId    Id of the build.
+   * @param result     Result of the build.
+   * @param cacheStats Json object with the cache stats of the build, see
+   *                   CacheStats::toJson().
    */
-  void endBuild(BuildResult result);
+  void endBuild(unsigned int buildId, BuildResult result,
+                const std::string& cacheStats);
 
   /**
    * Notify that a new command was started.
-   * @param cmdId Id of the command.
-   * @param cmd   Command being run.
+   * @param cmdId  Id of the command.
+   * @param cmd    Command being run.
+   * @param builds Builds that need the command. Its output is written to
+   *               each of them.
    */
-  void newCommand(unsigned int cmdId, const std::string& cmd);
+  void newCommand(unsigned int cmdId, const std::string& cmd,
+                  const BuildIds& builds);
 
   /**
    * Notify that a command has completed.
@@ -152,8 +175,10 @@ class StreamServer : public IBuildOutputConsumer {
 
   /**
    * Notify that a target was retrieved from the cache.
+   * @param path   Path of the target.
+   * @param builds Builds that need the target.
    */
-  void cacheRetrieveAction(const std::string& path);
+  void cacheRetrieveAction(const std::string& path, const BuildIds& builds);
 
  private:
 
@@ -177,8 +202,15 @@ class StreamServer : public IBuildOutputConsumer {
   void createClient(int fd);
 
   /**
-   * Called when a socket is ready for a read.
-   * @param fd Fd of the socket ready to be read.
+   * Called when a client that did not send its build id yet is ready for a
+   * read. Once the id is read, the client is assigned to the build.
+   * @param fd Fd of the client socket.
+   */
+  void readBuildId(int fd);
+
+  /**
+   * Called when a socket is ready for a write.
+   * @param fd Fd of the socket ready to be written.
    */
   void processClient(int fd);
 
@@ -188,8 +220,8 @@ class StreamServer : public IBuildOutputConsumer {
   void closeClient(int fd);
 
   /**
-   * Move all the file descriptors in the waiting_ list to fds_ so that they are
-   * monitored with poll.
+   * Move the file descriptors of the waiting_ list that have new data to be
+   * read to fds_ so that they are monitored with poll.
    */
   void flushWaiting();
 
@@ -198,8 +230,13 @@ class StreamServer : public IBuildOutputConsumer {
    * file descriptors to monitor or because we are shutting down. */
   void notifyPoll();
 
-  void writeBuf(const std::string& str);
-  void writeBufEscapeJson(const char* buf, std::size_t len);
+  struct BuildInfo;
+
+  void writeBuf(BuildInfo& build, const std::string& str);
+  void writeBufEscapeJson(BuildInfo& build, const char* buf, std::size_t len);
+
+  /** Start a new chunk of json in the output of a build. */
+  void newChunk(BuildInfo& build);
 
   struct BuildInfo {
     unsigned int id;
@@ -220,6 +257,18 @@ class StreamServer : public IBuildOutputConsumer {
   /** Remove a build from the list of builds. */
   void removeBuild(std::list<BuildInfo>::iterator it);
 
+  /** Remove the completed builds that no client reads, except for the
+   * kNumKeptBuilds last builds. */
+  void pruneBuilds();
+
+  /** Find a build that is not completed. Return builds_.end() if there is no
+   * such build. */
+  std::list<BuildInfo>::iterator findBuild(unsigned int buildId);
+
+  /** Find a build, completed or not. Return builds_.end() if there is no such
+   * build. */
+  std::list<BuildInfo>::iterator lookupBuild(unsigned int buildId);
+
   /**
    * Helper function for writing a chunk of data comming from a command.
    * @param cmdId    id of the command;
@@ -233,6 +282,9 @@ class StreamServer : public IBuildOutputConsumer {
   /** Queue of builds. Each new build is pushed to the front. */
   std::list<BuildInfo> builds_;
 
+  /** Builds that need each running command. */
+  std::unordered_map<unsigned int, BuildIds> cmdBuilds_;
+
   /* File descriptor of the server socket. */
   int serverSocket_;
 
@@ -243,6 +295,10 @@ class StreamServer : public IBuildOutputConsumer {
   /* List of fds monitored with ppoll. */
   std::list<int> fds_;
 
+  /* List of fds of the clients that did not send their build id yet. They are
+   * monitored with poll for reading. */
+  std::list<int> readers_;
+
   /* List of fds for which buf_ has been entirely sent. They are put on hold in
    * this list and will be put back for monitoring each time new data
    * arrives. */
@@ -250,23 +306,35 @@ class StreamServer : public IBuildOutputConsumer {
 
   std::mutex mutex_;
 
+  enum class ClientState {
+    /* The fd is in readers_, the client did not send its build id yet. */
+    READING_ID,
+    /* The fd is in waiting_ and will be moved to fds_ when new data arrives.
+     * bufPtr is at the end of the buffer. */
+    WAITING,
+    /* The fd is in fds_, there is data to be sent. */
+    SENDING
+  };
+
   struct ClientInfo {
     /* Iterator to the BuildInfo structure corresponding to the build the client
-     * is listening on. Equals to builds_.end() if there are no builds yet. */
+     * is listening on. Equals to builds_.end() until the client sent its build
+     * id. */
     std::list<BuildInfo>::iterator itBuild;
     /* Current pointer in itBuild->buf. Everything before this pointer has been
      * already sent. */
     std::size_t bufPtr;
-    /* Iterator to the fd entry in fds_ or waiting_, depending on isWaiting. */
+    /* Iterator to the fd entry in readers_, waiting_ or fds_, depending on
+     * state. */
     std::list<int>::iterator itFd;
-    /* Indicate if the fd is waiting for new data. In this case, it is stored in
-     * waiting_ and will be moved to fds_ when new data arrives. When a fd is
-     * waiting for new data, bufPtr should be at the end of the buffer or
-     * itBuild should be equal to builds_.end() (ie not assigned to a build
-     * yet). */
-    bool isWaiting;
+    ClientState state;
+    /* The part of the build id read so far. */
+    std::string idBuf;
   };
 
+  /** Return the list that contains the fd of a client in the given state. */
+  std::list<int>& listOf(ClientState state);
+
   /* Map a fd to some information about the client, such as the current position
    * in the buffer. */
   std::unordered_map<int, ClientInfo> map_;
@@ -0,0 +1,69 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#ifndef FALCON_TEST_DIRECTORY_H_
+# define FALCON_TEST_DIRECTORY_H_
+
+# include <cstdlib>
+# include <iostream>
+# include <string>
+
+# include "test.h"
+
+namespace falcon {
+
+/*!
+ * @class DirectoryTest
+ * @brief Test that works in a fresh temporary directory
+ * The directory is created by prepareTest() and removed with its content by
+ * closeTest(). */
+class DirectoryTest : public Test {
+public:
+  /* prefix is the beginning of the name of the directory in /tmp. */
+  DirectoryTest(std::string const& comment, std::string const& prefix)
+    : Test(comment, "no error"), prefix_(prefix) {}
+
+  void prepareTest() {
+    std::string tmpl = "/tmp/" + prefix_ + ".XXXXXX";
+    if (mkdtemp(&tmpl[0]) != NULL) {
+      dir_ = tmpl;
+    }
+  }
+
+  void closeTest() {
+    if (!dir_.empty()) {
+      std::string cmd = "rm -rf " + dir_;
+      if (system(cmd.c_str()) != 0) {
+        std::cerr << "could not remove " << dir_ << std::endl;
+      }
+    }
+  }
+
+protected:
+  /* Mark the test as failed, return false. */
+  bool fail(std::string const& msg) {
+    setSuccess(false);
+    setErrorMessage(msg);
+    return false;
+  }
+
+  /* Return true if a cache backend has an entry with the expected data. */
+  template <typename Cache>
+  bool hasData(Cache& cache, std::string const& hash,
+               std::string const& expected) {
+    std::string data;
+    return cache.loadEntry(hash, data) && data == expected;
+  }
+
+  /* Empty if the directory could not be created. */
+  std::string dir_;
+
+private:
+  std::string prefix_;
+};
+
+}
+
+#endif /* !FALCON_TEST_DIRECTORY_H_ */
@@ -0,0 +1,178 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#include <iostream>
+
+#include "admission_controller.h"
+#include "test.h"
+
+/* Admission controller that sees a fake machine. */
+class FakeAdmissionController : public falcon::AdmissionController {
+public:
+  FakeAdmissionController(const Limits& limits)
+    : falcon::AdmissionController(limits)
+  {
+    stats_.load = 0;
+    stats_.memoryPressure = 0;
+    stats_.memAvailable = 8 << 20;
+  }
+
+  SystemStats stats_;
+
+protected:
+  void readSystemStats(SystemStats& stats) {
+    stats = stats_;
+  }
+};
+
+class FalconAdmissionTestBase : public falcon::Test {
+public:
+  FalconAdmissionTestBase(std::string const& name)
+    : falcon::Test(name, "no error")
+  {}
+
+protected:
+  bool fail(std::string const& msg) {
+    setSuccess(false);
+    setErrorMessage(msg);
+    return false;
+  }
+
+  /* A rule whose last run used the given amount of memory. */
+  falcon::Rule* makeRule(uint64_t maxRss) {
+    falcon::Rule* rule = new falcon::Rule(falcon::NodeArray(),
+                                          falcon::NodeArray());
+    rule->setCommand("true");
+    rule->setMaxRss(maxRss);
+    rules_.push_back(rule);
+    return rule;
+  }
+
+  void prepareTest() {}
+  void closeTest() {
+    for (auto it = rules_.begin(); it != rules_.end(); ++it) {
+      delete *it;
+    }
+  }
+
+  falcon::RuleArray rules_;
+};
+
+class FalconAdmissionMemoryTest : public FalconAdmissionTestBase {
+public:
+  FalconAdmissionMemoryTest()
+    : FalconAdmissionTestBase("admission: commands must fit in memory")
+  {}
+
+  void runTest() {
+    /* 8GB available, 1GB reserve. */
+    FakeAdmissionController admission({ 0, 0, 1 << 20 });
+    admission.startBuild();
+
+    falcon::Rule* link1 = makeRule(4 << 20);
+    falcon::Rule* link2 = makeRule(4 << 20);
+    falcon::Rule* compile = makeRule(512 << 10);
+    falcon::Rule* unknown = makeRule(0);
+
+    if (!admission.admit(link1)) {
+      fail("first command held back");
+      return;
+    }
+    admission.onStarted(link1);
+    if (admission.admit(link2)) {
+      fail("admitted a command that does not fit in memory");
+      return;
+    }
+    if (!admission.admit(compile) || !admission.admit(unknown)) {
+      fail("held back a command that fits in memory");
+      return;
+    }
+
+    /* Another process took the memory. */
+    admission.stats_.memAvailable = 1 << 20;
+    if (admission.admit(compile)) {
+      fail("admitted a command while the memory is exhausted");
+      return;
+    }
+
+    admission.onFinished(link1);
+    if (admission.getReservedMemory() != 0) {
+      fail("memory still reserved after the command completed");
+      return;
+    }
+    if (!admission.admit(link2)) {
+      fail("held back a command while none is running");
+      return;
+    }
+    setSuccess(true);
+  }
+};
+
+class FalconAdmissionLoadTest : public FalconAdmissionTestBase {
+public:
+  FalconAdmissionLoadTest()
+    : FalconAdmissionTestBase("admission: load and memory pressure limits")
+  {}
+
+  void runTest() {
+    FakeAdmissionController admission({ 16, 10, 0 });
+    admission.startBuild();
+
+    falcon::Rule* first = makeRule(0);
+    falcon::Rule* second = makeRule(0);
+
+    admission.stats_.load = 20;
+    if (!admission.admit(first)) {
+      fail("held back a command while none is running");
+      return;
+    }
+    admission.onStarted(first);
+    if (admission.admit(second)) {
+      fail("admitted a command with a high load");
+      return;
+    }
+
+    admission.stats_.load = 4;
+    admission.stats_.memoryPressure = 25;
+    if (admission.admit(second)) {
+      fail("admitted a command with a high memory pressure");
+      return;
+    }
+
+    admission.stats_.memoryPressure = 1;
+    if (!admission.admit(second)) {
+      fail("held back a command on an idle machine");
+      return;
+    }
+    setSuccess(true);
+  }
+};
+
+int main(int const argc, char const* const argv[]) {
+  if (argc != 1 && argc != 2) {
+    std::cerr << "usage: " << argv[0] << " [--json]" << std::endl;
+    return 1;
+  }
+
+  falcon::TestSuite tests("Admission controller test suite");
+
+  tests.add(new FalconAdmissionMemoryTest());
+  tests.add(new FalconAdmissionLoadTest());
+  tests.run();
+
+  if (argc == 2) {
+    std::string option(argv[1]);
+    if (option.compare("--json") == 0) {
+      tests.printJsonOutput(std::cout);
+    } else {
+      std::cerr << "usage: " << argv[0] << " [--json]" << std::endl;
+      return 1;
+    }
+  } else {
+    tests.printStandardOutput(std::cout);
+  }
+
+  return 0;
+}
@@ -0,0 +1,120 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#include <iostream>
+#include <sstream>
+
+#include "test.h"
+#include "util/bloom_filter.h"
+
+static std::string makeKey(unsigned int i) {
+  std::ostringstream oss;
+  oss << "key-" << i;
+  return oss.str();
+}
+
+class FalconBloomFilterNoFalseNegativeTest : public falcon::Test {
+public:
+  FalconBloomFilterNoFalseNegativeTest()
+    : falcon::Test("bloom filter: no false negative", "no error")
+  {}
+
+  void prepareTest() { }
+  void runTest() {
+    falcon::BloomFilter filter(1000);
+    for (unsigned int i = 0; i < 1000; i++) {
+      filter.add(makeKey(i));
+    }
+    for (unsigned int i = 0; i < 1000; i++) {
+      if (!filter.mayContain(makeKey(i))) {
+        setSuccess(false);
+        setErrorMessage("key " + makeKey(i) + " not found");
+        return;
+      }
+    }
+    setSuccess(true);
+  }
+  void closeTest() {}
+};
+
+class FalconBloomFilterFalsePositiveRateTest : public falcon::Test {
+public:
+  FalconBloomFilterFalsePositiveRateTest()
+    : falcon::Test("bloom filter: false positive rate", "no error")
+  {}
+
+  void prepareTest() { }
+  void runTest() {
+    falcon::BloomFilter filter(10000);
+    for (unsigned int i = 0; i < 10000; i++) {
+      filter.add(makeKey(i));
+    }
+    unsigned int falsePositives = 0;
+    for (unsigned int i = 10000; i < 20000; i++) {
+      if (filter.mayContain(makeKey(i))) {
+        falsePositives++;
+      }
+    }
+    /* With 10 bits per key, we expect about 1% of false positives. */
+    if (falsePositives > 300) {
+      std::ostringstream oss;
+      oss << "too many false positives: " << falsePositives;
+      setSuccess(false);
+      setErrorMessage(oss.str());
+      return;
+    }
+    setSuccess(true);
+  }
+  void closeTest() {}
+};
+
+class FalconBloomFilterClearTest : public falcon::Test {
+public:
+  FalconBloomFilterClearTest()
+    : falcon::Test("bloom filter: clear", "no error")
+  {}
+
+  void prepareTest() { }
+  void runTest() {
+    falcon::BloomFilter filter(100);
+    filter.add("hello");
+    filter.clear();
+    if (filter.mayContain("hello")) {
+      setSuccess(false);
+      setErrorMessage("key still present after clear");
+      return;
+    }
+    setSuccess(true);
+  }
+  void closeTest() {}
+};
+
+int main(int const argc, char const* const argv[]) {
+  if (argc != 1 && argc != 2) {
+    std::cerr << "usage: " << argv[0] << " [--json]" << std::endl;
+    return 1;
+  }
+
+  falcon::TestSuite tests("Bloom filter test suite");
+
+  tests.add(new FalconBloomFilterNoFalseNegativeTest());
+  tests.add(new FalconBloomFilterFalsePositiveRateTest());
+  tests.add(new FalconBloomFilterClearTest());
+  tests.run();
+
+  if (argc == 2) {
+    std::string option(argv[1]);
+    if (option.compare("--json") == 0) {
+      tests.printJsonOutput(std::cout);
+    } else {
+      std::cerr << "usage: " << argv[0] << " [--json]" << std::endl;
+      return 1;
+    }
+  } else {
+    tests.printStandardOutput(std::cout);
+  }
+
+  return 0;
+}
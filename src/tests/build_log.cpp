@@ -0,0 +1,161 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "build_log.h"
+#include "test_directory.h"
+
+class FalconBuildLogTestBase : public falcon::DirectoryTest {
+public:
+  FalconBuildLogTestBase(std::string const& name)
+    : falcon::DirectoryTest(name, "falcon-build-log")
+  {}
+
+  void prepareTest() {
+    falcon::DirectoryTest::prepareTest();
+    if (!dir_.empty()) {
+      path_ = dir_ + "/build_log";
+    }
+  }
+
+protected:
+  falcon::BuildLog::Entry makeEntry(std::string const& output,
+                                    uint64_t start, uint64_t duration) {
+    falcon::BuildLog::Entry entry;
+    entry.startTime = start;
+    entry.endTime = start + duration;
+    entry.status = "SUCCEEDED";
+    entry.cpuTime = duration / 2;
+    entry.maxRss = 1024;
+    entry.outputSize = 42;
+    entry.hash = "0123456789abcdef";
+    entry.output = output;
+    return entry;
+  }
+
+  std::size_t countLines() {
+    std::ifstream ifs(path_.c_str());
+    std::size_t n = 0;
+    std::string line;
+    while (std::getline(ifs, line)) {
+      n++;
+    }
+    return n;
+  }
+
+  std::string path_;
+};
+
+class FalconBuildLogReloadTest : public FalconBuildLogTestBase {
+public:
+  FalconBuildLogReloadTest()
+    : FalconBuildLogTestBase("build log: records survive a restart")
+  {}
+
+  void runTest() {
+    {
+      falcon::BuildLog log(path_);
+      log.record(makeEntry("out/a.o", 1000, 500));
+      log.record(makeEntry("out/with space.o", 2000, 100));
+      log.record(makeEntry("out/a.o", 3000, 250));
+    }
+
+    /* A record cut by a crash is skipped. */
+    {
+      std::ofstream ofs(path_.c_str(), std::ios::out | std::ios::app);
+      ofs << "4000 4100 SUCC";
+    }
+
+    {
+      falcon::BuildLog log(path_);
+      log.record(makeEntry("out/b.o", 5000, 10));
+    }
+
+    falcon::BuildLog log(path_);
+    falcon::BuildLog::Entry entry;
+    if (log.size() != 3 || !log.find("out/b.o", entry)) {
+      fail("bad number of records after a restart");
+      return;
+    }
+    if (!log.find("out/a.o", entry) || entry.startTime != 3000
+        || entry.endTime != 3250 || entry.cpuTime != 125
+        || entry.maxRss != 1024 || entry.outputSize != 42
+        || entry.status != "SUCCEEDED") {
+      fail("the latest record was not kept");
+      return;
+    }
+    if (!log.find("out/with space.o", entry)) {
+      fail("could not find an output with a space");
+      return;
+    }
+    if (log.find("out/missing.o", entry)) {
+      fail("found a record that does not exist");
+      return;
+    }
+    setSuccess(true);
+  }
+};
+
+class FalconBuildLogCompactTest : public FalconBuildLogTestBase {
+public:
+  FalconBuildLogCompactTest()
+    : FalconBuildLogTestBase("build log: superseded records are dropped")
+  {}
+
+  void runTest() {
+    {
+      falcon::BuildLog log(path_);
+      for (int i = 0; i < 5000; i++) {
+        std::ostringstream output;
+        output << "out/" << (i % 10) << ".o";
+        log.record(makeEntry(output.str(), i, 10));
+      }
+      /* The header and at most 1000 records. */
+      if (countLines() > 1001) {
+        fail("the log was not compacted");
+        return;
+      }
+    }
+
+    falcon::BuildLog log(path_);
+    falcon::BuildLog::Entry entry;
+    if (log.size() != 10 || !log.find("out/9.o", entry)
+        || entry.startTime != 4999) {
+      fail("bad records after compaction");
+      return;
+    }
+    setSuccess(true);
+  }
+};
+
+int main(int const argc, char const* const argv[]) {
+  if (argc != 1 && argc != 2) {
+    std::cerr << "usage: " << argv[0] << " [--json]" << std::endl;
+    return 1;
+  }
+
+  falcon::TestSuite tests("Build log test suite");
+
+  tests.add(new FalconBuildLogReloadTest());
+  tests.add(new FalconBuildLogCompactTest());
+  tests.run();
+
+  if (argc == 2) {
+    std::string option(argv[1]);
+    if (option.compare("--json") == 0) {
+      tests.printJsonOutput(std::cout);
+    } else {
+      std::cerr << "usage: " << argv[0] << " [--json]" << std::endl;
+      return 1;
+    }
+  } else {
+    tests.printStandardOutput(std::cout);
+  }
+
+  return 0;
+}
@@ -0,0 +1,273 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+#include "action_cache.h"
+#include "cache_bundle.h"
+#include "cache_fs.h"
+#include "fs.h"
+#include "test_directory.h"
+
+class FalconCacheBundleTestBase : public falcon::DirectoryTest {
+public:
+  FalconCacheBundleTestBase(std::string const& name)
+    : falcon::DirectoryTest(name, "falcon-cache-bundle")
+  {}
+
+protected:
+  /* Write a file and save it as the only output of an action. */
+  bool saveAction(falcon::ActionCache& cache, std::string const& key,
+                  std::string const& name, std::string const& content) {
+    std::string path = dir_ + "/" + name;
+    std::ofstream out(path.c_str());
+    out << content;
+    out.close();
+    uint64_t mtime;
+    return falcon::fs::getModificationTime(path, mtime)
+      && cache.saveAction(key, { path }, { "" }, { mtime });
+  }
+
+  /* Export two actions, "one" and "two", to dir_/bundle. They produce
+   * "first" and "second" and have one blob each. */
+  bool exportBundle(falcon::bundle::Summary& summary) {
+    falcon::CacheFS actions(dir_ + "/src/ac", false);
+    falcon::CacheFS blobs(dir_ + "/src/cas", false);
+    falcon::ActionCache cache(actions, blobs, actions, blobs, "");
+    if (!saveAction(cache, "one", "one.o", "first")
+        || !saveAction(cache, "two", "two.o", "second")) {
+      return fail("could not save the actions");
+    }
+    if (!falcon::bundle::exportActions(dir_ + "/bundle", { "one", "two" },
+                                       cache, summary)) {
+      return fail("could not export the bundle");
+    }
+    return true;
+  }
+
+  /* Read the bundle in memory. */
+  std::string readBundle() {
+    std::ifstream in((dir_ + "/bundle").c_str(), std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in),
+                       std::istreambuf_iterator<char>());
+  }
+
+  /* Replace the bundle. */
+  void writeBundle(std::string const& data) {
+    std::ofstream out((dir_ + "/bundle").c_str(), std::ios::binary);
+    out << data;
+  }
+};
+
+class FalconCacheBundleRoundTripTest : public FalconCacheBundleTestBase {
+public:
+  FalconCacheBundleRoundTripTest()
+    : FalconCacheBundleTestBase("cache bundle: export and import actions")
+  {}
+
+  void runTest() {
+    falcon::bundle::Summary summary;
+    if (!exportBundle(summary)) {
+      return;
+    }
+    if (summary.numActions != 2 || summary.numBlobs != 2
+        || summary.numErrors != 0) {
+      fail("bad summary of the export");
+      return;
+    }
+
+    falcon::CacheFS actions(dir_ + "/dst/ac", false);
+    falcon::CacheFS blobs(dir_ + "/dst/cas", false);
+    if (!falcon::bundle::importActions(dir_ + "/bundle", actions, blobs, 2,
+                                       summary)) {
+      fail("could not import the bundle");
+      return;
+    }
+    if (summary.numActions != 2 || summary.numBlobs != 2
+        || summary.numBytes != 11 || summary.numErrors != 0) {
+      fail("bad summary of the import");
+      return;
+    }
+
+    falcon::ActionCache cache(actions, blobs, actions, blobs, "");
+    std::vector<falcon::ActionCache::Manifest> manifests;
+    std::vector<bool> found;
+    cache.getManifests({ "one", "two" }, manifests, found);
+    if (!found[0] || !found[1]
+        || manifests[0].size() != 1 || manifests[1].size() != 1) {
+      fail("imported actions not found");
+      return;
+    }
+    if (!hasData(blobs, manifests[0].begin()->second, "first")
+        || !hasData(blobs, manifests[1].begin()->second, "second")) {
+      fail("bad content for the imported blobs");
+      return;
+    }
+
+    /* Importing again skips what is already in cache. */
+    if (!falcon::bundle::importActions(dir_ + "/bundle", actions, blobs, 1,
+                                       summary)
+        || summary.numActions != 0 || summary.numBlobs != 0) {
+      fail("entries imported twice");
+      return;
+    }
+    setSuccess(true);
+  }
+};
+
+class FalconCacheBundleTruncatedTest : public FalconCacheBundleTestBase {
+public:
+  FalconCacheBundleTruncatedTest()
+    : FalconCacheBundleTestBase("cache bundle: a truncated bundle is rejected")
+  {}
+
+  void runTest() {
+    falcon::bundle::Summary summary;
+    if (!exportBundle(summary)) {
+      return;
+    }
+    std::string data = readBundle();
+    writeBundle(data.substr(0, data.size() - 4));
+
+    falcon::CacheFS actions(dir_ + "/dst/ac", false);
+    falcon::CacheFS blobs(dir_ + "/dst/cas", false);
+    if (falcon::bundle::importActions(dir_ + "/bundle", actions, blobs, 2,
+                                      summary)) {
+      fail("truncated bundle imported");
+      return;
+    }
+    if (!actions.listEntries().empty() || !blobs.listEntries().empty()) {
+      fail("entries imported from a truncated bundle");
+      return;
+    }
+    setSuccess(true);
+  }
+};
+
+class FalconCacheBundleCorruptedTest : public FalconCacheBundleTestBase {
+public:
+  FalconCacheBundleCorruptedTest()
+    : FalconCacheBundleTestBase("cache bundle: a corrupted blob is rejected")
+  {}
+
+  void runTest() {
+    falcon::bundle::Summary summary;
+    if (!exportBundle(summary)) {
+      return;
+    }
+    std::string data = readBundle();
+    std::size_t pos = data.find("second");
+    if (pos == std::string::npos) {
+      fail("blob not found in the bundle");
+      return;
+    }
+    data[pos] = 'S';
+    writeBundle(data);
+
+    falcon::CacheFS actions(dir_ + "/dst/ac", false);
+    falcon::CacheFS blobs(dir_ + "/dst/cas", false);
+    if (falcon::bundle::importActions(dir_ + "/bundle", actions, blobs, 2,
+                                      summary)) {
+      fail("corrupted bundle imported without error");
+      return;
+    }
+
+    /* The action that uses the corrupted blob is not imported either. */
+    if (summary.numActions != 1 || summary.numBlobs != 1
+        || summary.numErrors != 2) {
+      fail("bad summary of the import");
+      return;
+    }
+    if (!actions.hasEntry("one") || actions.hasEntry("two")
+        || blobs.listEntries().size() != 1) {
+      fail("corrupted entries imported");
+      return;
+    }
+    setSuccess(true);
+  }
+};
+
+class FalconCacheBundleMissingBlobTest : public FalconCacheBundleTestBase {
+public:
+  FalconCacheBundleMissingBlobTest()
+    : FalconCacheBundleTestBase(
+        "cache bundle: actions are only exported with all their blobs")
+  {}
+
+  void runTest() {
+    falcon::CacheFS actions(dir_ + "/src/ac", false);
+    falcon::CacheFS blobs(dir_ + "/src/cas", false);
+    falcon::ActionCache cache(actions, blobs, actions, blobs, "");
+    if (!saveAction(cache, "one", "one.o", "first")
+        || !saveAction(cache, "two", "two.o", "second")) {
+      fail("could not save the actions");
+      return;
+    }
+
+    std::vector<falcon::ActionCache::Manifest> manifests;
+    std::vector<bool> found;
+    cache.getManifests({ "two" }, manifests, found);
+    if (!found[0] || !blobs.delEntry(manifests[0].begin()->second)) {
+      fail("could not remove the blob");
+      return;
+    }
+
+    falcon::bundle::Summary summary;
+    if (!falcon::bundle::exportActions(dir_ + "/bundle", { "one", "two" },
+                                       cache, summary)) {
+      fail("could not export the bundle");
+      return;
+    }
+    if (summary.numActions != 1 || summary.numBlobs != 1
+        || summary.numErrors != 1) {
+      fail("bad summary of the export");
+      return;
+    }
+
+    falcon::CacheFS dstActions(dir_ + "/dst/ac", false);
+    falcon::CacheFS dstBlobs(dir_ + "/dst/cas", false);
+    if (!falcon::bundle::importActions(dir_ + "/bundle", dstActions, dstBlobs,
+                                       2, summary)) {
+      fail("could not import the bundle");
+      return;
+    }
+    if (!dstActions.hasEntry("one") || dstActions.hasEntry("two")) {
+      fail("action imported without its blob");
+      return;
+    }
+    setSuccess(true);
+  }
+};
+
+int main(int const argc, char const* const argv[]) {
+  if (argc != 1 && argc != 2) {
+    std::cerr << "usage: " << argv[0] << " [--json]" << std::endl;
+    return 1;
+  }
+
+  falcon::TestSuite tests("Cache bundle test suite");
+
+  tests.add(new FalconCacheBundleRoundTripTest());
+  tests.add(new FalconCacheBundleTruncatedTest());
+  tests.add(new FalconCacheBundleCorruptedTest());
+  tests.add(new FalconCacheBundleMissingBlobTest());
+  tests.run();
+
+  if (argc == 2) {
+    std::string option(argv[1]);
+    if (option.compare("--json") == 0) {
+      tests.printJsonOutput(std::cout);
+    } else {
+      std::cerr << "usage: " << argv[0] << " [--json]" << std::endl;
+      return 1;
+    }
+  } else {
+    tests.printStandardOutput(std::cout);
+  }
+
+  return 0;
+}
@@ -0,0 +1,115 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#include <iostream>
+
+#include "cache_fs.h"
+#include "test_directory.h"
+
+class FalconCacheFSTestBase : public falcon::DirectoryTest {
+public:
+  FalconCacheFSTestBase(std::string const& name)
+    : falcon::DirectoryTest(name, "falcon-cache-fs")
+  {}
+};
+
+class FalconCacheFSPrivateTest : public FalconCacheFSTestBase {
+public:
+  FalconCacheFSPrivateTest()
+    : FalconCacheFSTestBase("cache fs: a private cache only reads its index")
+  {}
+
+  void runTest() {
+    falcon::CacheFS first(dir_, false);
+    falcon::CacheFS second(dir_, false);
+
+    if (!first.storeEntry("key", "value") || !hasData(first, "key", "value")) {
+      fail("could not store an entry");
+      return;
+    }
+    if (second.hasEntry("key")) {
+      fail("private cache found an entry it did not index");
+      return;
+    }
+
+    falcon::CacheFS reopened(dir_, false);
+    if (!hasData(reopened, "key", "value")) {
+      fail("entry lost after a restart");
+      return;
+    }
+    setSuccess(true);
+  }
+};
+
+class FalconCacheFSSharedTest : public FalconCacheFSTestBase {
+public:
+  FalconCacheFSSharedTest()
+    : FalconCacheFSTestBase("cache fs: entries seen by the other instances")
+  {}
+
+  void runTest() {
+    falcon::CacheFS first(dir_, true);
+    falcon::CacheFS second(dir_, true);
+
+    if (!first.storeEntry("key", "value")) {
+      fail("could not store an entry");
+      return;
+    }
+    std::vector<std::string> hashes = { "missing", "key" };
+    std::vector<bool> found;
+    second.hasEntries(hashes, found);
+    if (found[0] || !found[1] || !hasData(second, "key", "value")) {
+      fail("entry stored by another instance not found");
+      return;
+    }
+
+    first.storeEntry("other", "data");
+    if (second.listEntries().size() != 2) {
+      fail("bad list of entries");
+      return;
+    }
+
+    /* The index of the second instance is stale until it misses the
+     * file. */
+    std::string data;
+    if (!first.delEntry("key") || second.loadEntry("key", data)
+        || second.hasEntry("key")) {
+      fail("entry removed by another instance still found");
+      return;
+    }
+    if (second.listEntries().size() != 1) {
+      fail("bad list of entries after a removal");
+      return;
+    }
+    setSuccess(true);
+  }
+};
+
+int main(int const argc, char const* const argv[]) {
+  if (argc != 1 && argc != 2) {
+    std::cerr << "usage: " << argv[0] << " [--json]" << std::endl;
+    return 1;
+  }
+
+  falcon::TestSuite tests("Cache fs test suite");
+
+  tests.add(new FalconCacheFSPrivateTest());
+  tests.add(new FalconCacheFSSharedTest());
+  tests.run();
+
+  if (argc == 2) {
+    std::string option(argv[1]);
+    if (option.compare("--json") == 0) {
+      tests.printJsonOutput(std::cout);
+    } else {
+      std::cerr << "usage: " << argv[0] << " [--json]" << std::endl;
+      return 1;
+    }
+  } else {
+    tests.printStandardOutput(std::cout);
+  }
+
+  return 0;
+}
@@ -0,0 +1,132 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#include <fstream>
+#include <iostream>
+#include <unistd.h>
+
+#include "cache_fs.h"
+#include "cache_memory.h"
+#include "test_directory.h"
+
+class FalconCacheMemoryTestBase : public falcon::DirectoryTest {
+public:
+  FalconCacheMemoryTestBase(std::string const& name)
+    : falcon::DirectoryTest(name, "falcon-cache-memory")
+  {}
+};
+
+class FalconCacheMemoryHitTest : public FalconCacheMemoryTestBase {
+public:
+  FalconCacheMemoryHitTest()
+    : FalconCacheMemoryTestBase("cache memory: hits are served from memory")
+  {}
+
+  void runTest() {
+    falcon::CacheFS fs(dir_ + "/fs", false);
+    falcon::CacheMemory memory(fs, 1024, 64);
+
+    std::string big(128, 'x');
+    if (!memory.storeEntry("small", "hello")
+        || !memory.storeEntry("big", big)) {
+      fail("could not store the entries");
+      return;
+    }
+    if (memory.size() != 5) {
+      fail("large entry kept in memory");
+      return;
+    }
+
+    /* Remove the file behind the back of the backing cache: the entry can
+     * only come from memory. */
+    unlink(fs.getEntryPath("small").c_str());
+
+    std::string data;
+    if (!memory.loadEntry("small", data) || data != "hello") {
+      fail("could not load the entry from memory");
+      return;
+    }
+    std::string path = dir_ + "/out";
+    if (!memory.readEntry("small", path)) {
+      fail("could not restore the entry from memory");
+      return;
+    }
+    std::ifstream in(path.c_str());
+    std::getline(in, data);
+    if (data != "hello") {
+      fail("bad content for the restored file");
+      return;
+    }
+
+    memory.delEntry("small");
+    if (memory.loadEntry("small", data) || memory.size() != 0) {
+      fail("deleted entry still in memory");
+      return;
+    }
+    setSuccess(true);
+  }
+};
+
+class FalconCacheMemoryEvictionTest : public FalconCacheMemoryTestBase {
+public:
+  FalconCacheMemoryEvictionTest()
+    : FalconCacheMemoryTestBase("cache memory: least recently used eviction")
+  {}
+
+  void runTest() {
+    falcon::CacheFS fs(dir_ + "/fs", false);
+    falcon::CacheMemory memory(fs, 10, 64);
+
+    std::string data;
+    memory.storeEntry("a", "aaaa");
+    memory.storeEntry("b", "bbbb");
+    /* Make "a" the most recently used, so that "b" is evicted. */
+    memory.loadEntry("a", data);
+    memory.storeEntry("c", "cccc");
+    if (memory.size() != 8) {
+      fail("memory bound not enforced");
+      return;
+    }
+
+    unlink(fs.getEntryPath("a").c_str());
+    unlink(fs.getEntryPath("b").c_str());
+    if (!memory.loadEntry("a", data) || data != "aaaa") {
+      fail("recently used entry evicted");
+      return;
+    }
+    if (memory.loadEntry("b", data)) {
+      fail("least recently used entry kept");
+      return;
+    }
+    setSuccess(true);
+  }
+};
+
+int main(int const argc, char const* const argv[]) {
+  if (argc != 1 && argc != 2) {
+    std::cerr << "usage: " << argv[0] << " [--json]" << std::endl;
+    return 1;
+  }
+
+  falcon::TestSuite tests("Cache memory test suite");
+
+  tests.add(new FalconCacheMemoryHitTest());
+  tests.add(new FalconCacheMemoryEvictionTest());
+  tests.run();
+
+  if (argc == 2) {
+    std::string option(argv[1]);
+    if (option.compare("--json") == 0) {
+      tests.printJsonOutput(std::cout);
+    } else {
+      std::cerr << "usage: " << argv[0] << " [--json]" << std::endl;
+      return 1;
+    }
+  } else {
+    tests.printStandardOutput(std::cout);
+  }
+
+  return 0;
+}
@@ -0,0 +1,241 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache_fs.h"
+#include "cache_pack.h"
+#include "test_directory.h"
+
+static const std::size_t kThreshold = 64;
+
+class FalconCachePackTestBase : public falcon::DirectoryTest {
+public:
+  FalconCachePackTestBase(std::string const& name)
+    : falcon::DirectoryTest(name, "falcon-cache-pack")
+  {}
+};
+
+class FalconCachePackStoreTest : public FalconCachePackTestBase {
+public:
+  FalconCachePackStoreTest()
+    : FalconCachePackTestBase("cache pack: store and load entries")
+  {}
+
+  void runTest() {
+    falcon::CacheFS large(dir_ + "/large", false);
+    falcon::CachePack pack(dir_ + "/pack", large, kThreshold);
+
+    std::string big(kThreshold * 2, 'x');
+    if (!pack.storeEntry("small", "hello") || !pack.storeEntry("empty", "")
+        || !pack.storeEntry("big", big)) {
+      fail("could not store the entries");
+      return;
+    }
+    if (!hasData(pack, "small", "hello") || !hasData(pack, "empty", "")
+        || !hasData(pack, "big", big)) {
+      fail("could not load the entries");
+      return;
+    }
+    if (large.hasEntry("small") || !large.hasEntry("big")) {
+      fail("entries not stored in the right place");
+      return;
+    }
+
+    std::string path = dir_ + "/out";
+    std::string data;
+    if (!pack.readEntry("small", path)) {
+      fail("could not read the entry in a file");
+      return;
+    }
+    std::ifstream in(path.c_str());
+    std::getline(in, data);
+    if (data != "hello") {
+      fail("bad content for the restored file");
+      return;
+    }
+
+    std::vector<std::string> hashes = { "small", "missing", "big" };
+    std::vector<bool> found;
+    pack.hasEntries(hashes, found);
+    if (!found[0] || found[1] || !found[2]) {
+      fail("bad result for hasEntries");
+      return;
+    }
+    setSuccess(true);
+  }
+};
+
+class FalconCachePackReopenTest : public FalconCachePackTestBase {
+public:
+  FalconCachePackReopenTest()
+    : FalconCachePackTestBase("cache pack: entries survive a restart")
+  {}
+
+  void runTest() {
+    falcon::CacheFS large(dir_ + "/large", false);
+    {
+      falcon::CachePack pack(dir_ + "/pack", large, kThreshold);
+      for (int i = 0; i < 100; i++) {
+        std::ostringstream key;
+        key << "key" << i;
+        pack.storeEntry(key.str(), key.str());
+      }
+      pack.delEntry("key0");
+      /* Half of the entries are covered by the index, the others are only
+       * found by scanning the pack. */
+      pack.compact();
+      for (int i = 100; i < 200; i++) {
+        std::ostringstream key;
+        key << "key" << i;
+        pack.storeEntry(key.str(), key.str());
+      }
+      pack.delEntry("key1");
+      pack.delEntry("key150");
+    }
+
+    falcon::CachePack pack(dir_ + "/pack", large, kThreshold);
+    if (pack.hasEntry("key0") || pack.hasEntry("key1")
+        || pack.hasEntry("key150")) {
+      fail("deleted entry found after a restart");
+      return;
+    }
+    if (!hasData(pack, "key2", "key2") || !hasData(pack, "key99", "key99")
+        || !hasData(pack, "key199", "key199")) {
+      fail("entry lost after a restart");
+      return;
+    }
+    if (pack.listEntries().size() != 197) {
+      fail("bad number of entries after a restart");
+      return;
+    }
+    setSuccess(true);
+  }
+};
+
+class FalconCachePackCompactTest : public FalconCachePackTestBase {
+public:
+  FalconCachePackCompactTest()
+    : FalconCachePackTestBase("cache pack: compaction drops dead entries")
+  {}
+
+  void runTest() {
+    falcon::CacheFS large(dir_ + "/large", false);
+    falcon::CachePack pack(dir_ + "/pack", large, 1 << 20);
+
+    /* Enough dead data for the packs to be rewritten. */
+    std::string data(512 << 10, 'x');
+    for (int i = 0; i < 20; i++) {
+      std::ostringstream key;
+      key << "key" << i;
+      pack.storeEntry(key.str(), data);
+      if (i > 0) {
+        pack.delEntry(key.str());
+      }
+    }
+    pack.compact();
+
+    if (access((dir_ + "/pack/pack-0").c_str(), F_OK) == 0) {
+      fail("old pack not removed");
+      return;
+    }
+    if (!hasData(pack, "key0", data) || pack.hasEntry("key1")) {
+      fail("bad entries after compaction");
+      return;
+    }
+    if (!pack.storeEntry("new", "value") || !hasData(pack, "new", "value")) {
+      fail("could not store an entry after compaction");
+      return;
+    }
+    setSuccess(true);
+  }
+};
+
+class FalconCachePackCompactFailureTest : public FalconCachePackTestBase {
+public:
+  FalconCachePackCompactFailureTest()
+    : FalconCachePackTestBase("cache pack: failed compaction keeps the packs")
+  {}
+
+  void runTest() {
+    falcon::CacheFS large(dir_ + "/large", false);
+    falcon::CachePack pack(dir_ + "/pack", large, 1 << 20);
+
+    std::string data(512 << 10, 'x');
+    for (int i = 0; i < 20; i++) {
+      std::ostringstream key;
+      key << "key" << i;
+      pack.storeEntry(key.str(), data);
+      if (i > 0) {
+        pack.delEntry(key.str());
+      }
+    }
+
+    /* The new index cannot be written. */
+    std::string tmp = dir_ + "/pack/index.tmp";
+    if (mkdir(tmp.c_str(), 0755) != 0) {
+      fail("could not create " + tmp);
+      return;
+    }
+    pack.compact();
+    if (access((dir_ + "/pack/pack-1").c_str(), F_OK) == 0) {
+      fail("new pack not removed after a failed compaction");
+      return;
+    }
+    if (!hasData(pack, "key0", data) || pack.hasEntry("key1")) {
+      fail("bad entries after a failed compaction");
+      return;
+    }
+    if (!pack.storeEntry("new", "value") || !hasData(pack, "new", "value")) {
+      fail("could not store an entry after a failed compaction");
+      return;
+    }
+
+    rmdir(tmp.c_str());
+    pack.compact();
+    if (access((dir_ + "/pack/pack-0").c_str(), F_OK) == 0) {
+      fail("old pack not removed");
+      return;
+    }
+    if (!hasData(pack, "key0", data) || !hasData(pack, "new", "value")) {
+      fail("bad entries after compaction");
+      return;
+    }
+    setSuccess(true);
+  }
+};
+
+int main(int const argc, char const* const argv[]) {
+  if (argc != 1 && argc != 2) {
+    std::cerr << "usage: " << argv[0] << " [--json]" << std::endl;
+    return 1;
+  }
+
+  falcon::TestSuite tests("Cache pack test suite");
+
+  tests.add(new FalconCachePackStoreTest());
+  tests.add(new FalconCachePackReopenTest());
+  tests.add(new FalconCachePackCompactTest());
+  tests.add(new FalconCachePackCompactFailureTest());
+  tests.run();
+
+  if (argc == 2) {
+    std::string option(argv[1]);
+    if (option.compare("--json") == 0) {
+      tests.printJsonOutput(std::cout);
+    } else {
+      std::cerr << "usage: " << argv[0] << " [--json]" << std::endl;
+      return 1;
+    }
+  } else {
+    tests.printStandardOutput(std::cout);
+  }
+
+  return 0;
+}
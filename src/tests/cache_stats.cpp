@@ -0,0 +1,159 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#include <iostream>
+#include <sstream>
+
+#include "cache_stats.h"
+#include "test.h"
+
+typedef falcon::CacheStats::Op Op;
+
+static const falcon::CacheStats::OpStats& getOp(
+    falcon::CacheStats::Snapshot& snapshot, std::string const& policy,
+    Op op) {
+  return snapshot[policy].ops[static_cast<std::size_t>(op)];
+}
+
+class FalconCacheStatsRecordTest : public falcon::Test {
+public:
+  FalconCacheStatsRecordTest()
+    : falcon::Test("cache stats: record calls by policy", "no error")
+  {}
+
+  void prepareTest() { }
+  void runTest() {
+    falcon::CacheStats stats;
+    auto start = falcon::CacheStats::Clock::now();
+    stats.record("git_refs", Op::RESTORE_RULE, 3, 1, 100, start);
+    stats.record("git_refs", Op::RESTORE_RULE, 0, 2, 0, start);
+    stats.record("everything", Op::SAVE_RULE, 1, 0, 10, start);
+
+    falcon::CacheStats::Snapshot snapshot = stats.snapshot();
+    const falcon::CacheStats::OpStats& restore =
+      getOp(snapshot, "git_refs", Op::RESTORE_RULE);
+    if (restore.calls != 2 || restore.hits != 3 || restore.misses != 3
+        || restore.bytes != 100) {
+      setSuccess(false);
+      setErrorMessage("bad counters for restore_rule");
+      return;
+    }
+    uint64_t numLatencies = 0;
+    for (std::size_t i = 0; i < falcon::CacheStats::kNumBuckets; i++) {
+      numLatencies += restore.latency[i];
+    }
+    if (numLatencies != 2) {
+      setSuccess(false);
+      setErrorMessage("bad latency histogram");
+      return;
+    }
+    if (getOp(snapshot, "everything", Op::SAVE_RULE).calls != 1
+        || getOp(snapshot, "everything", Op::RESTORE_RULE).calls != 0) {
+      setSuccess(false);
+      setErrorMessage("bad counters for the second policy");
+      return;
+    }
+    setSuccess(true);
+  }
+  void closeTest() {}
+};
+
+class FalconCacheStatsDiffTest : public falcon::Test {
+public:
+  FalconCacheStatsDiffTest()
+    : falcon::Test("cache stats: difference between snapshots", "no error")
+  {}
+
+  void prepareTest() { }
+  void runTest() {
+    falcon::CacheStats stats;
+    auto start = falcon::CacheStats::Clock::now();
+    stats.record("git_refs", Op::RESTORE_NODE, 5, 0, 50, start);
+    falcon::CacheStats::Snapshot before = stats.snapshot();
+    stats.record("git_refs", Op::RESTORE_NODE, 1, 1, 7, start);
+    stats.record("nothing", Op::RESTORE_DEPFILE, 0, 1, 0, start);
+
+    falcon::CacheStats::Snapshot diff =
+      falcon::CacheStats::diff(stats.snapshot(), before);
+    const falcon::CacheStats::OpStats& restore =
+      getOp(diff, "git_refs", Op::RESTORE_NODE);
+    if (restore.calls != 1 || restore.hits != 1 || restore.misses != 1
+        || restore.bytes != 7) {
+      setSuccess(false);
+      setErrorMessage("bad difference for restore_node");
+      return;
+    }
+    if (getOp(diff, "nothing", Op::RESTORE_DEPFILE).misses != 1) {
+      setSuccess(false);
+      setErrorMessage("policy missing from the first snapshot not counted");
+      return;
+    }
+    setSuccess(true);
+  }
+  void closeTest() {}
+};
+
+class FalconCacheStatsJsonTest : public falcon::Test {
+public:
+  FalconCacheStatsJsonTest()
+    : falcon::Test("cache stats: json output", "no error")
+  {}
+
+  void prepareTest() { }
+  void runTest() {
+    falcon::CacheStats stats;
+    std::ostringstream empty;
+    falcon::CacheStats::toJson(stats.snapshot(), empty);
+    if (empty.str() != "{ }") {
+      setSuccess(false);
+      setErrorMessage("bad output without stats: " + empty.str());
+      return;
+    }
+
+    stats.record("git_refs", Op::SAVE_RULE, 2, 0, 42,
+                 falcon::CacheStats::Clock::now());
+    std::ostringstream oss;
+    falcon::CacheStats::toJson(stats.snapshot(), oss);
+    std::string json = oss.str();
+    if (json.find("\"git_refs\": { \"save_rule\": { \"calls\": 1, "
+                  "\"hits\": 2, \"misses\": 0, \"bytes\": 42")
+        == std::string::npos
+        || json.find("restore_rule") != std::string::npos) {
+      setSuccess(false);
+      setErrorMessage("bad output: " + json);
+      return;
+    }
+    setSuccess(true);
+  }
+  void closeTest() {}
+};
+
+int main(int const argc, char const* const argv[]) {
+  if (argc != 1 && argc != 2) {
+    std::cerr << "usage: " << argv[0] << " [--json]" << std::endl;
+    return 1;
+  }
+
+  falcon::TestSuite tests("Cache stats test suite");
+
+  tests.add(new FalconCacheStatsRecordTest());
+  tests.add(new FalconCacheStatsDiffTest());
+  tests.add(new FalconCacheStatsJsonTest());
+  tests.run();
+
+  if (argc == 2) {
+    std::string option(argv[1]);
+    if (option.compare("--json") == 0) {
+      tests.printJsonOutput(std::cout);
+    } else {
+      std::cerr << "usage: " << argv[0] << " [--json]" << std::endl;
+      return 1;
+    }
+  } else {
+    tests.printStandardOutput(std::cout);
+  }
+
+  return 0;
+}
@@ -0,0 +1,205 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#include <iostream>
+#include <sstream>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "util/http.h"
+
+/* Base class for the tests that send data on one end of a socket pair and
+ * parse it on the other end. */
+class FalconHttpTestBase : public falcon::Test {
+public:
+  FalconHttpTestBase(std::string const& name)
+    : falcon::Test(name, "no error"), writeFd_(-1), readFd_(-1)
+  {}
+
+  void prepareTest() {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0) {
+      writeFd_ = fds[0];
+      readFd_ = fds[1];
+    }
+  }
+  void closeTest() {
+    if (writeFd_ >= 0) {
+      close(writeFd_);
+    }
+  }
+
+protected:
+  bool fail(std::string const& msg) {
+    setSuccess(false);
+    setErrorMessage(msg);
+    return false;
+  }
+
+  int writeFd_;
+  /* Owned by the connection created by the test. */
+  int readFd_;
+};
+
+class FalconHttpPipelinedRequestsTest : public FalconHttpTestBase {
+public:
+  FalconHttpPipelinedRequestsTest()
+    : FalconHttpTestBase("http: pipelined requests")
+  {}
+
+  void runTest() {
+    falcon::http::Connection writer(dup(writeFd_));
+    falcon::http::Connection reader(readFd_);
+
+    /* Send all the requests before reading any of them. */
+    std::string data =
+      falcon::http::formatRequest("HEAD", "/a", "localhost", 0)
+      + falcon::http::formatRequest("PUT", "/b", "localhost", 5) + "hello"
+      + falcon::http::formatRequest("GET", "/c", "localhost", 0);
+    if (!writer.write(data)) {
+      fail("could not write the requests");
+      return;
+    }
+
+    falcon::http::Request req;
+    std::string body;
+    if (!falcon::http::readRequest(reader, req)
+        || req.method != "HEAD" || req.path != "/a" || !req.keepAlive) {
+      fail("bad first request");
+      return;
+    }
+    if (!falcon::http::readRequest(reader, req)
+        || req.method != "PUT" || req.contentLength != 5
+        || !reader.readBody(req.contentLength, body) || body != "hello") {
+      fail("bad second request");
+      return;
+    }
+    if (!falcon::http::readRequest(reader, req)
+        || req.method != "GET" || req.path != "/c"
+        || req.headers["host"] != "localhost") {
+      fail("bad third request");
+      return;
+    }
+    setSuccess(true);
+  }
+};
+
+class FalconHttpResponseTest : public FalconHttpTestBase {
+public:
+  FalconHttpResponseTest()
+    : FalconHttpTestBase("http: responses")
+  {}
+
+  void runTest() {
+    falcon::http::Connection writer(dup(writeFd_));
+    falcon::http::Connection reader(readFd_);
+
+    std::string data = falcon::http::formatResponse(200, 3, true) + "abc"
+      + falcon::http::formatResponse(404, 0, false);
+    if (!writer.write(data)) {
+      fail("could not write the responses");
+      return;
+    }
+
+    falcon::http::Response res;
+    std::string body;
+    if (!falcon::http::readResponse(reader, res)
+        || res.status != 200 || !res.keepAlive
+        || !reader.readBody(res.contentLength, body) || body != "abc") {
+      fail("bad first response");
+      return;
+    }
+    if (!falcon::http::readResponse(reader, res)
+        || res.status != 404 || res.keepAlive || res.contentLength != 0) {
+      fail("bad second response");
+      return;
+    }
+    setSuccess(true);
+  }
+};
+
+class FalconHttpMalformedTest : public FalconHttpTestBase {
+public:
+  FalconHttpMalformedTest()
+    : FalconHttpTestBase("http: malformed headers")
+  {}
+
+  void runTest() {
+    falcon::http::Connection writer(dup(writeFd_));
+    falcon::http::Connection reader(readFd_);
+
+    std::string data = "GET /a HTTP/1.1\r\nContent-Length: 12x\r\n\r\n";
+    if (!writer.write(data)) {
+      fail("could not write the request");
+      return;
+    }
+
+    falcon::http::Request req;
+    if (falcon::http::readRequest(reader, req)) {
+      fail("invalid Content-Length accepted");
+      return;
+    }
+    setSuccess(true);
+  }
+};
+
+class FalconHttpHostPortTest : public falcon::Test {
+public:
+  FalconHttpHostPortTest()
+    : falcon::Test("http: parse host and port", "no error")
+  {}
+
+  void prepareTest() { }
+  void runTest() {
+    std::string host;
+    int port;
+    if (!falcon::http::parseHostPort("cache.example.com:8080", host, port)
+        || host != "cache.example.com" || port != 8080) {
+      setSuccess(false);
+      setErrorMessage("valid address rejected");
+      return;
+    }
+    if (falcon::http::parseHostPort("cache.example.com", host, port)
+        || falcon::http::parseHostPort(":8080", host, port)
+        || falcon::http::parseHostPort("host:0", host, port)
+        || falcon::http::parseHostPort("host:80a", host, port)) {
+      setSuccess(false);
+      setErrorMessage("invalid address accepted");
+      return;
+    }
+    setSuccess(true);
+  }
+  void closeTest() {}
+};
+
+int main(int const argc, char const* const argv[]) {
+  if (argc != 1 && argc != 2) {
+    std::cerr << "usage: " << argv[0] << " [--json]" << std::endl;
+    return 1;
+  }
+
+  falcon::TestSuite tests("HTTP test suite");
+
+  tests.add(new FalconHttpPipelinedRequestsTest());
+  tests.add(new FalconHttpResponseTest());
+  tests.add(new FalconHttpMalformedTest());
+  tests.add(new FalconHttpHostPortTest());
+  tests.run();
+
+  if (argc == 2) {
+    std::string option(argv[1]);
+    if (option.compare("--json") == 0) {
+      tests.printJsonOutput(std::cout);
+    } else {
+      std::cerr << "usage: " << argv[0] << " [--json]" << std::endl;
+      return 1;
+    }
+  } else {
+    tests.printStandardOutput(std::cout);
+  }
+
+  return 0;
+}
@@ -0,0 +1,159 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+#include "test.h"
+#include "util/rw_lock.h"
+
+static void sleepMs(unsigned int ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+class FalconRWLockSharedTest : public falcon::Test {
+public:
+  FalconRWLockSharedTest()
+    : falcon::Test("rw lock: readers share the lock", "no error")
+  {}
+
+  void prepareTest() { }
+  void runTest() {
+    falcon::RWLock rwLock;
+    std::atomic_int numReaders(0);
+    std::atomic_int maxReaders(0);
+
+    auto reader = [&]() {
+      falcon::ReadLock lock(rwLock);
+      int n = ++numReaders;
+      if (n > maxReaders) {
+        maxReaders = n;
+      }
+      /* Give the other reader time to take the lock. */
+      for (int i = 0; i < 100 && maxReaders < 2; i++) {
+        sleepMs(10);
+      }
+      --numReaders;
+    };
+    std::thread t1(reader);
+    std::thread t2(reader);
+    t1.join();
+    t2.join();
+
+    if (maxReaders != 2) {
+      setSuccess(false);
+      setErrorMessage("the readers did not hold the lock at the same time");
+      return;
+    }
+    setSuccess(true);
+  }
+  void closeTest() {}
+};
+
+class FalconRWLockExclusiveTest : public falcon::Test {
+public:
+  FalconRWLockExclusiveTest()
+    : falcon::Test("rw lock: a writer excludes the readers", "no error")
+  {}
+
+  void prepareTest() { }
+  void runTest() {
+    falcon::RWLock rwLock;
+    std::atomic_bool readerDone(false);
+
+    rwLock.lock();
+    std::thread reader([&]() {
+      falcon::ReadLock lock(rwLock);
+      readerDone = true;
+    });
+    sleepMs(50);
+    bool readDuringWrite = readerDone;
+    rwLock.unlock();
+    reader.join();
+
+    if (readDuringWrite) {
+      setSuccess(false);
+      setErrorMessage("a reader took the lock held by a writer");
+      return;
+    }
+    if (!readerDone) {
+      setSuccess(false);
+      setErrorMessage("the reader never took the lock");
+      return;
+    }
+    setSuccess(true);
+  }
+  void closeTest() {}
+};
+
+class FalconRWLockWriterFirstTest : public falcon::Test {
+public:
+  FalconRWLockWriterFirstTest()
+    : falcon::Test("rw lock: a waiting writer goes before new readers",
+                   "no error")
+  {}
+
+  void prepareTest() { }
+  void runTest() {
+    falcon::RWLock rwLock;
+    std::atomic_int order(0);
+    std::atomic_int writerOrder(0);
+    std::atomic_int readerOrder(0);
+
+    rwLock.lockShared();
+    std::thread writer([&]() {
+      std::lock_guard<falcon::RWLock> lock(rwLock);
+      writerOrder = ++order;
+    });
+    /* Let the writer wait for the lock. */
+    sleepMs(50);
+    std::thread reader([&]() {
+      falcon::ReadLock lock(rwLock);
+      readerOrder = ++order;
+    });
+    sleepMs(50);
+    rwLock.unlockShared();
+    writer.join();
+    reader.join();
+
+    if (writerOrder != 1 || readerOrder != 2) {
+      setSuccess(false);
+      setErrorMessage("a new reader went before the waiting writer");
+      return;
+    }
+    setSuccess(true);
+  }
+  void closeTest() {}
+};
+
+int main(int const argc, char const* const argv[]) {
+  if (argc != 1 && argc != 2) {
+    std::cerr << "usage: " << argv[0] << " [--json]" << std::endl;
+    return 1;
+  }
+
+  falcon::TestSuite tests("RW lock test suite");
+
+  tests.add(new FalconRWLockSharedTest());
+  tests.add(new FalconRWLockExclusiveTest());
+  tests.add(new FalconRWLockWriterFirstTest());
+  tests.run();
+
+  if (argc == 2) {
+    std::string option(argv[1]);
+    if (option.compare("--json") == 0) {
+      tests.printJsonOutput(std::cout);
+    } else {
+      std::cerr << "usage: " << argv[0] << " [--json]" << std::endl;
+      return 1;
+    }
+  } else {
+    tests.printStandardOutput(std::cout);
+  }
+
+  return 0;
+}
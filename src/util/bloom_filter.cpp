@@ -0,0 +1,57 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#include <algorithm>
+
+#include "util/bloom_filter.h"
+
+namespace falcon {
+
+/* 64 bits FNV-1a. The two halves of the result are combined to derive as many
+ * hash functions as needed (Kirsch-Mitzenmacher double hashing). */
+static inline uint64_t fnv1a(const std::string& key) {
+  uint64_t h = 14695981039346656037ULL;
+  for (std::size_t i = 0; i < key.size(); i++) {
+    h ^= static_cast<unsigned char>(key[i]);
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+BloomFilter::BloomFilter(std::size_t capacity, unsigned int bitsPerKey)
+  : capacity_(std::max<std::size_t>(capacity, 64))
+  , numHashes_(std::max(1U, std::min(16U, bitsPerKey * 69 / 100)))
+  , bits_((capacity_ * bitsPerKey + 63) / 64, 0) { }
+
+void BloomFilter::add(const std::string& key) {
+  uint64_t h = fnv1a(key);
+  uint64_t h1 = h & 0xffffffff;
+  uint64_t h2 = h >> 32;
+  uint64_t nbits = bits_.size() * 64;
+  for (unsigned int i = 0; i < numHashes_; i++) {
+    uint64_t bit = (h1 + i * h2) % nbits;
+    bits_[bit / 64] |= 1ULL << (bit % 64);
+  }
+}
+
+bool BloomFilter::mayContain(const std::string& key) const {
+  uint64_t h = fnv1a(key);
+  uint64_t h1 = h & 0xffffffff;
+  uint64_t h2 = h >> 32;
+  uint64_t nbits = bits_.size() * 64;
+  for (unsigned int i = 0; i < numHashes_; i++) {
+    uint64_t bit = (h1 + i * h2) % nbits;
+    if (!(bits_[bit / 64] & (1ULL << (bit % 64)))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void BloomFilter::clear() {
+  std::fill(bits_.begin(), bits_.end(), 0);
+}
+
+}
@@ -0,0 +1,56 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#ifndef FALCON_UTIL_BLOOM_FILTER_H_
+# define FALCON_UTIL_BLOOM_FILTER_H_
+
+# include <cstdint>
+# include <string>
+# include <vector>
+
+namespace falcon {
+
+/**
+ * @class BloomFilter
+ * @brief probabilistic set membership
+ *
+ * A bloom filter answers "definitely not present" or "maybe present" for a
+ * key. It never gives false negatives, so it can be used as a fast path for
+ * negative lookups before querying a more expensive structure.
+ *
+ * Keys cannot be removed. Callers that remove keys should keep the exact set
+ * elsewhere and rebuild the filter when the false positive rate matters.
+ */
+class BloomFilter {
+  public:
+    /**
+     * Construct a bloom filter sized for the given number of keys.
+     * @param capacity   Number of keys the filter is expected to hold.
+     * @param bitsPerKey Number of bits allocated per key. 10 bits per key gives
+     *                   a false positive rate of about 1%.
+     */
+    explicit BloomFilter(std::size_t capacity, unsigned int bitsPerKey = 10);
+
+    /** Add a key to the filter. */
+    void add(const std::string& key);
+
+    /** Return false if the key was never added, true if it may have been. */
+    bool mayContain(const std::string& key) const;
+
+    /** Remove all the keys. */
+    void clear();
+
+    /** Number of keys the filter was sized for. */
+    std::size_t capacity() const { return capacity_; }
+
+  private:
+    std::size_t capacity_;
+    unsigned int numHashes_;
+    std::vector<uint64_t> bits_;
+};
+
+}
+
+#endif /* !FALCON_UTIL_BLOOM_FILTER_H_ */
@@ -0,0 +1,45 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+#include "util/file_lock.h"
+
+#include "fs.h"
+#include "logging.h"
+
+namespace falcon {
+
+FileLock::FileLock(const std::string& path, Mode mode)
+  : fd_(-1) {
+  fs::createPath(path);
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+  if (fd < 0) {
+    LOG(ERROR) << "Could not open lock file " << path;
+    return;
+  }
+
+  int op = mode == Mode::SHARED ? LOCK_SH : LOCK_EX;
+  while (flock(fd, op) < 0) {
+    if (errno != EINTR) {
+      LOG(ERROR) << "Could not lock " << path;
+      close(fd);
+      return;
+    }
+  }
+  fd_ = fd;
+}
+
+FileLock::~FileLock() {
+  if (fd_ >= 0) {
+    /* Closing the file releases the lock. */
+    close(fd_);
+  }
+}
+
+} // namespace falcon
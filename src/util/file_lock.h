@@ -0,0 +1,44 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#ifndef FALCON_UTIL_FILE_LOCK_H_
+# define FALCON_UTIL_FILE_LOCK_H_
+
+# include <string>
+
+namespace falcon {
+
+/**
+ * @class FileLock
+ * @brief advisory lock shared between processes
+ *
+ * Take a flock(2) lock on a file, created if needed, for the lifetime of the
+ * object. Each FileLock opens the file again, so two FileLock objects
+ * conflict even in the same process: threads can use it like a
+ * reader/writer lock.
+ *
+ * The lock is advisory: it only excludes the processes that take it too.
+ */
+class FileLock {
+  public:
+    enum class Mode { SHARED, EXCLUSIVE };
+
+    /** Block until the lock is taken. If the file cannot be opened, the lock
+     * is not taken, see isLocked(). */
+    FileLock(const std::string& path, Mode mode);
+    ~FileLock();
+
+    bool isLocked() const { return fd_ >= 0; }
+
+  private:
+    int fd_;
+
+    FileLock(const FileLock& other) = delete;
+    FileLock& operator=(const FileLock&) = delete;
+};
+
+} // namespace falcon
+
+#endif // FALCON_UTIL_FILE_LOCK_H_
@@ -0,0 +1,35 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#include <fstream>
+
+#include "util/hasher.h"
+
+namespace falcon { namespace hash {
+
+bool hashFile(const std::string& path, std::string& digest) {
+  std::ifstream ifs(path, std::ios::in | std::ios::binary);
+  if (!ifs.is_open()) {
+    return false;
+  }
+  Hasher hasher;
+  char buf[64 << 10];
+  while (ifs.read(buf, sizeof(buf)) || ifs.gcount() > 0) {
+    hasher << std::string(buf, ifs.gcount());
+  }
+  if (ifs.bad()) {
+    return false;
+  }
+  digest = hasher.get();
+  return true;
+}
+
+std::string hashData(const std::string& data) {
+  Hasher hasher;
+  hasher << data;
+  return hasher.get();
+}
+
+} } // namespace falcon::hash
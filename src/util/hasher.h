@@ -0,0 +1,55 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#ifndef FALCON_UTIL_HASHER_H_
+# define FALCON_UTIL_HASHER_H_
+
+# include <cstdio>
+# include <cstring>
+# include <openssl/sha.h>
+# include <string>
+
+namespace falcon { namespace hash {
+
+/**
+ * @class Hasher
+ * @brief SHA-256 digest of data fed in several pieces, in hexadecimal
+ */
+class Hasher {
+ public:
+  Hasher() {
+    SHA256_Init(&ctx_);
+  }
+
+  Hasher& operator<<(const std::string& data) {
+    SHA256_Update(&ctx_, data.c_str(), data.size());
+    return *this;
+  }
+
+  std::string get() {
+    SHA256_Final(digest_, &ctx_);
+    char mdString[SHA256_DIGEST_LENGTH*2 + 1];
+    memset(mdString, 0, sizeof(mdString));
+    for (int i = 0; i < SHA256_DIGEST_LENGTH; i++) {
+      sprintf(&mdString[i*2], "%02x", (unsigned int)digest_[i]);
+    }
+    return mdString;
+  }
+
+ private:
+  SHA256_CTX ctx_;
+  unsigned char digest_[SHA256_DIGEST_LENGTH];
+};
+
+/* Compute the digest of the content of a file, used as the key of the file in
+ * the content-addressed cache. Return false if the file cannot be read. */
+bool hashFile(const std::string& path, std::string& digest);
+
+/* Same as hashFile() for data in memory. */
+std::string hashData(const std::string& data);
+
+} } // namespace falcon::hash
+
+#endif // FALCON_UTIL_HASHER_H_
@@ -0,0 +1,352 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+# include <sys/sendfile.h>
+#endif
+
+#include "util/http.h"
+
+namespace falcon { namespace http {
+
+static const std::size_t kReadSize = 64 << 10;
+
+/* Headers and request lines longer than this are rejected. */
+static const std::size_t kMaxLineSize = 8 << 10;
+
+Connection::Connection(int fd) : fd_(fd), pos_(0) { }
+
+Connection::~Connection() {
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+bool Connection::fill() {
+  /* Drop the data that was already consumed. */
+  if (pos_ > 0) {
+    buf_.erase(0, pos_);
+    pos_ = 0;
+  }
+
+  std::size_t size = buf_.size();
+  buf_.resize(size + kReadSize);
+  ssize_t len;
+  do {
+    len = read(fd_, &buf_[size], kReadSize);
+  } while (len < 0 && errno == EINTR);
+  buf_.resize(size + std::max<ssize_t>(len, 0));
+  return len > 0;
+}
+
+bool Connection::readLine(std::string& line) {
+  for (;;) {
+    std::size_t eol = buf_.find('\n', pos_);
+    if (eol != std::string::npos) {
+      std::size_t end = eol;
+      if (end > pos_ && buf_[end - 1] == '\r') {
+        end--;
+      }
+      line.assign(buf_, pos_, end - pos_);
+      pos_ = eol + 1;
+      return true;
+    }
+    if (available() > kMaxLineSize || !fill()) {
+      return false;
+    }
+  }
+}
+
+bool Connection::readHeaders(Headers& headers) {
+  std::string line;
+  for (;;) {
+    if (!readLine(line)) {
+      return false;
+    }
+    if (line.empty()) {
+      return true;
+    }
+    std::size_t colon = line.find(':');
+    if (colon == std::string::npos) {
+      return false;
+    }
+    std::string name = line.substr(0, colon);
+    std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+    std::size_t start = line.find_first_not_of(" \t", colon + 1);
+    headers[name] = start == std::string::npos ? "" : line.substr(start);
+  }
+}
+
+bool Connection::readBody(std::size_t len, int outFd) {
+  while (len > 0) {
+    if (available() == 0 && !fill()) {
+      return false;
+    }
+    std::size_t n = std::min(len, available());
+    const char* ptr = &buf_[pos_];
+    std::size_t remaining = n;
+    while (remaining > 0) {
+      ssize_t w = ::write(outFd, ptr, remaining);
+      if (w < 0 && errno == EINTR) {
+        continue;
+      }
+      if (w < 0) {
+        return false;
+      }
+      ptr += w;
+      remaining -= w;
+    }
+    pos_ += n;
+    len -= n;
+  }
+  return true;
+}
+
+bool Connection::readBody(std::size_t len, std::string& out) {
+  out.clear();
+  while (len > 0) {
+    if (available() == 0 && !fill()) {
+      return false;
+    }
+    std::size_t n = std::min(len, available());
+    out.append(buf_, pos_, n);
+    pos_ += n;
+    len -= n;
+  }
+  return true;
+}
+
+bool Connection::skipBody(std::size_t len) {
+  while (len > 0) {
+    if (available() == 0 && !fill()) {
+      return false;
+    }
+    std::size_t n = std::min(len, available());
+    pos_ += n;
+    len -= n;
+  }
+  return true;
+}
+
+bool Connection::write(const std::string& data) {
+  const char* ptr = data.data();
+  std::size_t len = data.size();
+  while (len > 0) {
+#ifdef MSG_NOSIGNAL
+    ssize_t w = send(fd_, ptr, len, MSG_NOSIGNAL);
+#else
+    ssize_t w = ::write(fd_, ptr, len);
+#endif
+    if (w < 0 && errno == EINTR) {
+      continue;
+    }
+    if (w < 0) {
+      return false;
+    }
+    ptr += w;
+    len -= w;
+  }
+  return true;
+}
+
+bool Connection::writeFile(int inFd, std::size_t offset, std::size_t len) {
+#if defined(__linux__)
+  off_t off = offset;
+  while (len > 0) {
+    ssize_t w = sendfile(fd_, inFd, &off, len);
+    if (w < 0 && errno == EINTR) {
+      continue;
+    }
+    if (w <= 0) {
+      return false;
+    }
+    len -= w;
+  }
+  return true;
+#else
+  char buf[kReadSize];
+  while (len > 0) {
+    ssize_t r = pread(inFd, buf, std::min(len, sizeof(buf)), offset);
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    if (r <= 0 || !write(std::string(buf, r))) {
+      return false;
+    }
+    offset += r;
+    len -= r;
+  }
+  return true;
+#endif
+}
+
+/* Fill contentLength and keepAlive from the headers. */
+static bool parseCommonHeaders(const Headers& headers, const std::string& version,
+                               std::size_t& contentLength, bool& keepAlive) {
+  contentLength = 0;
+  auto it = headers.find("content-length");
+  if (it != headers.end()) {
+    char* end;
+    contentLength = strtoull(it->second.c_str(), &end, 10);
+    if (*end != '\0') {
+      return false;
+    }
+  }
+
+  /* HTTP/1.1 connections are persistent unless told otherwise. */
+  keepAlive = version == "HTTP/1.1";
+  it = headers.find("connection");
+  if (it != headers.end()) {
+    std::string value = it->second;
+    std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+    if (value == "close") {
+      keepAlive = false;
+    } else if (value == "keep-alive") {
+      keepAlive = true;
+    }
+  }
+  return true;
+}
+
+bool readRequest(Connection& conn, Request& req) {
+  std::string line;
+  if (!conn.readLine(line)) {
+    return false;
+  }
+
+  std::istringstream iss(line);
+  std::string version;
+  if (!(iss >> req.method >> req.path >> version)) {
+    return false;
+  }
+
+  req.headers.clear();
+  if (!conn.readHeaders(req.headers)) {
+    return false;
+  }
+  return parseCommonHeaders(req.headers, version, req.contentLength,
+                            req.keepAlive);
+}
+
+bool readResponse(Connection& conn, Response& res) {
+  std::string line;
+  if (!conn.readLine(line)) {
+    return false;
+  }
+
+  std::istringstream iss(line);
+  std::string version;
+  if (!(iss >> version >> res.status)) {
+    return false;
+  }
+
+  res.headers.clear();
+  if (!conn.readHeaders(res.headers)) {
+    return false;
+  }
+  return parseCommonHeaders(res.headers, version, res.contentLength,
+                            res.keepAlive);
+}
+
+std::string formatRequest(const std::string& method, const std::string& path,
+                          const std::string& host, std::size_t contentLength) {
+  std::ostringstream oss;
+  oss << method << " " << path << " HTTP/1.1\r\n"
+      << "Host: " << host << "\r\n";
+  if (method == "PUT") {
+    oss << "Content-Length: " << contentLength << "\r\n";
+  }
+  oss << "\r\n";
+  return oss.str();
+}
+
+static const char* statusText(int status) {
+  switch (status) {
+    case 200: return "OK";
+    case 201: return "Created";
+    case 400: return "Bad Request";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    default: return "Internal Server Error";
+  }
+}
+
+std::string formatResponse(int status, std::size_t contentLength,
+                           bool keepAlive) {
+  std::ostringstream oss;
+  oss << "HTTP/1.1 " << status << " " << statusText(status) << "\r\n"
+      << "Content-Length: " << contentLength << "\r\n";
+  if (!keepAlive) {
+    oss << "Connection: close\r\n";
+  }
+  oss << "\r\n";
+  return oss.str();
+}
+
+int connectTo(const std::string& host, int port) {
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  std::ostringstream service;
+  service << port;
+
+  struct addrinfo* res;
+  if (getaddrinfo(host.c_str(), service.str().c_str(), &hints, &res) != 0) {
+    return -1;
+  }
+
+  int fd = -1;
+  for (struct addrinfo* ai = res; ai != NULL; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0) {
+      continue;
+    }
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+      break;
+    }
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(res);
+
+  if (fd >= 0) {
+    /* Requests are small and pipelined, don't let Nagle delay them. */
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  }
+  return fd;
+}
+
+bool parseHostPort(const std::string& str, std::string& host, int& port) {
+  std::size_t colon = str.rfind(':');
+  if (colon == std::string::npos || colon == 0) {
+    return false;
+  }
+  host = str.substr(0, colon);
+  char* end;
+  long p = strtol(str.c_str() + colon + 1, &end, 10);
+  if (*end != '\0' || p <= 0 || p > 65535) {
+    return false;
+  }
+  port = p;
+  return true;
+}
+
+} } // namespace falcon::http
@@ -0,0 +1,130 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#ifndef FALCON_UTIL_HTTP_H_
+# define FALCON_UTIL_HTTP_H_
+
+# include <map>
+# include <string>
+
+/**
+ * Minimal HTTP/1.1 support, just enough for the remote cache protocol:
+ *
+ *   HEAD /<store>/<hash>  -> 200 if the entry exists, 404 otherwise;
+ *   GET /<store>/<hash>   -> 200 with the content of the entry, 404 if not
+ *                            found;
+ *   PUT /<store>/<hash>   -> store the request body as the entry, 201 on
+ *                            success.
+ *
+ * where <store> is "ac" for the action manifests and "cas" for the blobs.
+ *
+ * Connections are kept alive. Requests can be pipelined: the client may send
+ * several requests before reading the responses, which are sent back in the
+ * same order.
+ *
+ * Bodies are always delimited with Content-Length, chunked transfer encoding
+ * is not supported.
+ */
+
+namespace falcon { namespace http {
+
+/** Header names are stored in lower case. */
+typedef std::map<std::string, std::string> Headers;
+
+struct Request {
+  std::string method;
+  std::string path;
+  Headers headers;
+  std::size_t contentLength;
+  bool keepAlive;
+};
+
+struct Response {
+  int status;
+  Headers headers;
+  std::size_t contentLength;
+  bool keepAlive;
+};
+
+/**
+ * @class Connection
+ * @brief buffered reads and writes on a socket
+ *
+ * Owns the file descriptor and closes it on destruction.
+ */
+class Connection {
+  public:
+    explicit Connection(int fd);
+    ~Connection();
+
+    int fd() const { return fd_; }
+
+    /** Read a line, without the trailing CRLF.
+     * @return false on error or end of stream. */
+    bool readLine(std::string& line);
+
+    /** Read header lines until an empty line. */
+    bool readHeaders(Headers& headers);
+
+    /** Read a body of the given length and write it to a file descriptor. */
+    bool readBody(std::size_t len, int outFd);
+
+    /** Read a body of the given length in a string. */
+    bool readBody(std::size_t len, std::string& out);
+
+    /** Read a body of the given length and discard it. */
+    bool skipBody(std::size_t len);
+
+    /** Write the whole buffer. */
+    bool write(const std::string& data);
+
+    /** Write len bytes read from a file descriptor, starting at offset.
+     * Uses sendfile when available. */
+    bool writeFile(int inFd, std::size_t offset, std::size_t len);
+
+  private:
+    /** Read more data in buf_. Return false on error or end of stream. */
+    bool fill();
+
+    /** Number of bytes available in buf_. */
+    std::size_t available() const { return buf_.size() - pos_; }
+
+    int fd_;
+    std::string buf_;
+    std::size_t pos_;
+
+    Connection(const Connection& other) = delete;
+    Connection& operator=(const Connection&) = delete;
+};
+
+/** Read the request line and the headers of a request. */
+bool readRequest(Connection& conn, Request& req);
+
+/** Read the status line and the headers of a response. */
+bool readResponse(Connection& conn, Response& res);
+
+/** Format the request line and the headers of a request. */
+std::string formatRequest(const std::string& method, const std::string& path,
+                          const std::string& host, std::size_t contentLength);
+
+/** Format the status line and the headers of a response. */
+std::string formatResponse(int status, std::size_t contentLength,
+                           bool keepAlive);
+
+/**
+ * Open a TCP connection.
+ * @return the socket, or -1 on error.
+ */
+int connectTo(const std::string& host, int port);
+
+/**
+ * Split a "host:port" string.
+ * @return false if the string is not valid.
+ */
+bool parseHostPort(const std::string& str, std::string& host, int& port);
+
+} } // namespace falcon::http
+
+#endif /* !FALCON_UTIL_HTTP_H_ */
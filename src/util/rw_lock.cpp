@@ -0,0 +1,57 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#include <cassert>
+
+#include "util/rw_lock.h"
+
+namespace falcon {
+
+RWLock::RWLock()
+    : numReaders_(0)
+    , numWritersWaiting_(0)
+    , writing_(false) { }
+
+void RWLock::lock() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  numWritersWaiting_++;
+  while (writing_ || numReaders_ > 0) {
+    cond_.wait(lock);
+  }
+  numWritersWaiting_--;
+  writing_ = true;
+}
+
+void RWLock::unlock() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    assert(writing_);
+    writing_ = false;
+  }
+  cond_.notify_all();
+}
+
+void RWLock::lockShared() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  /* Let the waiting writers go first. */
+  while (writing_ || numWritersWaiting_ > 0) {
+    cond_.wait(lock);
+  }
+  numReaders_++;
+}
+
+void RWLock::unlockShared() {
+  bool last;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    assert(numReaders_ > 0);
+    last = --numReaders_ == 0;
+  }
+  if (last) {
+    cond_.notify_all();
+  }
+}
+
+} // namespace falcon
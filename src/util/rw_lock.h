@@ -0,0 +1,67 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#ifndef FALCON_UTIL_RW_LOCK_H_
+# define FALCON_UTIL_RW_LOCK_H_
+
+# include <condition_variable>
+# include <cstddef>
+# include <mutex>
+
+namespace falcon {
+
+/**
+ * @class RWLock
+ * @brief lock shared by readers, exclusive for a writer
+ *
+ * The lock is either held by one writer, or shared by any number of readers.
+ * A writer waiting for the lock blocks the new readers, so that a steady
+ * stream of readers cannot starve it.
+ *
+ * lock() and unlock() take the lock for writing, so that it can be used with
+ * std::lock_guard and std::unique_lock. ReadLock takes it for reading.
+ */
+class RWLock {
+  public:
+    RWLock();
+
+    /** Take the lock for writing. */
+    void lock();
+    void unlock();
+
+    /** Take the lock for reading. */
+    void lockShared();
+    void unlockShared();
+
+  private:
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::size_t numReaders_;
+    std::size_t numWritersWaiting_;
+    bool writing_;
+
+    RWLock(const RWLock& other) = delete;
+    RWLock& operator=(const RWLock&) = delete;
+};
+
+/**
+ * @class ReadLock
+ * @brief hold a RWLock for reading in a scope
+ */
+class ReadLock {
+  public:
+    explicit ReadLock(RWLock& lock) : lock_(lock) { lock_.lockShared(); }
+    ~ReadLock() { lock_.unlockShared(); }
+
+  private:
+    RWLock& lock_;
+
+    ReadLock(const ReadLock& other) = delete;
+    ReadLock& operator=(const ReadLock&) = delete;
+};
+
+} // namespace falcon
+
+#endif // FALCON_UTIL_RW_LOCK_H_
@@ -0,0 +1,76 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#include <cassert>
+
+#include "util/thread_pool.h"
+
+namespace falcon {
+
+ThreadPool::ThreadPool(std::size_t numThreads, std::size_t maxQueued)
+  : maxQueued_(maxQueued)
+  , pending_(0)
+  , stopped_(false) {
+  assert(numThreads > 0);
+  for (std::size_t i = 0; i < numThreads; i++) {
+    workers_.push_back(std::thread(&ThreadPool::workerThread, this));
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopped_ = true;
+  }
+  taskAvailable_.notify_all();
+  for (auto it = workers_.begin(); it != workers_.end(); ++it) {
+    it->join();
+  }
+}
+
+void ThreadPool::submit(Task task) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  assert(!stopped_);
+  while (maxQueued_ > 0 && tasks_.size() >= maxQueued_) {
+    slotAvailable_.wait(lock);
+  }
+  tasks_.push(std::move(task));
+  pending_++;
+  taskAvailable_.notify_one();
+}
+
+void ThreadPool::wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (pending_ > 0) {
+    idle_.wait(lock);
+  }
+}
+
+void ThreadPool::workerThread() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    while (tasks_.empty() && !stopped_) {
+      taskAvailable_.wait(lock);
+    }
+    if (tasks_.empty()) {
+      /* Stopped, and nothing left to run. */
+      return;
+    }
+
+    Task task = std::move(tasks_.front());
+    tasks_.pop();
+    slotAvailable_.notify_one();
+
+    lock.unlock();
+    task();
+    lock.lock();
+
+    if (--pending_ == 0) {
+      idle_.notify_all();
+    }
+  }
+}
+
+}
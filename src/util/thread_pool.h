@@ -0,0 +1,75 @@
+/**
+ * Copyright : falcon build system (c) 2014.
+ * LICENSE : see accompanying LICENSE file for details.
+ */
+
+#ifndef FALCON_UTIL_THREAD_POOL_H_
+# define FALCON_UTIL_THREAD_POOL_H_
+
+# include <condition_variable>
+# include <functional>
+# include <mutex>
+# include <queue>
+# include <thread>
+# include <vector>
+
+namespace falcon {
+
+/**
+ * @class ThreadPool
+ * @brief run tasks on a fixed set of worker threads
+ *
+ * Tasks are queued in FIFO order. The queue is bounded: submit() blocks while
+ * the queue is full, which gives backpressure to the producer instead of
+ * letting the backlog grow without limit.
+ *
+ * The destructor runs all the tasks that are still queued before joining the
+ * workers.
+ */
+class ThreadPool {
+  public:
+    typedef std::function<void()> Task;
+
+    /**
+     * Construct a thread pool.
+     * @param numThreads Number of worker threads.
+     * @param maxQueued  Maximum number of tasks waiting to be run. 0 means the
+     *                   queue is not bounded.
+     */
+    ThreadPool(std::size_t numThreads, std::size_t maxQueued);
+    ~ThreadPool();
+
+    /** Queue a task. Block while the queue is full. */
+    void submit(Task task);
+
+    /** Block until all the submitted tasks have completed. */
+    void wait();
+
+    std::size_t numThreads() const { return workers_.size(); }
+
+  private:
+    void workerThread();
+
+    std::vector<std::thread> workers_;
+    std::queue<Task> tasks_;
+    std::size_t maxQueued_;
+
+    /* Number of tasks queued or running. */
+    std::size_t pending_;
+    bool stopped_;
+
+    std::mutex mutex_;
+    /* Notified when a task is queued or when the pool stops. */
+    std::condition_variable taskAvailable_;
+    /* Notified when a task is dequeued. */
+    std::condition_variable slotAvailable_;
+    /* Notified when pending_ reaches 0. */
+    std::condition_variable idle_;
+
+    ThreadPool(const ThreadPool& other) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+};
+
+}
+
+#endif /* !FALCON_UTIL_THREAD_POOL_H_ */
@@ -95,15 +95,29 @@ class FalconTest:
                          stdout=FNULL)
     assert(r == 0)
 
-  def build(self, lazyFetch = False):
+  def build(self, lazyFetch = False, jobs = 1, keepGoing = 1, targets = []):
     """Trigger a build.."""
-    p = [self._falcon_client, "--no-start", "--build", "--json"]
+    p = [self._falcon_client, "--no-start", "--build"] + targets + ["--json",
+         "--jobs", str(jobs), "--keep-going", str(keepGoing)]
     if not lazyFetch:
       p.append("--no-lazy-fetch")
     data = subprocess.check_output(p)
 
     return json.loads(data)
 
+  def request_build(self, targets = [], jobs = 1):
+    """Request a build without waiting for it, return its id."""
+    data = subprocess.check_output([self._falcon_client, "--no-start",
+                                    "--jobs", str(jobs), "--no-lazy-fetch",
+                                    "--request"] + targets)
+    return int(data)
+
+  def wait_for_build(self, buildId):
+    """Wait for a build started by request_build, return its result."""
+    p = subprocess.Popen([self._falcon_client, "--no-start", "--wait-for",
+                          str(buildId)], stdout=subprocess.PIPE)
+    return p.communicate()[0].strip()
+
   def write_file(self, name, content):
     """Write to a file"""
     f = open(self._test_dir + "/" + name, 'w')
@@ -0,0 +1,39 @@
+#!/usr/bin/env python
+
+# Check that a build requested after a source changed during another build
+# sees the change, instead of joining the running build with the old state.
+
+import threading
+import time
+
+makefile = '''
+{
+  "rules":
+    [
+    {
+      "inputs": [ "source" ],
+      "outputs": [ "bin" ],
+      "cmd": "sleep 3 && cp source bin"
+    }
+    ]
+}
+'''
+
+def run(test):
+  test.create_makefile(makefile)
+  test.write_file("source", "1")
+  test.start()
+
+  build = threading.Thread(target = test.build)
+  build.start()
+  # Let the command start, then change the source and give watchman time to
+  # notify the daemon.
+  time.sleep(0.5)
+  test.write_file("source", "2")
+  time.sleep(1)
+
+  test.build()
+  build.join()
+
+  assert(test.get_dirty_targets() == [])
+  assert(test.get_file_content('bin') == '2')
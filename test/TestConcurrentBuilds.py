@@ -0,0 +1,48 @@
+#!/usr/bin/env python
+
+# Check that two builds can run at the same time, and that the rule they both
+# need is only built once. Each run of the shared rule appends a line to
+# "runs".
+
+import threading
+
+makefile = '''
+{
+  "rules":
+    [
+    {
+      "inputs": [ "source" ],
+      "outputs": [ "shared" ],
+      "cmd": "sleep 0.5 && echo run >> runs && cp source shared"
+    },
+    {
+      "inputs": [ "shared" ],
+      "outputs": [ "bin1" ],
+      "cmd": "cp shared bin1"
+    },
+    {
+      "inputs": [ "shared" ],
+      "outputs": [ "bin2" ],
+      "cmd": "cp shared bin2"
+    }
+    ]
+}
+'''
+
+def run(test):
+  test.create_makefile(makefile)
+  test.write_file("source", "1")
+  test.start()
+
+  threads = [
+      threading.Thread(target = test.build, kwargs = { 'targets': ['bin1'] }),
+      threading.Thread(target = test.build, kwargs = { 'targets': ['bin2'] })]
+  for t in threads:
+    t.start()
+  for t in threads:
+    t.join()
+
+  assert(test.get_dirty_targets() == [])
+  assert(test.get_file_content('bin1') == '1')
+  assert(test.get_file_content('bin2') == '1')
+  assert(test.get_file_content('runs') == 'run\n')
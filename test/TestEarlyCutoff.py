@@ -0,0 +1,55 @@
+#!/usr/bin/env python
+
+# Check that the rules that depend on an output that was rebuilt with the same
+# content are skipped.
+
+import time
+
+makefile = '''
+{
+  "rules":
+    [
+    {
+      "inputs": [ "source" ],
+      "outputs": [ "header" ],
+      "cmd": "grep -v '^#' source > header"
+    },
+    {
+      "inputs": [ "header" ],
+      "outputs": [ "object" ],
+      "cmd": "cp header object && echo x >> runs"
+    }
+    ]
+}
+'''
+
+def run(test):
+  test.create_makefile(makefile)
+  test.write_file("source", "# comment\n1\n")
+  test.start()
+
+  test.build()
+  assert(test.get_dirty_targets() == [])
+  assert(test.get_file_content('runs') == 'x\n')
+
+  # Only change the comment: the header is rebuilt with the same content, the
+  # object should not be rebuilt.
+  time.sleep(1)
+  test.write_file("source", "# another comment\n1\n")
+  test.expect_watchman_trigger("source")
+  assert(set(["source", "header", "object"]) ==
+         set(test.get_dirty_targets()))
+
+  test.build()
+  assert(test.get_dirty_targets() == [])
+  assert(test.get_file_content('runs') == 'x\n')
+
+  # Change the content: the object is rebuilt.
+  time.sleep(1)
+  test.write_file("source", "# another comment\n2\n")
+  test.expect_watchman_trigger("source")
+
+  test.build()
+  assert(test.get_dirty_targets() == [])
+  assert(test.get_file_content('object') == '2\n')
+  assert(test.get_file_content('runs') == 'x\nx\n')
@@ -0,0 +1,47 @@
+#!/usr/bin/env python
+
+# Check that with --keep-going 0 a failed rule only prevents the rules that
+# depend on it from being built.
+
+makefile = '''
+{
+  "rules":
+    [
+    {
+      "inputs": [ "source" ],
+      "outputs": [ "broken" ],
+      "cmd": "exit 1"
+    },
+    {
+      "inputs": [ "broken" ],
+      "outputs": [ "dependent" ],
+      "cmd": "cp broken dependent"
+    },
+    {
+      "inputs": [ "source" ],
+      "outputs": [ "independent1" ],
+      "cmd": "cp source independent1"
+    },
+    {
+      "inputs": [ "independent1" ],
+      "outputs": [ "independent2" ],
+      "cmd": "cp independent1 independent2"
+    },
+    {
+      "inputs": [ "dependent", "independent2" ],
+      "outputs": [ "all" ]
+    }
+    ]
+}
+'''
+
+def run(test):
+  test.create_makefile(makefile)
+  test.write_file("source", "1")
+  test.start()
+
+  # The independent rules are built in spite of the failure.
+  test.build(keepGoing = 0)
+  assert(set(["broken", "dependent", "all"]) ==
+         set(test.get_dirty_targets()))
+  assert(test.get_file_content('independent2') == '1')
@@ -0,0 +1,52 @@
+#!/usr/bin/env python
+
+# Check that the rules of a pool never run more than the depth of the pool at
+# the same time. Each link step takes a lock directory: the command fails if
+# another link step holds it.
+
+makefile = '''
+{
+  "pools": { "link": 1 },
+  "rules":
+    [
+    {
+      "inputs": [ "source" ],
+      "outputs": [ "bin1" ],
+      "cmd": "mkdir lock && sleep 0.2 && cp source bin1 && rmdir lock",
+      "pool": "link"
+    },
+    {
+      "inputs": [ "source" ],
+      "outputs": [ "bin2" ],
+      "cmd": "mkdir lock && sleep 0.2 && cp source bin2 && rmdir lock",
+      "pool": "link"
+    },
+    {
+      "inputs": [ "source" ],
+      "outputs": [ "bin3" ],
+      "cmd": "mkdir lock && sleep 0.2 && cp source bin3 && rmdir lock",
+      "pool": "link"
+    },
+    {
+      "inputs": [ "source" ],
+      "outputs": [ "obj" ],
+      "cmd": "cp source obj"
+    },
+    {
+      "inputs": [ "bin1", "bin2", "bin3", "obj" ],
+      "outputs": [ "all" ]
+    }
+    ]
+}
+'''
+
+def run(test):
+  test.create_makefile(makefile)
+  test.write_file("source", "1")
+  test.start()
+
+  test.build(jobs = 4)
+  assert(test.get_dirty_targets() == [])
+  assert(test.get_file_content('bin1') == '1')
+  assert(test.get_file_content('bin2') == '1')
+  assert(test.get_file_content('bin3') == '1')
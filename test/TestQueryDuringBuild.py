@@ -0,0 +1,40 @@
+#!/usr/bin/env python
+
+# Check that the daemon answers the queries while a command runs, instead of
+# waiting for the build to complete.
+
+import threading
+import time
+
+makefile = '''
+{
+  "rules":
+    [
+    {
+      "inputs": [ "source" ],
+      "outputs": [ "bin" ],
+      "cmd": "sleep 3 && cp source bin"
+    }
+    ]
+}
+'''
+
+def run(test):
+  test.create_makefile(makefile)
+  test.write_file("source", "1")
+  test.start()
+
+  build = threading.Thread(target = test.build)
+  build.start()
+  # Let the command start.
+  time.sleep(1)
+
+  start = time.time()
+  dirty = test.get_dirty_targets()
+  elapsed = time.time() - start
+  build.join()
+
+  assert('bin' in dirty)
+  assert(elapsed < 1.5)
+  assert(test.get_dirty_targets() == [])
+  assert(test.get_file_content('bin') == '1')
@@ -0,0 +1,42 @@
+#!/usr/bin/env python
+
+# Check that builds can be requested without waiting for them, and that each
+# request can be waited for with its id.
+
+makefile = '''
+{
+  "rules":
+    [
+    {
+      "inputs": [ "source" ],
+      "outputs": [ "shared" ],
+      "cmd": "sleep 0.5 && cp source shared"
+    },
+    {
+      "inputs": [ "shared" ],
+      "outputs": [ "bin1" ],
+      "cmd": "cp shared bin1"
+    },
+    {
+      "inputs": [ "shared" ],
+      "outputs": [ "bin2" ],
+      "cmd": "cp shared bin2"
+    }
+    ]
+}
+'''
+
+def run(test):
+  test.create_makefile(makefile)
+  test.write_file("source", "1")
+  test.start()
+
+  id1 = test.request_build(targets = ['bin1'])
+  id2 = test.request_build(targets = ['bin2'])
+  assert(id1 != id2)
+
+  assert(test.wait_for_build(id2) == 'SUCCEEDED')
+  assert(test.wait_for_build(id1) == 'SUCCEEDED')
+  assert(test.get_dirty_targets() == [])
+  assert(test.get_file_content('bin1') == '1')
+  assert(test.get_file_content('bin2') == '1')
@@ -6,7 +6,13 @@ enum FalconStatus {
 enum StartBuildResult {
   OK,         /* The build was properly started. */
   ERROR,      /* Cannot start the build because of an error. */
-  BUSY        /* A build is already ongoing. */
+  BUSY        /* A build is already ongoing. No longer returned. */
+}
+
+enum BuildStatus {
+  SUCCEEDED,
+  FAILED,
+  INTERRUPTED
 }
 
 exception InvalidBuildError {
@@ -19,11 +25,26 @@ service FalconService {
   /* Get the pid of the Falcon daemon. */
   i64 getPid()
 
-  /* Start a build. */
+  /* Deprecated, use requestBuild. Start a build like requestBuild, without
+   * returning its id. Returns ERROR if the build cannot be started. */
   StartBuildResult startBuild(1:set<string> targets, 2:i32 numThreads,
-                              3:bool lazyFetch)
+                              3:bool lazyFetch, 4:i32 maxFailures = 1)
                               throws(1:InvalidBuildError e)
 
+  /* Start a build, and return its id. The build stops after maxFailures
+   * commands failed, or builds everything that does not depend on a failed
+   * command if maxFailures is 0. It can run while other builds are ongoing,
+   * the rules they share are built once. The builds requested while the daemon
+   * is busy are merged in the plan together. The output of
+   * the build is streamed to the clients that send this id, followed by a
+   * newline, when they connect to the stream server. */
+  i32 requestBuild(1:set<string> targets, 2:i32 numThreads, 3:bool lazyFetch,
+                   4:i32 maxFailures = 1) throws(1:InvalidBuildError e)
+
+  /* Wait for a build started by requestBuild to complete, and return its
+   * result. */
+  BuildStatus waitForBuild(1:i32 buildId) throws(1:InvalidBuildError e)
+
   /* Get the current status of the daemon. */
   FalconStatus getStatus()
 
@@ -53,4 +74,14 @@ service FalconService {
 
   /* Return a graphviz representation of the graph. */
   string getGraphviz()
+
+  /* Return the counters of the cache operations since the daemon started, as
+   * a json object. The same object is sent in the stream output at the end of
+   * each build, with the counters of that build. */
+  string getCacheStats()
+
+  /* Return the latest record of the build log for the rule that builds the
+   * given target, as a json object. The object is empty if the rule never
+   * ran. */
+  string getBuildLogOf(1:string target) throws(1:TargetNotFound e)
 }